@@ -54,6 +54,9 @@
 #include <pcap/bpf.h>
 
 #include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
 
 #define int32 bpf_int32
 #define u_int32 bpf_u_int32
@@ -104,32 +107,17 @@ enum {
 };
 
 /*
- * Execute the filter program starting at pc on the packet p
- * wirelen is the length of the original packet
- * buflen is the amount of data present
- * aux_data is auxiliary data, currently used only when interpreting
- * filters intended for the Linux kernel in cases where the kernel
- * rejects the filter; it contains VLAN tag information
- * For the kernel, p is assumed to be a pointer to an mbuf if buflen is 0,
- * in all other cases, p is a pointer to a buffer and buflen is its size.
- *
- * Thanks to Ani Sinha <ani@arista.com> for providing initial implementation
+ * Execute the filter program starting at pc, with A and X set to the
+ * specified values and the scratch memory not yet set.
  */
-u_int
-bpf_filter_with_aux_data(const struct bpf_insn *pc, const u_char *p,
-    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data)
+static inline u_int
+bpf_filter_from(const struct bpf_insn *pc, u_int32 A, u_int32 X,
+    const u_char *p, u_int wirelen, u_int buflen,
+    const struct bpf_aux_data *aux_data)
 {
-	register u_int32 A, X;
 	register bpf_u_int32 k;
 	u_int32 mem[BPF_MEMWORDS];
 
-	if (pc == 0)
-		/*
-		 * No filter means accept all.
-		 */
-		return (u_int)-1;
-	A = 0;
-	X = 0;
 	--pc;
 	for (;;) {
 		++pc;
@@ -395,6 +383,30 @@ bpf_filter_with_aux_data(const struct bpf_insn *pc, const u_char *p,
 	}
 }
 
+/*
+ * Execute the filter program starting at pc on the packet p
+ * wirelen is the length of the original packet
+ * buflen is the amount of data present
+ * aux_data is auxiliary data, currently used only when interpreting
+ * filters intended for the Linux kernel in cases where the kernel
+ * rejects the filter; it contains VLAN tag information
+ * For the kernel, p is assumed to be a pointer to an mbuf if buflen is 0,
+ * in all other cases, p is a pointer to a buffer and buflen is its size.
+ *
+ * Thanks to Ani Sinha <ani@arista.com> for providing initial implementation
+ */
+u_int
+bpf_filter_with_aux_data(const struct bpf_insn *pc, const u_char *p,
+    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data)
+{
+	if (pc == 0)
+		/*
+		 * No filter means accept all.
+		 */
+		return (u_int)-1;
+	return bpf_filter_from(pc, 0, 0, p, wirelen, buflen, aux_data);
+}
+
 u_int
 bpf_filter(const struct bpf_insn *pc, const u_char *p, u_int wirelen,
     u_int buflen)
@@ -402,6 +414,915 @@ bpf_filter(const struct bpf_insn *pc, const u_char *p, u_int wirelen,
 	return bpf_filter_with_aux_data(pc, p, wirelen, buflen, NULL);
 }
 
+/*
+ * Running one filter over a batch of packets.
+ *
+ * Rather than running the whole program for each packet in turn, we
+ * step through the program once for a group of packets that all take
+ * the same path through it, keeping A and X for each packet, and split
+ * the group when a conditional branch goes different ways for different
+ * packets.  Programs generated by gencode.c start with chains of "load
+ * a field, compare it with a constant" tests - the link-layer type,
+ * the IPv4 protocol or IPv6 next header, the fragment offset, the
+ * ports - so most packets only leave this loop at a "ret"; loads are
+ * done for the whole group at once, and equality tests are done with
+ * SIMD instructions where we have them.  For anything else, such as
+ * arithmetic and scratch memory, we finish the job for each packet
+ * with the interpreter.
+ */
+#define BPF_BATCH_CHUNK		64	/* packets handled together */
+#define BPF_BATCH_MAX_DEPTH	16	/* nested group splits */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Set match[i] to 1 if vals[i] == k and to 0 otherwise, for i < n.
+ */
+static void
+bpf_batch_cmpeq(const u_int32 *vals, u_int n, u_int32 k, u_char *match)
+{
+	u_int i = 0;
+#if defined(__SSE2__)
+	__m128i kv = _mm_set1_epi32((int)k);
+	int bits;
+
+	for (; i + 4 <= n; i += 4) {
+		bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+		    _mm_loadu_si128((const __m128i *)&vals[i]), kv)));
+		match[i] = bits & 1;
+		match[i + 1] = (bits >> 1) & 1;
+		match[i + 2] = (bits >> 2) & 1;
+		match[i + 3] = (bits >> 3) & 1;
+	}
+#elif defined(__ARM_NEON)
+	uint32x4_t kv = vdupq_n_u32(k);
+	uint32x4_t eq;
+
+	for (; i + 4 <= n; i += 4) {
+		eq = vceqq_u32(vld1q_u32(&vals[i]), kv);
+		match[i] = vgetq_lane_u32(eq, 0) & 1;
+		match[i + 1] = vgetq_lane_u32(eq, 1) & 1;
+		match[i + 2] = vgetq_lane_u32(eq, 2) & 1;
+		match[i + 3] = vgetq_lane_u32(eq, 3) & 1;
+	}
+#endif
+	for (; i < n; i++)
+		match[i] = (vals[i] == k);
+}
+
+/*
+ * Run the program starting at pc on the group of packets with the "n"
+ * indices in idx; A[i] and X[i] are the registers for packet i.
+ */
+static void
+bpf_batch_run(const struct bpf_insn *pc, u_int *idx, u_int n, u_int32 *A,
+    u_int32 *X, const u_char * const *pkts, const u_int *wirelens,
+    const u_int *buflens, u_int *verdicts, int depth)
+{
+	u_int32 vals[BPF_BATCH_CHUNK];
+	u_char match[BPF_BATCH_CHUNK];
+	u_int jtidx[BPF_BATCH_CHUNK];
+	u_int i, j, live, nt, nf, size;
+	bpf_u_int32 k, x;
+
+	while (n != 0) {
+		switch (pc->code) {
+
+		case BPF_RET|BPF_K:
+			for (j = 0; j < n; j++)
+				verdicts[idx[j]] = (u_int)pc->k;
+			return;
+
+		case BPF_RET|BPF_A:
+			for (j = 0; j < n; j++)
+				verdicts[idx[j]] = (u_int)A[idx[j]];
+			return;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND:
+		case BPF_LD|BPF_B|BPF_IND:
+		case BPF_LDX|BPF_MSH|BPF_B:
+#if defined(SKF_AD_VLAN_TAG_PRESENT)
+			if (pc->code == (BPF_LD|BPF_B|BPF_ABS) &&
+			    (pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG) ||
+			     pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT)))
+				goto interpret;
+#endif
+			/*
+			 * Do the load for each packet in the group,
+			 * dropping from the group, and rejecting, the
+			 * packets too short for it.
+			 */
+			switch (BPF_SIZE(pc->code)) {
+
+			case BPF_W:
+				size = 4;
+				break;
+
+			case BPF_H:
+				size = 2;
+				break;
+
+			default:
+				size = 1;
+				break;
+			}
+			k = pc->k;
+			live = 0;
+			for (j = 0; j < n; j++) {
+				i = idx[j];
+				x = k;
+				if (BPF_MODE(pc->code) == BPF_IND) {
+					/*
+					 * Don't let k + X wrap around.
+					 */
+					x += X[i];
+					if (x < k) {
+						verdicts[i] = 0;
+						continue;
+					}
+				}
+				if (x > buflens[i] || size > buflens[i] - x) {
+					verdicts[i] = 0;
+					continue;
+				}
+				idx[live] = i;
+				vals[live++] = x;
+			}
+			n = live;
+			switch (pc->code) {
+
+			case BPF_LD|BPF_W|BPF_ABS:
+			case BPF_LD|BPF_W|BPF_IND:
+				for (j = 0; j < n; j++)
+					A[idx[j]] =
+					    EXTRACT_LONG(&pkts[idx[j]][vals[j]]);
+				break;
+
+			case BPF_LD|BPF_H|BPF_ABS:
+			case BPF_LD|BPF_H|BPF_IND:
+				for (j = 0; j < n; j++)
+					A[idx[j]] =
+					    EXTRACT_SHORT(&pkts[idx[j]][vals[j]]);
+				break;
+
+			case BPF_LD|BPF_B|BPF_ABS:
+			case BPF_LD|BPF_B|BPF_IND:
+				for (j = 0; j < n; j++)
+					A[idx[j]] = pkts[idx[j]][vals[j]];
+				break;
+
+			default:
+				for (j = 0; j < n; j++)
+					X[idx[j]] =
+					    (pkts[idx[j]][vals[j]] & 0xf) << 2;
+				break;
+			}
+			pc++;
+			break;
+
+		case BPF_LD|BPF_IMM:
+			for (j = 0; j < n; j++)
+				A[idx[j]] = pc->k;
+			pc++;
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			for (j = 0; j < n; j++)
+				X[idx[j]] = pc->k;
+			pc++;
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			for (j = 0; j < n; j++)
+				A[idx[j]] = wirelens[idx[j]];
+			pc++;
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			for (j = 0; j < n; j++)
+				X[idx[j]] = A[idx[j]];
+			pc++;
+			break;
+
+		case BPF_JMP|BPF_JA:
+			if ((bpf_int32)pc->k < 0)
+				goto interpret;	/* protochain loop */
+			pc += 1 + pc->k;
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_K:
+			if (pc->jt == pc->jf) {
+				pc += 1 + pc->jt;
+				break;
+			}
+			for (j = 0; j < n; j++)
+				vals[j] = A[idx[j]];
+			k = pc->k;
+			switch (BPF_OP(pc->code)) {
+
+			case BPF_JEQ:
+				bpf_batch_cmpeq(vals, n, k, match);
+				break;
+
+			case BPF_JGT:
+				for (j = 0; j < n; j++)
+					match[j] = (vals[j] > k);
+				break;
+
+			case BPF_JGE:
+				for (j = 0; j < n; j++)
+					match[j] = (vals[j] >= k);
+				break;
+
+			default:
+				for (j = 0; j < n; j++)
+					match[j] = ((vals[j] & k) != 0);
+				break;
+			}
+
+			/*
+			 * Split the group; if all the packets went the
+			 * same way, we just carry on, otherwise we handle
+			 * the packets for which the test is true first.
+			 */
+			nt = nf = 0;
+			for (j = 0; j < n; j++) {
+				i = idx[j];
+				jtidx[nt] = i;
+				idx[nf] = i;
+				nt += match[j];
+				nf += !match[j];
+			}
+			if (nt != 0 && nf != 0) {
+				if (depth == BPF_BATCH_MAX_DEPTH) {
+					/*
+					 * Don't nest any deeper.
+					 */
+					for (j = 0; j < nt; j++) {
+						i = jtidx[j];
+						verdicts[i] = bpf_filter_from(
+						    pc + 1 + pc->jt, A[i], X[i],
+						    pkts[i], wirelens[i],
+						    buflens[i], NULL);
+					}
+				} else
+					bpf_batch_run(pc + 1 + pc->jt, jtidx,
+					    nt, A, X, pkts, wirelens, buflens,
+					    verdicts, depth + 1);
+				n = nf;
+				pc += 1 + pc->jf;
+			} else if (nt != 0) {
+				memcpy(idx, jtidx, nt * sizeof(*idx));
+				pc += 1 + pc->jt;
+			} else
+				pc += 1 + pc->jf;
+			break;
+
+		default:
+		interpret:
+			for (j = 0; j < n; j++) {
+				i = idx[j];
+				verdicts[i] = bpf_filter_from(pc, A[i], X[i],
+				    pkts[i], wirelens[i], buflens[i], NULL);
+			}
+			return;
+		}
+	}
+}
+
+/*
+ * Run the filter program pc on the n packets pkts[0..n-1], with
+ * on-the-wire lengths wirelens[0..n-1] and captured lengths
+ * buflens[0..n-1], setting verdicts[i] to what bpf_filter() would
+ * return for packet i.  Returns the number of packets accepted.
+ */
+u_int
+bpf_filter_batch(const struct bpf_insn *pc, const u_char * const *pkts,
+    const u_int *wirelens, const u_int *buflens, u_int n, u_int *verdicts)
+{
+	u_int idx[BPF_BATCH_CHUNK];
+	u_int32 A[BPF_BATCH_CHUNK], X[BPF_BATCH_CHUNK];
+	u_int base, chunk, i, naccepted;
+
+	for (base = 0; base < n; base += chunk) {
+		chunk = n - base;
+		if (chunk > BPF_BATCH_CHUNK)
+			chunk = BPF_BATCH_CHUNK;
+		if (pc == 0) {
+			/*
+			 * No filter means accept all.
+			 */
+			for (i = 0; i < chunk; i++)
+				verdicts[base + i] = (u_int)-1;
+			continue;
+		}
+		for (i = 0; i < chunk; i++) {
+			idx[i] = i;
+			A[i] = 0;
+			X[i] = 0;
+		}
+		bpf_batch_run(pc, idx, chunk, A, X, pkts + base,
+		    wirelens + base, buflens + base, verdicts + base, 0);
+	}
+
+	naccepted = 0;
+	for (i = 0; i < n; i++) {
+		if (verdicts[i] != 0)
+			naccepted++;
+	}
+	return naccepted;
+}
+
+/*
+ * Pre-decoded ("threaded") programs.
+ *
+ * Decoding a program once, when it's installed, lets us avoid doing
+ * some of the work the interpreter above does for every instruction
+ * of every packet:
+ *
+ *	jumps are turned into pointers to their targets;
+ *
+ *	the end offset of each absolute load is computed in advance,
+ *	and loads that can never succeed are turned into "return 0";
+ *
+ *	the bounds check on a load is dropped if every path to it
+ *	has already done a successful load at least that far into
+ *	the packet;
+ *
+ *	when built with a compiler supporting GCC's "labels as values"
+ *	extension, each instruction holds the address of the code that
+ *	implements it, so that each instruction jumps directly to the
+ *	next one, rather than going through a switch statement.
+ *
+ * This is used for filters installed on a pcap_t if they can't be
+ * compiled into native code.
+ */
+#if defined(__GNUC__) && !defined(BPF_THREADED_NO_COMPUTED_GOTO)
+#define BPF_THREADED_COMPUTED_GOTO
+#endif
+
+#define BPF_THREADED_OPS \
+	T(RET_K) T(RET_A) \
+	T(LD_W_ABS) T(LD_H_ABS) T(LD_B_ABS) \
+	T(LD_W_ABS_NC) T(LD_H_ABS_NC) T(LD_B_ABS_NC) \
+	T(LD_VLAN_TAG) T(LD_VLAN_TAG_PRESENT) \
+	T(LD_W_IND) T(LD_H_IND) T(LD_B_IND) \
+	T(LDX_MSH) T(LDX_MSH_NC) \
+	T(LD_LEN) T(LDX_LEN) T(LD_IMM) T(LDX_IMM) \
+	T(LD_MEM) T(LDX_MEM) T(ST) T(STX) \
+	T(JA) T(JGT_K) T(JGE_K) T(JEQ_K) T(JSET_K) \
+	T(JGT_X) T(JGE_X) T(JEQ_X) T(JSET_X) \
+	T(ADD_K) T(SUB_K) T(MUL_K) T(DIV_K) T(MOD_K) \
+	T(AND_K) T(OR_K) T(XOR_K) T(LSH_K) T(RSH_K) \
+	T(ADD_X) T(SUB_X) T(MUL_X) T(DIV_X) T(MOD_X) \
+	T(AND_X) T(OR_X) T(XOR_X) T(LSH_X) T(RSH_X) \
+	T(NEG) T(TAX) T(TXA)
+
+#define T(op)	TOP_##op,
+enum { BPF_THREADED_OPS };
+#undef T
+
+struct bpf_threaded_insn {
+#ifdef BPF_THREADED_COMPUTED_GOTO
+	const void *handler;	/* code for the operation */
+#endif
+	u_int	op;		/* TOP_ value */
+	u_int32	k;
+	u_int32	end;		/* for loads, offset past the last byte */
+	const struct bpf_threaded_insn *jt, *jf;
+};
+
+struct bpf_threaded_code {
+	u_int	len;
+	struct bpf_threaded_insn insns[1];
+};
+
+/*
+ * Run a pre-decoded program.
+ *
+ * With computed gotos, the addresses of the code for each operation
+ * are only available within this function, so, if "decode" is
+ * non-null, we just fill in the handler for each of its "ninsns"
+ * instructions.
+ */
+static u_int
+bpf_threaded_run(const struct bpf_threaded_insn *pc, const u_char *p,
+    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data,
+    struct bpf_threaded_insn *decode, u_int ninsns)
+{
+	register u_int32 A, X;
+	register bpf_u_int32 k;
+	u_int32 mem[BPF_MEMWORDS];
+
+#ifdef BPF_THREADED_COMPUTED_GOTO
+#define T(op)	&&L_##op,
+	static const void *const handlers[] = { BPF_THREADED_OPS };
+#undef T
+	u_int i;
+
+	if (decode != NULL) {
+		for (i = 0; i < ninsns; i++)
+			decode[i].handler = handlers[decode[i].op];
+		return 0;
+	}
+#define OP(op)		L_##op:
+#define NEXT()		goto *(++pc)->handler
+#define JUMP(to)	do { pc = (to); goto *pc->handler; } while (0)
+#define DISPATCH()	goto *pc->handler;
+#define END_DISPATCH()
+#else
+	(void)ninsns;
+	if (decode != NULL)
+		return 0;
+#define OP(op)		case TOP_##op:
+#define NEXT()		{ ++pc; continue; }
+#define JUMP(to)	{ pc = (to); continue; }
+#define DISPATCH()	for (;;) switch (pc->op) {
+#define END_DISPATCH()	}
+#endif
+
+	A = 0;
+	X = 0;
+	DISPATCH()
+
+	OP(RET_K)
+		return (u_int)pc->k;
+
+	OP(RET_A)
+		return (u_int)A;
+
+	OP(LD_W_ABS)
+		if (pc->end > buflen)
+			return 0;
+		A = EXTRACT_LONG(&p[pc->k]);
+		NEXT();
+
+	OP(LD_W_ABS_NC)
+		A = EXTRACT_LONG(&p[pc->k]);
+		NEXT();
+
+	OP(LD_H_ABS)
+		if (pc->end > buflen)
+			return 0;
+		A = EXTRACT_SHORT(&p[pc->k]);
+		NEXT();
+
+	OP(LD_H_ABS_NC)
+		A = EXTRACT_SHORT(&p[pc->k]);
+		NEXT();
+
+	OP(LD_B_ABS)
+		if (pc->end > buflen)
+			return 0;
+		A = p[pc->k];
+		NEXT();
+
+	OP(LD_B_ABS_NC)
+		A = p[pc->k];
+		NEXT();
+
+	OP(LD_VLAN_TAG)
+		if (!aux_data)
+			return 0;
+		A = aux_data->vlan_tag;
+		NEXT();
+
+	OP(LD_VLAN_TAG_PRESENT)
+		if (!aux_data)
+			return 0;
+		A = aux_data->vlan_tag_present;
+		NEXT();
+
+	OP(LD_W_IND)
+		k = X + pc->k;
+		if (pc->k > buflen || X > buflen - pc->k ||
+		    sizeof(int32_t) > buflen - k)
+			return 0;
+		A = EXTRACT_LONG(&p[k]);
+		NEXT();
+
+	OP(LD_H_IND)
+		k = X + pc->k;
+		if (X > buflen || pc->k > buflen - X ||
+		    sizeof(int16_t) > buflen - k)
+			return 0;
+		A = EXTRACT_SHORT(&p[k]);
+		NEXT();
+
+	OP(LD_B_IND)
+		k = X + pc->k;
+		if (pc->k >= buflen || X >= buflen - pc->k)
+			return 0;
+		A = p[k];
+		NEXT();
+
+	OP(LDX_MSH)
+		if (pc->end > buflen)
+			return 0;
+		X = (p[pc->k] & 0xf) << 2;
+		NEXT();
+
+	OP(LDX_MSH_NC)
+		X = (p[pc->k] & 0xf) << 2;
+		NEXT();
+
+	OP(LD_LEN)
+		A = wirelen;
+		NEXT();
+
+	OP(LDX_LEN)
+		X = wirelen;
+		NEXT();
+
+	OP(LD_IMM)
+		A = pc->k;
+		NEXT();
+
+	OP(LDX_IMM)
+		X = pc->k;
+		NEXT();
+
+	OP(LD_MEM)
+		A = mem[pc->k];
+		NEXT();
+
+	OP(LDX_MEM)
+		X = mem[pc->k];
+		NEXT();
+
+	OP(ST)
+		mem[pc->k] = A;
+		NEXT();
+
+	OP(STX)
+		mem[pc->k] = X;
+		NEXT();
+
+	OP(JA)
+		JUMP(pc->jt);
+
+	OP(JGT_K)
+		JUMP((A > pc->k) ? pc->jt : pc->jf);
+
+	OP(JGE_K)
+		JUMP((A >= pc->k) ? pc->jt : pc->jf);
+
+	OP(JEQ_K)
+		JUMP((A == pc->k) ? pc->jt : pc->jf);
+
+	OP(JSET_K)
+		JUMP((A & pc->k) ? pc->jt : pc->jf);
+
+	OP(JGT_X)
+		JUMP((A > X) ? pc->jt : pc->jf);
+
+	OP(JGE_X)
+		JUMP((A >= X) ? pc->jt : pc->jf);
+
+	OP(JEQ_X)
+		JUMP((A == X) ? pc->jt : pc->jf);
+
+	OP(JSET_X)
+		JUMP((A & X) ? pc->jt : pc->jf);
+
+	OP(ADD_K)
+		A += pc->k;
+		NEXT();
+
+	OP(SUB_K)
+		A -= pc->k;
+		NEXT();
+
+	OP(MUL_K)
+		A *= pc->k;
+		NEXT();
+
+	OP(DIV_K)
+		A /= pc->k;
+		NEXT();
+
+	OP(MOD_K)
+		A %= pc->k;
+		NEXT();
+
+	OP(AND_K)
+		A &= pc->k;
+		NEXT();
+
+	OP(OR_K)
+		A |= pc->k;
+		NEXT();
+
+	OP(XOR_K)
+		A ^= pc->k;
+		NEXT();
+
+	OP(LSH_K)
+		A <<= pc->k;
+		NEXT();
+
+	OP(RSH_K)
+		A >>= pc->k;
+		NEXT();
+
+	OP(ADD_X)
+		A += X;
+		NEXT();
+
+	OP(SUB_X)
+		A -= X;
+		NEXT();
+
+	OP(MUL_X)
+		A *= X;
+		NEXT();
+
+	OP(DIV_X)
+		if (X == 0)
+			return 0;
+		A /= X;
+		NEXT();
+
+	OP(MOD_X)
+		if (X == 0)
+			return 0;
+		A %= X;
+		NEXT();
+
+	OP(AND_X)
+		A &= X;
+		NEXT();
+
+	OP(OR_X)
+		A |= X;
+		NEXT();
+
+	OP(XOR_X)
+		A ^= X;
+		NEXT();
+
+	OP(LSH_X)
+		A <<= X;
+		NEXT();
+
+	OP(RSH_X)
+		A >>= X;
+		NEXT();
+
+	OP(NEG)
+		A = (u_int32)(-(int32)A);
+		NEXT();
+
+	OP(TAX)
+		X = A;
+		NEXT();
+
+	OP(TXA)
+		A = X;
+		NEXT();
+
+	END_DISPATCH()
+#undef OP
+#undef NEXT
+#undef JUMP
+#undef DISPATCH
+#undef END_DISPATCH
+}
+
+/*
+ * Map a BPF instruction to the corresponding pre-decoded operation;
+ * return -1 if it's one the interpreter doesn't support.
+ */
+static int
+bpf_threaded_op(const struct bpf_insn *pc)
+{
+	switch (pc->code) {
+
+	case BPF_RET|BPF_K:		return TOP_RET_K;
+	case BPF_RET|BPF_A:		return TOP_RET_A;
+	case BPF_LD|BPF_W|BPF_ABS:	return TOP_LD_W_ABS;
+	case BPF_LD|BPF_H|BPF_ABS:	return TOP_LD_H_ABS;
+	case BPF_LD|BPF_B|BPF_ABS:
+#if defined(SKF_AD_VLAN_TAG_PRESENT)
+		if (pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG))
+			return TOP_LD_VLAN_TAG;
+		if (pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT))
+			return TOP_LD_VLAN_TAG_PRESENT;
+#endif
+		return TOP_LD_B_ABS;
+	case BPF_LD|BPF_W|BPF_IND:	return TOP_LD_W_IND;
+	case BPF_LD|BPF_H|BPF_IND:	return TOP_LD_H_IND;
+	case BPF_LD|BPF_B|BPF_IND:	return TOP_LD_B_IND;
+	case BPF_LDX|BPF_MSH|BPF_B:	return TOP_LDX_MSH;
+	case BPF_LD|BPF_W|BPF_LEN:	return TOP_LD_LEN;
+	case BPF_LDX|BPF_W|BPF_LEN:	return TOP_LDX_LEN;
+	case BPF_LD|BPF_IMM:		return TOP_LD_IMM;
+	case BPF_LDX|BPF_IMM:		return TOP_LDX_IMM;
+	case BPF_LD|BPF_MEM:		return TOP_LD_MEM;
+	case BPF_LDX|BPF_MEM:		return TOP_LDX_MEM;
+	case BPF_ST:			return TOP_ST;
+	case BPF_STX:			return TOP_STX;
+	case BPF_JMP|BPF_JA:		return TOP_JA;
+	case BPF_JMP|BPF_JGT|BPF_K:	return TOP_JGT_K;
+	case BPF_JMP|BPF_JGE|BPF_K:	return TOP_JGE_K;
+	case BPF_JMP|BPF_JEQ|BPF_K:	return TOP_JEQ_K;
+	case BPF_JMP|BPF_JSET|BPF_K:	return TOP_JSET_K;
+	case BPF_JMP|BPF_JGT|BPF_X:	return TOP_JGT_X;
+	case BPF_JMP|BPF_JGE|BPF_X:	return TOP_JGE_X;
+	case BPF_JMP|BPF_JEQ|BPF_X:	return TOP_JEQ_X;
+	case BPF_JMP|BPF_JSET|BPF_X:	return TOP_JSET_X;
+	case BPF_ALU|BPF_ADD|BPF_K:	return TOP_ADD_K;
+	case BPF_ALU|BPF_SUB|BPF_K:	return TOP_SUB_K;
+	case BPF_ALU|BPF_MUL|BPF_K:	return TOP_MUL_K;
+	case BPF_ALU|BPF_DIV|BPF_K:	return TOP_DIV_K;
+	case BPF_ALU|BPF_MOD|BPF_K:	return TOP_MOD_K;
+	case BPF_ALU|BPF_AND|BPF_K:	return TOP_AND_K;
+	case BPF_ALU|BPF_OR|BPF_K:	return TOP_OR_K;
+	case BPF_ALU|BPF_XOR|BPF_K:	return TOP_XOR_K;
+	case BPF_ALU|BPF_LSH|BPF_K:	return TOP_LSH_K;
+	case BPF_ALU|BPF_RSH|BPF_K:	return TOP_RSH_K;
+	case BPF_ALU|BPF_ADD|BPF_X:	return TOP_ADD_X;
+	case BPF_ALU|BPF_SUB|BPF_X:	return TOP_SUB_X;
+	case BPF_ALU|BPF_MUL|BPF_X:	return TOP_MUL_X;
+	case BPF_ALU|BPF_DIV|BPF_X:	return TOP_DIV_X;
+	case BPF_ALU|BPF_MOD|BPF_X:	return TOP_MOD_X;
+	case BPF_ALU|BPF_AND|BPF_X:	return TOP_AND_X;
+	case BPF_ALU|BPF_OR|BPF_X:	return TOP_OR_X;
+	case BPF_ALU|BPF_XOR|BPF_X:	return TOP_XOR_X;
+	case BPF_ALU|BPF_LSH|BPF_X:	return TOP_LSH_X;
+	case BPF_ALU|BPF_RSH|BPF_X:	return TOP_RSH_X;
+	case BPF_ALU|BPF_NEG:		return TOP_NEG;
+	case BPF_MISC|BPF_TAX:		return TOP_TAX;
+	case BPF_MISC|BPF_TXA:		return TOP_TXA;
+	default:			return -1;
+	}
+}
+
+/*
+ * Return the variant of a load that doesn't check the packet length.
+ */
+static u_int
+bpf_threaded_unchecked(u_int op)
+{
+	switch (op) {
+
+	case TOP_LD_W_ABS:
+		return TOP_LD_W_ABS_NC;
+
+	case TOP_LD_H_ABS:
+		return TOP_LD_H_ABS_NC;
+
+	case TOP_LD_B_ABS:
+		return TOP_LD_B_ABS_NC;
+
+	default:
+		return TOP_LDX_MSH_NC;
+	}
+}
+
+/*
+ * Decode a program that's passed bpf_validate().
+ *
+ * Returns NULL if the program contains instructions the interpreter
+ * doesn't support, or if we run out of memory; the program should
+ * then be run with bpf_filter_with_aux_data().
+ */
+struct bpf_threaded_code *
+bpf_threaded_compile(const struct bpf_insn *insns, u_int len)
+{
+	struct bpf_threaded_code *code;
+	struct bpf_threaded_insn *ti;
+	u_int32 *known, *succ_known, out, size;
+	u_int i, succ[2], nsucc, s;
+	int op, backward = 0;
+
+	code = malloc(sizeof(*code) + (len - 1) * sizeof(code->insns[0]));
+	known = malloc(len * sizeof(*known));
+	if (code == NULL || known == NULL) {
+		free(code);
+		free(known);
+		return NULL;
+	}
+	code->len = len;
+
+	for (i = 0; i < len; i++) {
+		ti = &code->insns[i];
+		op = bpf_threaded_op(&insns[i]);
+		if (op == -1) {
+			free(code);
+			free(known);
+			return NULL;
+		}
+		ti->op = (u_int)op;
+		ti->k = insns[i].k;
+		ti->end = 0;
+		ti->jt = ti->jf = NULL;
+		if (BPF_CLASS(insns[i].code) == BPF_JMP) {
+			if (BPF_OP(insns[i].code) == BPF_JA) {
+				/*
+				 * "ip6 protochain" uses backward jumps.
+				 */
+				ti->jt = &code->insns[i + 1 + insns[i].k];
+				if ((bpf_int32)insns[i].k < 0)
+					backward = 1;
+			} else {
+				ti->jt = &code->insns[i + 1 + insns[i].jt];
+				ti->jf = &code->insns[i + 1 + insns[i].jf];
+			}
+		}
+		switch (ti->op) {
+
+		case TOP_LD_W_ABS:
+		case TOP_LD_H_ABS:
+		case TOP_LD_B_ABS:
+		case TOP_LDX_MSH:
+			size = (ti->op == TOP_LD_W_ABS) ? 4 :
+			    (ti->op == TOP_LD_H_ABS) ? 2 : 1;
+			if (ti->k > 0xffffffffU - size) {
+				/*
+				 * The load can never succeed.
+				 */
+				ti->op = TOP_RET_K;
+				ti->k = 0;
+			} else
+				ti->end = ti->k + size;
+			break;
+		}
+	}
+
+	/*
+	 * Work out, for each instruction, how much of the packet must
+	 * be present for us to have gotten there; that's the furthest
+	 * extent of the successful loads on all paths leading to it.
+	 * We only need one pass, as jumps only go forward, other than
+	 * protochain's backward jumps; don't bother if we have those.
+	 */
+	if (!backward) {
+		known[0] = 0;
+		for (i = 1; i < len; i++)
+			known[i] = 0xffffffffU;	/* not yet reached */
+		for (i = 0; i < len; i++) {
+			ti = &code->insns[i];
+			if (known[i] == 0xffffffffU)
+				known[i] = 0;	/* unreachable */
+			out = known[i];
+			switch (ti->op) {
+
+			case TOP_LD_W_ABS:
+			case TOP_LD_H_ABS:
+			case TOP_LD_B_ABS:
+			case TOP_LDX_MSH:
+				if (ti->end <= known[i])
+					ti->op = bpf_threaded_unchecked(ti->op);
+				else
+					out = ti->end;
+				break;
+			}
+			nsucc = 0;
+			if (ti->jt != NULL) {
+				succ[nsucc++] = (u_int)(ti->jt - code->insns);
+				if (ti->jf != NULL)
+					succ[nsucc++] = (u_int)(ti->jf - code->insns);
+			} else if (ti->op != TOP_RET_K && ti->op != TOP_RET_A)
+				succ[nsucc++] = i + 1;
+			for (s = 0; s < nsucc; s++) {
+				succ_known = &known[succ[s]];
+				if (out < *succ_known)
+					*succ_known = out;
+			}
+		}
+	}
+	free(known);
+
+	(void)bpf_threaded_run(NULL, NULL, 0, 0, NULL, code->insns, len);
+	return code;
+}
+
+u_int
+bpf_threaded_filter(const struct bpf_threaded_code *code, const u_char *p,
+    u_int wirelen, u_int buflen, const struct bpf_aux_data *aux_data)
+{
+	return bpf_threaded_run(code->insns, p, wirelen, buflen, aux_data,
+	    NULL, 0);
+}
+
+void
+bpf_threaded_free(struct bpf_threaded_code *code)
+{
+	free(code);
+}
+
 
 /*
  * Return true if the 'fcode' is a valid filter program.
@@ -0,0 +1,1130 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Filter sets: running many filters over the same packets.
+ *
+ * Each expression is compiled, and optimized, with pcap_compile(); the
+ * resulting programs are then merged into a single DAG of instructions,
+ * with jumps turned into pointers to the instructions they go to and
+ * "ja" instructions removed.  Instructions are interned, as
+ * intern_blocks() in optimize.c does with blocks, so that identical
+ * instructions with identical successors - in the same program or in
+ * different programs - become the same node, and filters that end the
+ * same way share that code.
+ *
+ * Filters that start the same way are merged the other way round.
+ * Filters that have run the same instructions so far are in the same
+ * state, so, as long as their next instructions are the same, they are
+ * run together, as one "group", with each instruction run once for all
+ * of them; the group follows a jump's branches as one filter would.
+ * Where the group's filters go different ways, a "fork" runs each set
+ * of filters that still agree, one after another, from a copy of the
+ * state at that point.  A group that's down to one node of the DAG -
+ * one filter, or several that have got to the same code - runs the DAG
+ * from there, and the value it returns is the result of each of its
+ * filters.  So, for example, "tcp port 80" and "tcp port 443" load and
+ * test the Ethertype, the protocol and the fragment offset once, and
+ * only fork when they compare the ports.  Groups are interned too, and
+ * there's a limit on how many are made, after which a group forks
+ * into its nodes of the DAG.
+ *
+ * For each node of the DAG we compute, as find_ud() in optimize.c does
+ * for blocks, the set of registers and scratch memory locations that
+ * might be used from that node on before being set.  If that set is
+ * empty, the value the filter returns once it gets to that node depends
+ * only on the packet, so, when running the set on a packet, we remember
+ * the result from the first time we get to that node, and, when another
+ * group gets to it, we use that result rather than running the code
+ * again.
+ *
+ * Programs with backward jumps, which gencode.c generates for
+ * "ip6 protochain", are kept as is and run with bpf_filter().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "extract.h"
+
+#define NO_NODE		((u_int)-1)
+
+/*
+ * Pseudo-instructions for groups; neither is a valid BPF_MISC
+ * instruction.
+ */
+#define FS_LEAF		(BPF_MISC|0x10)	/* run the DAG from jt for the filters in list k */
+#define FS_FORK		(BPF_MISC|0x20)	/* run each of the groups in list k */
+
+/*
+ * Atoms for the use-def computation: the scratch memory locations are
+ * bits 0 through BPF_MEMWORDS-1.
+ */
+#define ATOM_A		(1U << BPF_MEMWORDS)
+#define ATOM_X		(1U << (BPF_MEMWORDS + 1))
+#define ATOM_MEM(k)	(1U << (k))
+
+struct fs_node {
+	u_short	code;
+	u_char	memo;		/* remember the result from this node */
+	u_char	npreds;		/* number of references, saturating at 2 */
+	bpf_u_int32 k;
+	u_int	jt;		/* successor, for instructions other than "ret" */
+	u_int	jf;		/* false successor, for conditional jumps */
+	bpf_u_int32 uses;	/* atoms that might be used before being set */
+};
+
+/*
+ * What a fork saves to run one of its groups later.
+ */
+struct fs_frame {
+	u_int	node;
+	bpf_u_int32 A, X;
+	bpf_u_int32 mem[BPF_MEMWORDS];
+};
+
+struct bpf_filter_set {
+	u_int	nfilters;
+	struct bpf_program *unshared;	/* programs not in the DAG */
+	struct fs_node *nodes;		/* the DAG, followed by the groups */
+	u_int	nnodes;
+	u_int	root;		/* group of all the filters in the DAG, or NO_NODE */
+	u_int	*lists;		/* count, then items, for FS_LEAF and FS_FORK */
+
+	/*
+	 * Per-packet state; this is why a filter set can't be used by
+	 * more than one thread at a time.
+	 */
+	u_int	gen;		/* incremented for each packet */
+	u_int	*memo_gen;	/* packet for which memo_val is valid */
+	u_int	*memo_val;
+	u_int	*path;		/* memoizable nodes on the current path */
+	struct fs_frame *frames;	/* groups forks have left to run */
+};
+
+/*
+ * A filter, and the node of the DAG it's got to, in a group.
+ */
+struct fs_pair {
+	u_short	code;		/* the node's instruction, for sorting */
+	bpf_u_int32 k;
+	u_int	node;
+	u_int	filter;
+};
+
+/*
+ * What we know about a group while building them.
+ */
+struct fs_group {
+	u_int	next;		/* next group in the same hash chain */
+	u_int	pairs;		/* where its pairs are in gpairs */
+	u_int	npairs;
+};
+
+/*
+ * State used only while building the DAG and the groups.
+ */
+struct fs_builder {
+	struct bpf_filter_set *fs;
+	u_int	*hash;		/* head of each hash chain */
+	u_int	*next;		/* next node in the same hash chain */
+	u_int	hashsize;	/* power of 2 */
+	u_int	maxnodes;	/* room in fs->nodes */
+	u_int	ndag;		/* nodes in the DAG; groups come after them */
+	u_int	budget;		/* stop running groups in step after this many */
+	u_int	nlists;		/* words used in fs->lists */
+	u_int	maxlists;
+	u_int	*ghash;		/* head of each hash chain of groups */
+	u_int	ghashsize;	/* power of 2 */
+	struct fs_group *groups;
+	u_int	maxgroups;
+	struct fs_pair *gpairs;	/* the pairs in each group */
+	u_int	ngpairs;
+	u_int	maxgpairs;
+};
+
+static u_int
+fs_hash(u_short code, bpf_u_int32 k, u_int jt, u_int jf)
+{
+	u_int h;
+
+	h = code;
+	h = h * 31 + k;
+	h = h * 31 + jt;
+	h = h * 31 + jf;
+	return (h ^ (h >> 16));
+}
+
+/*
+ * Compute the atoms that might be used, starting at a node, before
+ * they're set.
+ */
+static bpf_u_int32
+fs_uses(const struct bpf_filter_set *fs, u_short code, bpf_u_int32 k,
+    u_int jt, u_int jf)
+{
+	bpf_u_int32 after = 0;
+
+	if (jt != NO_NODE)
+		after = fs->nodes[jt].uses;
+	if (jf != NO_NODE)
+		after |= fs->nodes[jf].uses;
+
+	switch (BPF_CLASS(code)) {
+
+	case BPF_RET:
+		return (BPF_RVAL(code) == BPF_A ? ATOM_A : 0);
+
+	case BPF_LD:
+		switch (BPF_MODE(code)) {
+
+		case BPF_IND:
+			return ((after & ~ATOM_A) | ATOM_X);
+
+		case BPF_MEM:
+			return ((after & ~ATOM_A) | ATOM_MEM(k));
+
+		default:
+			return (after & ~ATOM_A);
+		}
+
+	case BPF_LDX:
+		if (BPF_MODE(code) == BPF_MEM)
+			return ((after & ~ATOM_X) | ATOM_MEM(k));
+		return (after & ~ATOM_X);
+
+	case BPF_ST:
+		return ((after & ~ATOM_MEM(k)) | ATOM_A);
+
+	case BPF_STX:
+		return ((after & ~ATOM_MEM(k)) | ATOM_X);
+
+	case BPF_ALU:
+	case BPF_JMP:
+		if (BPF_SRC(code) == BPF_X && BPF_OP(code) != BPF_NEG)
+			return (after | ATOM_A | ATOM_X);
+		return (after | ATOM_A);
+
+	case BPF_MISC:
+		if (BPF_MISCOP(code) == BPF_TAX)
+			return ((after & ~ATOM_X) | ATOM_A);
+		return ((after & ~ATOM_A) | ATOM_X);
+	}
+	abort();
+	/* NOTREACHED */
+}
+
+/*
+ * Find or create the node for an instruction with the given successors.
+ */
+static u_int
+fs_intern(struct fs_builder *b, u_short code, bpf_u_int32 k, u_int jt,
+    u_int jf)
+{
+	struct bpf_filter_set *fs = b->fs;
+	struct fs_node *np;
+	u_int h, n;
+
+	h = fs_hash(code, k, jt, jf) & (b->hashsize - 1);
+	for (n = b->hash[h]; n != NO_NODE; n = b->next[n]) {
+		np = &fs->nodes[n];
+		if (np->code == code && np->k == k && np->jt == jt &&
+		    np->jf == jf)
+			return (n);
+	}
+	n = fs->nnodes++;
+	np = &fs->nodes[n];
+	np->code = code;
+	np->k = k;
+	np->jt = jt;
+	np->jf = jf;
+	np->uses = fs_uses(fs, code, k, jt, jf);
+	np->npreds = 0;
+	np->memo = 0;
+	b->next[n] = b->hash[h];
+	b->hash[h] = n;
+	return (n);
+}
+
+static void
+fs_addpred(struct bpf_filter_set *fs, u_int n)
+{
+	if (n != NO_NODE && fs->nodes[n].npreds < 2)
+		fs->nodes[n].npreds++;
+}
+
+/*
+ * Add a program to the DAG, returning its root node, or NO_NODE if it
+ * has backward or out-of-range jumps and has to be run on its own.
+ */
+static u_int
+fs_add_program(struct fs_builder *b, const struct bpf_program *prog,
+    u_int *map)
+{
+	const struct bpf_insn *insns = prog->bf_insns;
+	u_int len = prog->bf_len;
+	u_int i, jt, jf;
+
+	for (i = 0; i < len; i++) {
+		if (BPF_CLASS(insns[i].code) == BPF_RET)
+			continue;
+		if (BPF_CLASS(insns[i].code) != BPF_JMP) {
+			if (i + 1 >= len)
+				return (NO_NODE);
+		} else if (BPF_OP(insns[i].code) == BPF_JA) {
+			if (insns[i].k >= len - i - 1)
+				return (NO_NODE);
+		} else {
+			if (insns[i].jt >= len - i - 1 ||
+			    insns[i].jf >= len - i - 1)
+				return (NO_NODE);
+		}
+	}
+
+	/*
+	 * All jumps are forward, so build the program from the end,
+	 * so that the successors of each instruction are already in
+	 * the DAG.
+	 */
+	for (i = len; i-- != 0;) {
+		const struct bpf_insn *ip = &insns[i];
+
+		if (BPF_CLASS(ip->code) == BPF_RET) {
+			jt = jf = NO_NODE;
+		} else if (BPF_CLASS(ip->code) != BPF_JMP) {
+			jt = map[i + 1];
+			jf = NO_NODE;
+		} else if (BPF_OP(ip->code) == BPF_JA) {
+			map[i] = map[i + 1 + ip->k];
+			continue;
+		} else {
+			jt = map[i + 1 + ip->jt];
+			jf = map[i + 1 + ip->jf];
+		}
+		map[i] = fs_intern(b, ip->code, ip->k, jt, jf);
+	}
+	return (map[0]);
+}
+
+/*
+ * Decide which nodes of the DAG are worth remembering the result for:
+ * those that don't depend on anything set before them and that might
+ * be reached more than once for a packet, because they have more than
+ * one predecessor, counting the groups that run the DAG from them, or
+ * because their only predecessor might be reached more than once and
+ * doesn't itself have its result remembered.
+ *
+ * Successors always have lower node numbers than their predecessors,
+ * so going from the highest-numbered node to the lowest visits each
+ * node after all its predecessors.
+ */
+static void
+fs_mark_memo(struct bpf_filter_set *fs, u_int ndag)
+{
+	u_char *revisit;
+	u_int n, s;
+
+	revisit = calloc(ndag, 1);
+	if (revisit == NULL) {
+		/*
+		 * Remembering everything is safe, just slower.
+		 */
+		for (n = 0; n < ndag; n++)
+			fs->nodes[n].memo = (fs->nodes[n].uses == 0);
+		return;
+	}
+	for (n = ndag; n-- != 0;) {
+		struct fs_node *np = &fs->nodes[n];
+
+		if (np->npreds > 1)
+			revisit[n] = 1;
+		np->memo = revisit[n] && np->uses == 0;
+		if (revisit[n] && !np->memo) {
+			if ((s = np->jt) != NO_NODE && fs->nodes[s].npreds == 1)
+				revisit[s] = 1;
+			if ((s = np->jf) != NO_NODE && fs->nodes[s].npreds == 1)
+				revisit[s] = 1;
+		}
+	}
+	free(revisit);
+}
+
+/*
+ * Make room for at least need elements of size elsize in the array
+ * *arrp, which has room for *maxp of them.
+ */
+static int
+fs_grow(void **arrp, u_int *maxp, u_int need, size_t elsize)
+{
+	void *arr;
+	u_int max;
+
+	if (need <= *maxp)
+		return (0);
+	for (max = *maxp != 0 ? *maxp : 64; max < need; max *= 2)
+		;
+	arr = realloc(*arrp, max * elsize);
+	if (arr == NULL)
+		return (-1);
+	*arrp = arr;
+	*maxp = max;
+	return (0);
+}
+
+static int
+fs_pair_cmp(const void *a, const void *b)
+{
+	const struct fs_pair *pa = a, *pb = b;
+
+	if (pa->code != pb->code)
+		return (pa->code < pb->code ? -1 : 1);
+	if (pa->k != pb->k)
+		return (pa->k < pb->k ? -1 : 1);
+	if (pa->node != pb->node)
+		return (pa->node < pb->node ? -1 : 1);
+	if (pa->filter != pb->filter)
+		return (pa->filter < pb->filter ? -1 : 1);
+	return (0);
+}
+
+static void
+fs_set_pair(const struct bpf_filter_set *fs, struct fs_pair *pp, u_int node,
+    u_int filter)
+{
+	pp->code = fs->nodes[node].code;
+	pp->k = fs->nodes[node].k;
+	pp->node = node;
+	pp->filter = filter;
+}
+
+static u_int
+fs_group_hash(const struct fs_pair *pairs, u_int npairs)
+{
+	u_int h, i;
+
+	h = npairs;
+	for (i = 0; i < npairs; i++) {
+		h = h * 31 + pairs[i].node;
+		h = h * 31 + pairs[i].filter;
+	}
+	return (h ^ (h >> 16));
+}
+
+/*
+ * Add a list of n items to fs->lists, returning where it is, or
+ * NO_NODE if we run out of memory.
+ */
+static u_int
+fs_add_list(struct fs_builder *b, const u_int *items, u_int n)
+{
+	u_int off;
+
+	if (fs_grow((void **)&b->fs->lists, &b->maxlists, b->nlists + n + 1,
+	    sizeof(*b->fs->lists)) == -1)
+		return (NO_NODE);
+	off = b->nlists;
+	b->fs->lists[off] = n;
+	memcpy(&b->fs->lists[off + 1], items, n * sizeof(*items));
+	b->nlists += n + 1;
+	return (off);
+}
+
+/*
+ * Add the node for a group, returning it, or NO_NODE if we run out of
+ * memory.
+ */
+static u_int
+fs_add_group(struct fs_builder *b, const struct fs_pair *pairs, u_int npairs,
+    u_int h, u_short code, bpf_u_int32 k, u_int jt, u_int jf)
+{
+	struct bpf_filter_set *fs = b->fs;
+	struct fs_node *np;
+	struct fs_group *gp;
+	u_int n = fs->nnodes;
+
+	if (fs_grow((void **)&fs->nodes, &b->maxnodes, n + 1,
+	    sizeof(*fs->nodes)) == -1 ||
+	    fs_grow((void **)&b->groups, &b->maxgroups, n - b->ndag + 1,
+	    sizeof(*b->groups)) == -1 ||
+	    fs_grow((void **)&b->gpairs, &b->maxgpairs, b->ngpairs + npairs,
+	    sizeof(*b->gpairs)) == -1)
+		return (NO_NODE);
+	memcpy(&b->gpairs[b->ngpairs], pairs, npairs * sizeof(*pairs));
+	gp = &b->groups[n - b->ndag];
+	gp->pairs = b->ngpairs;
+	gp->npairs = npairs;
+	gp->next = b->ghash[h];
+	b->ghash[h] = n;
+	b->ngpairs += npairs;
+
+	np = &fs->nodes[n];
+	np->code = code;
+	np->k = k;
+	np->jt = jt;
+	np->jf = jf;
+	np->uses = 0;
+	np->npreds = 0;
+	np->memo = 0;
+	fs->nnodes++;
+	return (n);
+}
+
+/*
+ * Find or make the node for a group of filters, each at a node of the
+ * DAG, that have run the same instructions so far.  The pairs are
+ * sorted with fs_pair_cmp(), so that pairs with the same instruction,
+ * and pairs with the same node, are next to each other.  Returns
+ * NO_NODE if we run out of memory.
+ */
+static u_int
+fs_merge(struct fs_builder *b, const struct fs_pair *pairs, u_int npairs)
+{
+	struct bpf_filter_set *fs = b->fs;
+	const struct fs_group *gp;
+	const struct fs_pair *gpp;
+	struct fs_pair *next;
+	u_int *items;
+	u_int h, n, i, j, nitems, list, jt, jf;
+	u_short code;
+	bpf_u_int32 k;
+	int bynode;
+
+	h = fs_group_hash(pairs, npairs) & (b->ghashsize - 1);
+	for (n = b->ghash[h]; n != NO_NODE; n = gp->next) {
+		gp = &b->groups[n - b->ndag];
+		if (gp->npairs != npairs)
+			continue;
+		gpp = &b->gpairs[gp->pairs];
+		for (i = 0; i < npairs; i++) {
+			if (gpp[i].node != pairs[i].node ||
+			    gpp[i].filter != pairs[i].filter)
+				break;
+		}
+		if (i == npairs)
+			return (n);
+	}
+
+	items = malloc(npairs * sizeof(*items));
+	if (items == NULL)
+		return (NO_NODE);
+	if (pairs[0].node == pairs[npairs - 1].node) {
+		/*
+		 * They've all got to the same node; run the DAG from
+		 * there, and its result is theirs.
+		 */
+		for (i = 0; i < npairs; i++)
+			items[i] = pairs[i].filter;
+		list = fs_add_list(b, items, npairs);
+		free(items);
+		if (list == NO_NODE)
+			return (NO_NODE);
+		n = fs_add_group(b, pairs, npairs, h, FS_LEAF, list,
+		    pairs[0].node, NO_NODE);
+		if (n != NO_NODE)
+			fs_addpred(fs, pairs[0].node);
+		return (n);
+	}
+
+	bynode = fs->nnodes - b->ndag >= b->budget;
+	code = pairs[0].code;
+	k = pairs[0].k;
+	if (!bynode && pairs[npairs - 1].code == code &&
+	    pairs[npairs - 1].k == k) {
+		/*
+		 * They all have the same instruction; run it once, and
+		 * follow its branches together.  It isn't a "ret", as
+		 * there's only one node for each "ret" instruction.
+		 */
+		free(items);
+		next = malloc(npairs * sizeof(*next));
+		if (next == NULL)
+			return (NO_NODE);
+		for (i = 0; i < npairs; i++)
+			fs_set_pair(fs, &next[i], fs->nodes[pairs[i].node].jt,
+			    pairs[i].filter);
+		qsort(next, npairs, sizeof(*next), fs_pair_cmp);
+		jt = fs_merge(b, next, npairs);
+		jf = NO_NODE;
+		if (jt != NO_NODE && BPF_CLASS(code) == BPF_JMP) {
+			for (i = 0; i < npairs; i++)
+				fs_set_pair(fs, &next[i],
+				    fs->nodes[pairs[i].node].jf,
+				    pairs[i].filter);
+			qsort(next, npairs, sizeof(*next), fs_pair_cmp);
+			jf = fs_merge(b, next, npairs);
+			if (jf == NO_NODE)
+				jt = NO_NODE;
+		}
+		free(next);
+		if (jt == NO_NODE)
+			return (NO_NODE);
+		return (fs_add_group(b, pairs, npairs, h, code, k, jt, jf));
+	}
+
+	/*
+	 * They go different ways; fork, with a group for each
+	 * instruction, or, once we've made enough groups, for each
+	 * node of the DAG.
+	 */
+	nitems = 0;
+	for (i = 0; i < npairs; i = j) {
+		for (j = i + 1; j < npairs; j++) {
+			if (bynode ? pairs[j].node != pairs[i].node :
+			    (pairs[j].code != pairs[i].code ||
+			     pairs[j].k != pairs[i].k))
+				break;
+		}
+		items[nitems] = fs_merge(b, pairs + i, j - i);
+		if (items[nitems] == NO_NODE) {
+			free(items);
+			return (NO_NODE);
+		}
+		nitems++;
+	}
+	list = fs_add_list(b, items, nitems);
+	free(items);
+	if (list == NO_NODE)
+		return (NO_NODE);
+	return (fs_add_group(b, pairs, npairs, h, FS_FORK, list, NO_NODE,
+	    NO_NODE));
+}
+
+void
+pcap_freecode_set(struct bpf_filter_set *fs)
+{
+	u_int i;
+
+	if (fs == NULL)
+		return;
+	if (fs->unshared != NULL) {
+		for (i = 0; i < fs->nfilters; i++)
+			pcap_freecode(&fs->unshared[i]);
+		free(fs->unshared);
+	}
+	free(fs->nodes);
+	free(fs->lists);
+	free(fs->memo_gen);
+	free(fs->memo_val);
+	free(fs->path);
+	free(fs->frames);
+	free(fs);
+}
+
+int
+pcap_compile_set(pcap_t *p, struct bpf_filter_set **fsp,
+    const char * const *exprs, int nexprs, int optimize, bpf_u_int32 mask)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	pcap_compiler_t *pc;
+	struct bpf_filter_set *fs;
+	struct fs_builder b;
+	struct fs_pair *pairs = NULL;
+	u_int *map = NULL, *roots = NULL;
+	u_int i, total = 0, maxlen = 0, nshared = 0;
+
+	*fsp = NULL;
+	memset(&b, 0, sizeof(b));
+	if (nexprs <= 0) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "A filter set must have at least one filter");
+		return (-1);
+	}
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL)
+		goto nomem;
+	fs->nfilters = (u_int)nexprs;
+	fs->root = NO_NODE;
+	fs->unshared = calloc(fs->nfilters, sizeof(*fs->unshared));
+	roots = malloc(fs->nfilters * sizeof(*roots));
+	pairs = malloc(fs->nfilters * sizeof(*pairs));
+	if (fs->unshared == NULL || roots == NULL || pairs == NULL)
+		goto nomem;
+
+	pc = pcap_compiler_create(p->errbuf);
+	if (pc == NULL) {
+		free(roots);
+		free(pairs);
+		pcap_freecode_set(fs);
+		return (-1);
+	}
+	for (i = 0; i < fs->nfilters; i++) {
+		if (pcap_compiler_compile(pc, p, &fs->unshared[i], exprs[i],
+		    optimize, mask) == -1) {
+			/*
+			 * Put the filter number in front of the
+			 * compiler's message, cutting the message short
+			 * if it doesn't all fit.
+			 */
+			strlcpy(errbuf, p->errbuf, sizeof(errbuf));
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "filter %u: ", i);
+			strlcat(p->errbuf, errbuf, PCAP_ERRBUF_SIZE);
+			pcap_compiler_close(pc);
+			free(roots);
+			free(pairs);
+			pcap_freecode_set(fs);
+			return (-1);
+		}
+		total += fs->unshared[i].bf_len;
+		if (fs->unshared[i].bf_len > maxlen)
+			maxlen = fs->unshared[i].bf_len;
+	}
+	pcap_compiler_close(pc);
+
+	b.fs = fs;
+	for (b.hashsize = 64; b.hashsize < 2 * total; b.hashsize <<= 1)
+		;
+	b.maxnodes = total;
+	fs->nodes = malloc(total * sizeof(*fs->nodes));
+	b.hash = malloc(b.hashsize * sizeof(*b.hash));
+	b.next = malloc(total * sizeof(*b.next));
+	map = malloc(maxlen * sizeof(*map));
+	if (fs->nodes == NULL || b.hash == NULL || b.next == NULL ||
+	    map == NULL)
+		goto nomem;
+	memset(b.hash, 0xff, b.hashsize * sizeof(*b.hash));
+
+	for (i = 0; i < fs->nfilters; i++) {
+		roots[i] = fs_add_program(&b, &fs->unshared[i], map);
+		if (roots[i] != NO_NODE)
+			pcap_freecode(&fs->unshared[i]);
+	}
+	for (i = 0; i < fs->nnodes; i++) {
+		fs_addpred(fs, fs->nodes[i].jt);
+		fs_addpred(fs, fs->nodes[i].jf);
+	}
+	free(map);
+	free(b.hash);
+	free(b.next);
+	map = NULL;
+	b.hash = b.next = NULL;
+
+	/*
+	 * Now the groups, starting with the one with all the filters
+	 * in the DAG, each at its root.
+	 */
+	b.ndag = fs->nnodes;
+	b.budget = 4 * total;
+	for (b.ghashsize = 64; b.ghashsize < 2 * b.budget; b.ghashsize <<= 1)
+		;
+	b.ghash = malloc(b.ghashsize * sizeof(*b.ghash));
+	if (b.ghash == NULL)
+		goto nomem;
+	memset(b.ghash, 0xff, b.ghashsize * sizeof(*b.ghash));
+	for (i = 0; i < fs->nfilters; i++) {
+		if (roots[i] != NO_NODE)
+			fs_set_pair(fs, &pairs[nshared++], roots[i], i);
+	}
+	if (nshared != 0) {
+		qsort(pairs, nshared, sizeof(*pairs), fs_pair_cmp);
+		fs->root = fs_merge(&b, pairs, nshared);
+		if (fs->root == NO_NODE)
+			goto nomem;
+	}
+	fs_mark_memo(fs, b.ndag);
+	free(b.ghash);
+	free(b.groups);
+	free(b.gpairs);
+	b.ghash = NULL;
+	b.groups = NULL;
+	b.gpairs = NULL;
+	free(roots);
+	free(pairs);
+	roots = NULL;
+	pairs = NULL;
+
+	if (fs->nnodes != 0) {
+		fs->memo_gen = calloc(fs->nnodes, sizeof(*fs->memo_gen));
+		fs->memo_val = malloc(fs->nnodes * sizeof(*fs->memo_val));
+		fs->path = malloc(fs->nnodes * sizeof(*fs->path));
+		fs->frames = malloc(nshared * sizeof(*fs->frames));
+		if (fs->memo_gen == NULL || fs->memo_val == NULL ||
+		    fs->path == NULL || fs->frames == NULL)
+			goto nomem;
+	}
+	*fsp = fs;
+	return (0);
+
+nomem:
+	pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE, errno,
+	    "malloc");
+	free(map);
+	free(b.hash);
+	free(b.next);
+	free(b.ghash);
+	free(b.groups);
+	free(b.gpairs);
+	free(roots);
+	free(pairs);
+	pcap_freecode_set(fs);
+	return (-1);
+}
+
+/*
+ * Run the groups, starting with the root group, and the DAG, setting
+ * the bits in matches for the filters that match; this does what
+ * bpf_filter_from() does, with no auxiliary data, for each of them.
+ * Returns the number of filters that match.
+ */
+static int
+fs_run(struct bpf_filter_set *fs, const u_char *p, u_int wirelen,
+    u_int buflen, bpf_u_int32 *matches)
+{
+	const struct fs_node *np;
+	struct fs_frame *fp;
+	const u_int *lp;
+	bpf_u_int32 A = 0, X = 0, k;
+	bpf_u_int32 mem[BPF_MEMWORDS];
+	u_int n = fs->root, npath = 0, nframes = 0, leaf = 0, v, i;
+	int nmatched = 0;
+
+	memset(mem, 0, sizeof(mem));
+	for (;;) {
+		np = &fs->nodes[n];
+		if (np->memo) {
+			if (fs->memo_gen[n] == fs->gen) {
+				v = fs->memo_val[n];
+				goto done;
+			}
+			fs->path[npath++] = n;
+		}
+		n = np->jt;
+		k = np->k;
+
+		switch (np->code) {
+
+		default:
+			abort();
+
+		case FS_LEAF:
+			leaf = k;
+			continue;
+
+		case FS_FORK:
+			/*
+			 * Run the first group now, and the others
+			 * later, from the state we're in now.
+			 */
+			lp = &fs->lists[k];
+			for (i = lp[0]; i > 1; i--) {
+				fp = &fs->frames[nframes++];
+				fp->node = lp[i];
+				fp->A = A;
+				fp->X = X;
+				memcpy(fp->mem, mem, sizeof(mem));
+			}
+			n = lp[1];
+			continue;
+
+		case BPF_RET|BPF_K:
+			v = k;
+			goto done;
+
+		case BPF_RET|BPF_A:
+			v = A;
+			goto done;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			if (k > buflen || sizeof(int32_t) > buflen - k)
+				goto fail;
+			A = EXTRACT_32BITS(&p[k]);
+			continue;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			if (k > buflen || sizeof(int16_t) > buflen - k)
+				goto fail;
+			A = EXTRACT_16BITS(&p[k]);
+			continue;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+			/*
+			 * This includes the Linux auxiliary data loads,
+			 * which fail as there's no auxiliary data.
+			 */
+			if (k >= buflen)
+				goto fail;
+			A = p[k];
+			continue;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			A = wirelen;
+			continue;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			X = wirelen;
+			continue;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			if (k > buflen || X > buflen - k ||
+			    sizeof(int32_t) > buflen - k - X)
+				goto fail;
+			A = EXTRACT_32BITS(&p[X + k]);
+			continue;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			if (k > buflen || X > buflen - k ||
+			    sizeof(int16_t) > buflen - k - X)
+				goto fail;
+			A = EXTRACT_16BITS(&p[X + k]);
+			continue;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			if (k >= buflen || X >= buflen - k)
+				goto fail;
+			A = p[X + k];
+			continue;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			if (k >= buflen)
+				goto fail;
+			X = (p[k] & 0xf) << 2;
+			continue;
+
+		case BPF_LD|BPF_IMM:
+			A = k;
+			continue;
+
+		case BPF_LDX|BPF_IMM:
+			X = k;
+			continue;
+
+		case BPF_LD|BPF_MEM:
+			A = mem[k];
+			continue;
+
+		case BPF_LDX|BPF_MEM:
+			X = mem[k];
+			continue;
+
+		case BPF_ST:
+			mem[k] = A;
+			continue;
+
+		case BPF_STX:
+			mem[k] = X;
+			continue;
+
+		case BPF_JMP|BPF_JGT|BPF_K:
+			n = (A > k) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JGE|BPF_K:
+			n = (A >= k) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			n = (A == k) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JSET|BPF_K:
+			n = (A & k) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JGT|BPF_X:
+			n = (A > X) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JGE|BPF_X:
+			n = (A >= X) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			n = (A == X) ? np->jt : np->jf;
+			continue;
+
+		case BPF_JMP|BPF_JSET|BPF_X:
+			n = (A & X) ? np->jt : np->jf;
+			continue;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			A += X;
+			continue;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			A -= X;
+			continue;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			A *= X;
+			continue;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+			if (X == 0)
+				goto fail;
+			A /= X;
+			continue;
+
+		case BPF_ALU|BPF_MOD|BPF_X:
+			if (X == 0)
+				goto fail;
+			A %= X;
+			continue;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			A &= X;
+			continue;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			A |= X;
+			continue;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			A ^= X;
+			continue;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+			A <<= X;
+			continue;
+
+		case BPF_ALU|BPF_RSH|BPF_X:
+			A >>= X;
+			continue;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			A += k;
+			continue;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			A -= k;
+			continue;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			A *= k;
+			continue;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+			A /= k;
+			continue;
+
+		case BPF_ALU|BPF_MOD|BPF_K:
+			A %= k;
+			continue;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			A &= k;
+			continue;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			A |= k;
+			continue;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			A ^= k;
+			continue;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			A <<= k;
+			continue;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			A >>= k;
+			continue;
+
+		case BPF_ALU|BPF_NEG:
+			A = (bpf_u_int32)(-(bpf_int32)A);
+			continue;
+
+		case BPF_MISC|BPF_TAX:
+			X = A;
+			continue;
+
+		case BPF_MISC|BPF_TXA:
+			A = X;
+			continue;
+		}
+
+		/*
+		 * We only get here from a "ret", or from failing to
+		 * load from the packet, which ends the group we're
+		 * running; a value other than 0 can only come from a
+		 * "ret", which is in the DAG, run for leaf's filters.
+		 */
+fail:
+		v = 0;
+done:
+		while (npath != 0) {
+			n = fs->path[--npath];
+			fs->memo_gen[n] = fs->gen;
+			fs->memo_val[n] = v;
+		}
+		if (v != 0) {
+			lp = &fs->lists[leaf];
+			for (i = 1; i <= lp[0]; i++)
+				matches[lp[i] / 32] |=
+				    (bpf_u_int32)1 << (lp[i] % 32);
+			nmatched += (int)lp[0];
+		}
+		if (nframes == 0)
+			break;
+		fp = &fs->frames[--nframes];
+		n = fp->node;
+		A = fp->A;
+		X = fp->X;
+		memcpy(mem, fp->mem, sizeof(mem));
+	}
+	return (nmatched);
+}
+
+/*
+ * Run all the filters in a set on a packet, setting bit (i % 32) of
+ * matches[i / 32] if filter i matches and clearing it if it doesn't.
+ * Returns the number of filters that match.
+ */
+int
+pcap_offline_filter_set(struct bpf_filter_set *fs,
+    const struct pcap_pkthdr *h, const u_char *pkt, bpf_u_int32 *matches)
+{
+	u_int i;
+	int nmatched = 0;
+
+	if (++fs->gen == 0 && fs->memo_gen != NULL) {
+		/*
+		 * Wrapped around; forget everything, so that results
+		 * from 2^32 packets ago aren't taken as this packet's.
+		 */
+		memset(fs->memo_gen, 0, fs->nnodes * sizeof(*fs->memo_gen));
+		fs->gen = 1;
+	}
+	for (i = 0; i < fs->nfilters; i += 32)
+		matches[i / 32] = 0;
+	if (fs->root != NO_NODE)
+		nmatched = fs_run(fs, pkt, h->len, h->caplen, matches);
+	for (i = 0; i < fs->nfilters; i++) {
+		if (fs->unshared[i].bf_insns != NULL &&
+		    bpf_filter(fs->unshared[i].bf_insns, pkt, h->len,
+		    h->caplen) != 0) {
+			matches[i / 32] |= (bpf_u_int32)1 << (i % 32);
+			nmatched++;
+		}
+	}
+	return (nmatched);
+}
@@ -0,0 +1,1135 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Just-in-time compiler for userland BPF filters.
+ *
+ * When a filter is installed on a pcap_t with install_bpf_program(),
+ * we try to translate it into native code, so that filtering packets
+ * in userland - when reading a savefile, or when capturing with a
+ * mechanism that can't filter in the kernel - doesn't have to go
+ * through the interpreter in bpf_filter.c.
+ *
+ * The generated code does exactly what bpf_filter_with_aux_data()
+ * does, including its bounds checks on packet data, so it's a
+ * drop-in replacement.  For programs containing instructions the
+ * interpreter doesn't handle, we generate no code, and the caller
+ * uses the interpreter.
+ *
+ * Code is generated into a writable anonymous mapping that's then
+ * made read-only and executable, so that the mapping is never both
+ * writable and executable; if the system doesn't allow executable
+ * anonymous mappings, we just don't use the JIT.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+
+/*
+ * We only have code generators for x86-64 and AArch64, and only use
+ * mmap() and mprotect() to get executable memory.
+ */
+#if defined(PCAP_SUPPORT_BPF_JIT) && !defined(_WIN32) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define JIT_SUPPORTED
+#endif
+
+#ifdef JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/types.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+/*
+ * Label numbers for the code that returns 0 and, on platforms where
+ * returning requires an epilogue, for the code that returns A; all
+ * other labels are BPF instruction indices.
+ */
+#define LABEL_RET0	UINT_MAX
+#define LABEL_RETA	(UINT_MAX - 1)
+
+struct jit_fixup {
+	size_t	at;		/* offset of the branch instruction */
+	u_int	label;		/* where it branches to */
+	int	kind;		/* kind of branch, for the back end */
+};
+
+struct jit_state {
+	u_char	*buf;		/* code generated so far */
+	size_t	len;		/* length of that code */
+	size_t	size;		/* size of the buffer */
+	size_t	*insn_off;	/* offset of the code for each instruction */
+	size_t	ret0_off;	/* offset of the "return 0" code */
+	size_t	reta_off;	/* offset of the "return A" code */
+	struct jit_fixup *fixups;
+	u_int	nfixups;
+	u_int	maxfixups;
+	int	error;		/* ran out of memory */
+};
+
+static void
+jit_emit(struct jit_state *st, const void *code, size_t len)
+{
+	u_char *newbuf;
+	size_t newsize;
+
+	if (st->error)
+		return;
+	if (st->len + len > st->size) {
+		newsize = st->size * 2;
+		while (st->len + len > newsize)
+			newsize *= 2;
+		newbuf = realloc(st->buf, newsize);
+		if (newbuf == NULL) {
+			st->error = 1;
+			return;
+		}
+		st->buf = newbuf;
+		st->size = newsize;
+	}
+	memcpy(st->buf + st->len, code, len);
+	st->len += len;
+}
+
+/*
+ * Record that the branch instruction about to be emitted, at the
+ * current offset, goes to the given label.
+ */
+static void
+jit_fixup(struct jit_state *st, u_int label, int kind)
+{
+	struct jit_fixup *newfixups;
+
+	if (st->error)
+		return;
+	if (st->nfixups == st->maxfixups) {
+		newfixups = realloc(st->fixups,
+		    2 * st->maxfixups * sizeof(*st->fixups));
+		if (newfixups == NULL) {
+			st->error = 1;
+			return;
+		}
+		st->fixups = newfixups;
+		st->maxfixups *= 2;
+	}
+	st->fixups[st->nfixups].at = st->len;
+	st->fixups[st->nfixups].label = label;
+	st->fixups[st->nfixups].kind = kind;
+	st->nfixups++;
+}
+
+static size_t
+jit_label_offset(struct jit_state *st, u_int label)
+{
+	if (label == LABEL_RET0)
+		return (st->ret0_off);
+	if (label == LABEL_RETA)
+		return (st->reta_off);
+	return (st->insn_off[label]);
+}
+
+/*
+ * The size of each load, for bounds checking.
+ */
+static u_int
+load_size(u_int code)
+{
+	switch (BPF_SIZE(code)) {
+
+	case BPF_W:
+		return (4);
+
+	case BPF_H:
+		return (2);
+
+	default:
+		return (1);
+	}
+}
+
+/*
+ * Is this one of the loads from the auxiliary data that the interpreter
+ * supports?  If so, return the offset of the field in struct bpf_aux_data.
+ */
+static int
+aux_data_offset(const struct bpf_insn *pc)
+{
+#if defined(SKF_AD_VLAN_TAG_PRESENT)
+	if (pc->code == (BPF_LD|BPF_B|BPF_ABS)) {
+		if (pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG))
+			return (offsetof(struct bpf_aux_data, vlan_tag));
+		if (pc->k == (bpf_u_int32)(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT))
+			return (offsetof(struct bpf_aux_data, vlan_tag_present));
+	}
+#else
+	(void)pc;
+#endif
+	return (-1);
+}
+
+#if defined(__x86_64__)
+/*
+ * x86-64, System V ABI.
+ *
+ * On entry, the packet pointer is in %rdi, the wire length in %esi,
+ * the buffer length in %edx, and the auxiliary data pointer in %rcx.
+ * We keep A in %eax, X in %ecx (so that it can be used as a shift
+ * count), the buffer length in %r8d, and the auxiliary data pointer
+ * in %r10; %r11 and %rdx are temporaries.  The scratch memory words
+ * live in the red zone below the stack pointer, as we don't call
+ * anything.
+ */
+#define X86_JMP_REL32	0	/* branch with a 32-bit displacement at its end */
+
+/* Offset, from %rsp, of scratch memory word k. */
+#define X86_MEM(k)	((u_char)(-4 * BPF_MEMWORDS + 4 * (k)))
+
+static void
+x86_emit_imm32(struct jit_state *st, bpf_u_int32 k)
+{
+	u_char b[4];
+
+	b[0] = (u_char)k;
+	b[1] = (u_char)(k >> 8);
+	b[2] = (u_char)(k >> 16);
+	b[3] = (u_char)(k >> 24);
+	jit_emit(st, b, 4);
+}
+
+static void
+x86_emit_op_imm32(struct jit_state *st, u_char op, bpf_u_int32 k)
+{
+	jit_emit(st, &op, 1);
+	x86_emit_imm32(st, k);
+}
+
+/*
+ * Emit a jump, or a conditional jump with the given condition code
+ * (the second byte of the 0F 8x opcode), to the label.
+ */
+static void
+x86_emit_jmp(struct jit_state *st, int cc, u_int label)
+{
+	u_char b[2];
+
+	if (cc == -1) {
+		b[0] = 0xe9;			/* jmp rel32 */
+		jit_emit(st, b, 1);
+	} else {
+		b[0] = 0x0f;			/* jcc rel32 */
+		b[1] = (u_char)cc;
+		jit_emit(st, b, 2);
+	}
+	jit_fixup(st, label, X86_JMP_REL32);
+	x86_emit_imm32(st, 0);
+}
+
+#define X86_JB		0x82
+#define X86_JAE		0x83
+#define X86_JE		0x84
+#define X86_JNE		0x85
+#define X86_JBE		0x86
+#define X86_JA		0x87
+
+/*
+ * Emit code to check that "size" bytes starting at offset %r11 are
+ * within the buffer, jumping to the "return 0" code if they're not.
+ * %r11 holds a value < 2^33, so none of this overflows.
+ */
+static void
+x86_emit_bounds_check(struct jit_state *st, u_int size)
+{
+	u_char lea[] = { 0x49, 0x8d, 0x53, (u_char)size }; /* lea size(%r11),%rdx */
+	static const u_char cmp[] = { 0x4c, 0x39, 0xc2 };    /* cmp %r8,%rdx */
+
+	jit_emit(st, lea, sizeof(lea));
+	jit_emit(st, cmp, sizeof(cmp));
+	x86_emit_jmp(st, X86_JA, LABEL_RET0);
+}
+
+/*
+ * Emit code to load "size" bytes at offset %r11 in the packet into
+ * %eax, in host byte order.
+ */
+static void
+x86_emit_packet_load(struct jit_state *st, u_int size)
+{
+	static const u_char ldw[] = {
+		0x42, 0x8b, 0x04, 0x1f,		/* mov (%rdi,%r11),%eax */
+		0x0f, 0xc8			/* bswap %eax */
+	};
+	static const u_char ldh[] = {
+		0x42, 0x0f, 0xb7, 0x04, 0x1f,	/* movzwl (%rdi,%r11),%eax */
+		0x66, 0xc1, 0xc0, 0x08		/* rol $8,%ax */
+	};
+	static const u_char ldb[] = {
+		0x42, 0x0f, 0xb6, 0x04, 0x1f	/* movzbl (%rdi,%r11),%eax */
+	};
+
+	switch (size) {
+
+	case 4:
+		jit_emit(st, ldw, sizeof(ldw));
+		break;
+
+	case 2:
+		jit_emit(st, ldh, sizeof(ldh));
+		break;
+
+	default:
+		jit_emit(st, ldb, sizeof(ldb));
+		break;
+	}
+}
+
+static void
+jit_prologue(struct jit_state *st)
+{
+	static const u_char code[] = {
+		0x41, 0x89, 0xd0,		/* mov %edx,%r8d */
+		0x49, 0x89, 0xca,		/* mov %rcx,%r10 */
+		0x31, 0xc0,			/* xor %eax,%eax */
+		0x31, 0xc9			/* xor %ecx,%ecx */
+	};
+
+	jit_emit(st, code, sizeof(code));
+}
+
+static void
+jit_epilogue(struct jit_state *st)
+{
+	static const u_char ret0[] = {
+		0x31, 0xc0,			/* xor %eax,%eax */
+		0xc3				/* ret */
+	};
+
+	st->ret0_off = st->len;
+	jit_emit(st, ret0, sizeof(ret0));
+	st->reta_off = st->len;
+}
+
+static int
+jit_insn(struct jit_state *st, const struct bpf_insn *pc, u_int i)
+{
+	static const u_char ret[] = { 0xc3 };
+	u_int size, jt, jf;
+	int aux_off, cc, ncc;
+
+	switch (pc->code) {
+
+	case BPF_RET|BPF_K:
+		x86_emit_op_imm32(st, 0xb8, pc->k);	/* mov $k,%eax */
+		jit_emit(st, ret, sizeof(ret));
+		break;
+
+	case BPF_RET|BPF_A:
+		jit_emit(st, ret, sizeof(ret));
+		break;
+
+	case BPF_LD|BPF_W|BPF_ABS:
+	case BPF_LD|BPF_H|BPF_ABS:
+	case BPF_LD|BPF_B|BPF_ABS:
+		aux_off = aux_data_offset(pc);
+		if (aux_off != -1) {
+			u_char code[] = {
+				0x4d, 0x85, 0xd2,	/* test %r10,%r10 */
+			};
+			u_char load[] = {	/* movzwl off(%r10),%eax */
+				0x41, 0x0f, 0xb7, 0x42, (u_char)aux_off
+			};
+
+			jit_emit(st, code, sizeof(code));
+			x86_emit_jmp(st, X86_JE, LABEL_RET0);
+			jit_emit(st, load, sizeof(load));
+			break;
+		}
+		size = load_size(pc->code);
+		/* mov $k,%r11d */
+		jit_emit(st, "\x41", 1);
+		x86_emit_op_imm32(st, 0xbb, pc->k);
+		x86_emit_bounds_check(st, size);
+		x86_emit_packet_load(st, size);
+		break;
+
+	case BPF_LD|BPF_W|BPF_IND:
+	case BPF_LD|BPF_H|BPF_IND:
+	case BPF_LD|BPF_B|BPF_IND:
+		size = load_size(pc->code);
+		/* mov $k,%r11d; add %rcx,%r11 */
+		jit_emit(st, "\x41", 1);
+		x86_emit_op_imm32(st, 0xbb, pc->k);
+		jit_emit(st, "\x49\x01\xcb", 3);
+		x86_emit_bounds_check(st, size);
+		x86_emit_packet_load(st, size);
+		break;
+
+	case BPF_LDX|BPF_MSH|BPF_B: {
+		static const u_char code[] = {
+			0x42, 0x0f, 0xb6, 0x0c, 0x1f,	/* movzbl (%rdi,%r11),%ecx */
+			0x83, 0xe1, 0x0f,		/* and $0xf,%ecx */
+			0xc1, 0xe1, 0x02		/* shl $2,%ecx */
+		};
+
+		jit_emit(st, "\x41", 1);
+		x86_emit_op_imm32(st, 0xbb, pc->k);
+		x86_emit_bounds_check(st, 1);
+		jit_emit(st, code, sizeof(code));
+		break;
+	}
+
+	case BPF_LD|BPF_W|BPF_LEN:
+		jit_emit(st, "\x89\xf0", 2);		/* mov %esi,%eax */
+		break;
+
+	case BPF_LDX|BPF_W|BPF_LEN:
+		jit_emit(st, "\x89\xf1", 2);		/* mov %esi,%ecx */
+		break;
+
+	case BPF_LD|BPF_IMM:
+		x86_emit_op_imm32(st, 0xb8, pc->k);	/* mov $k,%eax */
+		break;
+
+	case BPF_LDX|BPF_IMM:
+		x86_emit_op_imm32(st, 0xb9, pc->k);	/* mov $k,%ecx */
+		break;
+
+	case BPF_LD|BPF_MEM:
+	case BPF_LDX|BPF_MEM:
+	case BPF_ST:
+	case BPF_STX: {
+		/* mov {%eax,%ecx} to or from k(%rsp) */
+		u_char code[] = { 0x8b, 0x44, 0x24, X86_MEM(pc->k) };
+
+		if (BPF_CLASS(pc->code) == BPF_ST ||
+		    BPF_CLASS(pc->code) == BPF_STX)
+			code[0] = 0x89;
+		if (BPF_CLASS(pc->code) == BPF_LDX ||
+		    BPF_CLASS(pc->code) == BPF_STX)
+			code[1] = 0x4c;
+		jit_emit(st, code, sizeof(code));
+		break;
+	}
+
+	case BPF_JMP|BPF_JA:
+		x86_emit_jmp(st, -1, i + 1 + pc->k);
+		break;
+
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_K:
+	case BPF_JMP|BPF_JSET|BPF_K:
+	case BPF_JMP|BPF_JGT|BPF_X:
+	case BPF_JMP|BPF_JGE|BPF_X:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+	case BPF_JMP|BPF_JSET|BPF_X:
+		switch (BPF_OP(pc->code)) {
+
+		case BPF_JGT:
+			cc = X86_JA;
+			ncc = X86_JBE;
+			break;
+
+		case BPF_JGE:
+			cc = X86_JAE;
+			ncc = X86_JB;
+			break;
+
+		case BPF_JEQ:
+			cc = X86_JE;
+			ncc = X86_JNE;
+			break;
+
+		default:
+			cc = X86_JNE;
+			ncc = X86_JE;
+			break;
+		}
+		if (BPF_OP(pc->code) == BPF_JSET) {
+			if (BPF_SRC(pc->code) == BPF_K)
+				x86_emit_op_imm32(st, 0xa9, pc->k); /* test $k,%eax */
+			else
+				jit_emit(st, "\x85\xc8", 2);	/* test %ecx,%eax */
+		} else {
+			if (BPF_SRC(pc->code) == BPF_K)
+				x86_emit_op_imm32(st, 0x3d, pc->k); /* cmp $k,%eax */
+			else
+				jit_emit(st, "\x39\xc8", 2);	/* cmp %ecx,%eax */
+		}
+		jt = i + 1 + pc->jt;
+		jf = i + 1 + pc->jf;
+		if (jt == jf) {
+			if (jt != i + 1)
+				x86_emit_jmp(st, -1, jt);
+		} else if (jt == i + 1)
+			x86_emit_jmp(st, ncc, jf);
+		else {
+			x86_emit_jmp(st, cc, jt);
+			if (jf != i + 1)
+				x86_emit_jmp(st, -1, jf);
+		}
+		break;
+
+	case BPF_ALU|BPF_ADD|BPF_X:
+		jit_emit(st, "\x01\xc8", 2);		/* add %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_SUB|BPF_X:
+		jit_emit(st, "\x29\xc8", 2);		/* sub %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_MUL|BPF_X:
+		jit_emit(st, "\x0f\xaf\xc1", 3);	/* imul %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_DIV|BPF_X:
+	case BPF_ALU|BPF_MOD|BPF_X:
+		jit_emit(st, "\x85\xc9", 2);		/* test %ecx,%ecx */
+		x86_emit_jmp(st, X86_JE, LABEL_RET0);
+		jit_emit(st, "\x31\xd2\xf7\xf1", 4);	/* xor %edx,%edx; div %ecx */
+		if (BPF_OP(pc->code) == BPF_MOD)
+			jit_emit(st, "\x89\xd0", 2);	/* mov %edx,%eax */
+		break;
+
+	case BPF_ALU|BPF_AND|BPF_X:
+		jit_emit(st, "\x21\xc8", 2);		/* and %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_OR|BPF_X:
+		jit_emit(st, "\x09\xc8", 2);		/* or %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_XOR|BPF_X:
+		jit_emit(st, "\x31\xc8", 2);		/* xor %ecx,%eax */
+		break;
+
+	case BPF_ALU|BPF_LSH|BPF_X:
+		jit_emit(st, "\xd3\xe0", 2);		/* shl %cl,%eax */
+		break;
+
+	case BPF_ALU|BPF_RSH|BPF_X:
+		jit_emit(st, "\xd3\xe8", 2);		/* shr %cl,%eax */
+		break;
+
+	case BPF_ALU|BPF_ADD|BPF_K:
+		x86_emit_op_imm32(st, 0x05, pc->k);	/* add $k,%eax */
+		break;
+
+	case BPF_ALU|BPF_SUB|BPF_K:
+		x86_emit_op_imm32(st, 0x2d, pc->k);	/* sub $k,%eax */
+		break;
+
+	case BPF_ALU|BPF_MUL|BPF_K:
+		jit_emit(st, "\x69\xc0", 2);		/* imul $k,%eax,%eax */
+		x86_emit_imm32(st, pc->k);
+		break;
+
+	case BPF_ALU|BPF_DIV|BPF_K:
+	case BPF_ALU|BPF_MOD|BPF_K:
+		/* mov $k,%r11d; xor %edx,%edx; div %r11d */
+		jit_emit(st, "\x41", 1);
+		x86_emit_op_imm32(st, 0xbb, pc->k);
+		jit_emit(st, "\x31\xd2\x41\xf7\xf3", 5);
+		if (BPF_OP(pc->code) == BPF_MOD)
+			jit_emit(st, "\x89\xd0", 2);	/* mov %edx,%eax */
+		break;
+
+	case BPF_ALU|BPF_AND|BPF_K:
+		x86_emit_op_imm32(st, 0x25, pc->k);	/* and $k,%eax */
+		break;
+
+	case BPF_ALU|BPF_OR|BPF_K:
+		x86_emit_op_imm32(st, 0x0d, pc->k);	/* or $k,%eax */
+		break;
+
+	case BPF_ALU|BPF_XOR|BPF_K:
+		x86_emit_op_imm32(st, 0x35, pc->k);	/* xor $k,%eax */
+		break;
+
+	case BPF_ALU|BPF_LSH|BPF_K: {
+		u_char code[] = { 0xc1, 0xe0, (u_char)pc->k };	/* shl $k,%eax */
+
+		jit_emit(st, code, sizeof(code));
+		break;
+	}
+
+	case BPF_ALU|BPF_RSH|BPF_K: {
+		u_char code[] = { 0xc1, 0xe8, (u_char)pc->k };	/* shr $k,%eax */
+
+		jit_emit(st, code, sizeof(code));
+		break;
+	}
+
+	case BPF_ALU|BPF_NEG:
+		jit_emit(st, "\xf7\xd8", 2);		/* neg %eax */
+		break;
+
+	case BPF_MISC|BPF_TAX:
+		jit_emit(st, "\x89\xc1", 2);		/* mov %eax,%ecx */
+		break;
+
+	case BPF_MISC|BPF_TXA:
+		jit_emit(st, "\x89\xc8", 2);		/* mov %ecx,%eax */
+		break;
+
+	default:
+		/*
+		 * The interpreter doesn't handle this either; let it
+		 * deal with it.
+		 */
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+jit_resolve(struct jit_state *st, const struct jit_fixup *f)
+{
+	size_t target = jit_label_offset(st, f->label);
+	/* The displacement is relative to the end of the instruction. */
+	long disp = (long)target - (long)(f->at + 4);
+	u_char *p = st->buf + f->at;
+
+	p[0] = (u_char)disp;
+	p[1] = (u_char)(disp >> 8);
+	p[2] = (u_char)(disp >> 16);
+	p[3] = (u_char)(disp >> 24);
+	return (0);
+}
+#endif /* __x86_64__ */
+
+#if defined(__aarch64__)
+/*
+ * AArch64.
+ *
+ * On entry, the packet pointer is in x0, the wire length in w1, the
+ * buffer length in w2, and the auxiliary data pointer in x3.  We keep
+ * A in w4 and X in w5; x6, x7, and x8 are temporaries.  The scratch
+ * memory words are in a 64-byte stack frame.
+ */
+#define A64_B		0	/* B: 26-bit displacement */
+#define A64_BCOND	1	/* B.cond, CBZ: 19-bit displacement */
+
+#define A64_A		4
+#define A64_X		5
+#define A64_T0		6
+#define A64_OFF		7
+#define A64_END		8
+#define A64_ZR		31
+#define A64_SP		31
+
+#define A64_EQ		0x0
+#define A64_NE		0x1
+#define A64_HS		0x2
+#define A64_LO		0x3
+#define A64_HI		0x8
+#define A64_LS		0x9
+
+static void
+a64_emit(struct jit_state *st, bpf_u_int32 insn)
+{
+	u_char b[4];
+
+	/* Instructions are always little-endian. */
+	b[0] = (u_char)insn;
+	b[1] = (u_char)(insn >> 8);
+	b[2] = (u_char)(insn >> 16);
+	b[3] = (u_char)(insn >> 24);
+	jit_emit(st, b, 4);
+}
+
+/* Three-register data-processing instruction. */
+#define A64_RRR(op, d, n, m)	((op) | ((m) << 16) | ((n) << 5) | (d))
+
+#define A64_ADD_W	0x0b000000
+#define A64_SUB_W	0x4b000000
+#define A64_AND_W	0x0a000000
+#define A64_ORR_W	0x2a000000
+#define A64_EOR_W	0x4a000000
+#define A64_MUL_W	0x1b007c00
+#define A64_UDIV_W	0x1ac00800
+#define A64_LSLV_W	0x1ac02000
+#define A64_LSRV_W	0x1ac02400
+#define A64_ADD_X	0x8b000000
+#define A64_SUBS_X	0xeb000000
+#define A64_SUBS_W	0x6b000000
+#define A64_ANDS_W	0x6a000000
+#define A64_LDR_W_REG	0xb8606800
+#define A64_LDRH_REG	0x78606800
+#define A64_LDRB_REG	0x38606800
+
+#define A64_MOV_W(d, m)	A64_RRR(A64_ORR_W, (d), A64_ZR, (m))
+
+/*
+ * Load a 32-bit immediate into a W register.
+ */
+static void
+a64_emit_mov_imm(struct jit_state *st, int rd, bpf_u_int32 k)
+{
+	a64_emit(st, 0x52800000 | ((k & 0xffff) << 5) | rd);	/* movz */
+	if (k >> 16)
+		a64_emit(st, 0x72a00000 | ((k >> 16) << 5) | rd); /* movk, lsl 16 */
+}
+
+static void
+a64_emit_branch(struct jit_state *st, int cond, u_int label)
+{
+	jit_fixup(st, label, cond == -1 ? A64_B : A64_BCOND);
+	if (cond == -1)
+		a64_emit(st, 0x14000000);		/* b */
+	else
+		a64_emit(st, 0x54000000 | cond);	/* b.cond */
+}
+
+/*
+ * Emit code to check that "size" bytes starting at offset x7 are within
+ * the buffer, branching to the "return 0" code if they're not.
+ */
+static void
+a64_emit_bounds_check(struct jit_state *st, u_int size)
+{
+	/* add x8, x7, #size */
+	a64_emit(st, 0x91000000 | (size << 10) | (A64_OFF << 5) | A64_END);
+	/* cmp x8, x2 */
+	a64_emit(st, A64_RRR(A64_SUBS_X, A64_ZR, A64_END, 2));
+	a64_emit_branch(st, A64_HI, LABEL_RET0);
+}
+
+static void
+a64_emit_packet_load(struct jit_state *st, int rd, u_int size)
+{
+	switch (size) {
+
+	case 4:
+		a64_emit(st, A64_RRR(A64_LDR_W_REG, rd, 0, A64_OFF));
+		a64_emit(st, 0x5ac00800 | (rd << 5) | rd);	/* rev */
+		break;
+
+	case 2:
+		a64_emit(st, A64_RRR(A64_LDRH_REG, rd, 0, A64_OFF));
+		a64_emit(st, 0x5ac00400 | (rd << 5) | rd);	/* rev16 */
+		break;
+
+	default:
+		a64_emit(st, A64_RRR(A64_LDRB_REG, rd, 0, A64_OFF));
+		break;
+	}
+}
+
+static void
+jit_prologue(struct jit_state *st)
+{
+	a64_emit(st, 0xd10103ff);			/* sub sp, sp, #64 */
+	a64_emit(st, A64_MOV_W(2, 2));			/* zero-extend w2 */
+	a64_emit(st, A64_MOV_W(A64_A, A64_ZR));
+	a64_emit(st, A64_MOV_W(A64_X, A64_ZR));
+}
+
+static void
+jit_epilogue(struct jit_state *st)
+{
+	st->ret0_off = st->len;
+	a64_emit(st, A64_MOV_W(A64_A, A64_ZR));
+	st->reta_off = st->len;
+	a64_emit(st, A64_MOV_W(0, A64_A));
+	a64_emit(st, 0x910103ff);			/* add sp, sp, #64 */
+	a64_emit(st, 0xd65f03c0);			/* ret */
+}
+
+static int
+jit_insn(struct jit_state *st, const struct bpf_insn *pc, u_int i)
+{
+	u_int size, jt, jf;
+	int aux_off, cc, ncc, src;
+	bpf_u_int32 op;
+
+	switch (pc->code) {
+
+	case BPF_RET|BPF_K:
+		a64_emit_mov_imm(st, A64_A, pc->k);
+		a64_emit_branch(st, -1, LABEL_RETA);
+		break;
+
+	case BPF_RET|BPF_A:
+		a64_emit_branch(st, -1, LABEL_RETA);
+		break;
+
+	case BPF_LD|BPF_W|BPF_ABS:
+	case BPF_LD|BPF_H|BPF_ABS:
+	case BPF_LD|BPF_B|BPF_ABS:
+		aux_off = aux_data_offset(pc);
+		if (aux_off != -1) {
+			/* cbz x3, ret0 */
+			jit_fixup(st, LABEL_RET0, A64_BCOND);
+			a64_emit(st, 0xb4000000 | 3);
+			/* ldrh w4, [x3, #off] */
+			a64_emit(st, 0x79400000 | ((aux_off / 2) << 10) |
+			    (3 << 5) | A64_A);
+			break;
+		}
+		size = load_size(pc->code);
+		a64_emit_mov_imm(st, A64_OFF, pc->k);
+		a64_emit_bounds_check(st, size);
+		a64_emit_packet_load(st, A64_A, size);
+		break;
+
+	case BPF_LD|BPF_W|BPF_IND:
+	case BPF_LD|BPF_H|BPF_IND:
+	case BPF_LD|BPF_B|BPF_IND:
+		size = load_size(pc->code);
+		a64_emit_mov_imm(st, A64_OFF, pc->k);
+		/* add x7, x7, x5 */
+		a64_emit(st, A64_RRR(A64_ADD_X, A64_OFF, A64_OFF, A64_X));
+		a64_emit_bounds_check(st, size);
+		a64_emit_packet_load(st, A64_A, size);
+		break;
+
+	case BPF_LDX|BPF_MSH|BPF_B:
+		a64_emit_mov_imm(st, A64_OFF, pc->k);
+		a64_emit_bounds_check(st, 1);
+		a64_emit_packet_load(st, A64_X, 1);
+		/* ubfiz w5, w5, #2, #4 - i.e., (w5 & 0xf) << 2 */
+		a64_emit(st, 0x531e0c00 | (A64_X << 5) | A64_X);
+		break;
+
+	case BPF_LD|BPF_W|BPF_LEN:
+		a64_emit(st, A64_MOV_W(A64_A, 1));
+		break;
+
+	case BPF_LDX|BPF_W|BPF_LEN:
+		a64_emit(st, A64_MOV_W(A64_X, 1));
+		break;
+
+	case BPF_LD|BPF_IMM:
+		a64_emit_mov_imm(st, A64_A, pc->k);
+		break;
+
+	case BPF_LDX|BPF_IMM:
+		a64_emit_mov_imm(st, A64_X, pc->k);
+		break;
+
+	case BPF_LD|BPF_MEM:
+	case BPF_LDX|BPF_MEM:
+	case BPF_ST:
+	case BPF_STX:
+		/* ldr/str wN, [sp, #4*k] */
+		op = (BPF_CLASS(pc->code) == BPF_ST ||
+		    BPF_CLASS(pc->code) == BPF_STX) ? 0xb9000000 : 0xb9400000;
+		src = (BPF_CLASS(pc->code) == BPF_LDX ||
+		    BPF_CLASS(pc->code) == BPF_STX) ? A64_X : A64_A;
+		a64_emit(st, op | (pc->k << 10) | (A64_SP << 5) | src);
+		break;
+
+	case BPF_JMP|BPF_JA:
+		a64_emit_branch(st, -1, i + 1 + pc->k);
+		break;
+
+	case BPF_JMP|BPF_JGT|BPF_K:
+	case BPF_JMP|BPF_JGE|BPF_K:
+	case BPF_JMP|BPF_JEQ|BPF_K:
+	case BPF_JMP|BPF_JSET|BPF_K:
+	case BPF_JMP|BPF_JGT|BPF_X:
+	case BPF_JMP|BPF_JGE|BPF_X:
+	case BPF_JMP|BPF_JEQ|BPF_X:
+	case BPF_JMP|BPF_JSET|BPF_X:
+		switch (BPF_OP(pc->code)) {
+
+		case BPF_JGT:
+			cc = A64_HI;
+			ncc = A64_LS;
+			break;
+
+		case BPF_JGE:
+			cc = A64_HS;
+			ncc = A64_LO;
+			break;
+
+		case BPF_JEQ:
+			cc = A64_EQ;
+			ncc = A64_NE;
+			break;
+
+		default:
+			cc = A64_NE;
+			ncc = A64_EQ;
+			break;
+		}
+		if (BPF_SRC(pc->code) == BPF_K) {
+			a64_emit_mov_imm(st, A64_T0, pc->k);
+			src = A64_T0;
+		} else
+			src = A64_X;
+		a64_emit(st, A64_RRR(BPF_OP(pc->code) == BPF_JSET ?
+		    A64_ANDS_W : A64_SUBS_W, A64_ZR, A64_A, src));
+		jt = i + 1 + pc->jt;
+		jf = i + 1 + pc->jf;
+		if (jt == jf) {
+			if (jt != i + 1)
+				a64_emit_branch(st, -1, jt);
+		} else if (jt == i + 1)
+			a64_emit_branch(st, ncc, jf);
+		else {
+			a64_emit_branch(st, cc, jt);
+			if (jf != i + 1)
+				a64_emit_branch(st, -1, jf);
+		}
+		break;
+
+	case BPF_ALU|BPF_ADD|BPF_X:
+	case BPF_ALU|BPF_SUB|BPF_X:
+	case BPF_ALU|BPF_MUL|BPF_X:
+	case BPF_ALU|BPF_DIV|BPF_X:
+	case BPF_ALU|BPF_MOD|BPF_X:
+	case BPF_ALU|BPF_AND|BPF_X:
+	case BPF_ALU|BPF_OR|BPF_X:
+	case BPF_ALU|BPF_XOR|BPF_X:
+	case BPF_ALU|BPF_LSH|BPF_X:
+	case BPF_ALU|BPF_RSH|BPF_X:
+	case BPF_ALU|BPF_ADD|BPF_K:
+	case BPF_ALU|BPF_SUB|BPF_K:
+	case BPF_ALU|BPF_MUL|BPF_K:
+	case BPF_ALU|BPF_DIV|BPF_K:
+	case BPF_ALU|BPF_MOD|BPF_K:
+	case BPF_ALU|BPF_AND|BPF_K:
+	case BPF_ALU|BPF_OR|BPF_K:
+	case BPF_ALU|BPF_XOR|BPF_K:
+	case BPF_ALU|BPF_LSH|BPF_K:
+	case BPF_ALU|BPF_RSH|BPF_K:
+		if (BPF_SRC(pc->code) == BPF_K) {
+			a64_emit_mov_imm(st, A64_T0, pc->k);
+			src = A64_T0;
+		} else {
+			src = A64_X;
+			if (BPF_OP(pc->code) == BPF_DIV ||
+			    BPF_OP(pc->code) == BPF_MOD) {
+				/* cbz w5, ret0 */
+				jit_fixup(st, LABEL_RET0, A64_BCOND);
+				a64_emit(st, 0x34000000 | A64_X);
+			}
+		}
+		switch (BPF_OP(pc->code)) {
+
+		case BPF_ADD:
+			op = A64_ADD_W;
+			break;
+
+		case BPF_SUB:
+			op = A64_SUB_W;
+			break;
+
+		case BPF_MUL:
+			op = A64_MUL_W;
+			break;
+
+		case BPF_DIV:
+			op = A64_UDIV_W;
+			break;
+
+		case BPF_MOD:
+			/*
+			 * A - (A / src) * src; compute the quotient
+			 * into x8, then use msub.
+			 */
+			a64_emit(st, A64_RRR(A64_UDIV_W, A64_END, A64_A, src));
+			a64_emit(st, 0x1b008000 | (src << 16) | (A64_A << 10) |
+			    (A64_END << 5) | A64_A);
+			return (0);
+
+		case BPF_AND:
+			op = A64_AND_W;
+			break;
+
+		case BPF_OR:
+			op = A64_ORR_W;
+			break;
+
+		case BPF_XOR:
+			op = A64_EOR_W;
+			break;
+
+		case BPF_LSH:
+			op = A64_LSLV_W;
+			break;
+
+		default:
+			op = A64_LSRV_W;
+			break;
+		}
+		a64_emit(st, A64_RRR(op, A64_A, A64_A, src));
+		break;
+
+	case BPF_ALU|BPF_NEG:
+		a64_emit(st, A64_RRR(A64_SUB_W, A64_A, A64_ZR, A64_A));
+		break;
+
+	case BPF_MISC|BPF_TAX:
+		a64_emit(st, A64_MOV_W(A64_X, A64_A));
+		break;
+
+	case BPF_MISC|BPF_TXA:
+		a64_emit(st, A64_MOV_W(A64_A, A64_X));
+		break;
+
+	default:
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+jit_resolve(struct jit_state *st, const struct jit_fixup *f)
+{
+	long disp = ((long)jit_label_offset(st, f->label) - (long)f->at) / 4;
+	u_char *p = st->buf + f->at;
+	bpf_u_int32 insn;
+
+	insn = p[0] | (p[1] << 8) | (p[2] << 16) | ((bpf_u_int32)p[3] << 24);
+	if (f->kind == A64_B) {
+		if (disp < -(1L << 25) || disp >= (1L << 25))
+			return (-1);
+		insn |= (bpf_u_int32)disp & 0x03ffffff;
+	} else {
+		if (disp < -(1L << 18) || disp >= (1L << 18))
+			return (-1);
+		insn |= ((bpf_u_int32)disp & 0x7ffff) << 5;
+	}
+	p[0] = (u_char)insn;
+	p[1] = (u_char)(insn >> 8);
+	p[2] = (u_char)(insn >> 16);
+	p[3] = (u_char)(insn >> 24);
+	return (0);
+}
+#endif /* __aarch64__ */
+
+/*
+ * Compile a validated BPF program into native code.
+ *
+ * Returns NULL if we can't, in which case the program should be run
+ * with the interpreter.
+ */
+struct bpf_jit_code *
+bpf_jit_compile(const struct bpf_insn *insns, u_int len)
+{
+	struct jit_state st;
+	struct bpf_jit_code *code = NULL;
+	void *mem;
+	size_t memlen, pagesize;
+	u_int i;
+
+	memset(&st, 0, sizeof(st));
+	st.size = 64 + 16 * (size_t)len;
+	st.buf = malloc(st.size);
+	st.insn_off = malloc(len * sizeof(*st.insn_off));
+	st.maxfixups = 16 + 2 * len;
+	st.fixups = malloc(st.maxfixups * sizeof(*st.fixups));
+	if (st.buf == NULL || st.insn_off == NULL || st.fixups == NULL)
+		goto done;
+
+	jit_prologue(&st);
+	for (i = 0; i < len; i++) {
+		st.insn_off[i] = st.len;
+		if (jit_insn(&st, &insns[i], i) == -1)
+			goto done;
+	}
+	jit_epilogue(&st);
+	if (st.error)
+		goto done;
+	for (i = 0; i < st.nfixups; i++) {
+		if (jit_resolve(&st, &st.fixups[i]) == -1)
+			goto done;
+	}
+
+	/*
+	 * Copy the code into a mapping of its own, and make that
+	 * mapping executable and no longer writable.
+	 */
+	pagesize = (size_t)sysconf(_SC_PAGESIZE);
+	memlen = (st.len + pagesize - 1) & ~(pagesize - 1);
+	mem = mmap(NULL, memlen, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		goto done;
+	memcpy(mem, st.buf, st.len);
+#ifdef __aarch64__
+	__builtin___clear_cache((char *)mem, (char *)mem + st.len);
+#endif
+	if (mprotect(mem, memlen, PROT_READ|PROT_EXEC) == -1) {
+		(void)munmap(mem, memlen);
+		goto done;
+	}
+	code = malloc(sizeof(*code));
+	if (code == NULL) {
+		(void)munmap(mem, memlen);
+		goto done;
+	}
+	code->func = (bpf_jit_filter_func)mem;
+	code->mem = mem;
+	code->memlen = memlen;
+
+done:
+	free(st.buf);
+	free(st.insn_off);
+	free(st.fixups);
+	return (code);
+}
+
+void
+bpf_jit_free(struct bpf_jit_code *code)
+{
+	(void)munmap(code->mem, code->memlen);
+	free(code);
+}
+#else /* JIT_SUPPORTED */
+/*
+ * We don't have a JIT for this platform, or it's been disabled.
+ */
+struct bpf_jit_code *
+bpf_jit_compile(const struct bpf_insn *insns _U_, u_int len _U_)
+{
+	return (NULL);
+}
+
+void
+bpf_jit_free(struct bpf_jit_code *code _U_)
+{
+}
+#endif /* JIT_SUPPORTED */
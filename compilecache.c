@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The compiled filter cache.
+ *
+ * When it's enabled, with pcap_compile_cache_set_size(), the programs
+ * that pcap_compile() generates are remembered, keyed by the filter
+ * expression and everything else the generated code depends on: the
+ * link-layer type and snapshot length of the pcap_t, the netmask, the
+ * optimize flag, and the few other properties of the pcap_t that the
+ * code generator looks at.  Compiling the same filter again is then a
+ * hash table lookup and a copy of the program.  Once the cache is full,
+ * the least recently used program is dropped.
+ *
+ * The cache can be written to a file, and read back in, with
+ * pcap_compile_cache_save() and pcap_compile_cache_load(); each program
+ * is written in the form "bpf_dump(program, 3)", i.e. "tcpdump -ddd",
+ * produces, after a line with its key.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(HAVE_PTHREADS)
+#include <pthread.h>
+#endif
+
+#include "pcap-int.h"
+
+#define CC_MAGIC	"# libpcap compiled filter cache, version 1"
+#define CC_MAX_EXPR	(1U << 24)	/* sanity limit when loading */
+
+/*
+ * Properties of the pcap_t, other than its link-layer type and snapshot
+ * length, that the code generator looks at.
+ */
+#define CC_SAVEFILE	0x00000001	/* reading a savefile */
+#define CC_SWAPPED	0x00000002	/* ... written with the other byte order */
+#define CC_FDDIPAD_SHIFT 8		/* padding before FDDI headers */
+#define CC_CODEGEN_SHIFT 16		/* bpf_codegen_flags */
+
+struct cc_key {
+	const char *expr;
+	size_t	exprlen;
+	int	linktype;
+	int	snaplen;
+	bpf_u_int32 netmask;
+	int	optimize;
+	u_int	flags;
+};
+
+struct cc_entry {
+	struct cc_entry *hnext;		/* next entry in the hash chain */
+	struct cc_entry *older;		/* LRU list */
+	struct cc_entry *newer;
+	u_int	hash;
+	int	linktype;
+	int	snaplen;
+	bpf_u_int32 netmask;
+	int	optimize;
+	u_int	flags;
+	size_t	exprlen;
+	char	*expr;			/* allocated with the entry */
+	u_int	len;
+	struct bpf_insn *insns;		/* allocated with the entry */
+};
+
+static struct cc_entry **cc_hash;	/* hash chains */
+static u_int cc_hashsize;		/* power of 2 */
+static struct cc_entry *cc_oldest, *cc_newest;
+static u_int cc_count;
+static u_int cc_max;			/* 0 if the cache is disabled */
+
+#ifdef _WIN32
+static SRWLOCK cc_lock = SRWLOCK_INIT;
+#define CC_LOCK()	AcquireSRWLockExclusive(&cc_lock)
+#define CC_UNLOCK()	ReleaseSRWLockExclusive(&cc_lock)
+#elif defined(HAVE_PTHREADS)
+static pthread_mutex_t cc_lock = PTHREAD_MUTEX_INITIALIZER;
+#define CC_LOCK()	pthread_mutex_lock(&cc_lock)
+#define CC_UNLOCK()	pthread_mutex_unlock(&cc_lock)
+#else
+#define CC_LOCK()
+#define CC_UNLOCK()
+#endif
+
+static void
+cc_make_key(struct cc_key *key, pcap_t *p, const char *buf, int optimize,
+    bpf_u_int32 mask)
+{
+	if (buf == NULL)
+		buf = "";
+	key->expr = buf;
+	key->exprlen = strlen(buf);
+	key->linktype = pcap_datalink(p);
+	key->snaplen = pcap_snapshot(p);
+	key->netmask = mask;
+	key->optimize = optimize != 0;
+	key->flags = (u_int)p->fddipad << CC_FDDIPAD_SHIFT |
+	    (u_int)p->bpf_codegen_flags << CC_CODEGEN_SHIFT;
+	if (p->rfile != NULL) {
+		key->flags |= CC_SAVEFILE;
+		if (p->swapped)
+			key->flags |= CC_SWAPPED;
+	}
+}
+
+static u_int
+cc_hash_key(const struct cc_key *key)
+{
+	const u_char *cp;
+	size_t i;
+	u_int h;
+
+	/* FNV-1a */
+	h = 2166136261U;
+	cp = (const u_char *)key->expr;
+	for (i = 0; i < key->exprlen; i++)
+		h = (h ^ cp[i]) * 16777619U;
+	h = (h ^ (u_int)key->linktype) * 16777619U;
+	h = (h ^ (u_int)key->snaplen) * 16777619U;
+	h = (h ^ key->netmask) * 16777619U;
+	h = (h ^ (u_int)key->optimize) * 16777619U;
+	h = (h ^ key->flags) * 16777619U;
+	return (h ^ (h >> 16));
+}
+
+static int
+cc_match(const struct cc_entry *e, const struct cc_key *key, u_int h)
+{
+	return (e->hash == h && e->exprlen == key->exprlen &&
+	    e->linktype == key->linktype && e->snaplen == key->snaplen &&
+	    e->netmask == key->netmask && e->optimize == key->optimize &&
+	    e->flags == key->flags &&
+	    memcmp(e->expr, key->expr, key->exprlen) == 0);
+}
+
+static struct cc_entry **
+cc_find(const struct cc_key *key, u_int h)
+{
+	struct cc_entry **ep;
+
+	for (ep = &cc_hash[h & (cc_hashsize - 1)]; *ep != NULL;
+	    ep = &(*ep)->hnext)
+		if (cc_match(*ep, key, h))
+			break;
+	return (ep);
+}
+
+static void
+cc_unlink_lru(struct cc_entry *e)
+{
+	if (e->older != NULL)
+		e->older->newer = e->newer;
+	else
+		cc_oldest = e->newer;
+	if (e->newer != NULL)
+		e->newer->older = e->older;
+	else
+		cc_newest = e->older;
+}
+
+static void
+cc_link_newest(struct cc_entry *e)
+{
+	e->older = cc_newest;
+	e->newer = NULL;
+	if (cc_newest != NULL)
+		cc_newest->newer = e;
+	else
+		cc_oldest = e;
+	cc_newest = e;
+}
+
+static void
+cc_remove(struct cc_entry *e)
+{
+	struct cc_entry **ep;
+
+	for (ep = &cc_hash[e->hash & (cc_hashsize - 1)]; *ep != e;
+	    ep = &(*ep)->hnext)
+		;
+	*ep = e->hnext;
+	cc_unlink_lru(e);
+	cc_count--;
+	free(e);
+}
+
+/*
+ * Add a program to the cache, replacing any program it has for the
+ * same key, and dropping the least recently used programs if it's
+ * full.  Must be called with the lock held; failing to allocate
+ * memory just means the program isn't cached.
+ */
+static void
+cc_add(const struct cc_key *key, const struct bpf_insn *insns, u_int len)
+{
+	struct cc_entry *e, **ep;
+	u_int h;
+
+	if (cc_max == 0)
+		return;
+	h = cc_hash_key(key);
+	ep = cc_find(key, h);
+	if (*ep != NULL)
+		cc_remove(*ep);
+	while (cc_count >= cc_max)
+		cc_remove(cc_oldest);
+
+	e = malloc(sizeof(*e) + len * sizeof(*insns) + key->exprlen);
+	if (e == NULL)
+		return;
+	e->hash = h;
+	e->linktype = key->linktype;
+	e->snaplen = key->snaplen;
+	e->netmask = key->netmask;
+	e->optimize = key->optimize;
+	e->flags = key->flags;
+	e->len = len;
+	e->insns = (struct bpf_insn *)(e + 1);
+	memcpy(e->insns, insns, len * sizeof(*insns));
+	e->exprlen = key->exprlen;
+	e->expr = (char *)(e->insns + len);
+	memcpy(e->expr, key->expr, key->exprlen);
+
+	ep = &cc_hash[h & (cc_hashsize - 1)];
+	e->hnext = *ep;
+	*ep = e;
+	cc_link_newest(e);
+	cc_count++;
+}
+
+/*
+ * If the cache has a program for the filter, fill in "program" with a
+ * copy of it and return 1; otherwise return 0.
+ */
+int
+pcap_compile_cache_lookup(pcap_t *p, struct bpf_program *program,
+    const char *buf, int optimize, bpf_u_int32 mask)
+{
+	struct cc_key key;
+	struct cc_entry *e;
+	struct bpf_insn *insns;
+	u_int h;
+	int found = 0;
+
+	CC_LOCK();
+	if (cc_max != 0) {
+		cc_make_key(&key, p, buf, optimize, mask);
+		h = cc_hash_key(&key);
+		e = *cc_find(&key, h);
+		if (e != NULL) {
+			insns = malloc(e->len * sizeof(*insns));
+			if (insns != NULL) {
+				memcpy(insns, e->insns, e->len * sizeof(*insns));
+				program->bf_insns = insns;
+				program->bf_len = e->len;
+				cc_unlink_lru(e);
+				cc_link_newest(e);
+				found = 1;
+			}
+		}
+	}
+	CC_UNLOCK();
+	return (found);
+}
+
+/*
+ * Remember a program that pcap_compile() generated for the filter.
+ */
+void
+pcap_compile_cache_insert(pcap_t *p, const struct bpf_program *program,
+    const char *buf, int optimize, bpf_u_int32 mask)
+{
+	struct cc_key key;
+
+	CC_LOCK();
+	if (cc_max != 0) {
+		cc_make_key(&key, p, buf, optimize, mask);
+		cc_add(&key, program->bf_insns, program->bf_len);
+	}
+	CC_UNLOCK();
+}
+
+int
+pcap_compile_cache_set_size(u_int entries)
+{
+	struct cc_entry **hash, *e;
+	u_int hashsize;
+
+	CC_LOCK();
+	if (entries == 0) {
+		while (cc_oldest != NULL)
+			cc_remove(cc_oldest);
+		free(cc_hash);
+		cc_hash = NULL;
+		cc_hashsize = 0;
+		cc_max = 0;
+		CC_UNLOCK();
+		return (0);
+	}
+
+	/*
+	 * Make the hash table at least as big as the cache, and
+	 * rehash the entries into it if it's a different size.
+	 */
+	for (hashsize = 16; hashsize < entries && hashsize < (1U << 30);
+	    hashsize <<= 1)
+		;
+	if (hashsize != cc_hashsize) {
+		hash = calloc(hashsize, sizeof(*hash));
+		if (hash == NULL) {
+			CC_UNLOCK();
+			return (PCAP_ERROR);
+		}
+		for (e = cc_oldest; e != NULL; e = e->newer) {
+			e->hnext = hash[e->hash & (hashsize - 1)];
+			hash[e->hash & (hashsize - 1)] = e;
+		}
+		free(cc_hash);
+		cc_hash = hash;
+		cc_hashsize = hashsize;
+	}
+	cc_max = entries;
+	while (cc_count > cc_max)
+		cc_remove(cc_oldest);
+	CC_UNLOCK();
+	return (0);
+}
+
+/*
+ * Write the cache to a file, from the least to the most recently used
+ * program, so that loading the file leaves the programs in the same
+ * order.
+ */
+int
+pcap_compile_cache_save(const char *fname, char *errbuf)
+{
+	FILE *fp;
+	struct cc_entry *e;
+	u_int i;
+	int err;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		return (PCAP_ERROR);
+	}
+	fprintf(fp, "%s\n", CC_MAGIC);
+	CC_LOCK();
+	for (e = cc_oldest; e != NULL; e = e->newer) {
+		fprintf(fp, "filter %d %d %u %d %u %lu\n", e->linktype,
+		    e->snaplen, e->netmask, e->optimize, e->flags,
+		    (unsigned long)e->exprlen);
+		fwrite(e->expr, 1, e->exprlen, fp);
+		fprintf(fp, "\n%u\n", e->len);
+		for (i = 0; i < e->len; i++)
+			fprintf(fp, "%u %u %u %u\n", e->insns[i].code,
+			    e->insns[i].jt, e->insns[i].jf, e->insns[i].k);
+	}
+	CC_UNLOCK();
+	err = ferror(fp);
+	if (fclose(fp) == EOF || err) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		return (PCAP_ERROR);
+	}
+	return (0);
+}
+
+/*
+ * Read one program, after its key, from a cache file; return 1 if we
+ * got one, 0 at the end of the file, and -1 if the file is bad.
+ */
+static int
+cc_read_entry(FILE *fp, struct cc_key *key, char **exprp,
+    struct bpf_insn **insnsp, u_int *lenp, char *errbuf)
+{
+	char line[256];
+	unsigned long exprlen;
+	u_int code, jt, jf, k, len, i;
+	char *expr;
+	struct bpf_insn *insns;
+
+	do {
+		if (fgets(line, sizeof(line), fp) == NULL)
+			return (0);
+	} while (line[0] == '#' || line[0] == '\n');
+	if (sscanf(line, "filter %d %d %u %d %u %lu", &key->linktype,
+	    &key->snaplen, &key->netmask, &key->optimize, &key->flags,
+	    &exprlen) != 6 || exprlen > CC_MAX_EXPR) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "bad filter line in compiled filter cache file");
+		return (-1);
+	}
+	expr = malloc(exprlen + 1);
+	if (expr == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	if (fread(expr, 1, exprlen, fp) != exprlen || getc(fp) != '\n' ||
+	    fscanf(fp, "%u", &len) != 1 || len == 0 || len > CC_MAX_EXPR) {
+		free(expr);
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated or bad compiled filter cache file");
+		return (-1);
+	}
+	insns = malloc(len * sizeof(*insns));
+	if (insns == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(expr);
+		return (-1);
+	}
+	for (i = 0; i < len; i++) {
+		if (fscanf(fp, "%u %u %u %u", &code, &jt, &jf, &k) != 4 ||
+		    code > 0xffff || jt > 0xff || jf > 0xff)
+			break;
+		insns[i].code = (u_short)code;
+		insns[i].jt = (u_char)jt;
+		insns[i].jf = (u_char)jf;
+		insns[i].k = k;
+	}
+	if (i < len || getc(fp) != '\n' || !bpf_validate(insns, (int)len)) {
+		free(insns);
+		free(expr);
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "bad program in compiled filter cache file");
+		return (-1);
+	}
+	key->expr = expr;
+	key->exprlen = exprlen;
+	*exprp = expr;
+	*insnsp = insns;
+	*lenp = len;
+	return (1);
+}
+
+/*
+ * Add the programs in a file written by pcap_compile_cache_save() to
+ * the cache.
+ */
+int
+pcap_compile_cache_load(const char *fname, char *errbuf)
+{
+	FILE *fp;
+	char line[sizeof(CC_MAGIC) + 1];
+	struct cc_key key;
+	char *expr;
+	struct bpf_insn *insns;
+	u_int len;
+	int ret;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		return (PCAP_ERROR);
+	}
+	if (fgets(line, sizeof(line), fp) == NULL ||
+	    strcmp(line, CC_MAGIC "\n") != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "%s is not a compiled filter cache file", fname);
+		fclose(fp);
+		return (PCAP_ERROR);
+	}
+	while ((ret = cc_read_entry(fp, &key, &expr, &insns, &len,
+	    errbuf)) == 1) {
+		CC_LOCK();
+		cc_add(&key, insns, len);
+		CC_UNLOCK();
+		free(expr);
+		free(insns);
+	}
+	fclose(fp);
+	return (ret == 0 ? 0 : PCAP_ERROR);
+}
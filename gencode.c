@@ -38,6 +38,7 @@
   #include <arpa/inet.h>
 #endif /* _WIN32 */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <memory.h>
@@ -233,14 +234,45 @@ enum e_offrel {
  * goes into a library that would probably not be a good idea.
  *
  * XXX - this *is* in a library....
+ *
+ * The chunks belong to a pcap_compiler_t, and are kept when a
+ * compilation is over, so that a program that compiles many filters
+ * with the same pcap_compiler_t allocates them only once; chunk k is
+ * CHUNK0SIZE << k bytes long, and is allocated the first time a
+ * compilation needs it.  With 20 chunks, a compilation can allocate
+ * up to 1GB, which is enough for an expression ORing 10,000 "port"
+ * terms.
  */
-#define NCHUNKS 16
+#define NCHUNKS 20
 #define CHUNK0SIZE 1024
 struct chunk {
 	size_t n_left;
+	size_t size;
 	void *m;
 };
 
+/*
+ * State that's kept from one compilation to the next.
+ */
+struct pcap_compiler {
+	struct chunk chunks[NCHUNKS];
+	int cur_chunk;
+	yyscan_t scanner;
+
+	/*
+	 * Host names given to us with pcap_compiler_add_host(), and how
+	 * to look up the ones that aren't there.
+	 */
+	struct nametab hosts;
+	int resolve;			/* PCAP_RESOLVE_ value */
+	u_int resolve_timeout;		/* milliseconds, or 0 for none */
+
+	/*
+	 * Host names looked up for the filter being compiled.
+	 */
+	struct nametab looked_up;
+};
+
 /* Code generator state */
 
 struct _compiler_state {
@@ -258,6 +290,16 @@ struct _compiler_state {
 	bpf_u_int32 netmask;
 	int no_optimize;
 
+	/*
+	 * If set, host names that haven't been looked up yet aren't
+	 * looked up when they're seen, they're added to the names to
+	 * look up, and counted in ndeferred; once the whole filter has
+	 * been parsed, all of them are looked up at once, and the
+	 * filter is parsed again.
+	 */
+	int defer_hosts;
+	u_int ndeferred;
+
 	/* Hack for handling VLAN and MPLS stacks. */
 	u_int label_stack_depth;
 	u_int vlan_stack_depth;
@@ -411,10 +453,9 @@ struct _compiler_state {
 	int curreg;
 
 	/*
-	 * Memory chunks.
+	 * Memory chunks and scanner.
 	 */
-	struct chunk chunks[NCHUNKS];
-	int cur_chunk;
+	pcap_compiler_t *pc;
 };
 
 void PCAP_NORETURN
@@ -445,10 +486,10 @@ static void init_regs(compiler_state_t *);
 static int alloc_reg(compiler_state_t *);
 static void free_reg(compiler_state_t *, int);
 
-static void initchunks(compiler_state_t *cstate);
+static int init_compiler(pcap_compiler_t *, char *);
+static void resetchunks(pcap_compiler_t *);
 static void *newchunk(compiler_state_t *cstate, size_t);
-static void freechunks(compiler_state_t *cstate);
-static inline struct block *new_block(compiler_state_t *cstate, int);
+static void cleanup_compiler(pcap_compiler_t *);
 static inline struct slist *new_stmt(compiler_state_t *cstate, int);
 static struct block *gen_retblk(compiler_state_t *cstate, int);
 static inline void syntax(compiler_state_t *cstate);
@@ -545,24 +586,65 @@ static struct block *gen_geneve_ll_check(compiler_state_t *cstate);
 static struct block *gen_ppi_dlt_check(compiler_state_t *);
 static struct block *gen_msg_abbrev(compiler_state_t *, int type);
 
-static void
-initchunks(compiler_state_t *cstate)
+static int
+init_compiler(pcap_compiler_t *pc, char *errbuf)
 {
 	int i;
 
 	for (i = 0; i < NCHUNKS; i++) {
-		cstate->chunks[i].n_left = 0;
-		cstate->chunks[i].m = NULL;
+		pc->chunks[i].n_left = 0;
+		pc->chunks[i].size = 0;
+		pc->chunks[i].m = NULL;
+	}
+	pc->cur_chunk = 0;
+	pc->scanner = NULL;
+	nametab_init(&pc->hosts);
+	pc->resolve = PCAP_RESOLVE_SYSTEM;
+	pc->resolve_timeout = 0;
+	nametab_init(&pc->looked_up);
+
+	pc->chunks[0].m = calloc(1, CHUNK0SIZE);
+	if (pc->chunks[0].m == NULL) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "out of memory");
+		return (-1);
 	}
-	cstate->cur_chunk = 0;
+	pc->chunks[0].size = CHUNK0SIZE;
+	pc->chunks[0].n_left = CHUNK0SIZE;
+
+	if (pcap_lex_init(&pc->scanner) != 0) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't initialize scanner");
+		free(pc->chunks[0].m);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Make all the chunks available again.  newchunk() hands out memory
+ * that's been zeroed, so clear whatever the last compilation used.
+ */
+static void
+resetchunks(pcap_compiler_t *pc)
+{
+	struct chunk *cp;
+	int i;
+
+	for (i = 0; i <= pc->cur_chunk; i++) {
+		cp = &pc->chunks[i];
+		memset((char *)cp->m + cp->n_left, 0, cp->size - cp->n_left);
+		cp->n_left = cp->size;
+	}
+	pc->cur_chunk = 0;
 }
 
 static void *
 newchunk(compiler_state_t *cstate, size_t n)
 {
+	pcap_compiler_t *pc = cstate->pc;
 	struct chunk *cp;
 	int k;
-	size_t size;
 
 #ifndef __NetBSD__
 	/* XXX Round up to nearest long. */
@@ -572,33 +654,37 @@ newchunk(compiler_state_t *cstate, size_t n)
 	n = ALIGN(n);
 #endif
 
-	cp = &cstate->chunks[cstate->cur_chunk];
-	if (n > cp->n_left) {
-		++cp;
-		k = ++cstate->cur_chunk;
+	cp = &pc->chunks[pc->cur_chunk];
+	while (n > cp->n_left) {
+		k = pc->cur_chunk + 1;
 		if (k >= NCHUNKS)
 			bpf_error(cstate, "out of memory");
-		size = CHUNK0SIZE << k;
-		cp->m = (void *)malloc(size);
-		if (cp->m == NULL)
-			bpf_error(cstate, "out of memory");
-		memset((char *)cp->m, 0, size);
-		cp->n_left = size;
-		if (n > size)
-			bpf_error(cstate, "out of memory");
+		cp = &pc->chunks[k];
+		if (cp->m == NULL) {
+			cp->m = calloc(1, CHUNK0SIZE << k);
+			if (cp->m == NULL)
+				bpf_error(cstate, "out of memory");
+			cp->size = CHUNK0SIZE << k;
+			cp->n_left = cp->size;
+		}
+		pc->cur_chunk = k;
 	}
 	cp->n_left -= n;
 	return (void *)((char *)cp->m + cp->n_left);
 }
 
 static void
-freechunks(compiler_state_t *cstate)
+cleanup_compiler(pcap_compiler_t *pc)
 {
 	int i;
 
 	for (i = 0; i < NCHUNKS; ++i)
-		if (cstate->chunks[i].m != NULL)
-			free(cstate->chunks[i].m);
+		if (pc->chunks[i].m != NULL)
+			free(pc->chunks[i].m);
+	if (pc->scanner != NULL)
+		pcap_lex_destroy(pc->scanner);
+	nametab_free(&pc->hosts);
+	nametab_free(&pc->looked_up);
 }
 
 /*
@@ -614,7 +700,7 @@ sdup(compiler_state_t *cstate, const char *s)
 	return (cp);
 }
 
-static inline struct block *
+struct block *
 new_block(compiler_state_t *cstate, int code)
 {
 	struct block *p;
@@ -652,19 +738,18 @@ syntax(compiler_state_t *cstate)
 	bpf_error(cstate, "syntax error in filter expression");
 }
 
-int
-pcap_compile(pcap_t *p, struct bpf_program *program,
-	     const char *buf, int optimize, bpf_u_int32 mask)
+static int
+compile(pcap_compiler_t *pc, pcap_t *p, struct bpf_program *program,
+	const char *buf, int optimize, bpf_u_int32 mask)
 {
 #ifdef _WIN32
 	static int done = 0;
 #endif
 	compiler_state_t cstate;
 	const char * volatile xbuf = buf;
-	yyscan_t scanner = NULL;
-	YY_BUFFER_STATE in_buffer = NULL;
+	YY_BUFFER_STATE volatile in_buffer = NULL;
 	u_int len;
-	int  rc;
+	int  rc, use_cache;
 
 	/*
 	 * If this pcap_t hasn't been activated, it doesn't have a
@@ -703,7 +788,17 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 		(p->save_current_filter_op)(p, buf);
 #endif
 
-	initchunks(&cstate);
+	/*
+	 * The compiled filter cache doesn't know about our host table,
+	 * so don't use it if we have one.
+	 */
+	use_cache = pc->hosts.count == 0 && pc->resolve == PCAP_RESOLVE_SYSTEM;
+	if (use_cache &&
+	    pcap_compile_cache_lookup(p, program, buf, optimize, mask))
+		return (0);
+
+	resetchunks(pc);
+	cstate.pc = pc;
 	cstate.no_optimize = 0;
 #ifdef INET6
 	cstate.ai = NULL;
@@ -711,6 +806,8 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 	cstate.ic.root = NULL;
 	cstate.ic.cur_mark = 0;
 	cstate.bpf_pcap = p;
+	cstate.defer_hosts = 1;
+	cstate.ndeferred = 0;
 	init_regs(&cstate);
 
 	if (setjmp(cstate.top_ctx)) {
@@ -732,19 +829,39 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 		goto quit;
 	}
 
-	if (pcap_lex_init(&scanner) != 0)
-		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
-		    errno, "can't initialize scanner");
-	in_buffer = pcap__scan_string(xbuf ? xbuf : "", scanner);
+	for (;;) {
+		in_buffer = pcap__scan_string(xbuf ? xbuf : "", pc->scanner);
 
-	/*
-	 * Associate the compiler state with the lexical analyzer
-	 * state.
-	 */
-	pcap_set_extra(&cstate, scanner);
+		/*
+		 * Associate the compiler state with the lexical analyzer
+		 * state.
+		 */
+		pcap_set_extra(&cstate, pc->scanner);
 
-	init_linktype(&cstate, p);
-	(void)pcap_parse(scanner, &cstate);
+		init_linktype(&cstate, p);
+		(void)pcap_parse(pc->scanner, &cstate);
+		if (cstate.ndeferred == 0)
+			break;
+
+		/*
+		 * Look up all the host names in the filter at once, and
+		 * then generate the code again, with their addresses.
+		 */
+		if (nametab_resolve(&pc->looked_up, pc->resolve_timeout,
+		    p->errbuf) == -1) {
+			rc = -1;
+			goto quit;
+		}
+		pcap__delete_buffer(in_buffer, pc->scanner);
+		in_buffer = NULL;
+		resetchunks(pc);
+		cstate.no_optimize = 0;
+		cstate.ic.root = NULL;
+		cstate.ic.cur_mark = 0;
+		cstate.defer_hosts = 0;
+		cstate.ndeferred = 0;
+		init_regs(&cstate);
+	}
 
 	if (cstate.ic.root == NULL)
 		cstate.ic.root = gen_retblk(&cstate, cstate.snaplen);
@@ -757,26 +874,110 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 	}
 	program->bf_insns = icode_to_fcode(&cstate, &cstate.ic, cstate.ic.root, &len);
 	program->bf_len = len;
+	if (use_cache)
+		pcap_compile_cache_insert(p, program, buf, optimize, mask);
 
 	rc = 0;  /* We're all okay */
 
 quit:
 	/*
-	 * Clean up everything for the lexical analyzer.
+	 * Clean up the input buffer for the lexical analyzer; the
+	 * analyzer itself, and our own allocated memory, are kept
+	 * for the next compilation.
 	 */
 	if (in_buffer != NULL)
-		pcap__delete_buffer(in_buffer, scanner);
-	if (scanner != NULL)
-		pcap_lex_destroy(scanner);
+		pcap__delete_buffer(in_buffer, pc->scanner);
+	nametab_free(&pc->looked_up);
 
-	/*
-	 * Clean up our own allocated memory.
-	 */
-	freechunks(&cstate);
+	return (rc);
+}
 
+int
+pcap_compile(pcap_t *p, struct bpf_program *program,
+	     const char *buf, int optimize, bpf_u_int32 mask)
+{
+	pcap_compiler_t pc;
+	int rc;
+
+	if (init_compiler(&pc, p->errbuf) == -1)
+		return (-1);
+	rc = compile(&pc, p, program, buf, optimize, mask);
+	cleanup_compiler(&pc);
 	return (rc);
 }
 
+/*
+ * A compiler handle keeps its memory chunks and lexical analyzer
+ * between compilations, so that compiling many filters doesn't mean
+ * allocating and freeing them for each filter.  A handle must not be
+ * used by more than one thread at a time; threads compiling filters
+ * concurrently should each have their own handle.
+ */
+pcap_compiler_t *
+pcap_compiler_create(char *errbuf)
+{
+	pcap_compiler_t *pc;
+
+	pc = malloc(sizeof(*pc));
+	if (pc == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	if (init_compiler(pc, errbuf) == -1) {
+		free(pc);
+		return (NULL);
+	}
+	return (pc);
+}
+
+int
+pcap_compiler_compile(pcap_compiler_t *pc, pcap_t *p,
+    struct bpf_program *program, const char *buf, int optimize,
+    bpf_u_int32 mask)
+{
+	return (compile(pc, p, program, buf, optimize, mask));
+}
+
+void
+pcap_compiler_close(pcap_compiler_t *pc)
+{
+	cleanup_compiler(pc);
+	free(pc);
+}
+
+/*
+ * Host names in filters compiled with a handle are looked up in the
+ * handle's host table first; names that aren't in it are looked up with
+ * the system's resolver, all at once after the filter has been parsed,
+ * unless the resolution mode is PCAP_RESOLVE_TABLE_ONLY.
+ */
+int
+pcap_compiler_set_resolve(pcap_compiler_t *pc, int mode, u_int timeout)
+{
+	if (mode != PCAP_RESOLVE_SYSTEM && mode != PCAP_RESOLVE_TABLE_ONLY)
+		return (PCAP_ERROR);
+	pc->resolve = mode;
+	pc->resolve_timeout = timeout;
+	return (0);
+}
+
+int
+pcap_compiler_add_host(pcap_compiler_t *pc, const char *name,
+    const char *addr, char *errbuf)
+{
+	return (nametab_add_addr(&pc->hosts, name, addr, errbuf) == -1 ?
+	    PCAP_ERROR : 0);
+}
+
+int
+pcap_compiler_load_hosts(pcap_compiler_t *pc, const char *fname,
+    char *errbuf)
+{
+	return (nametab_load_hosts(&pc->hosts, fname, errbuf) == -1 ?
+	    PCAP_ERROR : 0);
+}
+
 /*
  * entry point for using the compiler with no pcap open
  * pass in all the stuff that is needed explicitly instead.
@@ -6319,6 +6520,47 @@ gen_proto(compiler_state_t *cstate, int v, int proto, int dir)
 	/* NOTREACHED */
 }
 
+/*
+ * Find the addresses for a host name, in the host table the program
+ * gave us or, unless it told us not to, with the system's resolver.
+ * If we're deferring the lookup, return 0; otherwise, return 1, with
+ * *aip set to the addresses, or to NULL if the name wasn't found.
+ * The addresses belong to the compiler, and mustn't be freed.
+ */
+static int
+lookup_host(compiler_state_t *cstate, const char *name, struct addrinfo **aip)
+{
+	pcap_compiler_t *pc = cstate->pc;
+	struct nametab_entry *e;
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+	*aip = NULL;
+	e = nametab_lookup(&pc->hosts, name);
+	if (e != NULL) {
+		*aip = e->ai;
+		return (1);
+	}
+	if (pc->resolve == PCAP_RESOLVE_TABLE_ONLY)
+		return (1);
+
+	e = nametab_add(&pc->looked_up, name);
+	if (e == NULL)
+		bpf_error(cstate, "out of memory");
+	if (e->status == NAMETAB_PENDING) {
+		if (cstate->defer_hosts) {
+			cstate->ndeferred++;
+			return (0);
+		}
+		if (nametab_resolve(&pc->looked_up, pc->resolve_timeout,
+		    errbuf) == -1)
+			bpf_error(cstate, "%s", errbuf);
+	}
+	if (e->status == NAMETAB_TIMEDOUT)
+		bpf_error(cstate, "timed out looking up host '%s'", name);
+	*aip = e->ai;
+	return (1);
+}
+
 struct block *
 gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 {
@@ -6433,10 +6675,10 @@ gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 #ifdef INET6
 			memset(&mask128, 0xff, sizeof(mask128));
 #endif
-			res0 = res = pcap_nametoaddrinfo(name);
-			if (res == NULL)
+			if (!lookup_host(cstate, name, &res0))
+				return gen_true(cstate);
+			if (res0 == NULL)
 				bpf_error(cstate, "unknown host '%s'", name);
-			cstate->ai = res;
 			b = tmp = NULL;
 			tproto = proto;
 #ifdef INET6
@@ -6480,8 +6722,6 @@ gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 					gen_or(b, tmp);
 				b = tmp;
 			}
-			cstate->ai = NULL;
-			freeaddrinfo(res0);
 			if (b == NULL) {
 				bpf_error(cstate, "unknown host '%s'%s", name,
 				    (proto == Q_DEFAULT)
@@ -6586,13 +6826,13 @@ gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 		if (eaddr == NULL)
 			bpf_error(cstate, "unknown ether host: %s", name);
 
-		res = pcap_nametoaddrinfo(name);
-		cstate->ai = res;
+		if (!lookup_host(cstate, name, &res)) {
+			free(eaddr);
+			return gen_true(cstate);
+		}
 		if (res == NULL)
 			bpf_error(cstate, "unknown host '%s'", name);
 		b = gen_gateway(cstate, eaddr, res, proto, dir);
-		cstate->ai = NULL;
-		freeaddrinfo(res);
 		if (b == NULL)
 			bpf_error(cstate, "unknown host '%s'", name);
 		return b;
@@ -222,11 +222,6 @@ typedef bpf_u_int32 atomset;
 #define ATOMMASK(n) (1 << (n))
 #define ATOMELEM(d, n) (d & ATOMMASK(n))
 
-/*
- * An unbounded set.
- */
-typedef bpf_u_int32 *uset;
-
 /*
  * Total number of atomic entities, including accumulator (A) and index (X).
  * We treat all these guys similarly during flow analysis.
@@ -236,7 +231,6 @@ typedef bpf_u_int32 *uset;
 struct edge {
 	int id;
 	int code;
-	uset edom;
 	struct block *succ;
 	struct block *pred;
 	struct edge *next;	/* link list of incoming edges for a node */
@@ -256,8 +250,6 @@ struct block {
 	struct edge ef;
 	struct block *head;
 	struct block *link;	/* link field used by optimizer */
-	uset dom;
-	uset closure;
 	struct edge *in_edges;
 	atomset def, kill;
 	atomset in_use;
@@ -393,6 +385,7 @@ void PCAP_NORETURN bpf_error(compiler_state_t *, const char *, ...)
 
 void finish_parse(compiler_state_t *, struct block *);
 char *sdup(compiler_state_t *, const char *);
+struct block *new_block(compiler_state_t *, int);
 
 struct bpf_insn *icode_to_fcode(compiler_state_t *, struct icode *,
     struct block *, u_int *);
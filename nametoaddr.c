@@ -63,6 +63,7 @@
   #include <sys/param.h>
   #include <sys/types.h>
   #include <sys/socket.h>
+  #include <sys/stat.h>
   #include <sys/time.h>
 
   #include <netinet/in.h>
@@ -132,6 +133,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include "pcap-int.h"
 
@@ -194,6 +198,487 @@ pcap_nametoaddrinfo(const char *name)
 		return res;
 }
 
+/*
+ * Tables of host names and their addresses.
+ */
+#define NAMETAB_MAX_THREADS	16
+
+static u_int
+nametab_hash(const char *name)
+{
+	u_int h;
+
+	/* FNV-1a, ignoring case, as host names are case-insensitive */
+	h = 2166136261U;
+	for (; *name != '\0'; name++)
+		h = (h ^ (u_char)tolower((u_char)*name)) * 16777619U;
+	return (h ^ (h >> 16));
+}
+
+void
+nametab_init(struct nametab *tab)
+{
+	tab->hash = NULL;
+	tab->hashsize = 0;
+	tab->count = 0;
+	tab->npending = 0;
+}
+
+static void
+nametab_free_addrs(struct nametab_entry *e)
+{
+	struct addrinfo *ai, *next;
+
+	if (e->from_resolver) {
+		if (e->ai != NULL)
+			freeaddrinfo(e->ai);
+	} else {
+		for (ai = e->ai; ai != NULL; ai = next) {
+			next = ai->ai_next;
+			free(ai);
+		}
+	}
+	e->ai = NULL;
+	e->from_resolver = 0;
+}
+
+void
+nametab_free(struct nametab *tab)
+{
+	struct nametab_entry *e, *next;
+	u_int i;
+
+	for (i = 0; i < tab->hashsize; i++) {
+		for (e = tab->hash[i]; e != NULL; e = next) {
+			next = e->next;
+			nametab_free_addrs(e);
+			free(e);
+		}
+	}
+	free(tab->hash);
+	nametab_init(tab);
+}
+
+struct nametab_entry *
+nametab_lookup(const struct nametab *tab, const char *name)
+{
+	struct nametab_entry *e;
+
+	if (tab->hashsize == 0)
+		return (NULL);
+	for (e = tab->hash[nametab_hash(name) & (tab->hashsize - 1)];
+	    e != NULL; e = e->next)
+		if (pcap_strcasecmp(e->name, name) == 0)
+			return (e);
+	return (NULL);
+}
+
+struct nametab_entry *
+nametab_add(struct nametab *tab, const char *name)
+{
+	struct nametab_entry *e, *next, **hash;
+	u_int i, hashsize, h;
+	size_t len;
+
+	e = nametab_lookup(tab, name);
+	if (e != NULL)
+		return (e);
+
+	/*
+	 * Keep the hash table at least as big as the number of names.
+	 */
+	if (tab->count >= tab->hashsize) {
+		hashsize = tab->hashsize == 0 ? 16 : tab->hashsize * 2;
+		hash = calloc(hashsize, sizeof(*hash));
+		if (hash == NULL)
+			return (NULL);
+		for (i = 0; i < tab->hashsize; i++) {
+			for (e = tab->hash[i]; e != NULL; e = next) {
+				next = e->next;
+				h = nametab_hash(e->name) & (hashsize - 1);
+				e->next = hash[h];
+				hash[h] = e;
+			}
+		}
+		free(tab->hash);
+		tab->hash = hash;
+		tab->hashsize = hashsize;
+	}
+
+	len = strlen(name);
+	e = malloc(sizeof(*e) + len + 1);
+	if (e == NULL)
+		return (NULL);
+	e->name = (char *)(e + 1);
+	memcpy(e->name, name, len + 1);
+	e->ai = NULL;
+	e->status = NAMETAB_PENDING;
+	e->from_resolver = 0;
+	h = nametab_hash(name) & (tab->hashsize - 1);
+	e->next = tab->hash[h];
+	tab->hash[h] = e;
+	tab->count++;
+	tab->npending++;
+	return (e);
+}
+
+/*
+ * Add an address, given as a numeric IPv4 or IPv6 address string, to
+ * the addresses for a name.
+ */
+int
+nametab_add_addr(struct nametab *tab, const char *name, const char *addr,
+    char *errbuf)
+{
+	struct addrinfo hints, *res, *ai, **aip;
+	struct nametab_entry *e;
+	int error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;	/*not really*/
+	hints.ai_protocol = IPPROTO_TCP;	/*not really*/
+	hints.ai_flags = AI_NUMERICHOST;
+	error = getaddrinfo(addr, NULL, &hints, &res);
+	if (error != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "invalid address '%s' for host '%s'", addr, name);
+		return (-1);
+	}
+
+	/*
+	 * Copy the address, so that addresses from more than one call
+	 * can be put on the same list.
+	 */
+	ai = malloc(sizeof(*ai) + res->ai_addrlen);
+	if (ai == NULL) {
+		freeaddrinfo(res);
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	memset(ai, 0, sizeof(*ai));
+	ai->ai_family = res->ai_family;
+	ai->ai_socktype = res->ai_socktype;
+	ai->ai_protocol = res->ai_protocol;
+	ai->ai_addrlen = res->ai_addrlen;
+	ai->ai_addr = (struct sockaddr *)(ai + 1);
+	memcpy(ai->ai_addr, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	e = nametab_add(tab, name);
+	if (e == NULL) {
+		free(ai);
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	if (e->status == NAMETAB_PENDING)
+		tab->npending--;
+	else if (e->status != NAMETAB_FOUND || e->from_resolver)
+		nametab_free_addrs(e);
+	e->status = NAMETAB_FOUND;
+	for (aip = &e->ai; *aip != NULL; aip = &(*aip)->ai_next)
+		;
+	*aip = ai;
+	return (0);
+}
+
+/*
+ * Add the names in a file in the format of /etc/hosts: an address
+ * followed by one or more names for it on each line, with "#" starting
+ * a comment.
+ */
+int
+nametab_load_hosts(struct nametab *tab, const char *fname, char *errbuf)
+{
+	FILE *fp;
+	char line[1024], *cp, *addr, *name;
+	const char *sep = " \t\r\n";
+	int lineno = 0;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		return (-1);
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((cp = strchr(line, '#')) != NULL)
+			*cp = '\0';
+		addr = strtok(line, sep);
+		if (addr == NULL)
+			continue;
+		while ((name = strtok(NULL, sep)) != NULL) {
+			if (nametab_add_addr(tab, name, addr, errbuf) == -1) {
+				size_t len = strlen(errbuf);
+
+				pcap_snprintf(errbuf + len,
+				    PCAP_ERRBUF_SIZE - len, " at %s line %d",
+				    fname, lineno);
+				fclose(fp);
+				return (-1);
+			}
+		}
+	}
+	fclose(fp);
+	return (0);
+}
+
+static u_int
+nametab_now(void)
+{
+#ifdef _WIN32
+	return ((u_int)GetTickCount());
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((u_int)(tv.tv_sec * 1000 + tv.tv_usec / 1000));
+#endif
+}
+
+struct nametab_lookup {
+	char	*name;
+	struct addrinfo *ai;
+	int	done;
+};
+
+#ifdef HAVE_PTHREADS
+/*
+ * The names being looked up by a set of threads.  The threads, and the
+ * thread that started them, each hold a reference; if that thread gives
+ * up waiting, the threads still looking up names free the results, and
+ * the last one to finish frees this.
+ */
+struct nametab_job {
+	pthread_mutex_t mtx;
+	pthread_cond_t done;	/* signalled when a name has been looked up */
+	u_int	refs;
+	u_int	nnames;
+	u_int	next;		/* next name to look up */
+	u_int	ndone;
+	int	abandoned;
+	struct nametab_lookup *names;
+};
+
+static void
+nametab_job_release(struct nametab_job *job)
+{
+	u_int i;
+	int last;
+
+	pthread_mutex_lock(&job->mtx);
+	last = --job->refs == 0;
+	pthread_mutex_unlock(&job->mtx);
+	if (!last)
+		return;
+	for (i = 0; i < job->nnames; i++)
+		free(job->names[i].name);
+	free(job->names);
+	pthread_cond_destroy(&job->done);
+	pthread_mutex_destroy(&job->mtx);
+	free(job);
+}
+
+static void *
+nametab_thread(void *arg)
+{
+	struct nametab_job *job = arg;
+	struct addrinfo *ai;
+	u_int i;
+
+	pthread_mutex_lock(&job->mtx);
+	while (!job->abandoned && job->next < job->nnames) {
+		i = job->next++;
+		pthread_mutex_unlock(&job->mtx);
+		ai = pcap_nametoaddrinfo(job->names[i].name);
+		pthread_mutex_lock(&job->mtx);
+		if (job->abandoned) {
+			if (ai != NULL)
+				freeaddrinfo(ai);
+			break;
+		}
+		job->names[i].ai = ai;
+		job->names[i].done = 1;
+		job->ndone++;
+		pthread_cond_signal(&job->done);
+	}
+	pthread_mutex_unlock(&job->mtx);
+	nametab_job_release(job);
+	return (NULL);
+}
+
+/*
+ * Look up the names with a set of threads; return -1, without having
+ * looked any up, if no threads could be started.  The threads get
+ * their own copy of the names, which they free.
+ */
+static int
+nametab_lookup_threads(struct nametab_lookup *names, u_int nnames,
+    u_int timeout, char *errbuf)
+{
+	struct nametab_job *job;
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct timeval now;
+	struct timespec deadline;
+	u_int i, nthreads;
+	int err = 0;
+
+	job = malloc(sizeof(*job));
+	if (job != NULL) {
+		job->names = malloc(nnames * sizeof(*names));
+		if (job->names == NULL) {
+			free(job);
+			job = NULL;
+		}
+	}
+	if (job == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	memcpy(job->names, names, nnames * sizeof(*names));
+	pthread_mutex_init(&job->mtx, NULL);
+	pthread_cond_init(&job->done, NULL);
+	job->refs = 1;
+	job->nnames = nnames;
+	job->next = 0;
+	job->ndone = 0;
+	job->abandoned = 0;
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + timeout / 1000;
+	deadline.tv_nsec = now.tv_usec * 1000L + (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	nthreads = nnames < NAMETAB_MAX_THREADS ? nnames : NAMETAB_MAX_THREADS;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_mutex_lock(&job->mtx);
+	for (i = 0; i < nthreads; i++) {
+		job->refs++;
+		err = pthread_create(&thread, &attr, nametab_thread, job);
+		if (err != 0) {
+			job->refs--;
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	if (i == 0) {
+		pthread_mutex_unlock(&job->mtx);
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    err, "pthread_create");
+		job->nnames = 0;	/* the names are still the caller's */
+		nametab_job_release(job);
+		return (-1);
+	}
+
+	while (job->ndone < nnames) {
+		if (timeout == 0)
+			pthread_cond_wait(&job->done, &job->mtx);
+		else if (pthread_cond_timedwait(&job->done, &job->mtx,
+		    &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	/*
+	 * Take the results; any names still being looked up are left
+	 * for the threads to free.
+	 */
+	job->abandoned = 1;
+	for (i = 0; i < nnames; i++) {
+		names[i].name = NULL;
+		names[i].ai = job->names[i].ai;
+		names[i].done = job->names[i].done;
+	}
+	pthread_mutex_unlock(&job->mtx);
+	nametab_job_release(job);
+	return (0);
+}
+#endif /* HAVE_PTHREADS */
+
+/*
+ * Look up all the names that haven't been looked up yet; on
+ * platforms with threads, that's done with several threads, so that
+ * the lookups can be done at the same time.
+ */
+int
+nametab_resolve(struct nametab *tab, u_int timeout, char *errbuf)
+{
+	struct nametab_lookup *names;
+	struct nametab_entry *e, **ents;
+	u_int i, n, start;
+	int threaded = 0;
+
+	if (tab->npending == 0)
+		return (0);
+	names = calloc(tab->npending, sizeof(*names));
+	ents = malloc(tab->npending * sizeof(*ents));
+	if (names == NULL || ents == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(names);
+		free(ents);
+		return (-1);
+	}
+	n = 0;
+	for (i = 0; i < tab->hashsize; i++) {
+		for (e = tab->hash[i]; e != NULL; e = e->next) {
+			if (e->status != NAMETAB_PENDING)
+				continue;
+			names[n].name = strdup(e->name);
+			if (names[n].name == NULL) {
+				pcap_fmt_errmsg_for_errno(errbuf,
+				    PCAP_ERRBUF_SIZE, errno, "malloc");
+				while (n != 0)
+					free(names[--n].name);
+				free(names);
+				free(ents);
+				return (-1);
+			}
+			ents[n++] = e;
+		}
+	}
+
+#ifdef HAVE_PTHREADS
+	if (n > 1 && nametab_lookup_threads(names, n, timeout, errbuf) == 0)
+		threaded = 1;
+#endif
+	if (!threaded) {
+		start = nametab_now();
+		for (i = 0; i < n; i++) {
+			if (timeout != 0 && nametab_now() - start >= timeout)
+				break;
+			names[i].ai = pcap_nametoaddrinfo(names[i].name);
+			names[i].done = 1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		free(names[i].name);
+		e = ents[i];
+		if (!names[i].done)
+			e->status = NAMETAB_TIMEDOUT;
+		else if (names[i].ai == NULL)
+			e->status = NAMETAB_NOTFOUND;
+		else {
+			e->status = NAMETAB_FOUND;
+			e->ai = names[i].ai;
+			e->from_resolver = 1;
+		}
+	}
+	tab->npending -= n;
+	free(names);
+	free(ents);
+	return (0);
+}
+
 /*
  *  Convert net name to internet address.
  *  Return 0 upon failure.
@@ -279,13 +764,372 @@ pcap_nametonetaddr(const char *name)
 #endif /* _WIN32 */
 }
 
+#ifndef _WIN32
 /*
- * Convert a port name to its port and protocol numbers.
- * We assume only TCP or UDP.
- * Return 0 upon failure.
+ * Indexes of the names in /etc/services, /etc/protocols and /etc/ethers.
+ *
+ * getservbyname(), getprotobyname() and ether_hostton() read the file
+ * from the beginning on every call, so compiling a filter with hundreds
+ * of port or Ethernet host names read it hundreds of times.  Instead,
+ * the first lookup reads the whole file into a hash table, which is
+ * used until the file's modification time or size changes.  Names that
+ * aren't in the file are still looked up with the system's routines,
+ * which might get them from somewhere other than the file.
+ *
+ * Entries refer to each other, and to their names, by index and offset
+ * rather than by pointer, so the table is position-independent.
  */
-int
-pcap_nametoport(const char *name, int *port, int *proto)
+#ifndef _PATH_SERVICES
+#define _PATH_SERVICES	"/etc/services"
+#endif
+#ifndef _PATH_PROTOCOLS
+#define _PATH_PROTOCOLS	"/etc/protocols"
+#endif
+
+struct nameidx_entry {
+	u_int	next;		/* 1 + index of next entry in chain, or 0 */
+	u_int	name;		/* offset of the name in the string pool */
+	int	val;		/* port or protocol number */
+	int	proto;		/* IPPROTO_TCP or IPPROTO_UDP, for services */
+	u_char	addr[6];	/* for ethers */
+};
+
+struct nameidx {
+	const char *path;
+	int	(*parse)(struct nameidx *, char *);
+	int	loaded;
+	time_t	mtime;
+	off_t	size;
+	u_int	*buckets;	/* 1 + index of first entry in chain, or 0 */
+	u_int	nbuckets;	/* power of 2 */
+	struct nameidx_entry *entries;
+	u_int	nentries;
+	u_int	maxentries;
+	char	*pool;
+	size_t	poollen;
+	size_t	poolsize;
+};
+
+static inline u_char xdtoi(u_char);
+static int nameidx_parse_service(struct nameidx *, char *);
+static int nameidx_parse_protocol(struct nameidx *, char *);
+static int nameidx_parse_ether(struct nameidx *, char *);
+
+#define NAMEIDX_INIT(path, parse) \
+	{ path, parse, 0, 0, 0, NULL, 0, NULL, 0, 0, NULL, 0, 0 }
+
+static struct nameidx services_idx =
+    NAMEIDX_INIT(_PATH_SERVICES, nameidx_parse_service);
+static struct nameidx protocols_idx =
+    NAMEIDX_INIT(_PATH_PROTOCOLS, nameidx_parse_protocol);
+static struct nameidx ethers_idx =
+    NAMEIDX_INIT(PCAP_ETHERS_FILE, nameidx_parse_ether);
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t nameidx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NAMEIDX_LOCK()		pthread_mutex_lock(&nameidx_lock)
+#define NAMEIDX_UNLOCK()	pthread_mutex_unlock(&nameidx_lock)
+#else
+#define NAMEIDX_LOCK()
+#define NAMEIDX_UNLOCK()
+#endif
+
+static u_int
+nameidx_hash(const char *name)
+{
+	u_int h;
+
+	/* FNV-1a */
+	h = 2166136261U;
+	for (; *name != '\0'; name++)
+		h = (h ^ (u_char)*name) * 16777619U;
+	return (h ^ (h >> 16));
+}
+
+static void
+nameidx_clear(struct nameidx *idx)
+{
+	free(idx->buckets);
+	free(idx->entries);
+	free(idx->pool);
+	idx->buckets = NULL;
+	idx->nbuckets = 0;
+	idx->entries = NULL;
+	idx->nentries = 0;
+	idx->maxentries = 0;
+	idx->pool = NULL;
+	idx->poollen = 0;
+	idx->poolsize = 0;
+}
+
+/*
+ * Add an entry for a name; the caller fills in the rest of it.
+ */
+static struct nameidx_entry *
+nameidx_add(struct nameidx *idx, const char *name)
+{
+	struct nameidx_entry *e;
+	size_t len, size;
+	u_int max;
+	char *pool;
+
+	if (idx->nentries == idx->maxentries) {
+		max = idx->maxentries == 0 ? 256 : idx->maxentries * 2;
+		e = realloc(idx->entries, max * sizeof(*e));
+		if (e == NULL)
+			return (NULL);
+		idx->entries = e;
+		idx->maxentries = max;
+	}
+	len = strlen(name) + 1;
+	if (idx->poollen + len > idx->poolsize) {
+		size = idx->poolsize == 0 ? 4096 : idx->poolsize * 2;
+		while (idx->poollen + len > size)
+			size *= 2;
+		pool = realloc(idx->pool, size);
+		if (pool == NULL)
+			return (NULL);
+		idx->pool = pool;
+		idx->poolsize = size;
+	}
+	e = &idx->entries[idx->nentries++];
+	memset(e, 0, sizeof(*e));
+	e->name = (u_int)idx->poollen;
+	memcpy(idx->pool + idx->poollen, name, len);
+	idx->poollen += len;
+	return (e);
+}
+
+/*
+ * Return the next white-space-separated word on a line, stopping at
+ * a "#", or NULL if there isn't one.
+ */
+static char *
+nameidx_word(char **cpp)
+{
+	char *cp = *cpp, *word;
+
+	while (*cp == ' ' || *cp == '\t')
+		cp++;
+	if (*cp == '\0' || *cp == '#')
+		return (NULL);
+	word = cp;
+	while (*cp != '\0' && *cp != ' ' && *cp != '\t' && *cp != '#')
+		cp++;
+	if (*cp == '#')
+		*cp = '\0';
+	else if (*cp != '\0')
+		*cp++ = '\0';
+	*cpp = cp;
+	return (word);
+}
+
+/*
+ * "name port/protocol alias ..."
+ */
+static int
+nameidx_parse_service(struct nameidx *idx, char *line)
+{
+	struct nameidx_entry *e;
+	char *name, *port, *proto, *cp;
+	long val;
+	int p;
+
+	name = nameidx_word(&line);
+	port = nameidx_word(&line);
+	if (port == NULL || (proto = strchr(port, '/')) == NULL)
+		return (0);
+	*proto++ = '\0';
+	if (strcmp(proto, "tcp") == 0)
+		p = IPPROTO_TCP;
+	else if (strcmp(proto, "udp") == 0)
+		p = IPPROTO_UDP;
+	else
+		return (0);
+	val = strtol(port, &cp, 10);
+	if (cp == port || *cp != '\0' || val < 0 || val > 65535)
+		return (0);
+	for (; name != NULL; name = nameidx_word(&line)) {
+		if ((e = nameidx_add(idx, name)) == NULL)
+			return (-1);
+		e->val = (int)val;
+		e->proto = p;
+	}
+	return (0);
+}
+
+/*
+ * "name number alias ..."
+ */
+static int
+nameidx_parse_protocol(struct nameidx *idx, char *line)
+{
+	struct nameidx_entry *e;
+	char *name, *num, *cp;
+	long val;
+
+	name = nameidx_word(&line);
+	num = nameidx_word(&line);
+	if (num == NULL)
+		return (0);
+	val = strtol(num, &cp, 10);
+	if (cp == num || *cp != '\0' || val < 0 || val > 255)
+		return (0);
+	for (; name != NULL; name = nameidx_word(&line)) {
+		if ((e = nameidx_add(idx, name)) == NULL)
+			return (-1);
+		e->val = (int)val;
+	}
+	return (0);
+}
+
+/*
+ * "xx:xx:xx:xx:xx:xx name", parsed as pcap_next_etherent() does.
+ */
+static int
+nameidx_parse_ether(struct nameidx *idx, char *line)
+{
+	struct nameidx_entry *e;
+	u_char addr[6];
+	char *word, *name;
+	int i;
+
+	/*
+	 * As in pcap_next_etherent(), a short address has zeroes for
+	 * the bytes it doesn't give.
+	 */
+	memset(addr, 0, sizeof(addr));
+	word = nameidx_word(&line);
+	if (word == NULL)
+		return (0);
+	for (i = 0; i < 6; i++) {
+		if (!isxdigit((u_char)*word))
+			return (0);
+		addr[i] = xdtoi(*word++);
+		if (isxdigit((u_char)*word))
+			addr[i] = (addr[i] << 4) | xdtoi(*word++);
+		if (*word != ':')
+			break;
+		word++;
+	}
+	if (*word != '\0')
+		return (0);
+	name = nameidx_word(&line);
+	if (name == NULL)
+		return (0);
+	if ((e = nameidx_add(idx, name)) == NULL)
+		return (-1);
+	memcpy(e->addr, addr, sizeof(addr));
+	return (0);
+}
+
+/*
+ * Make sure the index is up to date with the file, reading it if it
+ * hasn't been read or has changed.  Returns -1 if the file couldn't be
+ * indexed, in which case the caller should use the system's routines.
+ */
+static int
+nameidx_update(struct nameidx *idx)
+{
+	struct stat st;
+	FILE *fp;
+	char line[1024];
+	size_t len;
+	u_int i, nbuckets, h;
+	int skip = 0;
+
+	if (stat(idx->path, &st) == -1) {
+		/*
+		 * There's no file, so there's nothing to index.
+		 */
+		nameidx_clear(idx);
+		idx->loaded = 0;
+		return (-1);
+	}
+	if (idx->loaded && st.st_mtime == idx->mtime &&
+	    st.st_size == idx->size)
+		return (0);
+
+	nameidx_clear(idx);
+	idx->loaded = 0;
+	fp = fopen(idx->path, "r");
+	if (fp == NULL)
+		return (-1);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strcspn(line, "\r\n");
+		if (line[len] == '\0' && !feof(fp)) {
+			/*
+			 * The line is too long; skip all of it.
+			 */
+			skip = 1;
+			continue;
+		}
+		line[len] = '\0';
+		if (skip) {
+			skip = 0;
+			continue;
+		}
+		if ((*idx->parse)(idx, line) == -1) {
+			fclose(fp);
+			nameidx_clear(idx);
+			return (-1);
+		}
+	}
+	fclose(fp);
+
+	for (nbuckets = 16; nbuckets < idx->nentries; nbuckets *= 2)
+		;
+	idx->buckets = calloc(nbuckets, sizeof(*idx->buckets));
+	if (idx->buckets == NULL) {
+		nameidx_clear(idx);
+		return (-1);
+	}
+	idx->nbuckets = nbuckets;
+	/*
+	 * Add the entries in reverse order, so that each chain is in
+	 * the order of the file, and the first entry for a name is the
+	 * one found, as with the system's routines.
+	 */
+	for (i = idx->nentries; i-- > 0; ) {
+		h = nameidx_hash(idx->pool + idx->entries[i].name) &
+		    (nbuckets - 1);
+		idx->entries[i].next = idx->buckets[h];
+		idx->buckets[h] = i + 1;
+	}
+	idx->mtime = st.st_mtime;
+	idx->size = st.st_size;
+	idx->loaded = 1;
+	return (0);
+}
+
+/*
+ * Return the first entry for a name after 'e', or the first entry for
+ * it if 'e' is NULL; the index must be up to date.
+ */
+static struct nameidx_entry *
+nameidx_next(struct nameidx *idx, const char *name, struct nameidx_entry *e)
+{
+	u_int i;
+
+	if (e == NULL)
+		i = idx->buckets[nameidx_hash(name) & (idx->nbuckets - 1)];
+	else
+		i = e->next;
+	for (; i != 0; i = idx->entries[i - 1].next) {
+		e = &idx->entries[i - 1];
+		if (strcmp(idx->pool + e->name, name) == 0)
+			return (e);
+	}
+	return (NULL);
+}
+#endif /* _WIN32 */
+
+/*
+ * Look up a port name with the system's routines, for TCP and for UDP.
+ * Return 0 upon a real error, rather than just not finding the name.
+ */
+static int
+nametoport_system(const char *name, int *tcp_portp, int *udp_portp)
 {
 	struct addrinfo hints, *res, *ai;
 	int error;
@@ -388,6 +1232,42 @@ pcap_nametoport(const char *name, int *port, int *proto)
 		freeaddrinfo(res);
 	}
 
+	*tcp_portp = tcp_port;
+	*udp_portp = udp_port;
+	return 1;
+}
+
+/*
+ * Convert a port name to its port and protocol numbers.
+ * We assume only TCP or UDP.
+ * Return 0 upon failure.
+ */
+int
+pcap_nametoport(const char *name, int *port, int *proto)
+{
+	int tcp_port = -1;
+	int udp_port = -1;
+#ifndef _WIN32
+	struct nameidx_entry *e;
+
+	NAMEIDX_LOCK();
+	if (nameidx_update(&services_idx) == 0) {
+		for (e = NULL;
+		    (e = nameidx_next(&services_idx, name, e)) != NULL; ) {
+			if (e->proto == IPPROTO_TCP && tcp_port < 0)
+				tcp_port = e->val;
+			else if (e->proto == IPPROTO_UDP && udp_port < 0)
+				udp_port = e->val;
+		}
+	}
+	NAMEIDX_UNLOCK();
+	if (tcp_port < 0 && udp_port < 0)
+#endif
+	{
+		if (nametoport_system(name, &tcp_port, &udp_port) == 0)
+			return 0;
+	}
+
 	/*
 	 * We need to check /etc/services for ambiguous entries.
 	 * If we find an ambiguous entry, and it has the
@@ -476,8 +1356,8 @@ pcap_nametoportrange(const char *name, int *port1, int *port2, int *proto)
  * XXX - not guaranteed to be thread-safe!  See below for platforms
  * on which it is thread-safe and on which it isn't.
  */
-int
-pcap_nametoproto(const char *str)
+static int
+nametoproto_system(const char *str)
 {
 	struct protoent *p;
   #if defined(HAVE_LINUX_GETNETBYNAME_R)
@@ -534,6 +1414,28 @@ pcap_nametoproto(const char *str)
 		return PROTO_UNDEF;
 }
 
+/*
+ * Names in /etc/protocols are found in its index; other names are
+ * looked up with nametoproto_system().
+ */
+int
+pcap_nametoproto(const char *str)
+{
+#ifndef _WIN32
+	struct nameidx_entry *e;
+	int v = -1;
+
+	NAMEIDX_LOCK();
+	if (nameidx_update(&protocols_idx) == 0 &&
+	    (e = nameidx_next(&protocols_idx, str, NULL)) != NULL)
+		v = e->val;
+	NAMEIDX_UNLOCK();
+	if (v >= 0)
+		return v;
+#endif
+	return nametoproto_system(str);
+}
+
 #include "ethertype.h"
 
 struct eproto {
@@ -706,9 +1608,10 @@ pcap_ether_aton(const char *s)
 
 #ifndef HAVE_ETHER_HOSTTON
 /*
- * Roll our own.
- * XXX - not thread-safe, because pcap_next_etherent() isn't thread-
- * safe!  Needs a mutex or a thread-safe pcap_next_etherent().
+ * Roll our own.  The index of /etc/ethers is used if it can be built;
+ * otherwise, the file is read with pcap_next_etherent().
+ * XXX - that's not thread-safe, because pcap_next_etherent() isn't
+ * thread-safe!  Needs a mutex or a thread-safe pcap_next_etherent().
  */
 u_char *
 pcap_ether_hostton(const char *name)
@@ -717,6 +1620,23 @@ pcap_ether_hostton(const char *name)
 	register u_char *ap;
 	static FILE *fp = NULL;
 	static int init = 0;
+#ifndef _WIN32
+	struct nameidx_entry *e;
+	int status;
+
+	ap = NULL;
+	NAMEIDX_LOCK();
+	status = nameidx_update(&ethers_idx);
+	if (status == 0 &&
+	    (e = nameidx_next(&ethers_idx, name, NULL)) != NULL) {
+		ap = (u_char *)malloc(6);
+		if (ap != NULL)
+			memcpy(ap, e->addr, 6);
+	}
+	NAMEIDX_UNLOCK();
+	if (status == 0)
+		return (ap);
+#endif
 
 	if (!init) {
 		fp = fopen(PCAP_ETHERS_FILE, "r");
@@ -742,7 +1662,8 @@ pcap_ether_hostton(const char *name)
 }
 #else
 /*
- * Use the OS-supplied routine.
+ * Use the OS-supplied routine for names that aren't in the index of
+ * /etc/ethers, as it might get them from somewhere else.
  * This *should* be thread-safe; the API doesn't have a static buffer.
  */
 u_char *
@@ -750,8 +1671,19 @@ pcap_ether_hostton(const char *name)
 {
 	register u_char *ap;
 	u_char a[6];
+	struct nameidx_entry *e;
 
 	ap = NULL;
+	NAMEIDX_LOCK();
+	if (nameidx_update(&ethers_idx) == 0 &&
+	    (e = nameidx_next(&ethers_idx, name, NULL)) != NULL) {
+		ap = (u_char *)malloc(6);
+		if (ap != NULL)
+			memcpy(ap, e->addr, 6);
+	}
+	NAMEIDX_UNLOCK();
+	if (ap != NULL)
+		return (ap);
 	if (ether_hostton(name, (struct ether_addr *)a) == 0) {
 		ap = (u_char *)malloc(6);
 		if (ap != NULL)
@@ -43,6 +43,47 @@ int __pcap_atodn(const char *, bpf_u_int32 *);
 int __pcap_atoin(const char *, bpf_u_int32 *);
 int __pcap_nametodnaddr(const char *, u_short *);
 
+/*
+ * Tables of host names and their addresses.  A filter compiler has
+ * one with the names the program using it gave it, and one with the
+ * names in the filter being compiled that were looked up.
+ *
+ * nametab_add() returns the entry for a name, adding one, with a
+ * status of NAMETAB_PENDING, if there isn't one; nametab_resolve()
+ * looks up all the names with a status of NAMETAB_PENDING at the same
+ * time, giving up on the ones not found after the timeout, in
+ * milliseconds, if it's not 0.
+ */
+#define NAMETAB_PENDING		0	/* not looked up yet */
+#define NAMETAB_FOUND		1
+#define NAMETAB_NOTFOUND	2
+#define NAMETAB_TIMEDOUT	3
+
+struct addrinfo;
+
+struct nametab_entry {
+	struct nametab_entry *next;	/* next entry in the hash chain */
+	char	*name;
+	struct addrinfo *ai;		/* addresses, if status is NAMETAB_FOUND */
+	int	status;
+	int	from_resolver;		/* ai is to be freed with freeaddrinfo() */
+};
+
+struct nametab {
+	struct nametab_entry **hash;
+	u_int	hashsize;		/* power of 2, or 0 */
+	u_int	count;
+	u_int	npending;		/* entries with status NAMETAB_PENDING */
+};
+
+void	nametab_init(struct nametab *);
+void	nametab_free(struct nametab *);
+struct nametab_entry *nametab_lookup(const struct nametab *, const char *);
+struct nametab_entry *nametab_add(struct nametab *, const char *);
+int	nametab_add_addr(struct nametab *, const char *, const char *, char *);
+int	nametab_load_hosts(struct nametab *, const char *, char *);
+int	nametab_resolve(struct nametab *, u_int, char *);
+
 #ifdef __cplusplus
 }
 #endif
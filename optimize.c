@@ -96,93 +96,6 @@ pcap_set_print_dot_graph(int value)
 
 #endif
 
-/*
- * lowest_set_bit().
- *
- * Takes a 32-bit integer as an argument.
- *
- * If handed a non-zero value, returns the index of the lowest set bit,
- * counting upwards fro zero.
- *
- * If handed zero, the results are platform- and compiler-dependent.
- * Keep it out of the light, don't give it any water, don't feed it
- * after midnight, and don't pass zero to it.
- *
- * This is the same as the count of trailing zeroes in the word.
- */
-#if PCAP_IS_AT_LEAST_GNUC_VERSION(3,4)
-  /*
-   * GCC 3.4 and later; we have __builtin_ctz().
-   */
-  #define lowest_set_bit(mask) __builtin_ctz(mask)
-#elif defined(_MSC_VER)
-  /*
-   * Visual Studio; we support only 2005 and later, so use
-   * _BitScanForward().
-   */
-#include <intrin.h>
-
-#ifndef __clang__
-#pragma intrinsic(_BitScanForward)
-#endif
-
-static __forceinline int
-lowest_set_bit(int mask)
-{
-	unsigned long bit;
-
-	/*
-	 * Don't sign-extend mask if long is longer than int.
-	 * (It's currently not, in MSVC, even on 64-bit platforms, but....)
-	 */
-	if (_BitScanForward(&bit, (unsigned int)mask) == 0)
-		return -1;	/* mask is zero */
-	return (int)bit;
-}
-#elif defined(MSDOS) && defined(__DJGPP__)
-  /*
-   * MS-DOS with DJGPP, which declares ffs() in <string.h>, which
-   * we've already included.
-   */
-  #define lowest_set_bit(mask)	(ffs((mask)) - 1)
-#elif (defined(MSDOS) && defined(__WATCOMC__)) || defined(STRINGS_H_DECLARES_FFS)
-  /*
-   * MS-DOS with Watcom C, which has <strings.h> and declares ffs() there,
-   * or some other platform (UN*X conforming to a sufficient recent version
-   * of the Single UNIX Specification).
-   */
-  #include <strings.h>
-  #define lowest_set_bit(mask)	(ffs((mask)) - 1)
-#else
-/*
- * None of the above.
- * Use a perfect-hash-function-based function.
- */
-static int
-lowest_set_bit(int mask)
-{
-	unsigned int v = (unsigned int)mask;
-
-	static const int MultiplyDeBruijnBitPosition[32] = {
-		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
-		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
-	};
-
-	/*
-	 * We strip off all but the lowermost set bit (v & ~v),
-	 * and perform a minimal perfect hash on it to look up the
-	 * number of low-order zero bits in a table.
-	 *
-	 * See:
-	 *
-	 *	http://7ooo.mooo.com/text/ComputingTrailingZerosHOWTO.pdf
-	 *
-	 *	http://supertech.csail.mit.edu/papers/debruijn.pdf
-	 */
-	return (MultiplyDeBruijnBitPosition[((v & -v) * 0x077CB531U) >> 27]);
-}
-#endif
-
 /*
  * Represents a deleted instruction.
  */
@@ -225,6 +138,61 @@ struct vmapinfo {
 	bpf_int32 const_val;
 };
 
+/*
+ * A dominator tree.  The parent of a node is its immediate dominator;
+ * the roots have a parent of -1.  A node's jump pointer is an ancestor
+ * chosen so that any ancestor can be reached in a logarithmic number
+ * of steps, as in E. W. Myers, "An applicative random-access stack".
+ * Nodes that aren't reachable have a depth of -1.
+ *
+ * If the nodes are numbered in preorder, 'pre' is the number of a
+ * node and 'last' is the number of the last of its descendants.
+ */
+struct domtree {
+	int *parent;
+	int *jump;
+	int *depth;
+	int *pre;
+	int *last;
+	int *child;
+	int *sibling;
+};
+
+/*
+ * Edges are put into classes by the branch they take; an edge for
+ * the true branch of a block is in the ECLASS_TRUE class for the
+ * block's branch instruction and operands, and an edge for the false
+ * branch is in the ECLASS_FALSE class.  True edges of BPF_JEQ|BPF_K
+ * branches are also in the ECLASS_JEQ class for the accumulator
+ * value; see fold_edge().
+ */
+#define ECLASS_FALSE	0
+#define ECLASS_TRUE	1
+#define ECLASS_JEQ	2
+
+struct eclass {
+	int kind;
+	int code;
+	int aval;
+	int oval;
+	int first;	/* index of the first member in eclass_members */
+	int n;		/* number of members */
+	int top;	/* innermost member on the current search path */
+	int next;	/* next class in the hash chain */
+};
+
+struct edgeinfo {
+	int pre;	/* preorder number in the edge dominator tree */
+	int last;	/* preorder number of the last descendant */
+	int child;	/* first child in the edge dominator tree */
+	int sibling;	/* next child of the same parent */
+	int cls[2];	/* ECLASS_TRUE/ECLASS_FALSE and ECLASS_JEQ class, or -1 */
+	int up[2];	/* nearest dominating edge in the same class, or -1 */
+	int min;	/* lowest id of this edge and the edges up[0] leads to */
+	int best;	/* the same, for up[1] */
+	int second;	/* lowest id with an oval different from that of best */
+};
+
 typedef struct {
 	/*
 	 * A flag to indicate that further optimization is needed.
@@ -238,67 +206,29 @@ typedef struct {
 	int n_edges;
 	struct edge **edges;
 
-	/*
-	 * A bit vector set representation of the dominators.
-	 * We round up the set size to the next power of two.
-	 */
-	int nodewords;
-	int edgewords;
 	struct block **levels;
-	bpf_u_int32 *space;
-
-#define BITS_PER_WORD (8*sizeof(bpf_u_int32))
-/*
- * True if a is in uset {p}
- */
-#define SET_MEMBER(p, a) \
-((p)[(unsigned)(a) / BITS_PER_WORD] & ((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD)))
 
-/*
- * Add 'a' to uset p.
- */
-#define SET_INSERT(p, a) \
-(p)[(unsigned)(a) / BITS_PER_WORD] |= ((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD))
-
-/*
- * Delete 'a' from uset p.
- */
-#define SET_DELETE(p, a) \
-(p)[(unsigned)(a) / BITS_PER_WORD] &= ~((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD))
-
-/*
- * a := a intersect b
- */
-#define SET_INTERSECT(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register int _n = n;\
-	while (--_n >= 0) *_x++ &= *_y++;\
-}
-
-/*
- * a := a - b
- */
-#define SET_SUBTRACT(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register int _n = n;\
-	while (--_n >= 0) *_x++ &=~ *_y++;\
-}
-
-/*
- * a := a union b
- */
-#define SET_UNION(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register int _n = n;\
-	while (--_n >= 0) *_x++ |= *_y++;\
-}
+	/*
+	 * The dominator tree of the blocks, indexed by block id, and
+	 * the dominator tree of the edges, indexed by edge id.
+	 */
+	struct domtree bdom;
+	struct domtree edom;
 
-	uset all_dom_sets;
-	uset all_closure_sets;
-	uset all_edge_sets;
+	/*
+	 * Per-edge information used by opt_j() to find the dominating
+	 * edges that let a branch be moved, indexed by edge id, and the
+	 * classes of edges with the same branch.  eclass_hash is a
+	 * hash table of classes, chained through eclass.next; a class's
+	 * members are stored in eclass_members in preorder.
+	 */
+	struct edgeinfo *einfo;
+	struct eclass *eclasses;
+	int n_eclasses;
+	u_int eclass_hash_size;
+	int *eclass_hash;
+	int *eclass_members;
+	int *estack;
 
 #define MODULUS 213
 	struct valnode *hashtbl[MODULUS];
@@ -308,6 +238,25 @@ typedef struct {
 	struct vmapinfo *vmap;
 	struct valnode *vnode_base;
 	struct valnode *next_vnode;
+
+	/*
+	 * Hash table of blocks used by intern_blocks(); blk_hash_next
+	 * is indexed by block id.
+	 */
+	u_int blk_hash_size;
+	struct block **blk_hash;
+	struct block **blk_hash_next;
+
+	/*
+	 * Used by pullup(): per-block flags and the chain being
+	 * reordered, indexed by block id and by position in the chain,
+	 * a map from value numbers to groups, and the group counts.
+	 */
+	u_char *pull_flags;
+	struct block **pull_chain;
+	struct block **pull_sorted;
+	int *pull_group;
+	int *pull_count;
 } opt_state_t;
 
 typedef struct {
@@ -319,6 +268,14 @@ typedef struct {
 	 */
 	struct bpf_insn *fstart;
 	struct bpf_insn *ftail;
+
+	/*
+	 * Set if a branch was found to need a long jump; the rest
+	 * of the program is still converted, so that all the
+	 * branches that are too long are found in one pass rather
+	 * than one pass per branch.
+	 */
+	int retry;
 } conv_state_t;
 
 static void opt_init(compiler_state_t *, opt_state_t *, struct icode *);
@@ -372,104 +329,165 @@ find_levels(opt_state_t *opt_state, struct icode *ic)
 }
 
 /*
- * Find dominator relationships.
- * Assumes graph has been leveled.
+ * Make 'v' a node of the dominator tree, with 'parent' as its parent.
  */
 static void
-find_dom(opt_state_t *opt_state, struct block *root)
+dt_insert(struct domtree *dt, int v, int parent)
 {
-	int i;
-	struct block *b;
-	bpf_u_int32 *x;
+	int j;
 
-	/*
-	 * Initialize sets to contain all nodes.
-	 */
-	x = opt_state->all_dom_sets;
-	i = opt_state->n_blocks * opt_state->nodewords;
-	while (--i >= 0)
-		*x++ = 0xFFFFFFFFU;
-	/* Root starts off empty. */
-	for (i = opt_state->nodewords; --i >= 0;)
-		root->dom[i] = 0;
+	dt->parent[v] = parent;
+	if (parent < 0) {
+		dt->depth[v] = 0;
+		dt->jump[v] = v;
+		return;
+	}
+	dt->depth[v] = dt->depth[parent] + 1;
+	j = dt->jump[parent];
+	if (dt->depth[parent] - dt->depth[j] ==
+	    dt->depth[j] - dt->depth[dt->jump[j]])
+		dt->jump[v] = dt->jump[j];
+	else
+		dt->jump[v] = parent;
+}
 
-	/* root->level is the highest level no found. */
-	for (i = root->level; i >= 0; --i) {
-		for (b = opt_state->levels[i]; b; b = b->link) {
-			SET_INSERT(b->dom, b->id);
-			if (JT(b) == 0)
-				continue;
-			SET_INTERSECT(JT(b)->dom, b->dom, opt_state->nodewords);
-			SET_INTERSECT(JF(b)->dom, b->dom, opt_state->nodewords);
-		}
+/*
+ * Return the ancestor of 'v' at depth 'depth'.
+ */
+static int
+dt_ancestor(struct domtree *dt, int v, int depth)
+{
+	while (dt->depth[v] > depth) {
+		if (dt->depth[dt->jump[v]] >= depth)
+			v = dt->jump[v];
+		else
+			v = dt->parent[v];
 	}
+	return v;
 }
 
-static void
-propedom(opt_state_t *opt_state, struct edge *ep)
+/*
+ * Return the nearest common ancestor of 'u' and 'v', or -1 if they
+ * are in different trees.
+ */
+static int
+dt_common(struct domtree *dt, int u, int v)
 {
-	SET_INSERT(ep->edom, ep->id);
-	if (ep->succ) {
-		SET_INTERSECT(ep->succ->et.edom, ep->edom, opt_state->edgewords);
-		SET_INTERSECT(ep->succ->ef.edom, ep->edom, opt_state->edgewords);
+	if (u < 0 || v < 0)
+		return -1;
+	if (dt->depth[u] > dt->depth[v])
+		u = dt_ancestor(dt, u, dt->depth[v]);
+	else
+		v = dt_ancestor(dt, v, dt->depth[u]);
+	while (u != v) {
+		if (dt->depth[u] == 0)
+			return -1;
+		if (dt->jump[u] != dt->jump[v]) {
+			u = dt->jump[u];
+			v = dt->jump[v];
+		} else {
+			u = dt->parent[u];
+			v = dt->parent[v];
+		}
 	}
+	return u;
 }
 
 /*
- * Compute edge dominators.
- * Assumes graph has been leveled and predecessors established.
+ * Number the tree with the root 'root' in preorder, using 'stack',
+ * which must have room for twice the number of nodes.
  */
 static void
-find_edom(opt_state_t *opt_state, struct block *root)
+dt_number(struct domtree *dt, int root, int n_nodes, int *stack)
 {
-	int i;
-	uset x;
-	struct block *b;
+	int i, v, p, n, sp;
 
-	x = opt_state->all_edge_sets;
-	for (i = opt_state->n_edges * opt_state->edgewords; --i >= 0; )
-		x[i] = 0xFFFFFFFFU;
-
-	/* root->level is the highest level no found. */
-	memset(root->et.edom, 0, opt_state->edgewords * sizeof(*(uset)0));
-	memset(root->ef.edom, 0, opt_state->edgewords * sizeof(*(uset)0));
-	for (i = root->level; i >= 0; --i) {
-		for (b = opt_state->levels[i]; b != 0; b = b->link) {
-			propedom(opt_state, &b->et);
-			propedom(opt_state, &b->ef);
+	for (i = 0; i < n_nodes; ++i)
+		dt->child[i] = -1;
+	for (i = 0; i < n_nodes; ++i) {
+		if (dt->depth[i] < 0 || (p = dt->parent[i]) < 0)
+			continue;
+		dt->sibling[i] = dt->child[p];
+		dt->child[p] = i;
+	}
+	n = 0;
+	sp = 0;
+	stack[sp++] = root;
+	while (sp > 0) {
+		v = stack[--sp];
+		if (v < 0) {
+			dt->last[~v] = n - 1;
+			continue;
 		}
+		dt->pre[v] = n++;
+		stack[sp++] = ~v;
+		for (v = dt->child[v]; v >= 0; v = dt->sibling[v])
+			stack[sp++] = v;
 	}
 }
 
 /*
- * Find the backwards transitive closure of the flow graph.  These sets
- * are backwards in the sense that we find the set of nodes that reach
- * a given node, not the set of nodes that can be reached by a node.
+ * True if 'u' dominates 'v', for a tree numbered by dt_number().
+ * As every node is taken to dominate the nodes that aren't reachable,
+ * so is this.
+ */
+static int
+dt_dominates(struct domtree *dt, int u, int v)
+{
+	if (dt->depth[v] < 0)
+		return 1;
+	if (dt->depth[u] < 0)
+		return 0;
+	return dt->pre[u] <= dt->pre[v] && dt->pre[v] <= dt->last[u];
+}
+
+/*
+ * Find dominator relationships, among the blocks and among the edges.
+ *
+ * A block is dominated by itself and by the blocks that dominate all
+ * of its predecessors, so its immediate dominator is the nearest common
+ * ancestor of its predecessors in the dominator tree; likewise, the
+ * edges out of a block are dominated by themselves and by the edges that
+ * dominate all the edges into the block.  Visiting the blocks top-down,
+ * each block's predecessors are in the trees before the block is.
  *
  * Assumes graph has been leveled.
  */
 static void
-find_closure(opt_state_t *opt_state, struct block *root)
+find_dom(opt_state_t *opt_state, struct block *root)
 {
-	int i;
+	int i, bp, ep;
 	struct block *b;
+	struct edge *e;
 
-	/*
-	 * Initialize sets to contain no nodes.
-	 */
-	memset((char *)opt_state->all_closure_sets, 0,
-	      opt_state->n_blocks * opt_state->nodewords * sizeof(*opt_state->all_closure_sets));
+	for (i = 0; i < opt_state->n_blocks; ++i)
+		opt_state->bdom.depth[i] = -1;
+	for (i = 0; i < opt_state->n_edges; ++i)
+		opt_state->edom.depth[i] = -1;
+	find_inedges(opt_state, root);
 
 	/* root->level is the highest level no found. */
 	for (i = root->level; i >= 0; --i) {
 		for (b = opt_state->levels[i]; b; b = b->link) {
-			SET_INSERT(b->closure, b->id);
-			if (JT(b) == 0)
-				continue;
-			SET_UNION(JT(b)->closure, b->closure, opt_state->nodewords);
-			SET_UNION(JF(b)->closure, b->closure, opt_state->nodewords);
+			bp = ep = -1;
+			e = b->in_edges;
+			if (e != 0) {
+				bp = e->pred->id;
+				ep = e->id;
+				for (e = e->next; e != 0; e = e->next) {
+					bp = dt_common(&opt_state->bdom, bp,
+					    e->pred->id);
+					ep = dt_common(&opt_state->edom, ep,
+					    e->id);
+				}
+			}
+			dt_insert(&opt_state->bdom, b->id, bp);
+			dt_insert(&opt_state->edom, b->et.id, ep);
+			dt_insert(&opt_state->edom, b->ef.id, ep);
 		}
 	}
+	dt_number(&opt_state->bdom, root->id, opt_state->n_blocks,
+	    opt_state->estack);
 }
 
 /*
@@ -1448,10 +1466,282 @@ fold_edge(struct block *child, struct edge *ep)
 	return 0;
 }
 
+/*
+ * Return the class of edges for the given branch, adding it if 'add'
+ * is set; if it's not set, and there's no such class, return -1.
+ */
+static int
+find_eclass(opt_state_t *opt_state, int kind, int code, int aval, int oval,
+    int add)
+{
+	struct eclass *cl;
+	u_int h;
+	int c;
+
+	h = (u_int)kind;
+	h = h * 31 + (u_int)code;
+	h = h * 31 + (u_int)aval;
+	h = h * 31 + (u_int)oval;
+	h = (h ^ (h >> 16)) & (opt_state->eclass_hash_size - 1);
+	for (c = opt_state->eclass_hash[h]; c >= 0; c = cl->next) {
+		cl = &opt_state->eclasses[c];
+		if (cl->kind == kind && cl->code == code &&
+		    cl->aval == aval && cl->oval == oval)
+			return c;
+	}
+	if (!add)
+		return -1;
+	c = opt_state->n_eclasses++;
+	cl = &opt_state->eclasses[c];
+	cl->kind = kind;
+	cl->code = code;
+	cl->aval = aval;
+	cl->oval = oval;
+	cl->n = 0;
+	cl->top = -1;
+	cl->next = opt_state->eclass_hash[h];
+	opt_state->eclass_hash[h] = c;
+	return c;
+}
+
+/*
+ * Put the edges out of the branches into classes, and number the edge
+ * dominator tree in preorder, listing the members of each class in that
+ * order.  The edges of a class that dominate a given edge are then the
+ * nearest one at or before it in the list that is one of its ancestors,
+ * and the edges that one leads to through einfo.up; see opt_j().
+ *
+ * Assumes graph has been leveled, and that opt_blk() has been run
+ * on all of it.
+ */
+static void
+find_eclasses(opt_state_t *opt_state, struct block *root)
+{
+	int i, j, c, e, p, n, sp;
+	struct block *b;
+	struct edge *ep;
+	struct edgeinfo *ei, *pi;
+	struct eclass *cl;
+	int *stack = opt_state->estack;
+
+	opt_state->n_eclasses = 0;
+	for (i = 0; i < (int)opt_state->eclass_hash_size; ++i)
+		opt_state->eclass_hash[i] = -1;
+	for (i = root->level; i >= 0; --i) {
+		for (b = opt_state->levels[i]; b; b = b->link) {
+			for (j = 0; j < 2; ++j) {
+				ep = j ? &b->ef : &b->et;
+				ei = &opt_state->einfo[ep->id];
+				ei->child = -1;
+				ei->cls[0] = ei->cls[1] = -1;
+				if (JT(b) == 0)
+					continue;
+				if (ep->code < 0)
+					c = find_eclass(opt_state, ECLASS_FALSE,
+					    -ep->code, b->val[A_ATOM], b->oval, 1);
+				else
+					c = find_eclass(opt_state, ECLASS_TRUE,
+					    ep->code, b->val[A_ATOM], b->oval, 1);
+				ei->cls[0] = c;
+				opt_state->eclasses[c].n++;
+				if (ep->code == (BPF_JMP|BPF_JEQ|BPF_K)) {
+					c = find_eclass(opt_state, ECLASS_JEQ,
+					    ep->code, b->val[A_ATOM], 0, 1);
+					ei->cls[1] = c;
+					opt_state->eclasses[c].n++;
+				}
+			}
+		}
+	}
+	for (c = 0, n = 0; c < opt_state->n_eclasses; ++c) {
+		cl = &opt_state->eclasses[c];
+		cl->first = n;
+		n += cl->n;
+		cl->n = 0;
+	}
+
+	/*
+	 * Link up the tree, and start the walk at its roots.
+	 */
+	sp = 0;
+	for (i = root->level; i >= 0; --i) {
+		for (b = opt_state->levels[i]; b; b = b->link) {
+			for (j = 0; j < 2; ++j) {
+				e = j ? b->ef.id : b->et.id;
+				p = opt_state->edom.parent[e];
+				if (p < 0)
+					stack[sp++] = e;
+				else {
+					opt_state->einfo[e].sibling =
+					    opt_state->einfo[p].child;
+					opt_state->einfo[p].child = e;
+				}
+			}
+		}
+	}
+
+	/*
+	 * Walk the tree; an edge is pushed as its complement to
+	 * note when its descendants have all been visited.
+	 */
+	n = 0;
+	while (sp > 0) {
+		e = stack[--sp];
+		if (e < 0) {
+			ei = &opt_state->einfo[~e];
+			ei->last = n - 1;
+			for (j = 0; j < 2; ++j)
+				if (ei->cls[j] >= 0)
+					opt_state->eclasses[ei->cls[j]].top = ei->up[j];
+			continue;
+		}
+		ei = &opt_state->einfo[e];
+		ei->pre = n++;
+		for (j = 0; j < 2; ++j) {
+			if (ei->cls[j] < 0)
+				continue;
+			cl = &opt_state->eclasses[ei->cls[j]];
+			ei->up[j] = cl->top;
+			cl->top = e;
+			opt_state->eclass_members[cl->first + cl->n++] = e;
+		}
+		if (ei->cls[0] >= 0) {
+			p = ei->up[0];
+			if (p >= 0 && opt_state->einfo[p].min < e)
+				ei->min = opt_state->einfo[p].min;
+			else
+				ei->min = e;
+		}
+		if (ei->cls[1] >= 0) {
+			p = ei->up[1];
+			if (p < 0) {
+				ei->best = e;
+				ei->second = -1;
+			} else {
+				pi = &opt_state->einfo[p];
+				if (pi->best < e) {
+					ei->best = pi->best;
+					ei->second = pi->second;
+					if (opt_state->edges[e]->pred->oval !=
+					    opt_state->edges[pi->best]->pred->oval &&
+					    (ei->second < 0 || e < ei->second))
+						ei->second = e;
+				} else {
+					ei->best = e;
+					if (opt_state->edges[pi->best]->pred->oval !=
+					    opt_state->edges[e]->pred->oval)
+						ei->second = pi->best;
+					else
+						ei->second = pi->second;
+				}
+			}
+		}
+		stack[sp++] = ~e;
+		for (c = ei->child; c >= 0; c = opt_state->einfo[c].sibling)
+			stack[sp++] = c;
+	}
+}
+
+/*
+ * Return the nearest edge in class 'c' that dominates edge 'e', where
+ * 'j' is the index of the class in einfo.cls, or -1 if there's none.
+ */
+static int
+eclass_dom(opt_state_t *opt_state, int c, int j, int e)
+{
+	struct eclass *cl = &opt_state->eclasses[c];
+	int *m = &opt_state->eclass_members[cl->first];
+	int pre = opt_state->einfo[e].pre;
+	int lo, hi, mid, d;
+
+	lo = 0;
+	hi = cl->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (opt_state->einfo[m[mid]].pre <= pre)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return -1;
+	/*
+	 * The member is an ancestor of 'e' if 'e' is numbered within
+	 * its subtree; if it isn't, any ancestor of 'e' in the class
+	 * is one of the member's.
+	 */
+	d = m[lo - 1];
+	while (d >= 0 && opt_state->einfo[d].last < pre)
+		d = opt_state->einfo[d].up[j];
+	return d;
+}
+
+/*
+ * Find the lowest-numbered edge dominating 'ep' for which fold_edge()
+ * gives a new successor for 'ep' without a data dependency being
+ * violated, and return that successor, or 0 if there's none.
+ *
+ * The edges that fold to the true branch of the successor are those
+ * in its ECLASS_TRUE class; the ones that fold to its false branch
+ * are those in its ECLASS_FALSE class and, for a BPF_JEQ|BPF_K branch,
+ * those in its ECLASS_JEQ class that compare with another constant.
+ */
+static struct block *
+fold_dominator(opt_state_t *opt_state, struct edge *ep)
+{
+	struct block *child = ep->succ;
+	struct block *target;
+	struct edgeinfo *ei;
+	int code = child->s.code;
+	int aval = child->val[A_ATOM];
+	int oval = child->oval;
+	int c, d, k, t, f;
+
+	t = f = -1;
+	c = find_eclass(opt_state, ECLASS_TRUE, code, aval, oval, 0);
+	if (c >= 0 && (d = eclass_dom(opt_state, c, 0, ep->id)) >= 0)
+		t = opt_state->einfo[d].min;
+	c = find_eclass(opt_state, ECLASS_FALSE, code, aval, oval, 0);
+	if (c >= 0 && (d = eclass_dom(opt_state, c, 0, ep->id)) >= 0)
+		f = opt_state->einfo[d].min;
+	if (code == (BPF_JMP|BPF_JEQ|BPF_K)) {
+		c = find_eclass(opt_state, ECLASS_JEQ, code, aval, 0, 0);
+		if (c >= 0 && (d = eclass_dom(opt_state, c, 1, ep->id)) >= 0) {
+			ei = &opt_state->einfo[d];
+			k = ei->best;
+			if (opt_state->edges[k]->pred->oval == oval)
+				k = ei->second;
+			if (k >= 0 && (f < 0 || k < f))
+				f = k;
+		}
+	}
+
+	/*
+	 * Try the lower-numbered edge first, checking that there is
+	 * no data dependency between nodes that will be violated if
+	 * we move the edge.
+	 */
+	if (f >= 0 && (t < 0 || f < t)) {
+		k = t;
+		t = f;
+		f = k;
+	}
+	if (t >= 0) {
+		target = fold_edge(child, opt_state->edges[t]);
+		if (!use_conflict(ep->pred, target))
+			return target;
+	}
+	if (f >= 0) {
+		target = fold_edge(child, opt_state->edges[f]);
+		if (!use_conflict(ep->pred, target))
+			return target;
+	}
+	return 0;
+}
+
 static void
 opt_j(opt_state_t *opt_state, struct edge *ep)
 {
-	register int i, k;
 	register struct block *target;
 
 	if (JT(ep->succ) == 0)
@@ -1470,46 +1760,75 @@ opt_j(opt_state_t *opt_state, struct edge *ep)
 	/*
 	 * For each edge dominator that matches the successor of this
 	 * edge, promote the edge successor to the its grandchild.
-	 *
-	 * XXX We violate the set abstraction here in favor a reasonably
-	 * efficient loop.
 	 */
- top:
-	for (i = 0; i < opt_state->edgewords; ++i) {
-		register bpf_u_int32 x = ep->edom[i];
-
-		while (x != 0) {
-			k = lowest_set_bit(x);
-			x &=~ ((bpf_u_int32)1 << k);
-			k += i * BITS_PER_WORD;
-
-			target = fold_edge(ep->succ, opt_state->edges[k]);
+	while ((target = fold_dominator(opt_state, ep)) != 0) {
+		opt_state->done = 0;
+		ep->succ = target;
+		if (JT(target) == 0)
 			/*
-			 * Check that there is no data dependency between
-			 * nodes that will be violated if we move the edge.
+			 * Stop if we hit a leaf.
 			 */
-			if (target != 0 && !use_conflict(ep->pred, target)) {
-				opt_state->done = 0;
-				ep->succ = target;
-				if (JT(target) != 0)
-					/*
-					 * Start over unless we hit a leaf.
-					 */
-					goto top;
-				return;
-			}
-		}
+			return;
 	}
 }
 
 
+/*
+ * The "or" chains that or_pullup() reorders go through the false
+ * branches of blocks whose true branches all go to the same place, and
+ * the "and" chains that and_pullup() reorders go through the true
+ * branches of blocks whose false branches all go to the same place.
+ */
+#define CHAIN_NEXT(b, is_or)	((is_or) ? &JF(b) : &JT(b))
+#define CHAIN_EXIT(b, is_or)	((is_or) ? JT(b) : JF(b))
+
+/*
+ * Flags in opt_state->pull_flags, indexed by block id, that are
+ * cleared before the chains are reordered in a pass.
+ */
+#define PULL_MOVED	0x01	/* predecessors changed; in_edges are stale */
+#define PULL_OR_DONE	0x02	/* in an "or" chain that's already in order */
+#define PULL_AND_DONE	0x04	/* in an "and" chain that's already in order */
+
+/*
+ * Reorder the chain that starts at 'b' so that the blocks that load
+ * the same value into the accumulator are next to each other, with
+ * those that load the value the predecessors of 'b' leave in it first,
+ * and the others in the order in which their values first appear;
+ * the order of the blocks that load the same value doesn't change.
+ * The loads that then follow loads of the same value are eliminated
+ * by later passes, and the comparisons of the value can be turned
+ * into a binary search.
+ *
+ * The chain continues for as long as its blocks leave it on the same
+ * side as 'b' does, and are dominated by 'b'; each of them, other
+ * than 'b', has only its predecessor in the chain as a predecessor,
+ * as anything else that led to it would either bypass 'b' or form a
+ * cycle.
+ *
+ * This used to move one block up per call, after walking the chain to
+ * find it, so that grouping a chain of N blocks took O(N^2) steps in
+ * each pass even when the chain was already grouped.  The chain is now
+ * put in order in one step, and its blocks are flagged so that the
+ * calls for them in the same pass do nothing.  A block whose
+ * predecessors have changed is left alone until the next pass, as its
+ * in_edges, and the dominator tree, are out of date.
+ */
 static void
-or_pullup(opt_state_t *opt_state, struct block *b)
+pullup(opt_state_t *opt_state, struct block *b, int is_or)
 {
-	int val, at_top;
-	struct block *pull;
-	struct block **diffp, **samep;
+	u_char *flags = opt_state->pull_flags;
+	int *group = opt_state->pull_group;
+	int *count = opt_state->pull_count;
+	struct block **chain = opt_state->pull_chain;
+	struct block **sorted = opt_state->pull_sorted;
+	struct block *p, *exit_b, *next;
 	struct edge *ep;
+	int done, val, n, ng, g, last_g, in_order, i;
+
+	done = is_or ? PULL_OR_DONE : PULL_AND_DONE;
+	if (flags[b->id] & (PULL_MOVED | done))
+		return;
 
 	ep = b->in_edges;
 	if (ep == 0)
@@ -1524,168 +1843,102 @@ or_pullup(opt_state_t *opt_state, struct block *b)
 		if (val != ep->pred->val[A_ATOM])
 			return;
 
-	if (JT(b->in_edges->pred) == b)
-		diffp = &JT(b->in_edges->pred);
-	else
-		diffp = &JF(b->in_edges->pred);
-
-	at_top = 1;
-	for (;;) {
-		if (*diffp == 0)
-			return;
-
-		if (JT(*diffp) != JT(b))
-			return;
-
-		if (!SET_MEMBER((*diffp)->dom, b->id))
-			return;
-
-		if ((*diffp)->val[A_ATOM] != val)
+	exit_b = CHAIN_EXIT(b, is_or);
+	n = 0;
+	for (p = b; p != 0; p = *CHAIN_NEXT(p, is_or)) {
+		if (CHAIN_EXIT(p, is_or) != exit_b)
 			break;
 
-		diffp = &JF(*diffp);
-		at_top = 0;
-	}
-	samep = &JF(*diffp);
-	for (;;) {
-		if (*samep == 0)
-			return;
-
-		if (JT(*samep) != JT(b))
-			return;
-
-		if (!SET_MEMBER((*samep)->dom, b->id))
-			return;
+		if (!dt_dominates(&opt_state->bdom, b->id, p->id))
+			break;
 
-		if ((*samep)->val[A_ATOM] == val)
+		if (flags[p->id] & PULL_MOVED)
 			break;
 
 		/* XXX Need to check that there are no data dependencies
-		   between dp0 and dp1.  Currently, the code generator
+		   between the blocks.  Currently, the code generator
 		   will not produce such dependencies. */
-		samep = &JF(*samep);
+		chain[n++] = p;
 	}
-#ifdef notdef
-	/* XXX This doesn't cover everything. */
-	for (i = 0; i < N_ATOMS; ++i)
-		if ((*samep)->val[i] != pred->val[i])
-			return;
-#endif
-	/* Pull up the node. */
-	pull = *samep;
-	*samep = JF(pull);
-	JF(pull) = *diffp;
+	next = p;
 
 	/*
-	 * At the top of the chain, each predecessor needs to point at the
-	 * pulled up node.  Inside the chain, there is only one predecessor
-	 * to worry about.
+	 * Number the values in the order in which they're to appear;
+	 * group[] maps a value number to its group number plus 1, and
+	 * is all zeroes between calls.
 	 */
-	if (at_top) {
-		for (ep = b->in_edges; ep != 0; ep = ep->next) {
-			if (JT(ep->pred) == b)
-				JT(ep->pred) = pull;
-			else
-				JF(ep->pred) = pull;
-		}
+	group[val] = 1;
+	ng = 1;
+	last_g = 1;
+	in_order = 1;
+	for (i = 0; i < n; ++i) {
+		g = group[chain[i]->val[A_ATOM]];
+		if (g == 0)
+			g = group[chain[i]->val[A_ATOM]] = ++ng;
+		else if (g < last_g)
+			in_order = 0;
+		last_g = g;
 	}
-	else
-		*diffp = pull;
-
-	opt_state->done = 0;
-}
-
-static void
-and_pullup(opt_state_t *opt_state, struct block *b)
-{
-	int val, at_top;
-	struct block *pull;
-	struct block **diffp, **samep;
-	struct edge *ep;
-
-	ep = b->in_edges;
-	if (ep == 0)
+	if (in_order) {
+		group[val] = 0;
+		for (i = 0; i < n; ++i) {
+			group[chain[i]->val[A_ATOM]] = 0;
+			flags[chain[i]->id] |= done;
+		}
 		return;
+	}
 
 	/*
-	 * Make sure each predecessor loads the same value.
+	 * Sort the chain by group; the sort is stable.
 	 */
-	val = ep->pred->val[A_ATOM];
-	for (ep = ep->next; ep != 0; ep = ep->next)
-		if (val != ep->pred->val[A_ATOM])
-			return;
-
-	if (JT(b->in_edges->pred) == b)
-		diffp = &JT(b->in_edges->pred);
-	else
-		diffp = &JF(b->in_edges->pred);
-
-	at_top = 1;
-	for (;;) {
-		if (*diffp == 0)
-			return;
-
-		if (JF(*diffp) != JF(b))
-			return;
-
-		if (!SET_MEMBER((*diffp)->dom, b->id))
-			return;
-
-		if ((*diffp)->val[A_ATOM] != val)
-			break;
-
-		diffp = &JT(*diffp);
-		at_top = 0;
-	}
-	samep = &JT(*diffp);
-	for (;;) {
-		if (*samep == 0)
-			return;
-
-		if (JF(*samep) != JF(b))
-			return;
-
-		if (!SET_MEMBER((*samep)->dom, b->id))
-			return;
-
-		if ((*samep)->val[A_ATOM] == val)
-			break;
+	memset((char *)count, 0, (ng + 1) * sizeof(*count));
+	for (i = 0; i < n; ++i)
+		++count[group[chain[i]->val[A_ATOM]]];
+	for (g = 1; g <= ng; ++g)
+		count[g] += count[g - 1];
+	for (i = 0; i < n; ++i)
+		sorted[count[group[chain[i]->val[A_ATOM]] - 1]++] = chain[i];
+	group[val] = 0;
+	for (i = 0; i < n; ++i)
+		group[chain[i]->val[A_ATOM]] = 0;
 
-		/* XXX Need to check that there are no data dependencies
-		   between diffp and samep.  Currently, the code generator
-		   will not produce such dependencies. */
-		samep = &JT(*samep);
+	for (i = 0; i < n - 1; ++i) {
+		*CHAIN_NEXT(sorted[i], is_or) = sorted[i + 1];
+		flags[sorted[i]->id] |= PULL_MOVED;
 	}
-#ifdef notdef
-	/* XXX This doesn't cover everything. */
-	for (i = 0; i < N_ATOMS; ++i)
-		if ((*samep)->val[i] != pred->val[i])
-			return;
-#endif
-	/* Pull up the node. */
-	pull = *samep;
-	*samep = JT(pull);
-	JT(pull) = *diffp;
+	*CHAIN_NEXT(sorted[n - 1], is_or) = next;
+	flags[sorted[n - 1]->id] |= PULL_MOVED;
+	if (next != 0)
+		flags[next->id] |= PULL_MOVED;
 
 	/*
-	 * At the top of the chain, each predecessor needs to point at the
-	 * pulled up node.  Inside the chain, there is only one predecessor
-	 * to worry about.
+	 * If the top of the chain changed, each predecessor needs to
+	 * point at the new top.
 	 */
-	if (at_top) {
+	if (sorted[0] != b) {
 		for (ep = b->in_edges; ep != 0; ep = ep->next) {
 			if (JT(ep->pred) == b)
-				JT(ep->pred) = pull;
+				JT(ep->pred) = sorted[0];
 			else
-				JF(ep->pred) = pull;
+				JF(ep->pred) = sorted[0];
 		}
 	}
-	else
-		*diffp = pull;
 
 	opt_state->done = 0;
 }
 
+static void
+or_pullup(opt_state_t *opt_state, struct block *b)
+{
+	pullup(opt_state, b, 1);
+}
+
+static void
+and_pullup(opt_state_t *opt_state, struct block *b)
+{
+	pullup(opt_state, b, 0);
+}
+
 static void
 opt_blks(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic,
     int do_stmts)
@@ -1708,6 +1961,7 @@ opt_blks(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic,
 		 */
 		return;
 
+	find_eclasses(opt_state, ic->root);
 	for (i = 1; i <= maxlevel; ++i) {
 		for (p = opt_state->levels[i]; p; p = p->link) {
 			opt_j(opt_state, &p->et);
@@ -1715,8 +1969,13 @@ opt_blks(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic,
 		}
 	}
 
+	/*
+	 * Reorder the chains from the top down, so that each chain is
+	 * reordered as a whole, from its first block.
+	 */
 	find_inedges(opt_state, ic->root);
-	for (i = 1; i <= maxlevel; ++i) {
+	memset((char *)opt_state->pull_flags, 0, opt_state->n_blocks * sizeof(*opt_state->pull_flags));
+	for (i = maxlevel; i >= 1; --i) {
 		for (p = opt_state->levels[i]; p; p = p->link) {
 			or_pullup(opt_state, p);
 			and_pullup(opt_state, p);
@@ -1776,6 +2035,330 @@ opt_root(struct block **b)
 		(*b)->stmts = 0;
 }
 
+/*
+ * Chains of BPF_JEQ|BPF_K branches on the same value that all go to
+ * the same place if true, such as the code for "host A or host B or
+ * ...", take time linear in the number of values to run.  Once there
+ * are JEQ_TREE_MIN or more of them, they are replaced with a binary
+ * search over the values, sorted and merged into ranges; JEQ_TREE_LEAF
+ * or fewer ranges are checked one after another.
+ */
+#define JEQ_TREE_MIN	8
+#define JEQ_TREE_LEAF	4
+
+struct jeq_range {
+	bpf_u_int32 lo;
+	bpf_u_int32 hi;
+};
+
+static int
+jeq_range_cmp(const void *a, const void *b)
+{
+	const struct jeq_range *ra = a, *rb = b;
+
+	if (ra->lo < rb->lo)
+		return -1;
+	if (ra->lo > rb->lo)
+		return 1;
+	return 0;
+}
+
+/*
+ * True if the value in the accumulator on entry to 'b' isn't used.
+ */
+static int
+a_dead(struct block *b)
+{
+	struct slist *s;
+	int atom;
+
+	for (s = b->stmts; s != 0; s = s->next) {
+		if (s->s.code == NOP)
+			continue;
+		atom = atomuse(&s->s);
+		if (atom == A_ATOM || atom == AX_ATOM)
+			return 0;
+		if (atomdef(&s->s) == A_ATOM)
+			return 1;
+	}
+	atom = atomuse(&b->s);
+	return atom != A_ATOM && atom != AX_ATOM;
+}
+
+/*
+ * If 'b' can be the next branch in a chain starting with a branch on
+ * the value loaded by 'load', with a true branch to 't', set '*maskp'
+ * to the mask applied to the value, if any, and return 1.
+ */
+static int
+jeq_link(struct block *b, struct slist *load, struct block *t, u_int *npred,
+    bpf_u_int32 *maskp)
+{
+	struct slist *s, *stmts[3];
+	int n;
+
+	if (b->s.code != (BPF_JMP|BPF_JEQ|BPF_K) || JT(b) != t ||
+	    npred[b->id] != 1)
+		return 0;
+	n = 0;
+	for (s = b->stmts; s != 0; s = s->next) {
+		if (s->s.code == NOP)
+			continue;
+		if (n == 2)
+			return 0;
+		stmts[n++] = s;
+	}
+	if (n == 0)
+		return 1;
+	if (load == 0 || stmts[0]->s.code != load->s.code ||
+	    stmts[0]->s.k != load->s.k)
+		return 0;
+	if (n == 1)
+		*maskp = 0xffffffffU;
+	else if (stmts[1]->s.code == (BPF_ALU|BPF_AND|BPF_K))
+		*maskp = stmts[1]->s.k;
+	else
+		return 0;
+	return 1;
+}
+
+/*
+ * Make the code to check whether the accumulator is in the range 'r',
+ * going to 't' if it is and to 'next' if it isn't; 'f' is where to
+ * go if it's below the range, as the ranges are checked in order.
+ */
+static struct block *
+jeq_range_blk(compiler_state_t *cstate, struct jeq_range *r,
+    struct block *t, struct block *next, struct block *f)
+{
+	struct block *b, *gt;
+
+	if (r->lo == r->hi) {
+		b = new_block(cstate, BPF_JMP|BPF_JEQ|BPF_K);
+		b->s.k = r->lo;
+		JT(b) = t;
+		JF(b) = next;
+		return b;
+	}
+	if (r->hi == 0xffffffffU)
+		gt = t;
+	else {
+		gt = new_block(cstate, BPF_JMP|BPF_JGT|BPF_K);
+		gt->s.k = r->hi;
+		JT(gt) = next;
+		JF(gt) = t;
+	}
+	if (r->lo == 0)
+		return gt;
+	b = new_block(cstate, BPF_JMP|BPF_JGE|BPF_K);
+	b->s.k = r->lo;
+	JT(b) = gt;
+	JF(b) = f;
+	return b;
+}
+
+/*
+ * Make a binary search over the sorted, disjoint ranges r[lo..hi-1].
+ */
+static struct block *
+jeq_tree(compiler_state_t *cstate, struct jeq_range *r, int lo, int hi,
+    struct block *t, struct block *f)
+{
+	struct block *b;
+	int i, mid;
+
+	if (hi - lo > JEQ_TREE_LEAF) {
+		mid = lo + (hi - lo) / 2;
+		b = new_block(cstate, BPF_JMP|BPF_JGE|BPF_K);
+		b->s.k = r[mid].lo;
+		JT(b) = jeq_tree(cstate, r, mid, hi, t, f);
+		JF(b) = jeq_tree(cstate, r, lo, mid, t, f);
+		return b;
+	}
+	b = f;
+	for (i = hi - 1; i >= lo; --i)
+		b = jeq_range_blk(cstate, &r[i], t, b, f);
+	return b;
+}
+
+/*
+ * If 'b' starts a long enough chain of BPF_JEQ|BPF_K branches, replace
+ * the chain with a binary search, and return where the chain goes if
+ * none of the branches are true; otherwise, return 0.  'r' has room
+ * for a range for every block.
+ */
+static struct block *
+opt_jeq_chain(compiler_state_t *cstate, struct block *b, u_int *npred,
+    struct jeq_range *r)
+{
+	struct slist *s, *prev, *last, *load, *and;
+	struct block *p, *t, *f, *root;
+	bpf_u_int32 mask, first, width, low;
+	int i, j, n, masked, ranges;
+
+	if (b->s.code != (BPF_JMP|BPF_JEQ|BPF_K))
+		return 0;
+
+	/*
+	 * Find the load of the value the chain compares, and any mask
+	 * applied to it, so that branches that load it again can be
+	 * part of the chain.
+	 */
+	prev = last = 0;
+	for (s = b->stmts; s != 0; s = s->next) {
+		if (s->s.code == NOP)
+			continue;
+		prev = last;
+		last = s;
+	}
+	load = and = 0;
+	mask = 0xffffffffU;
+	if (last != 0 && last->s.code == (BPF_ALU|BPF_AND|BPF_K)) {
+		if (prev != 0 && BPF_CLASS(prev->s.code) == BPF_LD) {
+			load = prev;
+			and = last;
+			mask = and->s.k;
+		}
+	} else if (last != 0 && BPF_CLASS(last->s.code) == BPF_LD)
+		load = last;
+
+	/*
+	 * The bits the loaded value can have set.
+	 */
+	width = 0xffffffffU;
+	if (load != 0 && (BPF_MODE(load->s.code) == BPF_ABS ||
+	    BPF_MODE(load->s.code) == BPF_IND)) {
+		if (BPF_SIZE(load->s.code) == BPF_H)
+			width = 0xffffU;
+		else if (BPF_SIZE(load->s.code) == BPF_B)
+			width = 0xffU;
+	}
+
+	/*
+	 * Collect the range of values of the loaded value that each
+	 * branch in the chain is true for.  That's a single range only
+	 * if the bits the mask clears are all below the bits it keeps;
+	 * "ranges" is cleared if they aren't for some branch.
+	 */
+	t = JT(b);
+	first = mask;
+	masked = 0;
+	ranges = 1;
+	n = 0;
+	p = b;
+	do {
+		if (mask != first)
+			masked = 1;
+		if ((p->s.k & ~mask) == 0) {
+			low = ~mask & width;
+			if ((low & (low + 1)) != 0)
+				ranges = 0;
+			r[n].lo = p->s.k;
+			r[n].hi = p->s.k | low;
+			n++;
+		}
+		f = JF(p);
+		p = f;
+	} while (jeq_link(p, load, t, npred, &mask));
+	if (n < JEQ_TREE_MIN)
+		return 0;
+
+	/*
+	 * If every branch applies the same mask, the search can be done
+	 * on the masked value.  Otherwise it's done on the value as
+	 * loaded, so the accumulator will hold a different value at the
+	 * end of the search than at the end of the chain, and each
+	 * branch has to be true for a single range of that value.
+	 */
+	if (!masked) {
+		for (i = 0; i < n; i++)
+			r[i].hi = r[i].lo;
+	} else if (!ranges || !a_dead(t) || !a_dead(f))
+		return 0;
+
+	qsort(r, n, sizeof(*r), jeq_range_cmp);
+	for (i = 1, j = 0; i < n; i++) {
+		if (r[i].lo <= r[j].hi || r[i].lo == r[j].hi + 1) {
+			if (r[i].hi > r[j].hi)
+				r[j].hi = r[i].hi;
+		} else
+			r[++j] = r[i];
+	}
+	n = j + 1;
+
+	if (masked && and != 0)
+		and->s.code = NOP;
+	root = jeq_tree(cstate, r, 0, n, t, f);
+	if (root == t || root == f) {
+		JT(b) = root;
+		JF(b) = root;
+	} else {
+		b->s.code = root->s.code;
+		b->s.k = root->s.k;
+		JT(b) = JT(root);
+		JF(b) = JF(root);
+	}
+	return f;
+}
+
+static void
+count_preds(struct icode *ic, struct block *b, u_int *npred)
+{
+	if (isMarked(ic, b))
+		return;
+	Mark(ic, b);
+	if (JT(b) == 0)
+		return;
+	npred[JT(b)->id]++;
+	npred[JF(b)->id]++;
+	count_preds(ic, JT(b), npred);
+	count_preds(ic, JF(b), npred);
+}
+
+static void
+opt_jeq_chains_r(compiler_state_t *cstate, struct icode *ic, struct block *b,
+    u_int *npred, struct jeq_range *r)
+{
+	struct block *t, *f;
+
+	if (isMarked(ic, b))
+		return;
+	Mark(ic, b);
+	if (JT(b) == 0)
+		return;
+	t = JT(b);
+	f = opt_jeq_chain(cstate, b, npred, r);
+	if (f == 0)
+		f = JF(b);
+	opt_jeq_chains_r(cstate, ic, t, npred, r);
+	opt_jeq_chains_r(cstate, ic, f, npred, r);
+}
+
+/*
+ * Replace long chains of BPF_JEQ|BPF_K branches with binary searches.
+ */
+static void
+opt_jeq_chains(compiler_state_t *cstate, opt_state_t *opt_state,
+    struct icode *ic)
+{
+	u_int *npred;
+	struct jeq_range *r;
+
+	npred = (u_int *)calloc(opt_state->n_blocks, sizeof(*npred));
+	r = (struct jeq_range *)calloc(opt_state->n_blocks, sizeof(*r));
+	if (npred == NULL || r == NULL) {
+		free(npred);
+		free(r);
+		bpf_error(cstate, "malloc");
+	}
+	unMarkAll(ic);
+	count_preds(ic, ic->root, npred);
+	unMarkAll(ic);
+	opt_jeq_chains_r(cstate, ic, ic->root, npred, r);
+	free(npred);
+	free(r);
+}
+
 static void
 opt_loop(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic,
     int do_stmts)
@@ -1791,9 +2374,7 @@ opt_loop(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic,
 		opt_state->done = 1;
 		find_levels(opt_state, ic);
 		find_dom(opt_state, ic->root);
-		find_closure(opt_state, ic->root);
 		find_ud(opt_state, ic->root);
-		find_edom(opt_state, ic->root);
 		opt_blks(cstate, opt_state, ic, do_stmts);
 #ifdef BDEBUG
 		if (pcap_optimizer_debug > 1 || pcap_print_dot_graph) {
@@ -1829,30 +2410,14 @@ bpf_optimize(compiler_state_t *cstate, struct icode *ic)
 		opt_dump(cstate, ic);
 	}
 #endif
-	opt_cleanup(&opt_state);
-}
-
-static void
-make_marks(struct icode *ic, struct block *p)
-{
-	if (!isMarked(ic, p)) {
-		Mark(ic, p);
-		if (BPF_CLASS(p->s.code) != BPF_RET) {
-			make_marks(ic, JT(p));
-			make_marks(ic, JF(p));
-		}
+	opt_jeq_chains(cstate, &opt_state, ic);
+#ifdef BDEBUG
+	if (pcap_optimizer_debug > 1 || pcap_print_dot_graph) {
+		printf("after opt_jeq_chains()\n");
+		opt_dump(cstate, ic);
 	}
-}
-
-/*
- * Mark code array such that isMarked(ic->cur_mark, i) is true
- * only for nodes that are alive.
- */
-static void
-mark_code(struct icode *ic)
-{
-	ic->cur_mark += 1;
-	make_marks(ic, ic->root);
+#endif
+	opt_cleanup(&opt_state);
 }
 
 /*
@@ -1889,47 +2454,70 @@ eq_blk(struct block *b0, struct block *b1)
 	return 0;
 }
 
-static void
-intern_blocks(opt_state_t *opt_state, struct icode *ic)
+/*
+ * Hash a block on the values that eq_blk() compares.
+ */
+static u_int
+hash_blk(struct block *b)
+{
+	struct slist *s;
+	u_int h;
+
+	h = (u_int)b->s.code * 31 + (u_int)b->s.k;
+	if (JT(b) != 0) {
+		h = h * 31 + (u_int)JT(b)->id;
+		h = h * 31 + (u_int)JF(b)->id;
+	}
+	for (s = b->stmts; s != 0; s = s->next) {
+		if (s->s.code == NOP)
+			continue;
+		h = h * 31 + (u_int)s->s.code;
+		h = h * 31 + (u_int)s->s.k;
+	}
+	return (h ^ (h >> 16));
+}
+
+/*
+ * Replace 'b' with the first block seen that's equal to it.  The
+ * successors of a block are interned before the block itself, so
+ * blocks that were equal only once their successors were interned
+ * are found in the same pass.
+ */
+static struct block *
+intern_blk(opt_state_t *opt_state, struct icode *ic, struct block *b)
 {
 	struct block *p;
-	int i, j;
-	int done1; /* don't shadow global */
- top:
-	done1 = 1;
-	for (i = 0; i < opt_state->n_blocks; ++i)
-		opt_state->blocks[i]->link = 0;
+	u_int h;
 
-	mark_code(ic);
+	if (isMarked(ic, b))
+		return b->link;
+	Mark(ic, b);
 
-	for (i = opt_state->n_blocks - 1; --i >= 0; ) {
-		if (!isMarked(ic, opt_state->blocks[i]))
-			continue;
-		for (j = i + 1; j < opt_state->n_blocks; ++j) {
-			if (!isMarked(ic, opt_state->blocks[j]))
-				continue;
-			if (eq_blk(opt_state->blocks[i], opt_state->blocks[j])) {
-				opt_state->blocks[i]->link = opt_state->blocks[j]->link ?
-					opt_state->blocks[j]->link : opt_state->blocks[j];
-				break;
-			}
-		}
+	if (JT(b) != 0) {
+		JT(b) = intern_blk(opt_state, ic, JT(b));
+		JF(b) = intern_blk(opt_state, ic, JF(b));
 	}
-	for (i = 0; i < opt_state->n_blocks; ++i) {
-		p = opt_state->blocks[i];
-		if (JT(p) == 0)
-			continue;
-		if (JT(p)->link) {
-			done1 = 0;
-			JT(p) = JT(p)->link;
-		}
-		if (JF(p)->link) {
-			done1 = 0;
-			JF(p) = JF(p)->link;
+	h = hash_blk(b) & (opt_state->blk_hash_size - 1);
+	for (p = opt_state->blk_hash[h]; p != 0;
+	    p = opt_state->blk_hash_next[p->id]) {
+		if (eq_blk(p, b)) {
+			b->link = p;
+			return p;
 		}
 	}
-	if (!done1)
-		goto top;
+	opt_state->blk_hash_next[b->id] = opt_state->blk_hash[h];
+	opt_state->blk_hash[h] = b;
+	b->link = b;
+	return b;
+}
+
+static void
+intern_blocks(opt_state_t *opt_state, struct icode *ic)
+{
+	memset(opt_state->blk_hash, 0,
+	    opt_state->blk_hash_size * sizeof(*opt_state->blk_hash));
+	unMarkAll(ic);
+	ic->root = intern_blk(opt_state, ic, ic->root);
 }
 
 static void
@@ -1938,9 +2526,21 @@ opt_cleanup(opt_state_t *opt_state)
 	free((void *)opt_state->vnode_base);
 	free((void *)opt_state->vmap);
 	free((void *)opt_state->edges);
-	free((void *)opt_state->space);
+	free((void *)opt_state->bdom.parent);
+	free((void *)opt_state->edom.parent);
+	free((void *)opt_state->einfo);
+	free((void *)opt_state->eclasses);
+	free((void *)opt_state->eclass_members);
+	free((void *)opt_state->eclass_hash);
+	free((void *)opt_state->estack);
 	free((void *)opt_state->levels);
 	free((void *)opt_state->blocks);
+	free((void *)opt_state->blk_hash);
+	free((void *)opt_state->blk_hash_next);
+	free((void *)opt_state->pull_flags);
+	free((void *)opt_state->pull_chain);
+	free((void *)opt_state->pull_group);
+	free((void *)opt_state->pull_count);
 }
 
 /*
@@ -2029,7 +2629,6 @@ count_stmts(struct icode *ic, struct block *p)
 static void
 opt_init(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic)
 {
-	bpf_u_int32 *p;
 	int i, n, max_stmts;
 
 	/*
@@ -2057,33 +2656,38 @@ opt_init(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic)
 	if (opt_state->levels == NULL)
 		bpf_error(cstate, "malloc");
 
-	opt_state->edgewords = opt_state->n_edges / (8 * sizeof(bpf_u_int32)) + 1;
-	opt_state->nodewords = opt_state->n_blocks / (8 * sizeof(bpf_u_int32)) + 1;
-
-	/* XXX */
-	opt_state->space = (bpf_u_int32 *)malloc(2 * opt_state->n_blocks * opt_state->nodewords * sizeof(*opt_state->space)
-				 + opt_state->n_edges * opt_state->edgewords * sizeof(*opt_state->space));
-	if (opt_state->space == NULL)
+	/*
+	 * The dominator trees, and the edge classes; there are at
+	 * most two classes for each edge.
+	 */
+	opt_state->bdom.parent = (int *)calloc(7 * n, sizeof(int));
+	opt_state->edom.parent = (int *)calloc(3 * opt_state->n_edges, sizeof(int));
+	opt_state->einfo = (struct edgeinfo *)calloc(opt_state->n_edges, sizeof(*opt_state->einfo));
+	opt_state->eclasses = (struct eclass *)calloc(2 * opt_state->n_edges, sizeof(*opt_state->eclasses));
+	opt_state->eclass_members = (int *)calloc(2 * opt_state->n_edges, sizeof(int));
+	opt_state->estack = (int *)calloc(2 * opt_state->n_edges, sizeof(int));
+	for (opt_state->eclass_hash_size = 64;
+	    opt_state->eclass_hash_size < 2 * (u_int)opt_state->n_edges;
+	    opt_state->eclass_hash_size <<= 1)
+		;
+	opt_state->eclass_hash = (int *)calloc(opt_state->eclass_hash_size, sizeof(int));
+	if (opt_state->bdom.parent == NULL || opt_state->edom.parent == NULL ||
+	    opt_state->einfo == NULL || opt_state->eclasses == NULL ||
+	    opt_state->eclass_members == NULL || opt_state->estack == NULL ||
+	    opt_state->eclass_hash == NULL)
 		bpf_error(cstate, "malloc");
-	p = opt_state->space;
-	opt_state->all_dom_sets = p;
-	for (i = 0; i < n; ++i) {
-		opt_state->blocks[i]->dom = p;
-		p += opt_state->nodewords;
-	}
-	opt_state->all_closure_sets = p;
-	for (i = 0; i < n; ++i) {
-		opt_state->blocks[i]->closure = p;
-		p += opt_state->nodewords;
-	}
-	opt_state->all_edge_sets = p;
+	opt_state->bdom.jump = opt_state->bdom.parent + n;
+	opt_state->bdom.depth = opt_state->bdom.jump + n;
+	opt_state->bdom.pre = opt_state->bdom.depth + n;
+	opt_state->bdom.last = opt_state->bdom.pre + n;
+	opt_state->bdom.child = opt_state->bdom.last + n;
+	opt_state->bdom.sibling = opt_state->bdom.child + n;
+	opt_state->edom.jump = opt_state->edom.parent + opt_state->n_edges;
+	opt_state->edom.depth = opt_state->edom.jump + opt_state->n_edges;
+
 	for (i = 0; i < n; ++i) {
 		register struct block *b = opt_state->blocks[i];
 
-		b->et.edom = p;
-		p += opt_state->edgewords;
-		b->ef.edom = p;
-		p += opt_state->edgewords;
 		b->et.id = i;
 		opt_state->edges[i] = &b->et;
 		b->ef.id = opt_state->n_blocks + i;
@@ -2104,6 +2708,28 @@ opt_init(compiler_state_t *cstate, opt_state_t *opt_state, struct icode *ic)
 	opt_state->vnode_base = (struct valnode *)calloc(opt_state->maxval, sizeof(*opt_state->vnode_base));
 	if (opt_state->vmap == NULL || opt_state->vnode_base == NULL)
 		bpf_error(cstate, "malloc");
+	for (opt_state->blk_hash_size = 64;
+	    opt_state->blk_hash_size < 2 * (u_int)n;
+	    opt_state->blk_hash_size <<= 1)
+		;
+	opt_state->blk_hash = (struct block **)calloc(opt_state->blk_hash_size, sizeof(*opt_state->blk_hash));
+	opt_state->blk_hash_next = (struct block **)calloc(n, sizeof(*opt_state->blk_hash_next));
+	if (opt_state->blk_hash == NULL || opt_state->blk_hash_next == NULL)
+		bpf_error(cstate, "malloc");
+
+	/*
+	 * There are at most n blocks in a chain, so at most n + 1
+	 * groups of values in it, counting the one the predecessors
+	 * of the chain leave in the accumulator.
+	 */
+	opt_state->pull_flags = (u_char *)calloc(n, sizeof(*opt_state->pull_flags));
+	opt_state->pull_chain = (struct block **)calloc(2 * n, sizeof(*opt_state->pull_chain));
+	opt_state->pull_group = (int *)calloc(opt_state->maxval, sizeof(*opt_state->pull_group));
+	opt_state->pull_count = (int *)calloc(n + 2, sizeof(*opt_state->pull_count));
+	if (opt_state->pull_flags == NULL || opt_state->pull_chain == NULL ||
+	    opt_state->pull_group == NULL || opt_state->pull_count == NULL)
+		bpf_error(cstate, "malloc");
+	opt_state->pull_sorted = opt_state->pull_chain + n;
 }
 
 /*
@@ -2116,12 +2742,11 @@ int bids[NBIDS];
 #endif
 
 /*
- * Returns true if successful.  Returns false if a branch has
- * an offset that is too large.  If so, we have marked that
- * branch so that on a subsequent iteration, it will be treated
- * properly.
+ * If a branch has an offset that is too large, we mark that branch,
+ * so that on a subsequent iteration it will be treated properly, and
+ * set conv_state->retry.
  */
-static int
+static void
 convert_code_r(compiler_state_t *cstate, conv_state_t *conv_state,
     struct icode *ic, struct block *p)
 {
@@ -2133,13 +2758,11 @@ convert_code_r(compiler_state_t *cstate, conv_state_t *conv_state,
 	struct slist **offset = NULL;
 
 	if (p == 0 || isMarked(ic, p))
-		return (1);
+		return;
 	Mark(ic, p);
 
-	if (convert_code_r(cstate, conv_state, ic, JF(p)) == 0)
-		return (0);
-	if (convert_code_r(cstate, conv_state, ic, JT(p)) == 0)
-		return (0);
+	convert_code_r(cstate, conv_state, ic, JF(p));
+	convert_code_r(cstate, conv_state, ic, JT(p));
 
 	slen = slength(p->stmts);
 	dst = conv_state->ftail -= (slen + 1 + p->longjt + p->longjf);
@@ -2253,7 +2876,8 @@ filled:
 		    if (p->longjt == 0) {
 		    	/* mark this instruction and retry */
 			p->longjt++;
-			return(0);
+			conv_state->retry = 1;
+			return;
 		    }
 		    /* branch if T to following jump */
 		    if (extrajmps >= 256) {
@@ -2273,7 +2897,8 @@ filled:
 		    if (p->longjf == 0) {
 		    	/* mark this instruction and retry */
 			p->longjf++;
-			return(0);
+			conv_state->retry = 1;
+			return;
 		    }
 		    /* branch if F to following jump */
 		    /* if two jumps are inserted, F goes to second one */
@@ -2289,7 +2914,6 @@ filled:
 		else
 		    dst->jf = (u_char)off;
 	}
-	return (1);
 }
 
 
@@ -2333,9 +2957,11 @@ icode_to_fcode(compiler_state_t *cstate, struct icode *ic,
 	    memset((char *)fp, 0, sizeof(*fp) * n);
 	    conv_state.fstart = fp;
 	    conv_state.ftail = fp + n;
+	    conv_state.retry = 0;
 
 	    unMarkAll(ic);
-	    if (convert_code_r(cstate, &conv_state, ic, root))
+	    convert_code_r(cstate, &conv_state, ic, root);
+	    if (!conv_state.retry)
 		break;
 	    free(fp);
 	}
@@ -2368,7 +2994,7 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 	/*
 	 * Free up any already installed program.
 	 */
-	pcap_freecode(&p->fcode);
+	uninstall_bpf_program(p);
 
 	prog_size = sizeof(*fp->bf_insns) * fp->bf_len;
 	p->fcode.bf_len = fp->bf_len;
@@ -2379,9 +3005,37 @@ install_bpf_program(pcap_t *p, struct bpf_program *fp)
 		return (-1);
 	}
 	memcpy(p->fcode.bf_insns, fp->bf_insns, prog_size);
+
+	/*
+	 * Try to compile it into native code; if we can't, decode it
+	 * for the interpreter, and if we can't do that, we'll just
+	 * interpret it as is.
+	 */
+	p->fcode_jit = bpf_jit_compile(p->fcode.bf_insns, p->fcode.bf_len);
+	if (p->fcode_jit == NULL)
+		p->fcode_threaded = bpf_threaded_compile(p->fcode.bf_insns,
+		    p->fcode.bf_len);
 	return (0);
 }
 
+/*
+ * Free up the program installed with install_bpf_program(), and any
+ * native or pre-decoded code for it.
+ */
+void
+uninstall_bpf_program(pcap_t *p)
+{
+	if (p->fcode_jit != NULL) {
+		bpf_jit_free(p->fcode_jit);
+		p->fcode_jit = NULL;
+	}
+	if (p->fcode_threaded != NULL) {
+		bpf_threaded_free(p->fcode_threaded);
+		p->fcode_threaded = NULL;
+	}
+	pcap_freecode(&p->fcode);
+}
+
 #ifdef BDEBUG
 static void
 dot_dump_node(struct icode *ic, struct block *block, struct bpf_program *prog,
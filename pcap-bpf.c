@@ -1116,7 +1116,7 @@ pcap_read_bpf(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 #endif
 		 */
 		if (pb->filtering_in_kernel ||
-		    bpf_filter(p->fcode.bf_insns, datap, bhp->bh_datalen, caplen)) {
+		    pcap_filter_packet(p, datap, bhp->bh_datalen, caplen, NULL)) {
 			struct pcap_pkthdr pkthdr;
 #ifdef BIOCSTSTAMP
 			struct bintime bt;
@@ -3165,7 +3165,7 @@ pcap_setfilter_bpf(pcap_t *p, struct bpf_program *fp)
 	/*
 	 * Free any user-mode filter we might happen to have installed.
 	 */
-	pcap_freecode(&p->fcode);
+	uninstall_bpf_program(p);
 
 	/*
 	 * Try to install the kernel filter.
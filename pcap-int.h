@@ -108,6 +108,10 @@ struct pcap_opt {
 	 */
 #ifdef __linux__
 	int	protocol;	/* protocol to use when creating PF_PACKET socket */
+	int	fanout_group;	/* PACKET_FANOUT group to join; -1 if none */
+	int	fanout_mode;	/* PACKET_FANOUT_ mode and flags for that group */
+	int	qdisc_bypass;	/* bypass the qdisc layer when transmitting */
+	int	ebpf_filter;	/* try to put filters in the kernel as eBPF */
 #endif
 #ifdef _WIN32
 	int	nocapture_local;/* disable NPF loopback */
@@ -118,6 +122,10 @@ typedef int	(*activate_op_t)(pcap_t *);
 typedef int	(*can_set_rfmon_op_t)(pcap_t *);
 typedef int	(*read_op_t)(pcap_t *, int cnt, pcap_handler, u_char *);
 typedef int	(*next_packet_op_t)(pcap_t *, struct pcap_pkthdr *, u_char **);
+typedef int64_t	(*sf_tell_op_t)(pcap_t *);
+typedef int	(*sf_seek_op_t)(pcap_t *, int64_t, u_int);
+typedef int	(*sf_resync_op_t)(pcap_t *, int64_t, int64_t *,
+		    struct pcap_pkthdr *, u_int *);
 typedef int	(*inject_op_t)(pcap_t *, const void *, size_t);
 typedef void	(*save_current_filter_op_t)(pcap_t *, const char *);
 typedef int	(*setfilter_op_t)(pcap_t *, struct bpf_program *);
@@ -242,6 +250,13 @@ struct pcap {
 	 */
 	struct bpf_program fcode;
 
+	/*
+	 * Native code for that filter, if it could be compiled, or,
+	 * if not, a pre-decoded version of it for the interpreter.
+	 */
+	struct bpf_jit_code *fcode_jit;
+	struct bpf_threaded_code *fcode_threaded;
+
 	char errbuf[PCAP_ERRBUF_SIZE + 1];
 	int dlt_count;
 	u_int *dlt_list;
@@ -289,6 +304,45 @@ struct pcap {
 	live_dump_ended_op_t live_dump_ended_op;
 	get_airpcap_handle_op_t get_airpcap_handle_op;
 #endif
+
+	/*
+	 * Methods for repositioning a savefile; NULL for live captures.
+	 *
+	 * sf_tell_op returns the offset in the file of the next record
+	 * to be read, or -1 if that's not known.
+	 *
+	 * sf_seek_op makes the record at the given offset the next one
+	 * to be read; the last argument, if not 0, is the number of
+	 * interfaces that are known to have been described before that
+	 * offset, for formats that care.
+	 *
+	 * sf_resync_op finds the first record that appears to start at
+	 * or after the given offset, returning 0 and its offset, header,
+	 * and the interface count to hand to sf_seek_op if it finds one,
+	 * 1 if it doesn't, and -1 on an error; it's NULL if the format
+	 * has no way of doing that.
+	 */
+	sf_tell_op_t sf_tell_op;
+	sf_seek_op_t sf_seek_op;
+	sf_resync_op_t sf_resync_op;
+
+	/*
+	 * 1 if every record in the savefile is a packet record, as in
+	 * pcap files, so that the record next_packet_op reads a packet
+	 * from is the one at sf_tell_op's offset, and 0 if there are
+	 * other records, as in pcapng files, that it may skip first.
+	 */
+	int sf_packets_only;
+
+	/*
+	 * For a handle from pcap_offline_partition(), the offset at
+	 * which its part of the file ends, and the format's own
+	 * next_packet_op, which sf_chunk_next_packet() calls until
+	 * it gets there.
+	 */
+	int64_t sf_end;
+	next_packet_op_t sf_chunk_next_op;
+
 	cleanup_op_t cleanup_op;
 };
 
@@ -472,13 +526,24 @@ int	add_addr_to_if(pcap_if_list_t *, const char *, bpf_u_int32,
  * "pcap_open_offline_common()" allocates and fills in a pcap_t, for use
  * by pcap_open_offline routines.
  *
+ * "sf_setup_ops()" fills in the operations common to all handles that
+ * read savefiles.
+ *
  * "sf_cleanup()" closes the file handle associated with a pcap_t, if
  * appropriate, and frees all data common to all modules for handling
  * savefile types.
  */
 pcap_t	*pcap_open_offline_common(char *ebuf, size_t size);
+void	sf_setup_ops(pcap_t *p);
 void	sf_cleanup(pcap_t *p);
 
+/*
+ * 64-bit file positioning for the savefile modules; they return -1
+ * on an error, with errno set.
+ */
+int64_t	sf_ftell64(FILE *fp);
+int	sf_fseek64(FILE *fp, int64_t off);
+
 /*
  * Internal interfaces for both "pcap_create()" and routines that
  * open savefiles.
@@ -493,6 +558,69 @@ void	pcap_win32_err_to_str(DWORD, char *);
 #endif
 
 int	install_bpf_program(pcap_t *, struct bpf_program *);
+void	uninstall_bpf_program(pcap_t *);
+
+/*
+ * Just-in-time compilation of BPF programs.
+ *
+ * bpf_jit_compile() returns NULL if the program can't be compiled,
+ * in which case it must be run with the interpreter.  The compiled
+ * code takes the same arguments as bpf_filter_with_aux_data(), other
+ * than the program, and returns the same value.
+ */
+typedef u_int (*bpf_jit_filter_func)(const u_char *, u_int, u_int,
+    const struct bpf_aux_data *);
+
+struct bpf_jit_code {
+	bpf_jit_filter_func func;
+	void	*mem;		/* the mapping holding the code */
+	size_t	memlen;		/* size of that mapping */
+};
+
+struct bpf_jit_code *bpf_jit_compile(const struct bpf_insn *, u_int);
+void	bpf_jit_free(struct bpf_jit_code *);
+
+/*
+ * Pre-decoded BPF programs, for a faster interpreter; see bpf_filter.c.
+ *
+ * bpf_threaded_compile() returns NULL if the program can't be decoded,
+ * in which case it must be run with bpf_filter_with_aux_data().
+ */
+struct bpf_threaded_code;
+
+struct bpf_threaded_code *bpf_threaded_compile(const struct bpf_insn *, u_int);
+u_int	bpf_threaded_filter(const struct bpf_threaded_code *, const u_char *,
+	    u_int, u_int, const struct bpf_aux_data *);
+void	bpf_threaded_free(struct bpf_threaded_code *);
+
+/*
+ * The compiled filter cache; see compilecache.c.
+ *
+ * pcap_compile_cache_lookup() returns 1, and fills in the program with
+ * a copy of the cached one, if the cache has a program for the filter,
+ * and 0 otherwise.
+ */
+int	pcap_compile_cache_lookup(pcap_t *, struct bpf_program *,
+	    const char *, int, bpf_u_int32);
+void	pcap_compile_cache_insert(pcap_t *, const struct bpf_program *,
+	    const char *, int, bpf_u_int32);
+
+/*
+ * Run the filter installed with install_bpf_program() on a packet,
+ * using the compiled or pre-decoded code if we have it.
+ */
+static inline u_int
+pcap_filter_packet(pcap_t *p, const u_char *pkt, u_int wirelen,
+    u_int buflen, const struct bpf_aux_data *aux_data)
+{
+	if (p->fcode_jit != NULL)
+		return (p->fcode_jit->func(pkt, wirelen, buflen, aux_data));
+	if (p->fcode_threaded != NULL)
+		return (bpf_threaded_filter(p->fcode_threaded, pkt, wirelen,
+		    buflen, aux_data));
+	return (bpf_filter_with_aux_data(p->fcode.bf_insns, pkt, wirelen,
+	    buflen, aux_data));
+}
 
 int	pcap_strcasecmp(const char *, const char *);
 
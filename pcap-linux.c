@@ -199,6 +199,9 @@
 #  endif /* TPACKET3_HDRLEN */
 #  ifdef TPACKET2_HDRLEN
 #   define HAVE_TPACKET2
+#   ifdef PACKET_TX_RING
+#    define HAVE_PACKET_TX_RING
+#   endif /* PACKET_TX_RING */
 #  else  /* TPACKET2_HDRLEN */
 #   define TPACKET_V1	0    /* Old kernel with only V1, so no TPACKET_Vn defined */
 #  endif /* TPACKET2_HDRLEN */
@@ -209,6 +212,15 @@
 #ifdef SO_ATTACH_FILTER
 #include <linux/types.h>
 #include <linux/filter.h>
+#include <sys/syscall.h>
+
+/*
+ * If we have SO_ATTACH_BPF and the bpf() system call, we can try to
+ * translate filters to eBPF and put them onto the socket that way.
+ */
+#if defined(SO_ATTACH_BPF) && defined(SYS_bpf)
+#define HAVE_EBPF_SOCKET_FILTER
+#endif
 #endif
 
 #ifdef HAVE_LINUX_NET_TSTAMP_H
@@ -323,6 +335,17 @@ struct pcap_linux {
 #ifdef HAVE_TPACKET3
 	unsigned char *current_packet; /* Current packet within the TPACKET_V3 block. Move to next block if NULL. */
 	int packets_left; /* Unhandled packets left within the block from previous call to pcap_read_linux_mmap_v3 in case of TPACKET_V3. */
+	int blocks_held; /* Blocks finished by pcap_next_batch_linux() but not yet handed back to the kernel. */
+#endif
+#ifdef HAVE_PACKET_TX_RING
+	int	tx_fd;		/* socket with the transmit ring */
+	u_char	*tx_ring;	/* memory-mapped transmit ring; NULL if none */
+	size_t	tx_ringlen;	/* size of that ring */
+	u_int	tx_block_size;	/* size of a block in that ring */
+	u_int	tx_frame_size;	/* size of a frame in that ring */
+	u_int	tx_frames_per_block; /* number of frames in a block */
+	u_int	tx_frame_nr;	/* number of frames in that ring */
+	u_int	tx_offset;	/* index of the next frame to fill */
 #endif
 };
 
@@ -355,6 +378,7 @@ static int pcap_setfilter_linux(pcap_t *, struct bpf_program *);
 static int pcap_setdirection_linux(pcap_t *, pcap_direction_t);
 static int pcap_set_datalink_linux(pcap_t *, int);
 static void pcap_cleanup_linux(pcap_t *);
+static int join_fanout_group(pcap_t *);
 
 /*
  * This is what the header structure looks like in a 64-bit kernel;
@@ -395,6 +419,11 @@ union thdr {
 
 static void destroy_ring(pcap_t *handle);
 static int create_ring(pcap_t *handle, int *status);
+#ifdef HAVE_PACKET_TX_RING
+static void destroy_tx_ring(pcap_t *handle);
+static int pcap_inject_batch_mmap(pcap_t *, const void * const *,
+    const size_t *, int);
+#endif
 static int prepare_tpacket_socket(pcap_t *handle);
 static void pcap_cleanup_linux_mmap(pcap_t *);
 static int pcap_read_linux_mmap_v1(pcap_t *, int, pcap_handler , u_char *);
@@ -404,6 +433,9 @@ static int pcap_read_linux_mmap_v2(pcap_t *, int, pcap_handler , u_char *);
 #endif
 #ifdef HAVE_TPACKET3
 static int pcap_read_linux_mmap_v3(pcap_t *, int, pcap_handler , u_char *);
+static void release_held_blocks_v3(pcap_t *);
+static int pcap_next_batch_mmap_v3(pcap_t *, struct pcap_pkthdr *,
+    const u_char **, int);
 #endif
 static int pcap_setfilter_linux_mmap(pcap_t *, struct bpf_program *);
 static int pcap_setnonblock_mmap(pcap_t *p, int nonblock);
@@ -487,7 +519,11 @@ static int 	iface_bind_old(int fd, const char *device, char *ebuf);
 static int	fix_program(pcap_t *handle, struct sock_fprog *fcode,
     int is_mapped);
 static int	fix_offset(pcap_t *handle, struct bpf_insn *p);
-static int	set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode);
+static int	set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode,
+    int prog_fd);
+#ifdef HAVE_EBPF_SOCKET_FILTER
+static int	set_kernel_ebpf_filter(pcap_t *handle, int is_mmapped);
+#endif
 static int	reset_kernel_filter(pcap_t *handle);
 
 static struct sock_filter	total_insn
@@ -1364,6 +1400,10 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 		pcap_remove_from_pcaps_to_close(handle);
 	}
 
+#ifdef HAVE_PACKET_TX_RING
+	if (handlep->tx_ring != NULL)
+		destroy_tx_ring(handle);
+#endif
 	if (handlep->mondevice != NULL) {
 		free(handlep->mondevice);
 		handlep->mondevice = NULL;
@@ -1589,6 +1629,20 @@ pcap_activate_linux(pcap_t *handle)
 			 * returning.
 			 */
 			set_poll_timeout(handlep);
+
+			/*
+			 * Join the fanout group, if one was requested,
+			 * now that the ring is set up.
+			 */
+			ret = join_fanout_group(handle);
+			if (ret < 0) {
+				/*
+				 * The ring has been set up, so use
+				 * the memory-mapped cleanup routine.
+				 */
+				handle->cleanup_op(handle);
+				return ret;
+			}
 			return status;
 
 		case 0:
@@ -1656,6 +1710,12 @@ pcap_activate_linux(pcap_t *handle)
 	 */
 	handle->selectable_fd = handle->fd;
 
+	ret = join_fanout_group(handle);
+	if (ret < 0) {
+		status = ret;
+		goto fail;
+	}
+
 	return status;
 
 fail:
@@ -1663,6 +1723,67 @@ fail:
 	return status;
 }
 
+/*
+ * If pcap_set_fanout_linux() was called, add the socket to the
+ * requested PACKET_FANOUT group, so that the kernel spreads the
+ * packets for the device over all the sockets in that group.
+ *
+ * This must be done after the socket is bound and after any ring
+ * has been set up.
+ *
+ * Returns 0 on success and PCAP_ERROR, with handle->errbuf set, on
+ * failure.
+ */
+static int
+join_fanout_group(pcap_t *handle)
+{
+#if defined(HAVE_PF_PACKET_SOCKETS) && defined(PACKET_FANOUT)
+	struct pcap_linux *handlep = handle->priv;
+	int val;
+#endif
+
+	if (handle->opt.fanout_group == -1)
+		return 0;	/* not requested */
+
+#if defined(HAVE_PF_PACKET_SOCKETS) && defined(PACKET_FANOUT)
+	if (handlep->sock_packet) {
+		pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    "Fanout groups are not supported with SOCK_PACKET sockets");
+		return PCAP_ERROR;
+	}
+
+	/*
+	 * The low-order 16 bits are the group ID; the upper 16 bits
+	 * are the fanout mode and flags.
+	 */
+	val = handle->opt.fanout_group | (handle->opt.fanout_mode << 16);
+	if (setsockopt(handle->fd, SOL_PACKET, PACKET_FANOUT,
+	    &val, sizeof(val)) == -1) {
+		if (errno == EINVAL) {
+			/*
+			 * Either the kernel doesn't support that mode,
+			 * or the group already exists with a different
+			 * mode or on a different device.
+			 */
+			pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Can't join fanout group %d with mode 0x%04x: the mode is not supported, or the group exists with a different mode or device",
+			    handle->opt.fanout_group, handle->opt.fanout_mode);
+		} else {
+			pcap_fmt_errmsg_for_errno(handle->errbuf,
+			    PCAP_ERRBUF_SIZE, errno,
+			    "Can't join fanout group %d",
+			    handle->opt.fanout_group);
+		}
+		return PCAP_ERROR;
+	}
+	return 0;
+#else
+	pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+	    "Fanout groups are not supported by this version of libpcap");
+	return PCAP_ERROR;
+#endif
+}
+
 /*
  *  Read at most max_packets from the capture stream and call the callback
  *  for each of them. Returns the number of packets handled or -1 if an
@@ -2048,8 +2169,8 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 
 	/* Run the packet filter if not using kernel filter */
 	if (handlep->filter_in_userland && handle->fcode.bf_insns) {
-		if (bpf_filter_with_aux_data(handle->fcode.bf_insns, bp,
-		    packet_len, caplen, &aux_data) == 0) {
+		if (pcap_filter_packet(handle, bp, packet_len, caplen,
+		    &aux_data) == 0) {
 			/* rejected by filter */
 			return 0;
 		}
@@ -2130,13 +2251,17 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	return 1;
 }
 
+/*
+ * Returns 0 if we can send packets on this handle and -1, with
+ * handle->errbuf set, if we can't.
+ */
 static int
-pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
+check_inject_supported(pcap_t *handle)
 {
+#ifdef HAVE_PF_PACKET_SOCKETS
 	struct pcap_linux *handlep = handle->priv;
-	int ret;
 
-#ifdef HAVE_PF_PACKET_SOCKETS
+
 	if (!handlep->sock_packet) {
 		/* PF_PACKET socket */
 		if (handlep->ifindex == -1) {
@@ -2164,6 +2289,16 @@ pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
 		}
 	}
 #endif
+	return (0);
+}
+
+static int
+pcap_inject_linux(pcap_t *handle, const void *buf, size_t size)
+{
+	int ret;
+
+	if (check_inject_supported(handle) == -1)
+		return (-1);
 
 	ret = send(handle->fd, buf, size, 0);
 	if (ret == -1) {
@@ -2880,6 +3015,33 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 	/* Install kernel level filter if possible */
 
 #ifdef SO_ATTACH_FILTER
+#ifdef HAVE_EBPF_SOCKET_FILTER
+	if (handle->opt.ebpf_filter) {
+		/*
+		 * Try translating the filter to eBPF; that lets us
+		 * run filters in the kernel that we can't run there
+		 * as classic BPF.  If the kernel can't handle that,
+		 * fall back on classic BPF.
+		 */
+		switch (set_kernel_ebpf_filter(handle, is_mmapped)) {
+
+		case 1:
+			/*
+			 * Installation succeeded - using kernel filter,
+			 * so userland filtering not needed.
+			 */
+			handlep->filter_in_userland = 0;
+			return 0;
+
+		case 0:
+			break;
+
+		default:
+			return -1;
+		}
+	}
+#endif /* HAVE_EBPF_SOCKET_FILTER */
+
 #ifdef USHRT_MAX
 	if (handle->fcode.bf_len > USHRT_MAX) {
 		/*
@@ -2962,7 +3124,7 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 	 *	padding.
 	 */
 	if (can_filter_in_kernel) {
-		if ((err = set_kernel_filter(handle, &fcode)) == 0)
+		if ((err = set_kernel_filter(handle, &fcode, -1)) == 0)
 		{
 			/*
 			 * Installation succeded - using kernel filter,
@@ -3842,6 +4004,31 @@ activate_new(pcap_t *handle)
 			else
 				return 0;	/* try old mechanism */
 		}
+
+		if (handle->opt.qdisc_bypass) {
+#ifdef PACKET_QDISC_BYPASS
+			int bypass = 1;
+
+			/*
+			 * Have packets we send go straight to the
+			 * driver, rather than through the qdisc layer.
+			 */
+			if (setsockopt(sock_fd, SOL_PACKET,
+			    PACKET_QDISC_BYPASS, &bypass,
+			    sizeof(bypass)) == -1) {
+				pcap_fmt_errmsg_for_errno(handle->errbuf,
+				    PCAP_ERRBUF_SIZE, errno,
+				    "can't set PACKET_QDISC_BYPASS");
+				close(sock_fd);
+				return PCAP_ERROR;
+			}
+#else
+			pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Bypassing the qdisc layer is not supported by this version of libpcap");
+			close(sock_fd);
+			return PCAP_ERROR;
+#endif
+		}
 	} else {
 		/*
 		 * The "any" device.
@@ -4827,6 +5014,233 @@ destroy_ring(pcap_t *handle)
 	}
 }
 
+#ifdef HAVE_PACKET_TX_RING
+/*
+ * Number of bytes we ask for in the transmit ring.
+ */
+#define TX_RING_SIZE	(2*1024*1024)
+
+/*
+ * Offset of the packet data in a transmit ring frame.
+ */
+#define TX_FRAME_DATA_OFFSET	TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
+
+/*
+ * Get a pointer to the header of the Nth transmit ring frame.  Frames
+ * don't straddle blocks, so, if the frame size doesn't divide the
+ * block size, there's a gap at the end of each block.
+ */
+static struct tpacket2_hdr *
+tx_ring_frame(struct pcap_linux *handlep, u_int n)
+{
+	return ((struct tpacket2_hdr *)(handlep->tx_ring +
+	    (size_t)(n / handlep->tx_frames_per_block) * handlep->tx_block_size +
+	    (size_t)(n % handlep->tx_frames_per_block) * handlep->tx_frame_size));
+}
+
+/*
+ * Set up a PACKET_TX_RING for pcap_inject_batch_linux().
+ *
+ * The receive ring, if any, has already been mapped, and a transmit
+ * ring can't be added to a socket after its rings are mapped, so we
+ * use a separate socket, bound to the same interface, with a protocol
+ * of 0, so that it doesn't receive any packets.
+ *
+ * Returns 0 on success and PCAP_ERROR, with handle->errbuf set, on
+ * failure.
+ */
+static int
+create_tx_ring(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct tpacket_req req;
+	int fd, val, mtu, err;
+
+	fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (fd == -1) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "socket");
+		return (PCAP_ERROR);
+	}
+	if ((err = iface_bind(fd, handlep->ifindex, handle->errbuf, 0)) != 1) {
+		close(fd);
+		return (err < 0 ? err : PCAP_ERROR);
+	}
+
+	val = TPACKET_V2;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val,
+	    sizeof(val)) == -1) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't set TPACKET_V2 on transmit socket");
+		close(fd);
+		return (PCAP_ERROR);
+	}
+
+	/*
+	 * Have the kernel skip malformed frames, rather than stopping
+	 * at the first one and leaving it, and everything after it,
+	 * in the ring.
+	 */
+	val = 1;
+	(void)setsockopt(fd, SOL_PACKET, PACKET_LOSS, &val, sizeof(val));
+
+#ifdef PACKET_QDISC_BYPASS
+	if (handle->opt.qdisc_bypass) {
+		val = 1;
+		if (setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &val,
+		    sizeof(val)) == -1) {
+			pcap_fmt_errmsg_for_errno(handle->errbuf,
+			    PCAP_ERRBUF_SIZE, errno,
+			    "can't set PACKET_QDISC_BYPASS");
+			close(fd);
+			return (PCAP_ERROR);
+		}
+	}
+#endif
+
+	/*
+	 * Each frame has to hold the frame header, the link-layer
+	 * header, and an MTU's worth of payload.
+	 */
+	mtu = iface_get_mtu(fd, handle->opt.device, handle->errbuf);
+	if (mtu == -1) {
+		close(fd);
+		return (PCAP_ERROR);
+	}
+	memset(&req, 0, sizeof(req));
+	req.tp_frame_size = TPACKET_ALIGN(TX_FRAME_DATA_OFFSET +
+	    MAX_LINKHEADER_SIZE + mtu);
+	req.tp_block_size = getpagesize();
+	while (req.tp_block_size < req.tp_frame_size)
+		req.tp_block_size <<= 1;
+	req.tp_block_nr = TX_RING_SIZE / req.tp_block_size;
+	if (req.tp_block_nr == 0)
+		req.tp_block_nr = 1;
+	req.tp_frame_nr = req.tp_block_nr *
+	    (req.tp_block_size / req.tp_frame_size);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req,
+	    sizeof(req)) == -1) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't create tx ring on packet socket");
+		close(fd);
+		return (PCAP_ERROR);
+	}
+
+	handlep->tx_ringlen = (size_t)req.tp_block_nr * req.tp_block_size;
+	handlep->tx_ring = mmap(0, handlep->tx_ringlen,
+	    PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (handlep->tx_ring == MAP_FAILED) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't mmap tx ring");
+		handlep->tx_ring = NULL;
+		close(fd);
+		return (PCAP_ERROR);
+	}
+	handlep->tx_fd = fd;
+	handlep->tx_block_size = req.tp_block_size;
+	handlep->tx_frame_size = req.tp_frame_size;
+	handlep->tx_frames_per_block = req.tp_block_size / req.tp_frame_size;
+	handlep->tx_frame_nr = req.tp_frame_nr;
+	handlep->tx_offset = 0;
+	return (0);
+}
+
+/* free the transmit ring and its socket */
+static void
+destroy_tx_ring(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	(void)munmap(handlep->tx_ring, handlep->tx_ringlen);
+	handlep->tx_ring = NULL;
+	close(handlep->tx_fd);
+	handlep->tx_fd = -1;
+}
+
+/*
+ * Have the kernel transmit all the frames queued in the transmit ring,
+ * waiting until it's done.
+ */
+static int
+flush_tx_ring(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+
+	if (send(handlep->tx_fd, NULL, 0, 0) == -1) {
+		pcap_fmt_errmsg_for_errno(handle->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "send");
+		return (PCAP_ERROR);
+	}
+	return (0);
+}
+
+/*
+ * Queue a batch of packets in the transmit ring, setting it up first if
+ * this is the first batch, and then have the kernel transmit them with
+ * a single system call (or one per ring's worth of packets, if there
+ * are more packets than there are frames in the ring).
+ */
+static int
+pcap_inject_batch_mmap(pcap_t *handle, const void * const *bufs,
+    const size_t *sizes, int count)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct tpacket2_hdr *hdr;
+	int i;
+
+	if (handlep->tx_ring == NULL) {
+		if (create_tx_ring(handle) != 0)
+			return (PCAP_ERROR);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (sizes[i] > handlep->tx_frame_size - TX_FRAME_DATA_OFFSET) {
+			pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "Packet %d is %zu bytes long, which is too large to send",
+			    i, sizes[i]);
+			goto error;
+		}
+		hdr = tx_ring_frame(handlep, handlep->tx_offset);
+		if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+			/*
+			 * The ring is full; wait for the kernel to
+			 * send what's in it.
+			 */
+			if (flush_tx_ring(handle) != 0)
+				goto error;
+			if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+				pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+				    "Transmit ring frame still in use after flushing the ring");
+				goto error;
+			}
+		}
+		memcpy((u_char *)hdr + TX_FRAME_DATA_OFFSET, bufs[i], sizes[i]);
+		hdr->tp_len = sizes[i];
+		/*
+		 * Make sure the packet data is visible before we hand
+		 * the frame to the kernel.
+		 */
+		__sync_synchronize();
+		hdr->tp_status = TP_STATUS_SEND_REQUEST;
+		if (++handlep->tx_offset == handlep->tx_frame_nr)
+			handlep->tx_offset = 0;
+	}
+	if (flush_tx_ring(handle) != 0)
+		return (PCAP_ERROR);
+	return (count);
+
+error:
+	/*
+	 * Send whatever we've already queued, and report how many
+	 * packets that was; if it's none, report the error.
+	 */
+	if (i == 0 || flush_tx_ring(handle) != 0)
+		return (PCAP_ERROR);
+	return (i);
+}
+#endif /* HAVE_PACKET_TX_RING */
+
 /*
  * Special one-shot callback, used for pcap_next() and pcap_next_ex(),
  * for Linux mmapped capture.
@@ -5036,11 +5450,19 @@ static int pcap_wait_for_frames_mmap(pcap_t *handle)
 	return 0;
 }
 
-/* handle a single memory mapped packet */
-static int pcap_handle_packet_mmap(
+/*
+ * Prepare a single memory mapped packet for delivery: construct the
+ * sll header and reinsert the VLAN tag in place, if necessary, apply
+ * the userland filter and direction check, and fill in the pcap
+ * packet header.
+ *
+ * Returns 1, with *pcaphdrp and *bpp filled in, if the packet is to
+ * be delivered, 0 if it was rejected, and -1 on error.
+ */
+static inline int pcap_prepare_packet_mmap(
 		pcap_t *handle,
-		pcap_handler callback,
-		u_char *user,
+		struct pcap_pkthdr *pcaphdrp,
+		unsigned char **bpp,
 		unsigned char *frame,
 		unsigned int tp_len,
 		unsigned int tp_mac,
@@ -5169,11 +5591,8 @@ static int pcap_handle_packet_mmap(
 		aux_data.vlan_tag_present = tp_vlan_tci_valid;
 		aux_data.vlan_tag = tp_vlan_tci & 0x0fff;
 
-		if (bpf_filter_with_aux_data(handle->fcode.bf_insns,
-					     bp,
-					     tp_len,
-					     snaplen,
-					     &aux_data) == 0)
+		if (pcap_filter_packet(handle, bp, tp_len, snaplen,
+		    &aux_data) == 0)
 			return 0;
 	}
 
@@ -5240,6 +5659,36 @@ static int pcap_handle_packet_mmap(
 	if (pcaphdr.caplen > (bpf_u_int32)handle->snapshot)
 		pcaphdr.caplen = handle->snapshot;
 
+	*pcaphdrp = pcaphdr;
+	*bpp = bp;
+	return 1;
+}
+
+/* handle a single memory mapped packet */
+static int pcap_handle_packet_mmap(
+		pcap_t *handle,
+		pcap_handler callback,
+		u_char *user,
+		unsigned char *frame,
+		unsigned int tp_len,
+		unsigned int tp_mac,
+		unsigned int tp_snaplen,
+		unsigned int tp_sec,
+		unsigned int tp_usec,
+		int tp_vlan_tci_valid,
+		__u16 tp_vlan_tci,
+		__u16 tp_vlan_tpid)
+{
+	struct pcap_pkthdr pcaphdr;
+	unsigned char *bp;
+	int ret;
+
+	ret = pcap_prepare_packet_mmap(handle, &pcaphdr, &bp, frame,
+	    tp_len, tp_mac, tp_snaplen, tp_sec, tp_usec,
+	    tp_vlan_tci_valid, tp_vlan_tci, tp_vlan_tpid);
+	if (ret != 1)
+		return ret;
+
 	/* pass the packet to the user */
 	callback(user, &pcaphdr, bp);
 
@@ -5510,6 +5959,14 @@ pcap_read_linux_mmap_v3(pcap_t *handle, int max_packets, pcap_handler callback,
 	int pkts = 0;
 	int ret;
 
+	/*
+	 * If pcap_next_batch_linux() was used, and its blocks
+	 * weren't released, release them now, as we're about to
+	 * hand the blocks we process back to the kernel.
+	 */
+	if (handlep->blocks_held > 0)
+		release_held_blocks_v3(handle);
+
 again:
 	if (handlep->current_packet == NULL) {
 		/* wait for frames availability.*/
@@ -5625,20 +6082,174 @@ again:
 	}
 	return pkts;
 }
-#endif /* HAVE_TPACKET3 */
 
+/*
+ * Hand the blocks that pcap_next_batch_mmap_v3() has finished with
+ * back to the kernel.  They're the blocks immediately preceding the
+ * current one.
+ */
+static void
+release_held_blocks_v3(pcap_t *handle)
+{
+	struct pcap_linux *handlep = handle->priv;
+	union thdr h;
+	int offset;
+
+	offset = handle->offset - handlep->blocks_held;
+	if (offset < 0)
+		offset += handle->cc;
+	while (handlep->blocks_held > 0) {
+		h.raw = RING_GET_FRAME_AT(handle, offset);
+		h.h3->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		if (++offset >= handle->cc)
+			offset = 0;
+		handlep->blocks_held--;
+	}
+}
+
+/*
+ * Return up to max_packets packets from the current TPACKET_V3 block,
+ * without copying them and without calling a callback for each of them.
+ *
+ * The headers are filled into hdrs[] and pointers to the packet data,
+ * which point into the ring, into pkts[].  The blocks those pointers
+ * refer to aren't handed back to the kernel until
+ * pcap_release_batch_linux() is called.
+ */
 static int
-pcap_setfilter_linux_mmap(pcap_t *handle, struct bpf_program *filter)
+pcap_next_batch_mmap_v3(pcap_t *handle, struct pcap_pkthdr *hdrs,
+    const u_char **pkts, int max_packets)
 {
 	struct pcap_linux *handlep = handle->priv;
-	int n, offset;
+	union thdr h;
+	int n = 0;
 	int ret;
 
-	/*
-	 * Don't rewrite "ret" instructions; we don't need to, as
-	 * we're not reading packets with recvmsg(), and we don't
-	 * want to, as, by not rewriting them, the kernel can avoid
-	 * copying extra data.
+again:
+	if (handlep->current_packet == NULL) {
+		if (handlep->blocks_held >= handle->cc) {
+			/*
+			 * Every block in the ring is being held by
+			 * our caller; we can't go any further.
+			 */
+			pcap_snprintf(handle->errbuf, PCAP_ERRBUF_SIZE,
+			    "All blocks of the ring are held; pcap_release_batch_linux() must be called");
+			return PCAP_ERROR;
+		}
+		h.raw = RING_GET_CURRENT_FRAME(handle);
+		if (h.h3->hdr.bh1.block_status == TP_STATUS_KERNEL) {
+			/*
+			 * The current frame is owned by the kernel; wait
+			 * for a frame to be handed to us.
+			 */
+			ret = pcap_wait_for_frames_mmap(handle);
+			if (ret)
+				return ret;
+			h.raw = RING_GET_CURRENT_FRAME(handle);
+			if (h.h3->hdr.bh1.block_status == TP_STATUS_KERNEL) {
+				if (handlep->timeout == 0) {
+					/* Block until we see a packet. */
+					goto again;
+				}
+				return 0;
+			}
+		}
+		handlep->current_packet = h.raw + h.h3->hdr.bh1.offset_to_first_pkt;
+		handlep->packets_left = h.h3->hdr.bh1.num_pkts;
+	}
+	h.raw = RING_GET_CURRENT_FRAME(handle);
+
+	while (n < max_packets && handlep->packets_left > 0) {
+		struct tpacket3_hdr* tp3_hdr = (struct tpacket3_hdr*) handlep->current_packet;
+		unsigned char *bp;
+
+		ret = pcap_prepare_packet_mmap(
+				handle,
+				&hdrs[n],
+				&bp,
+				handlep->current_packet,
+				tp3_hdr->tp_len,
+				tp3_hdr->tp_mac,
+				tp3_hdr->tp_snaplen,
+				tp3_hdr->tp_sec,
+				handle->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ? tp3_hdr->tp_nsec : tp3_hdr->tp_nsec / 1000,
+				VLAN_VALID(tp3_hdr, &tp3_hdr->hv1),
+				tp3_hdr->hv1.tp_vlan_tci,
+				VLAN_TPID(tp3_hdr, &tp3_hdr->hv1));
+		if (ret < 0) {
+			handlep->current_packet = NULL;
+			return ret;
+		}
+		if (ret == 1) {
+			pkts[n++] = bp;
+			handlep->packets_read++;
+		}
+		handlep->current_packet += tp3_hdr->tp_next_offset;
+		handlep->packets_left--;
+	}
+
+	if (handlep->packets_left <= 0) {
+		/*
+		 * We're done with this block, but our caller might
+		 * still be looking at the packets in it, so don't
+		 * hand it back to the kernel; just count it, and,
+		 * if we're counting blocks that need to be filtered
+		 * in userland, count it for that as well.
+		 */
+		handlep->blocks_held++;
+		if (handlep->blocks_to_filter_in_userland > 0) {
+			handlep->blocks_to_filter_in_userland--;
+			if (handlep->blocks_to_filter_in_userland == 0) {
+				/*
+				 * No more blocks need to be filtered
+				 * in userland.
+				 */
+				handlep->filter_in_userland = 0;
+			}
+		}
+
+		/* next block */
+		if (++handle->offset >= handle->cc)
+			handle->offset = 0;
+
+		handlep->current_packet = NULL;
+	}
+
+	/*
+	 * Check for break loop condition; as with pcap_offline_read(),
+	 * if we've got packets, return them, and leave the flag set
+	 * for the next call.
+	 */
+	if (handle->break_loop) {
+		if (n == 0) {
+			handle->break_loop = 0;
+			return PCAP_ERROR_BREAK;
+		}
+		return n;
+	}
+	if (n == 0 && max_packets > 0) {
+		/*
+		 * Everything in that block was rejected; try the
+		 * next block.
+		 */
+		goto again;
+	}
+	return n;
+}
+#endif /* HAVE_TPACKET3 */
+
+static int
+pcap_setfilter_linux_mmap(pcap_t *handle, struct bpf_program *filter)
+{
+	struct pcap_linux *handlep = handle->priv;
+	int n, offset;
+	int ret;
+
+	/*
+	 * Don't rewrite "ret" instructions; we don't need to, as
+	 * we're not reading packets with recvmsg(), and we don't
+	 * want to, as, by not rewriting them, the kernel can avoid
+	 * copying extra data.
 	 */
 	ret = pcap_setfilter_linux_common(handle, filter, 1);
 	if (ret < 0)
@@ -7234,8 +7845,12 @@ fix_offset(pcap_t *handle, struct bpf_insn *p)
 	return 0;
 }
 
+/*
+ * Put a filter onto the socket: the classic BPF program "fcode" if
+ * "prog_fd" is -1, otherwise the eBPF program "prog_fd" refers to.
+ */
 static int
-set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode)
+set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode, int prog_fd)
 {
 	int total_filter_on = 0;
 	int save_mode;
@@ -7329,6 +7944,12 @@ set_kernel_filter(pcap_t *handle, struct sock_fprog *fcode)
 	/*
 	 * Now attach the new filter.
 	 */
+#ifdef HAVE_EBPF_SOCKET_FILTER
+	if (prog_fd != -1)
+		ret = setsockopt(handle->fd, SOL_SOCKET, SO_ATTACH_BPF,
+				 &prog_fd, sizeof(prog_fd));
+	else
+#endif
 	ret = setsockopt(handle->fd, SOL_SOCKET, SO_ATTACH_FILTER,
 			 fcode, sizeof(*fcode));
 	if (ret == -1 && total_filter_on) {
@@ -7386,6 +8007,595 @@ reset_kernel_filter(pcap_t *handle)
 		return -1;
 	return 0;
 }
+
+#ifdef HAVE_EBPF_SOCKET_FILTER
+/*
+ * Translating classic BPF programs to eBPF, so that filters that
+ * "fix_program()" can't make work in the kernel can still be run there.
+ *
+ * We don't include <linux/bpf.h>, as its "struct bpf_insn" collides
+ * with ours, so we define the bits of it we need here.  They're all
+ * part of the kernel's ABI, so they won't change.
+ */
+struct ebpf_insn {
+	__u8	code;
+	__u8	dst_reg:4;
+	__u8	src_reg:4;
+	__s16	off;
+	__s32	imm;
+};
+
+/*
+ * Opcodes that classic BPF doesn't have; the ones it does have are
+ * the same in eBPF, apart from the return instruction.
+ */
+#define EBPF_ALU64	0x07
+#define EBPF_MOV	0xb0
+#define EBPF_END	0xd0
+#define EBPF_TO_BE	0x08
+#define EBPF_JNE	0x50
+#define EBPF_CALL	0x80
+#define EBPF_EXIT	0x90
+
+/*
+ * Register assignments.  The accumulator has to be R0, as that's where
+ * the packet-loading instructions put their result, and the context
+ * pointer has to be in R6, as that's where they expect to find it.
+ * X and our temporary are in callee-saved registers, so that the
+ * packet-loading instructions and helper calls don't clobber them.
+ */
+#define EBPF_REG_A	0
+#define EBPF_REG_ARG1	1
+#define EBPF_REG_CTX	6
+#define EBPF_REG_X	7
+#define EBPF_REG_TMP	8
+#define EBPF_REG_FP	10
+
+/*
+ * Offsets of fields in struct __sk_buff.
+ */
+#define SKB_LEN			0
+#define SKB_PKT_TYPE		4
+#define SKB_MARK		8
+#define SKB_QUEUE_MAPPING	12
+#define SKB_PROTOCOL		16
+#define SKB_VLAN_PRESENT	20
+#define SKB_VLAN_TCI		24
+#define SKB_VLAN_PROTO		28
+#define SKB_IFINDEX		40
+#define SKB_HASH		68
+
+/*
+ * Helper functions, bpf() commands, and program types.
+ */
+#define EBPF_FUNC_GET_PRANDOM_U32	7
+#define EBPF_FUNC_GET_SMP_PROCESSOR_ID	8
+#define EBPF_PROG_LOAD			5
+#define EBPF_PROG_TYPE_SOCKET_FILTER	1
+
+/*
+ * The BPF_PROG_LOAD flavor of union bpf_attr.
+ */
+struct ebpf_prog_load_attr {
+	__u32	prog_type;
+	__u32	insn_cnt;
+	__u64	insns;
+	__u64	license;
+	__u32	log_level;
+	__u32	log_size;
+	__u64	log_buf;
+	__u32	kern_version;
+};
+
+/*
+ * Maximum number of eBPF instructions we generate for one classic BPF
+ * instruction, and for the prologue.
+ */
+#define EBPF_MAX_INSNS_PER_INSN	6
+#define EBPF_MAX_PROLOGUE_INSNS	(3 + BPF_MEMWORDS)
+
+/*
+ * Offset, from the frame pointer, of the stack slot for the
+ * scratch memory word k.
+ */
+#define EBPF_MEM_OFF(k)	(-(int)(BPF_MEMWORDS - (k)) * 4)
+
+/*
+ * No jump to fix up.
+ */
+#define EBPF_NO_TARGET	UINT_MAX
+
+static void
+emit_ebpf(struct ebpf_insn **ipp, int code, int dst, int src, int off,
+    bpf_u_int32 imm)
+{
+	struct ebpf_insn *ip = (*ipp)++;
+
+	ip->code = code;
+	ip->dst_reg = dst;
+	ip->src_reg = src;
+	ip->off = off;
+	ip->imm = (__s32)imm;
+}
+
+/*
+ * Generate code to load the value of the Linux BPF extension at
+ * SKF_AD_OFF + ad into the accumulator, the way the kernel's classic
+ * BPF interpreter would.  Returns -1 for extensions that have no eBPF
+ * equivalent available to socket filters.
+ */
+static int
+emit_ebpf_ancillary(struct ebpf_insn **ipp, int ad)
+{
+	int field, swap = 0;
+
+	switch (ad) {
+
+	case SKF_AD_PROTOCOL:
+		field = SKB_PROTOCOL;
+		swap = 1;
+		break;
+
+	case SKF_AD_PKTTYPE:
+		field = SKB_PKT_TYPE;
+		break;
+
+	case SKF_AD_IFINDEX:
+		field = SKB_IFINDEX;
+		break;
+
+	case SKF_AD_MARK:
+		field = SKB_MARK;
+		break;
+
+	case SKF_AD_QUEUE:
+		field = SKB_QUEUE_MAPPING;
+		break;
+
+#ifdef SKF_AD_RXHASH
+	case SKF_AD_RXHASH:
+		field = SKB_HASH;
+		break;
+#endif
+
+#ifdef SKF_AD_VLAN_TAG
+	case SKF_AD_VLAN_TAG:
+		field = SKB_VLAN_TCI;
+		break;
+#endif
+
+#ifdef SKF_AD_VLAN_TAG_PRESENT
+	case SKF_AD_VLAN_TAG_PRESENT:
+		field = SKB_VLAN_PRESENT;
+		break;
+#endif
+
+#ifdef SKF_AD_VLAN_TPID
+	case SKF_AD_VLAN_TPID:
+		field = SKB_VLAN_PROTO;
+		swap = 1;
+		break;
+#endif
+
+#ifdef SKF_AD_CPU
+	case SKF_AD_CPU:
+		emit_ebpf(ipp, BPF_JMP|EBPF_CALL, 0, 0, 0,
+		    EBPF_FUNC_GET_SMP_PROCESSOR_ID);
+		return 0;
+#endif
+
+#ifdef SKF_AD_RANDOM
+	case SKF_AD_RANDOM:
+		emit_ebpf(ipp, BPF_JMP|EBPF_CALL, 0, 0, 0,
+		    EBPF_FUNC_GET_PRANDOM_U32);
+		return 0;
+#endif
+
+#ifdef SKF_AD_ALU_XOR_X
+	case SKF_AD_ALU_XOR_X:
+		emit_ebpf(ipp, BPF_ALU|BPF_XOR|BPF_X, EBPF_REG_A, EBPF_REG_X,
+		    0, 0);
+		return 0;
+#endif
+
+	default:
+		return -1;
+	}
+	emit_ebpf(ipp, BPF_LDX|BPF_MEM|BPF_W, EBPF_REG_A, EBPF_REG_CTX,
+	    field, 0);
+	if (swap) {
+		/*
+		 * The field is in network byte order; the classic BPF
+		 * extension returns it in host byte order.
+		 */
+		emit_ebpf(ipp, BPF_ALU|EBPF_END|EBPF_TO_BE, EBPF_REG_A, 0,
+		    0, 16);
+	}
+	return 0;
+}
+
+/*
+ * Is this offset one of the Linux BPF extensions?
+ */
+#define IS_ANCILLARY_OFFSET(k) \
+	((bpf_int32)(k) >= SKF_AD_OFF && (bpf_int32)(k) < 0)
+
+/*
+ * Translate the handle's filter program to eBPF, applying the same
+ * fixups "fix_program()" applies to the copy it hands to the kernel,
+ * plus the ones it can't do with classic BPF.
+ *
+ * Returns a pointer to the translated program, which must be freed
+ * by the caller, or NULL if the program can't be translated.
+ */
+static struct ebpf_insn *
+translate_to_ebpf(pcap_t *handle, int is_mmapped, u_int *ebpf_len)
+{
+	struct pcap_linux *handlep = handle->priv;
+	struct bpf_insn *prog = handle->fcode.bf_insns;
+	u_int len = handle->fcode.bf_len;
+	struct ebpf_insn *insns = NULL, *ip;
+	u_int *start = NULL, *target = NULL;
+	size_t max_insns;
+	u_int i, j, mem_read = 0;
+	struct bpf_insn insn;
+	int src, off;
+
+	max_insns = (size_t)len * EBPF_MAX_INSNS_PER_INSN +
+	    EBPF_MAX_PROLOGUE_INSNS;
+	insns = malloc(max_insns * sizeof(*insns));
+	start = malloc((len + 1) * sizeof(*start));
+	target = malloc(max_insns * sizeof(*target));
+	if (insns == NULL || start == NULL || target == NULL)
+		goto fail;
+	for (j = 0; j < max_insns; j++)
+		target[j] = EBPF_NO_TARGET;
+
+	/*
+	 * Find out which scratch memory words are read; the verifier
+	 * won't let us read stack slots we haven't written to, so we
+	 * have to initialize them.
+	 */
+	for (i = 0; i < len; i++) {
+		if ((prog[i].code == (BPF_LD|BPF_MEM) ||
+		    prog[i].code == (BPF_LDX|BPF_MEM)) &&
+		    prog[i].k < BPF_MEMWORDS)
+			mem_read |= 1U << prog[i].k;
+	}
+
+	/*
+	 * Prologue: save the context pointer where the packet-loading
+	 * instructions expect it, and clear A, X, and the scratch
+	 * memory words we read, as the classic BPF interpreter does.
+	 */
+	ip = insns;
+	emit_ebpf(&ip, EBPF_ALU64|EBPF_MOV|BPF_X, EBPF_REG_CTX, EBPF_REG_ARG1,
+	    0, 0);
+	emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K, EBPF_REG_A, 0, 0, 0);
+	emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K, EBPF_REG_X, 0, 0, 0);
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		if (mem_read & (1U << i))
+			emit_ebpf(&ip, BPF_ST|BPF_MEM|BPF_W, EBPF_REG_FP, 0,
+			    EBPF_MEM_OFF(i), 0);
+	}
+
+	for (i = 0; i < len; i++) {
+		start[i] = (u_int)(ip - insns);
+		insn = prog[i];
+
+		/*
+		 * If this loads from the packet and we're in cooked
+		 * mode, the offset has to be relocated, as "fix_program()"
+		 * does.  The SLL2 interface index field, which classic BPF
+		 * can't get at, is available to eBPF.
+		 */
+		if (handlep->cooked &&
+		    (BPF_CLASS(insn.code) == BPF_LD ||
+		     BPF_CLASS(insn.code) == BPF_LDX) &&
+		    (BPF_MODE(insn.code) == BPF_ABS ||
+		     BPF_MODE(insn.code) == BPF_IND ||
+		     BPF_MODE(insn.code) == BPF_MSH) &&
+		    (bpf_int32)insn.k >= 0) {
+			if (insn.code == (BPF_LD|BPF_W|BPF_ABS) &&
+			    handle->linktype == DLT_LINUX_SLL2 &&
+			    insn.k == 4) {
+				emit_ebpf(&ip, BPF_LDX|BPF_MEM|BPF_W,
+				    EBPF_REG_A, EBPF_REG_CTX, SKB_IFINDEX, 0);
+				continue;
+			}
+			if (fix_offset(handle, &insn) < 0)
+				goto fail;
+			if (BPF_MODE(insn.code) != BPF_ABS &&
+			    IS_ANCILLARY_OFFSET(insn.k))
+				goto fail;
+		}
+
+		src = (BPF_SRC(insn.code) == BPF_X) ? EBPF_REG_X : 0;
+
+		switch (BPF_CLASS(insn.code)) {
+
+		case BPF_LD:
+			switch (BPF_MODE(insn.code)) {
+
+			case BPF_IMM:
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+				    EBPF_REG_A, 0, 0, insn.k);
+				break;
+
+			case BPF_MEM:
+				if (insn.k >= BPF_MEMWORDS)
+					goto fail;
+				emit_ebpf(&ip, BPF_LDX|BPF_MEM|BPF_W,
+				    EBPF_REG_A, EBPF_REG_FP,
+				    EBPF_MEM_OFF(insn.k), 0);
+				break;
+
+			case BPF_LEN:
+				emit_ebpf(&ip, BPF_LDX|BPF_MEM|BPF_W,
+				    EBPF_REG_A, EBPF_REG_CTX, SKB_LEN, 0);
+				break;
+
+			case BPF_ABS:
+				if (IS_ANCILLARY_OFFSET(insn.k)) {
+					if (emit_ebpf_ancillary(&ip,
+					    (bpf_int32)insn.k - SKF_AD_OFF) < 0)
+						goto fail;
+					break;
+				}
+				emit_ebpf(&ip, insn.code, 0, 0, 0, insn.k);
+				break;
+
+			case BPF_IND:
+				emit_ebpf(&ip, insn.code, 0, EBPF_REG_X, 0,
+				    insn.k);
+				break;
+
+			default:
+				goto fail;
+			}
+			break;
+
+		case BPF_LDX:
+			switch (BPF_MODE(insn.code)) {
+
+			case BPF_IMM:
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+				    EBPF_REG_X, 0, 0, insn.k);
+				break;
+
+			case BPF_MEM:
+				if (insn.k >= BPF_MEMWORDS)
+					goto fail;
+				emit_ebpf(&ip, BPF_LDX|BPF_MEM|BPF_W,
+				    EBPF_REG_X, EBPF_REG_FP,
+				    EBPF_MEM_OFF(insn.k), 0);
+				break;
+
+			case BPF_LEN:
+				emit_ebpf(&ip, BPF_LDX|BPF_MEM|BPF_W,
+				    EBPF_REG_X, EBPF_REG_CTX, SKB_LEN, 0);
+				break;
+
+			case BPF_MSH:
+				/*
+				 * X = 4*(P[k]&0xf); the load clobbers A,
+				 * so save it first.
+				 */
+				emit_ebpf(&ip, EBPF_ALU64|EBPF_MOV|BPF_X,
+				    EBPF_REG_TMP, EBPF_REG_A, 0, 0);
+				emit_ebpf(&ip, BPF_LD|BPF_B|BPF_ABS, 0, 0, 0,
+				    insn.k);
+				emit_ebpf(&ip, BPF_ALU|BPF_AND|BPF_K,
+				    EBPF_REG_A, 0, 0, 0xf);
+				emit_ebpf(&ip, BPF_ALU|BPF_LSH|BPF_K,
+				    EBPF_REG_A, 0, 0, 2);
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_X,
+				    EBPF_REG_X, EBPF_REG_A, 0, 0);
+				emit_ebpf(&ip, EBPF_ALU64|EBPF_MOV|BPF_X,
+				    EBPF_REG_A, EBPF_REG_TMP, 0, 0);
+				break;
+
+			default:
+				goto fail;
+			}
+			break;
+
+		case BPF_ST:
+		case BPF_STX:
+			if (insn.k >= BPF_MEMWORDS)
+				goto fail;
+			emit_ebpf(&ip, BPF_STX|BPF_MEM|BPF_W, EBPF_REG_FP,
+			    BPF_CLASS(insn.code) == BPF_ST ?
+			      EBPF_REG_A : EBPF_REG_X,
+			    EBPF_MEM_OFF(insn.k), 0);
+			break;
+
+		case BPF_ALU:
+			if (BPF_OP(insn.code) == BPF_NEG) {
+				emit_ebpf(&ip, BPF_ALU|BPF_NEG, EBPF_REG_A, 0,
+				    0, 0);
+				break;
+			}
+			if (BPF_OP(insn.code) == BPF_DIV ||
+			    BPF_OP(insn.code) == BPF_MOD) {
+				if (src == 0) {
+					/* The verifier rejects this. */
+					if (insn.k == 0)
+						goto fail;
+				} else {
+					/*
+					 * Classic BPF rejects the packet
+					 * if X is 0; eBPF doesn't.
+					 */
+					emit_ebpf(&ip, BPF_JMP|EBPF_JNE|BPF_K,
+					    EBPF_REG_X, 0, 2, 0);
+					emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+					    EBPF_REG_A, 0, 0, 0);
+					emit_ebpf(&ip, BPF_JMP|EBPF_EXIT, 0, 0,
+					    0, 0);
+				}
+			}
+			emit_ebpf(&ip, insn.code, EBPF_REG_A, src, 0,
+			    src != 0 ? 0 : insn.k);
+			break;
+
+		case BPF_JMP:
+			if (BPF_OP(insn.code) == BPF_JA) {
+				target[ip - insns] = i + 1 + insn.k;
+				emit_ebpf(&ip, BPF_JMP|BPF_JA, 0, 0, 0, 0);
+				break;
+			}
+			if (src == 0 && (bpf_int32)insn.k < 0) {
+				/*
+				 * eBPF sign-extends the immediate operand
+				 * to 64 bits, which would make unsigned
+				 * comparisons with A come out wrong; compare
+				 * with a register holding it instead.
+				 */
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+				    EBPF_REG_TMP, 0, 0, insn.k);
+				src = EBPF_REG_TMP;
+			}
+			target[ip - insns] = i + 1 + insn.jt;
+			emit_ebpf(&ip, BPF_JMP|BPF_OP(insn.code)|
+			    (src != 0 ? BPF_X : BPF_K), EBPF_REG_A, src, 0,
+			    src != 0 ? 0 : insn.k);
+			if (insn.jf != 0) {
+				target[ip - insns] = i + 1 + insn.jf;
+				emit_ebpf(&ip, BPF_JMP|BPF_JA, 0, 0, 0, 0);
+			}
+			break;
+
+		case BPF_RET:
+			switch (BPF_RVAL(insn.code)) {
+
+			case BPF_K:
+				/*
+				 * As in "fix_program()", if we're not
+				 * capturing in memory-mapped mode, have
+				 * "recvfrom()", not the filter, truncate
+				 * the packet.
+				 */
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+				    EBPF_REG_A, 0, 0,
+				    (!is_mmapped && insn.k != 0) ?
+				      MAXIMUM_SNAPLEN : insn.k);
+				break;
+
+			case BPF_X:
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_X,
+				    EBPF_REG_A, EBPF_REG_X, 0, 0);
+				/* FALLTHROUGH */
+
+			case BPF_A:
+				/*
+				 * Unlike "fix_program()", we can force
+				 * non-zero values to MAXIMUM_SNAPLEN here.
+				 */
+				if (!is_mmapped) {
+					emit_ebpf(&ip, BPF_JMP|BPF_JEQ|BPF_K,
+					    EBPF_REG_A, 0, 1, 0);
+					emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_K,
+					    EBPF_REG_A, 0, 0, MAXIMUM_SNAPLEN);
+				}
+				break;
+
+			default:
+				goto fail;
+			}
+			emit_ebpf(&ip, BPF_JMP|EBPF_EXIT, 0, 0, 0, 0);
+			break;
+
+		case BPF_MISC:
+			if (BPF_MISCOP(insn.code) == BPF_TAX)
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_X,
+				    EBPF_REG_X, EBPF_REG_A, 0, 0);
+			else
+				emit_ebpf(&ip, BPF_ALU|EBPF_MOV|BPF_X,
+				    EBPF_REG_A, EBPF_REG_X, 0, 0);
+			break;
+
+		default:
+			goto fail;
+		}
+	}
+	start[len] = (u_int)(ip - insns);
+
+	/*
+	 * Now that we know where each classic instruction starts,
+	 * fill in the jump offsets.
+	 */
+	for (j = 0; j < (u_int)(ip - insns); j++) {
+		if (target[j] == EBPF_NO_TARGET)
+			continue;
+		if (target[j] >= len)
+			goto fail;
+		off = (int)start[target[j]] - (int)(j + 1);
+		if (off > 32767 || off < -32768)
+			goto fail;
+		insns[j].off = off;
+	}
+
+	free(start);
+	free(target);
+	*ebpf_len = (u_int)(ip - insns);
+	return insns;
+
+fail:
+	free(insns);
+	free(start);
+	free(target);
+	return NULL;
+}
+
+/*
+ * Try to put the handle's filter program onto the socket as an eBPF
+ * program.
+ *
+ * Returns 1 if that succeeded, 0 if it didn't and we should fall back
+ * on classic BPF, and -1 on a fatal error.
+ */
+static int
+set_kernel_ebpf_filter(pcap_t *handle, int is_mmapped)
+{
+	struct ebpf_insn *insns;
+	u_int len;
+	struct ebpf_prog_load_attr attr;
+	int prog_fd, err;
+
+	insns = translate_to_ebpf(handle, is_mmapped, &len);
+	if (insns == NULL)
+		return 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = EBPF_PROG_TYPE_SOCKET_FILTER;
+	attr.insn_cnt = len;
+	attr.insns = (__u64)(uintptr_t)insns;
+	attr.license = (__u64)(uintptr_t)"BSD";
+	prog_fd = (int)syscall(SYS_bpf, EBPF_PROG_LOAD, &attr, sizeof(attr));
+	free(insns);
+	if (prog_fd == -1) {
+		/*
+		 * The kernel doesn't support eBPF, we're not allowed
+		 * to load programs, or the verifier didn't like it;
+		 * use classic BPF.
+		 */
+		return 0;
+	}
+
+	/*
+	 * Once it's attached, the socket holds a reference to the
+	 * program, so we don't need the descriptor any more.
+	 */
+	err = set_kernel_filter(handle, NULL, prog_fd);
+	close(prog_fd);
+	if (err == 0)
+		return 1;
+	if (err == -2)
+		return -1;
+	return 0;
+}
+#endif /* HAVE_EBPF_SOCKET_FILTER */
 #endif
 
 int
@@ -7397,6 +8607,128 @@ pcap_set_protocol_linux(pcap_t *p, int protocol)
 	return (0);
 }
 
+int
+pcap_set_fanout_linux(pcap_t *p, int group_id, int mode, int flags)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	if (group_id < 0 || group_id > 0xffff) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Fanout group ID %d is not between 0 and 65535", group_id);
+		return (PCAP_ERROR);
+	}
+	if (mode < 0 || mode > 0xff || (flags & ~0xff00) != 0) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Invalid fanout mode %d or flags 0x%x", mode, flags);
+		return (PCAP_ERROR);
+	}
+	p->opt.fanout_group = group_id;
+	p->opt.fanout_mode = mode | flags;
+	return (0);
+}
+
+int
+pcap_next_batch_linux(pcap_t *p, struct pcap_pkthdr *hdrs,
+    const u_char **pkts, int max_packets)
+{
+#ifdef HAVE_TPACKET3
+	if (p->read_op == pcap_read_linux_mmap_v3)
+		return (pcap_next_batch_mmap_v3(p, hdrs, pkts, max_packets));
+#endif
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "This handle hasn't been activated yet");
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	}
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Batch reads are only supported on TPACKET_V3 memory-mapped captures");
+	return (PCAP_ERROR);
+}
+
+int
+pcap_release_batch_linux(pcap_t *p)
+{
+#ifdef HAVE_TPACKET3
+	if (p->read_op == pcap_read_linux_mmap_v3) {
+		release_held_blocks_v3(p);
+		return (0);
+	}
+#endif
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "This handle hasn't been activated yet");
+		return (PCAP_ERROR_NOT_ACTIVATED);
+	}
+	pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+	    "Batch reads are only supported on TPACKET_V3 memory-mapped captures");
+	return (PCAP_ERROR);
+}
+
+int
+pcap_set_ebpf_filter_linux(pcap_t *p, int enable)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.ebpf_filter = enable;
+	return (0);
+}
+
+int
+pcap_set_qdisc_bypass_linux(pcap_t *p, int bypass)
+{
+	if (pcap_check_activated(p))
+		return (PCAP_ERROR_ACTIVATED);
+	p->opt.qdisc_bypass = bypass;
+	return (0);
+}
+
+int
+pcap_inject_batch_linux(pcap_t *p, const void * const *bufs,
+    const size_t *sizes, int count)
+{
+	int i, ret;
+
+	if (p->inject_op != pcap_inject_linux) {
+		if (!p->activated) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "This handle hasn't been activated yet");
+			return (PCAP_ERROR_NOT_ACTIVATED);
+		}
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Batch sends are only supported on Linux network interfaces");
+		return (PCAP_ERROR);
+	}
+	if (count < 0) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Invalid packet count %d", count);
+		return (PCAP_ERROR);
+	}
+	if (count == 0)
+		return (0);
+	if (check_inject_supported(p) == -1)
+		return (PCAP_ERROR);
+
+#ifdef HAVE_PACKET_TX_RING
+	if (!((struct pcap_linux *)p->priv)->sock_packet)
+		return (pcap_inject_batch_mmap(p, bufs, sizes, count));
+#endif
+
+	/*
+	 * No transmit ring; send the packets one at a time.
+	 */
+	for (i = 0; i < count; i++) {
+		ret = send(p->fd, bufs[i], sizes[i], 0);
+		if (ret == -1) {
+			if (i != 0)
+				break;
+			pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "send");
+			return (PCAP_ERROR);
+		}
+	}
+	return (i);
+}
+
 /*
  * Libpcap version string.
  */
@@ -79,10 +79,10 @@ pcap_netmap_filter(u_char *arg, struct pcap_pkthdr *h, const u_char *buf)
 {
 	pcap_t *p = (pcap_t *)arg;
 	struct pcap_netmap *pn = p->priv;
-	const struct bpf_insn *pc = p->fcode.bf_insns;
 
 	++pn->rx_pkts;
-	if (pc == NULL || bpf_filter(pc, buf, h->len, h->caplen))
+	if (p->fcode.bf_insns == NULL ||
+	    pcap_filter_packet(p, buf, h->len, h->caplen, NULL))
 		pn->cb(pn->cb_arg, h, buf);
 }
 
@@ -177,7 +177,7 @@ snf_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 			caplen = p->snapshot;
 
 		if ((p->fcode.bf_insns == NULL) ||
-		     bpf_filter(p->fcode.bf_insns, req.pkt_addr, req.length, caplen)) {
+		     pcap_filter_packet(p, req.pkt_addr, req.length, caplen, NULL)) {
 			hdr.ts = snf_timestamp_to_timeval(req.timestamp, p->opt.tstamp_precision);
 			hdr.caplen = caplen;
 			hdr.len = req.length;
@@ -2211,6 +2211,10 @@ pcap_create_common(char *ebuf, size_t size)
 	 */
 #ifdef __linux__
 	p->opt.protocol = 0;
+	p->opt.fanout_group = -1;	/* don't join a fanout group */
+	p->opt.fanout_mode = 0;
+	p->opt.qdisc_bypass = 0;
+	p->opt.ebpf_filter = 0;
 #endif
 #ifdef _WIN32
 	p->opt.nocapture_local = 0;
@@ -3626,7 +3630,7 @@ pcap_cleanup_live_common(pcap_t *p)
 		p->tstamp_precision_list = NULL;
 		p->tstamp_precision_count = 0;
 	}
-	pcap_freecode(&p->fcode);
+	uninstall_bpf_program(p);
 #if !defined(_WIN32) && !defined(MSDOS)
 	if (p->fd >= 0) {
 		close(p->fd);
@@ -3687,6 +3691,47 @@ pcap_offline_filter(const struct bpf_program *fp, const struct pcap_pkthdr *h,
 		return (0);
 }
 
+/*
+ * Given a BPF program, an array of n pcap_pkthdr structures for packets,
+ * and an array of pointers to the raw data for the packets, check which
+ * of the packets pass the filter, setting verdicts[i] to the value
+ * pcap_offline_filter() would return for packet i.  Returns the number
+ * of packets that pass.
+ */
+#define OFFLINE_FILTER_BATCH	64
+
+int
+pcap_offline_filter_batch(const struct bpf_program *fp,
+    const struct pcap_pkthdr *hdrs, const u_char * const *pkts, int n,
+    int *verdicts)
+{
+	const struct bpf_insn *fcode = fp->bf_insns;
+	u_int wirelens[OFFLINE_FILTER_BATCH];
+	u_int buflens[OFFLINE_FILTER_BATCH];
+	u_int results[OFFLINE_FILTER_BATCH];
+	int base, chunk, i, npassed = 0;
+
+	for (base = 0; base < n; base += chunk) {
+		chunk = n - base;
+		if (chunk > OFFLINE_FILTER_BATCH)
+			chunk = OFFLINE_FILTER_BATCH;
+		if (fcode == NULL) {
+			for (i = 0; i < chunk; i++)
+				verdicts[base + i] = 0;
+			continue;
+		}
+		for (i = 0; i < chunk; i++) {
+			wirelens[i] = hdrs[base + i].len;
+			buflens[i] = hdrs[base + i].caplen;
+		}
+		npassed += (int)bpf_filter_batch(fcode, pkts + base, wirelens,
+		    buflens, (u_int)chunk, results);
+		for (i = 0; i < chunk; i++)
+			verdicts[base + i] = (int)results[i];
+	}
+	return (npassed);
+}
+
 static int
 pcap_can_set_rfmon_dead(pcap_t *p)
 {
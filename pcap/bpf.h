@@ -256,6 +256,7 @@ struct bpf_aux_data {
 
 PCAP_API int bpf_validate(const struct bpf_insn *, int);
 PCAP_API u_int bpf_filter(const struct bpf_insn *, const u_char *, u_int, u_int);
+PCAP_API u_int bpf_filter_batch(const struct bpf_insn *, const u_char * const *, const u_int *, const u_int *, u_int, u_int *);
 extern u_int bpf_filter_with_aux_data(const struct bpf_insn *, const u_char *, u_int, u_int, const struct bpf_aux_data *);
 
 /*
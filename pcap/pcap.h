@@ -117,6 +117,7 @@ typedef	u_int bpf_u_int32;
 
 typedef struct pcap pcap_t;
 typedef struct pcap_dumper pcap_dumper_t;
+typedef struct pcap_ng_dumper pcap_ng_dumper_t;
 typedef struct pcap_if pcap_if_t;
 typedef struct pcap_addr pcap_addr_t;
 
@@ -349,6 +350,14 @@ PCAP_API const char *pcap_tstamp_type_val_to_description(int);
 
 #ifdef __linux__
 PCAP_API int	pcap_set_protocol_linux(pcap_t *, int);
+PCAP_API int	pcap_set_fanout_linux(pcap_t *, int, int, int);
+PCAP_API int	pcap_next_batch_linux(pcap_t *, struct pcap_pkthdr *,
+	    const u_char **, int);
+PCAP_API int	pcap_release_batch_linux(pcap_t *);
+PCAP_API int	pcap_set_qdisc_bypass_linux(pcap_t *, int);
+PCAP_API int	pcap_set_ebpf_filter_linux(pcap_t *, int);
+PCAP_API int	pcap_inject_batch_linux(pcap_t *, const void * const *,
+	    const size_t *, int);
 #endif
 
 /*
@@ -409,6 +418,15 @@ PCAP_API pcap_t	*pcap_open_dead(int, int);
 PCAP_API pcap_t	*pcap_open_dead_with_tstamp_precision(int, int, u_int);
 PCAP_API pcap_t	*pcap_open_offline_with_tstamp_precision(const char *, u_int, char *);
 PCAP_API pcap_t	*pcap_open_offline(const char *, char *);
+PCAP_API pcap_t	*pcap_open_offline_mmap(const char *, u_int, char *);
+PCAP_API pcap_t	*pcap_open_offline_readahead(const char *, u_int, size_t,
+	    char *);
+PCAP_API int	pcap_offline_seek_time(pcap_t *, const struct timeval *);
+PCAP_API int	pcap_offline_partition(const char *, u_int, pcap_t **, u_int,
+	    char *);
+PCAP_API pcap_t	*pcap_open_offline_merge(const char * const *, u_int, u_int,
+	    char *);
+PCAP_API int	pcap_offline_merge_source(pcap_t *);
 #ifdef _WIN32
   PCAP_API pcap_t  *pcap_hopen_offline_with_tstamp_precision(intptr_t, u_int, char *);
   PCAP_API pcap_t  *pcap_hopen_offline(intptr_t, char *);
@@ -458,8 +476,53 @@ PCAP_API int	pcap_compile(pcap_t *, struct bpf_program *, const char *, int,
 PCAP_API int	pcap_compile_nopcap(int, int, struct bpf_program *,
 	    const char *, int, bpf_u_int32);
 PCAP_API void	pcap_freecode(struct bpf_program *);
+
+/*
+ * A filter compiler whose memory is reused from one filter to the next;
+ * see pcap_compiler_create(3PCAP).
+ */
+typedef struct pcap_compiler pcap_compiler_t;
+
+PCAP_API pcap_compiler_t *pcap_compiler_create(char *);
+PCAP_API int	pcap_compiler_compile(pcap_compiler_t *, pcap_t *,
+	    struct bpf_program *, const char *, int, bpf_u_int32);
+PCAP_API void	pcap_compiler_close(pcap_compiler_t *);
+
+/*
+ * How a filter compiler looks up host names that aren't in its host
+ * table; see pcap_compiler_set_resolve(3PCAP).
+ */
+#define PCAP_RESOLVE_SYSTEM	0	/* with the system's resolver */
+#define PCAP_RESOLVE_TABLE_ONLY	1	/* they're unknown */
+
+PCAP_API int	pcap_compiler_set_resolve(pcap_compiler_t *, int, u_int);
+PCAP_API int	pcap_compiler_add_host(pcap_compiler_t *, const char *,
+	    const char *, char *);
+PCAP_API int	pcap_compiler_load_hosts(pcap_compiler_t *, const char *,
+	    char *);
+
+/*
+ * A process-wide cache of compiled filters; see
+ * pcap_compile_cache_set_size(3PCAP).
+ */
+PCAP_API int	pcap_compile_cache_set_size(u_int);
+PCAP_API int	pcap_compile_cache_load(const char *, char *);
+PCAP_API int	pcap_compile_cache_save(const char *, char *);
 PCAP_API int	pcap_offline_filter(const struct bpf_program *,
 	    const struct pcap_pkthdr *, const u_char *);
+PCAP_API int	pcap_offline_filter_batch(const struct bpf_program *,
+	    const struct pcap_pkthdr *, const u_char * const *, int, int *);
+
+/*
+ * A set of filters run together on each packet; see pcap_compile_set(3PCAP).
+ */
+struct bpf_filter_set;
+
+PCAP_API int	pcap_compile_set(pcap_t *, struct bpf_filter_set **,
+	    const char * const *, int, int, bpf_u_int32);
+PCAP_API void	pcap_freecode_set(struct bpf_filter_set *);
+PCAP_API int	pcap_offline_filter_set(struct bpf_filter_set *,
+	    const struct pcap_pkthdr *, const u_char *, bpf_u_int32 *);
 PCAP_API int	pcap_datalink(pcap_t *);
 PCAP_API int	pcap_datalink_ext(pcap_t *);
 PCAP_API int	pcap_list_datalinks(pcap_t *, int **);
@@ -483,6 +546,8 @@ PCAP_API int	pcap_fileno(pcap_t *);
 #endif
 
 PCAP_API pcap_dumper_t *pcap_dump_open(pcap_t *, const char *);
+PCAP_API pcap_dumper_t *pcap_dump_open_buffered(pcap_t *, const char *,
+	    size_t, int);
 PCAP_API pcap_dumper_t *pcap_dump_fopen(pcap_t *, FILE *fp);
 PCAP_API pcap_dumper_t *pcap_dump_open_append(pcap_t *, const char *);
 PCAP_API FILE	*pcap_dump_file(pcap_dumper_t *);
@@ -491,6 +556,68 @@ PCAP_API int64_t	pcap_dump_ftell64(pcap_dumper_t *);
 PCAP_API int	pcap_dump_flush(pcap_dumper_t *);
 PCAP_API void	pcap_dump_close(pcap_dumper_t *);
 PCAP_API void	pcap_dump(u_char *, const struct pcap_pkthdr *, const u_char *);
+PCAP_API int	pcap_dump_batch(pcap_dumper_t *, const struct pcap_pkthdr *,
+	    const u_char * const *, int);
+
+/*
+ * Flags for pcap_dump_open_buffered().
+ */
+#define PCAP_DUMP_DIRECT	0x00000001	/* bypass the page cache (O_DIRECT) */
+
+/*
+ * Writing compressed savefiles; pcap_open_offline() and the other
+ * routines that open savefiles read them without being told.
+ */
+#define PCAP_COMPRESS_ZSTD	1	/* zstd */
+#define PCAP_COMPRESS_LZ4	2	/* LZ4 frame format */
+
+PCAP_API pcap_dumper_t *pcap_dump_open_compressed(pcap_t *, const char *,
+	    int, int);
+
+/*
+ * Writing a series of files, each limited in size or time span,
+ * optionally keeping only the most recent ones.
+ */
+struct pcap_dump_rotate_stat {
+	u_int	rs_files;	/* number of files started */
+	u_int	rs_deleted;	/* number of old files deleted */
+	u_int	rs_stalls;	/* switches that waited for the next file */
+	uint64_t rs_last_usec;	/* time taken by the last switch */
+	uint64_t rs_max_usec;	/* time taken by the slowest switch */
+	uint64_t rs_total_usec;	/* time taken by all switches */
+};
+
+PCAP_API pcap_dumper_t *pcap_dump_open_rotating(pcap_t *, const char *,
+	    uint64_t, u_int, u_int);
+PCAP_API int	pcap_dump_rotate_stats(pcap_dumper_t *,
+	    struct pcap_dump_rotate_stat *);
+
+/*
+ * Writing a savefile along with an index of its time stamps, for
+ * pcap_offline_seek_time().
+ */
+PCAP_API pcap_dumper_t *pcap_dump_open_indexed(pcap_t *, const char *,
+	    u_int, uint64_t);
+
+/*
+ * Writing pcapng files, with any number of interfaces.
+ */
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_open(const char *, char *);
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_open_indexed(const char *, u_int,
+	    uint64_t, char *);
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_fopen(FILE *, char *);
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_open_compressed(const char *, int,
+	    int, char *);
+PCAP_API pcap_ng_dumper_t *pcap_ng_dump_open_merged(pcap_t *, const char *);
+PCAP_API int	pcap_ng_dump_add_interface(pcap_ng_dumper_t *, pcap_t *,
+	    const char *);
+PCAP_API int	pcap_ng_dump(pcap_ng_dumper_t *, int,
+	    const struct pcap_pkthdr *, const u_char *);
+PCAP_API int	pcap_ng_dump_stats(pcap_ng_dumper_t *, int,
+	    const struct pcap_stat *);
+PCAP_API FILE	*pcap_ng_dump_file(pcap_ng_dumper_t *);
+PCAP_API int	pcap_ng_dump_flush(pcap_ng_dumper_t *);
+PCAP_API int	pcap_ng_dump_close(pcap_ng_dumper_t *);
 
 PCAP_API int	pcap_findalldevs(pcap_if_t **, char *);
 PCAP_API void	pcap_freealldevs(pcap_if_t *);
@@ -52,6 +52,10 @@
 
 #include "sf-pcap.h"
 #include "sf-pcapng.h"
+#include "sf-readahead.h"
+#include "sf-index.h"
+#include "sf-merge.h"
+#include "sf-compress.h"
 
 #ifdef _WIN32
 /*
@@ -69,6 +73,8 @@
 static pcap_t *pcap_fopen_offline_with_tstamp_precision(FILE *, u_int, char *);
 static pcap_t *pcap_fopen_offline(FILE *, char *);
 #endif
+static pcap_t *sf_open_offline(const char *, u_int, size_t, char *);
+static pcap_t *sf_fopen_offline(FILE *, u_int, size_t, char *);
 
 /*
  * Setting O_BINARY on DOS/Windows is a bit tricky
@@ -242,12 +248,75 @@ sf_cleanup(pcap_t *p)
 		(void)fclose(p->rfile);
 	if (p->buffer != NULL)
 		free(p->buffer);
-	pcap_freecode(&p->fcode);
+	uninstall_bpf_program(p);
 }
 
+#if defined(HAVE_FSEEKO)
+int64_t
+sf_ftell64(FILE *fp)
+{
+	return (ftello(fp));
+}
+
+int
+sf_fseek64(FILE *fp, int64_t off)
+{
+	return (fseeko(fp, (off_t)off, SEEK_SET));
+}
+#elif defined(_MSC_VER)
+int64_t
+sf_ftell64(FILE *fp)
+{
+	return (_ftelli64(fp));
+}
+
+int
+sf_fseek64(FILE *fp, int64_t off)
+{
+	return (_fseeki64(fp, off, SEEK_SET));
+}
+#else
+/*
+ * As with pcap_dump_ftell64(), fall back on ftell() and fseek().
+ */
+int64_t
+sf_ftell64(FILE *fp)
+{
+	return (ftell(fp));
+}
+
+int
+sf_fseek64(FILE *fp, int64_t off)
+{
+	if ((int64_t)(long)off != off) {
+		errno = EOVERFLOW;
+		return (-1);
+	}
+	return (fseek(fp, (long)off, SEEK_SET));
+}
+#endif
+
 pcap_t *
 pcap_open_offline_with_tstamp_precision(const char *fname, u_int precision,
 					char *errbuf)
+{
+	return (sf_open_offline(fname, precision, 0, errbuf));
+}
+
+/*
+ * Open a savefile and have a thread read up to depth bytes of it ahead
+ * of the packets being processed.
+ */
+pcap_t *
+pcap_open_offline_readahead(const char *fname, u_int precision, size_t depth,
+    char *errbuf)
+{
+	return (sf_open_offline(fname, precision, depth, errbuf));
+}
+
+static pcap_t *
+sf_open_offline(const char *fname, u_int precision, size_t readahead,
+    char *errbuf)
 {
 	FILE *fp;
 	pcap_t *p;
@@ -282,11 +351,19 @@ pcap_open_offline_with_tstamp_precision(const char *fname, u_int precision,
 			return (NULL);
 		}
 	}
-	p = pcap_fopen_offline_with_tstamp_precision(fp, precision, errbuf);
+	p = sf_fopen_offline(fp, precision, readahead, errbuf);
 	if (p == NULL) {
 		if (fp != stdin)
 			fclose(fp);
+		return (NULL);
 	}
+
+	/*
+	 * Remember the file's name, so pcap_offline_seek_time() can
+	 * look for its index; if we can't, it'll do without.
+	 */
+	if (fp != stdin)
+		p->opt.device = strdup(fname);
 	return (p);
 }
 
@@ -297,6 +374,31 @@ pcap_open_offline(const char *fname, char *errbuf)
 	    PCAP_TSTAMP_PRECISION_MICRO, errbuf));
 }
 
+/*
+ * Map a savefile into memory, if its format and the file allow it.
+ */
+static int
+sf_mmap(pcap_t *p)
+{
+	return (sf_pcap_mmap(p) || sf_pcap_ng_mmap(p));
+}
+
+/*
+ * Open a savefile and, if we can, map it into memory rather than
+ * reading it with stdio; there's no point in reading ahead of a
+ * mapping, so we don't.
+ */
+pcap_t *
+pcap_open_offline_mmap(const char *fname, u_int precision, char *errbuf)
+{
+	pcap_t *p;
+
+	p = sf_open_offline(fname, precision, 0, errbuf);
+	if (p != NULL)
+		(void)sf_mmap(p);
+	return (p);
+}
+
 #ifdef _WIN32
 pcap_t* pcap_hopen_offline_with_tstamp_precision(intptr_t osfd, u_int precision,
     char *errbuf)
@@ -338,18 +440,92 @@ static pcap_t *(*check_headers[])(bpf_u_int32, FILE *, u_int, char *, int *) = {
 
 #define	N_FILE_TYPES	(sizeof check_headers / sizeof check_headers[0])
 
+/*
+ * Fill in the operations, and the other members that don't depend on
+ * the file format, for a handle that reads savefiles.
+ */
+void
+sf_setup_ops(pcap_t *p)
+{
+	p->read_op = pcap_offline_read;
+	p->inject_op = sf_inject;
+	p->setfilter_op = install_bpf_program;
+	p->setdirection_op = sf_setdirection;
+	p->set_datalink_op = NULL;	/* we don't support munging link-layer headers */
+	p->getnonblock_op = sf_getnonblock;
+	p->setnonblock_op = sf_setnonblock;
+	p->stats_op = sf_stats;
+#ifdef _WIN32
+	p->stats_ex_op = sf_stats_ex;
+	p->setbuff_op = sf_setbuff;
+	p->setmode_op = sf_setmode;
+	p->setmintocopy_op = sf_setmintocopy;
+	p->getevent_op = sf_getevent;
+	p->oid_get_request_op = sf_oid_get_request;
+	p->oid_set_request_op = sf_oid_set_request;
+	p->sendqueue_transmit_op = sf_sendqueue_transmit;
+	p->setuserbuffer_op = sf_setuserbuffer;
+	p->live_dump_op = sf_live_dump;
+	p->live_dump_ended_op = sf_live_dump_ended;
+	p->get_airpcap_handle_op = sf_get_airpcap_handle;
+#endif
+
+	/*
+	 * For offline captures, the standard one-shot callback can
+	 * be used for pcap_next()/pcap_next_ex().
+	 */
+	p->oneshot_callback = pcap_oneshot;
+
+	/*
+	 * Savefiles never require special BPF code generation.
+	 */
+	p->bpf_codegen_flags = 0;
+
+	p->activated = 1;
+}
+
 #ifdef _WIN32
 static
 #endif
 pcap_t *
 pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
     char *errbuf)
+{
+	return (sf_fopen_offline(fp, precision, 0, errbuf));
+}
+
+static pcap_t *
+sf_fopen_offline(FILE *fp, u_int precision, size_t readahead, char *errbuf)
 {
 	register pcap_t *p;
 	bpf_u_int32 magic;
 	size_t amt_read;
 	u_int i;
-	int err;
+	int err, method;
+	struct sf_decompress *dc = NULL;
+#if !defined(_WIN32) && !defined(MSDOS)
+	int fd = fileno(fp);
+#endif
+#ifdef SF_READAHEAD_SUPPORTED
+	struct sf_readahead *ra = NULL;
+
+	/*
+	 * If we've been asked to, have a thread read the file ahead
+	 * of us, and read from its buffers rather than from fp.
+	 */
+	if (readahead != 0) {
+		ra = sf_readahead_open(fp, readahead, errbuf);
+		if (ra == NULL)
+			return (NULL);
+		fp = sf_readahead_stream(ra);
+	}
+#else
+	if (readahead != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "Reading ahead isn't supported on this platform");
+		return (NULL);
+	}
+#endif
 
 	/*
 	 * Read the first 4 bytes of the file; the network analyzer dump
@@ -359,17 +535,23 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 	 * numbers that are unique in their first 4 bytes.
 	 */
 	amt_read = fread((char *)&magic, 1, sizeof(magic), fp);
-	if (amt_read != sizeof(magic)) {
-		if (ferror(fp)) {
-			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
-			    errno, "error reading dump file");
-		} else {
-			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
-			    "truncated dump file; tried to read %lu file header bytes, only got %lu",
-			    (unsigned long)sizeof(magic),
-			    (unsigned long)amt_read);
-		}
-		return (NULL);
+	if (amt_read != sizeof(magic))
+		goto read_fail;
+
+	/*
+	 * If the file is compressed, read it through a stream that
+	 * decompresses it, and look at the magic number of what's
+	 * inside.
+	 */
+	method = sf_compressed_magic(magic);
+	if (method != 0) {
+		dc = sf_decompress_open(fp, method, magic, errbuf);
+		if (dc == NULL)
+			goto fail;
+		fp = sf_decompress_stream(dc);
+		amt_read = fread((char *)&magic, 1, sizeof(magic), fp);
+		if (amt_read != sizeof(magic))
+			goto read_fail;
 	}
 
 	/*
@@ -385,7 +567,7 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 			/*
 			 * Error trying to read the header.
 			 */
-			return (NULL);
+			goto fail;
 		}
 	}
 
@@ -393,6 +575,28 @@ pcap_fopen_offline_with_tstamp_precision(FILE *fp, u_int precision,
 	 * Well, who knows what this mess is....
 	 */
 	pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE, "unknown file format");
+	goto fail;
+
+read_fail:
+	if (ferror(fp)) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "error reading dump file");
+	} else {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated dump file; tried to read %lu file header bytes, only got %lu",
+		    (unsigned long)sizeof(magic),
+		    (unsigned long)amt_read);
+	}
+fail:
+	/*
+	 * Our caller closes fp.
+	 */
+	if (dc != NULL)
+		sf_decompress_close(dc, 0);
+#ifdef SF_READAHEAD_SUPPORTED
+	if (ra != NULL)
+		sf_readahead_close(ra, 0);
+#endif
 	return (NULL);
 
 found:
@@ -408,45 +612,14 @@ found:
 	 *
 	 * You can't do "select()" on anything other than sockets in
 	 * Windows, so, on Win32 systems, we don't have "selectable_fd".
+	 *
+	 * If we're reading ahead, fp has no descriptor of its own; use
+	 * the file's.
 	 */
-	p->selectable_fd = fileno(fp);
-#endif
-
-	p->read_op = pcap_offline_read;
-	p->inject_op = sf_inject;
-	p->setfilter_op = install_bpf_program;
-	p->setdirection_op = sf_setdirection;
-	p->set_datalink_op = NULL;	/* we don't support munging link-layer headers */
-	p->getnonblock_op = sf_getnonblock;
-	p->setnonblock_op = sf_setnonblock;
-	p->stats_op = sf_stats;
-#ifdef _WIN32
-	p->stats_ex_op = sf_stats_ex;
-	p->setbuff_op = sf_setbuff;
-	p->setmode_op = sf_setmode;
-	p->setmintocopy_op = sf_setmintocopy;
-	p->getevent_op = sf_getevent;
-	p->oid_get_request_op = sf_oid_get_request;
-	p->oid_set_request_op = sf_oid_set_request;
-	p->sendqueue_transmit_op = sf_sendqueue_transmit;
-	p->setuserbuffer_op = sf_setuserbuffer;
-	p->live_dump_op = sf_live_dump;
-	p->live_dump_ended_op = sf_live_dump_ended;
-	p->get_airpcap_handle_op = sf_get_airpcap_handle;
+	p->selectable_fd = fd;
 #endif
 
-	/*
-	 * For offline captures, the standard one-shot callback can
-	 * be used for pcap_next()/pcap_next_ex().
-	 */
-	p->oneshot_callback = pcap_oneshot;
-
-	/*
-	 * Savefiles never require special BPF code generation.
-	 */
-	p->bpf_codegen_flags = 0;
-
-	p->activated = 1;
+	sf_setup_ops(p);
 
 	return (p);
 }
@@ -469,7 +642,6 @@ pcap_fopen_offline(FILE *fp, char *errbuf)
 int
 pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 {
-	struct bpf_insn *fcode;
 	int status = 0;
 	int n = 0;
 	u_char *data;
@@ -501,8 +673,17 @@ pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 			return (status);
 		}
 
-		if ((fcode = p->fcode.bf_insns) == NULL ||
-		    bpf_filter(fcode, data, h.len, h.caplen)) {
+		/*
+		 * We filter one packet at a time rather than collecting
+		 * packets for pcap_offline_filter_batch(): unless the
+		 * file is mapped, each packet's data is overwritten by
+		 * the next one read; the callback may call
+		 * pcap_breakloop() or pcap_setfilter() between packets;
+		 * and the batch interpreter is slower than the native
+		 * or pre-decoded code pcap_filter_packet() runs.
+		 */
+		if (p->fcode.bf_insns == NULL ||
+		    pcap_filter_packet(p, data, h.len, h.caplen, NULL)) {
 			(*callback)(user, &h, data);
 			if (++n >= cnt && cnt > 0)
 				break;
@@ -511,3 +692,435 @@ pcap_offline_read(pcap_t *p, int cnt, pcap_handler callback, u_char *user)
 	/*XXX this breaks semantics tcpslice expects */
 	return (n);
 }
+
+/*
+ * Stop bisecting once the range is smaller than this, and read the
+ * rest.
+ */
+#define SF_BISECT_MIN	(64*1024)
+
+static int
+sf_ts_before(const struct timeval *a, const struct timeval *b)
+{
+	return (a->tv_sec < b->tv_sec ||
+	    (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec));
+}
+
+static int64_t
+sf_file_size(pcap_t *p)
+{
+	int64_t size;
+
+	if (fseek(p->rfile, 0, SEEK_END) == -1 ||
+	    (size = sf_ftell64(p->rfile)) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't seek in dump file");
+		return (-1);
+	}
+	return (size);
+}
+
+/*
+ * With no index, bisect the file, finding packet records at arbitrary
+ * offsets with the format's resync method, to get near the first
+ * packet at or after ts.  This assumes the packets are in time order,
+ * or close to it.
+ */
+static int
+sf_bisect_time(pcap_t *p, const struct timeval *ts)
+{
+	struct pcap_pkthdr h;
+	int64_t lo, hi, mid, off;
+	u_int lo_nifs, nifs;
+	int status;
+
+	status = p->sf_resync_op(p, 0, &lo, &h, &lo_nifs);
+	if (status != 0)
+		return (status == 1 ? 0 : -1);	/* no packets, or error */
+	if ((hi = sf_file_size(p)) == -1)
+		return (-1);
+	if (sf_ts_before(&h.ts, ts)) {
+		while (hi - lo > SF_BISECT_MIN) {
+			mid = lo + (hi - lo) / 2;
+			status = p->sf_resync_op(p, mid, &off, &h, &nifs);
+			if (status == -1)
+				return (-1);
+			if (status == 0 && sf_ts_before(&h.ts, ts)) {
+				lo = off;
+				lo_nifs = nifs;
+			} else
+				hi = mid;
+		}
+	}
+	return (p->sf_seek_op(p, lo, lo_nifs));
+}
+
+/*
+ * Check that an index entry found by sf_index_find() is for this
+ * savefile, rather than one that's since been written over it: the
+ * first packet has to be where, and from when, the index says, and
+ * the entry has to point to a plausible packet record.  Returns 0 if
+ * it looks right, 1 if it doesn't, and -1 on an error.
+ */
+static int
+sf_index_check(pcap_t *p, const struct sf_index_hit *hit)
+{
+	struct pcap_pkthdr h;
+	u_char *data;
+	uint64_t ts, first_ts;
+	int64_t off;
+	u_int nifs;
+	int status;
+
+	if (p->sf_seek_op(p, (int64_t)hit->first_offset,
+	    hit->first_nifs) == -1)
+		return (-1);
+	status = p->next_packet_op(p, &h, &data);
+	if (status != 0)
+		return (status);
+	first_ts = hit->first_ts;
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO)
+		ts = (uint64_t)h.ts.tv_sec * 1000000000 +
+		    (uint64_t)h.ts.tv_usec;
+	else {
+		ts = (uint64_t)h.ts.tv_sec * 1000000000 +
+		    (uint64_t)h.ts.tv_usec * 1000;
+		first_ts -= first_ts % 1000;
+	}
+	if (ts != first_ts)
+		return (1);
+
+	if (p->sf_resync_op != NULL) {
+		status = p->sf_resync_op(p, (int64_t)hit->offset, &off, &h,
+		    &nifs);
+		if (status != 0)
+			return (status);
+		if (off != (int64_t)hit->offset)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Make the first packet with a time stamp at or after ts, in the time
+ * stamp precision of p, the next packet read from p.  If p's savefile
+ * has an index, use it; otherwise, search the file as best we can.
+ */
+int
+pcap_offline_seek_time(pcap_t *p, const struct timeval *ts)
+{
+	struct pcap_pkthdr h;
+	u_char *data;
+	struct sf_index_hit hit;
+	uint64_t target;
+	int64_t size, off;
+	int status;
+
+	if (p->rfile == NULL || p->sf_seek_op == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "Seeking is supported only on savefiles");
+		return (PCAP_ERROR);
+	}
+
+	status = 1;
+	if (p->opt.device != NULL && ts->tv_sec >= 0) {
+		target = (uint64_t)ts->tv_sec * 1000000000 +
+		    (uint64_t)ts->tv_usec *
+		    (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO ?
+		     1 : 1000);
+		if ((size = sf_file_size(p)) == -1)
+			return (PCAP_ERROR);
+		status = sf_index_find(p->opt.device, size, target, &hit,
+		    p->errbuf);
+		if (status == 0)
+			status = sf_index_check(p, &hit);
+		if (status == -1)
+			return (PCAP_ERROR);
+	}
+	if (status == 0)
+		status = p->sf_seek_op(p, (int64_t)hit.offset, hit.nifs);
+	else if (p->sf_resync_op != NULL)
+		status = sf_bisect_time(p, ts);
+	else
+		status = p->sf_seek_op(p, 0, 0);
+	if (status == -1)
+		return (PCAP_ERROR);
+
+	/*
+	 * We're at or before the packet we want; read forward to it,
+	 * and then back up to the beginning of its record.
+	 */
+	for (;;) {
+		off = p->sf_tell_op(p);
+		if (off == -1) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't get the position in the dump file");
+			return (PCAP_ERROR);
+		}
+		status = p->next_packet_op(p, &h, &data);
+		if (status == 1)
+			return (0);	/* EOF; there's no such packet */
+		if (status == -1)
+			return (PCAP_ERROR);
+		if (!sf_ts_before(&h.ts, ts))
+			break;
+	}
+	if (p->sf_seek_op(p, off, 0) == -1)
+		return (PCAP_ERROR);
+	return (0);
+}
+
+/*
+ * next_packet_op for a handle from pcap_offline_partition(): hand out
+ * packets until we get to the end of our part of the file, which is
+ * the start of the next part's first packet record.
+ */
+static int
+sf_chunk_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	int64_t off, end;
+	int status;
+
+	off = p->sf_tell_op(p);
+	if (off == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "can't get the position in the dump file");
+		return (-1);
+	}
+	if (off >= p->sf_end)
+		return (1);
+	status = p->sf_chunk_next_op(p, hdr, data);
+	if (status != 0)
+		return (status);
+	end = p->sf_tell_op(p);
+	if (end > p->sf_end) {
+		if (p->sf_packets_only) {
+			/*
+			 * This record starts before our end and ends
+			 * after it, so our end isn't really the start
+			 * of a record; the resync that found it was
+			 * fooled, and the next part's packets are
+			 * garbage.
+			 */
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "the packet record at offset %" PRId64
+			    " runs past the end of this part, at %" PRId64
+			    "; the file was split at a false record boundary",
+			    off, p->sf_end);
+			return (-1);
+		}
+
+		/*
+		 * We skipped over some other records, such as pcapng
+		 * IDBs, to get to the next packet, and it's after our
+		 * end; that's the next part's first packet.
+		 */
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * How far past a split point sf_partition_check() reads: further than
+ * the end of the biggest record, header and all, that could contain it.
+ */
+#define SF_PARTITION_CHECK	(MAXIMUM_SNAPLEN + 1024)
+
+/*
+ * Is off, which the resync found, really the start of a record?  A
+ * sequence of plausible records in a packet's data, such as a pcap
+ * file being transferred over the network, can fool the resync, but
+ * can't carry on in step past the end of that packet, so read the
+ * records from off until we're past the end of any record that could
+ * contain it.  Returns 0 if off is the start of a record, 1, with
+ * *next set to where the records stopped making sense, if it isn't,
+ * and -1 on an error.
+ */
+static int
+sf_partition_check(pcap_t *p, int64_t off, u_int nifs, int64_t *next)
+{
+	struct pcap_pkthdr h;
+	u_char *data;
+	int64_t pos;
+	int status;
+
+	if (p->sf_seek_op(p, off, nifs) == -1)
+		return (-1);
+	for (;;) {
+		pos = p->sf_tell_op(p);
+		if (pos == -1) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "can't get the position in the dump file");
+			return (-1);
+		}
+		if (pos - off > SF_PARTITION_CHECK)
+			return (0);
+		status = p->next_packet_op(p, &h, &data);
+		if (status == 1)
+			return (0);	/* the records end at the end of the file */
+		if (status == -1) {
+			*next = pos > off ? pos : off + 1;
+			return (1);
+		}
+	}
+}
+
+/*
+ * Split a savefile into at most nchunks parts, each starting at a
+ * packet record, and open a handle for each, which reads only the
+ * packets in its part.
+ */
+int
+pcap_offline_partition(const char *fname, u_int precision, pcap_t **chunks,
+    u_int nchunks, char *errbuf)
+{
+	pcap_t *p;
+	struct pcap_pkthdr h;
+	int64_t *bounds, start, size, off;
+	u_int *nifs, n, i;
+	int status;
+
+	if (nchunks == 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "The number of parts must be at least 1");
+		return (PCAP_ERROR);
+	}
+	if (fname != NULL && fname[0] == '-' && fname[1] == '\0') {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "The standard input can't be split into parts");
+		return (PCAP_ERROR);
+	}
+	bounds = calloc(nchunks, sizeof(*bounds));
+	nifs = calloc(nchunks, sizeof(*nifs));
+	if (bounds == NULL || nifs == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(bounds);
+		free(nifs);
+		return (PCAP_ERROR);
+	}
+
+	/*
+	 * Each part's handle reads from its own mapping or stream, so
+	 * the parts can be read by different threads at the same time.
+	 */
+	p = sf_open_offline(fname, precision, 0, errbuf);
+	if (p == NULL)
+		goto fail;
+	(void)sf_mmap(p);
+	if (p->sf_resync_op == NULL) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "Files in this format can't be split into parts");
+		pcap_close(p);
+		goto fail;
+	}
+
+	/*
+	 * Find the first packet record at or after each of the points
+	 * that split the packet data evenly; parts that would be
+	 * empty, because there's a packet record bigger than a part,
+	 * or because there are no packets after that point, are
+	 * dropped.
+	 */
+	start = p->sf_tell_op(p);
+	if (start == -1 || (size = sf_file_size(p)) == -1)
+		goto fail_p;
+	bounds[0] = start;
+	nifs[0] = 0;
+	n = 1;
+	for (i = 1; i < nchunks; i++) {
+		off = start + (size - start) / nchunks * i;
+		for (;;) {
+			status = p->sf_resync_op(p, off, &off, &h, &nifs[n]);
+			if (status != 0)
+				break;
+			status = sf_partition_check(p, off, nifs[n], &off);
+			if (status != 1)
+				break;
+			/* a false boundary; look further on */
+		}
+		if (status == -1)
+			goto fail_p;
+		if (status == 1)
+			break;
+		if (off > bounds[n - 1])
+			bounds[n++] = off;
+	}
+	if (p->sf_seek_op(p, start, 0) == -1)
+		goto fail_p;
+	chunks[0] = p;
+
+	for (i = 1; i < n; i++) {
+		p = sf_open_offline(fname, precision, 0, errbuf);
+		if (p == NULL)
+			goto fail_chunks;
+		(void)sf_mmap(p);
+		if (p->sf_seek_op(p, bounds[i], nifs[i]) == -1)
+			goto fail_p_chunks;
+		chunks[i] = p;
+	}
+	for (i = 0; i + 1 < n; i++) {
+		chunks[i]->sf_end = bounds[i + 1];
+		chunks[i]->sf_chunk_next_op = chunks[i]->next_packet_op;
+		chunks[i]->next_packet_op = sf_chunk_next_packet;
+	}
+	free(bounds);
+	free(nifs);
+	return ((int)n);
+
+fail_p_chunks:
+	strlcpy(errbuf, p->errbuf, PCAP_ERRBUF_SIZE);
+	pcap_close(p);
+fail_chunks:
+	while (i > 0)
+		pcap_close(chunks[--i]);
+	goto fail;
+fail_p:
+	strlcpy(errbuf, p->errbuf, PCAP_ERRBUF_SIZE);
+	pcap_close(p);
+fail:
+	free(bounds);
+	free(nifs);
+	return (PCAP_ERROR);
+}
+
+/*
+ * Open a list of savefiles and return a handle that reads the packets
+ * in all of them in time stamp order.
+ */
+pcap_t *
+pcap_open_offline_merge(const char * const *fnames, u_int nfiles,
+    u_int precision, char *errbuf)
+{
+	pcap_t **sources, *p;
+	u_int i;
+
+	if (nfiles == 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "At least one file must be given");
+		return (NULL);
+	}
+	sources = calloc(nfiles, sizeof(*sources));
+	if (sources == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	for (i = 0; i < nfiles; i++) {
+		sources[i] = sf_open_offline(fnames[i], precision, 0, errbuf);
+		if (sources[i] == NULL)
+			goto fail;
+		(void)sf_mmap(sources[i]);
+	}
+	p = sf_merge_open(sources, nfiles, precision, errbuf);
+	if (p == NULL)
+		goto fail;
+	free(sources);
+	return (p);
+
+fail:
+	while (i > 0)
+		pcap_close(sources[--i]);
+	free(sources);
+	return (NULL);
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Large-buffer output streams for savefile writers.
+ *
+ * pcap_dumper_t is a FILE *, and pcap_dump() and friends write to it
+ * with stdio, so a buffered dumper is a stdio stream whose buffer is
+ * large and aligned, and whose output goes through our own write
+ * routine, made with fopencookie() or funopen().  Packet headers and
+ * data are gathered in the buffer, and a full buffer is written with
+ * one write().
+ *
+ * If asked to, we open the file with O_DIRECT.  Writes that bypass the
+ * page cache must be of whole blocks, from aligned memory, at aligned
+ * offsets, so anything less than a block left at the end of a write is
+ * kept in an aligned "bounce" buffer and written again once the block
+ * is full; in the meantime it's written with pwrite(), with O_DIRECT
+ * turned off, so that the file is complete whenever the stream has been
+ * flushed.
+ */
+
+/*
+ * fopencookie() is a GNU extension, as is O_DIRECT.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "sf-bufwrite.h"
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+#define SF_BUFWRITE_SUPPORTED
+#endif
+
+/*
+ * Smallest buffer we'll use.
+ */
+#define SF_BUFWRITE_MINBUF	(64*1024)
+
+#ifdef SF_BUFWRITE_SUPPORTED
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Alignment of buffers, and of the sizes and offsets of O_DIRECT
+ * writes; this is at least the logical block size of any device
+ * we're likely to see.
+ */
+#define SF_BUFWRITE_ALIGN	4096
+
+struct sf_bufwrite {
+	int	fd;
+	int	close_fd;	/* close fd when we're closed */
+	u_char	*buf;		/* the stream's buffer */
+	size_t	bufsize;
+	off_t	pos;		/* file offset of the end of what we've written */
+
+	/*
+	 * Used only with O_DIRECT.
+	 */
+	int	direct;		/* fd was opened with O_DIRECT */
+	u_char	*bounce;	/* data not yet written with O_DIRECT */
+	size_t	blen;		/* amount of data in bounce */
+	off_t	doff;		/* file offset at which bounce goes */
+};
+
+static int
+sf_bufwrite_all(int fd, const u_char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len != 0) {
+		n = write(fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+#ifdef O_DIRECT
+/*
+ * Put the partial block at the end of the bounce buffer in the file,
+ * without moving the file offset, so the next aligned write starts
+ * with that block.
+ */
+static int
+sf_bufwrite_tail(struct sf_bufwrite *w)
+{
+	int flags, ret = 0;
+	ssize_t n;
+
+	flags = fcntl(w->fd, F_GETFL);
+	if (flags == -1 || fcntl(w->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+		return (-1);
+	do {
+		n = pwrite(w->fd, w->bounce, w->blen, w->doff);
+	} while (n == -1 && errno == EINTR);
+	if (n != (ssize_t)w->blen) {
+		if (n != -1)
+			errno = EIO;
+		ret = -1;
+	}
+	if (fcntl(w->fd, F_SETFL, flags) == -1)
+		ret = -1;
+	return (ret);
+}
+
+static int
+sf_bufwrite_direct(struct sf_bufwrite *w, const u_char *data, size_t size)
+{
+	size_t n, aligned;
+
+	/*
+	 * When stdio flushes a full buffer, it hands us the buffer we
+	 * gave it, which is aligned; if we have nothing left over from
+	 * last time, write the whole blocks in it straight from there.
+	 */
+	if (w->blen == 0 && data == w->buf) {
+		aligned = size & ~(size_t)(SF_BUFWRITE_ALIGN - 1);
+		if (aligned != 0) {
+			if (sf_bufwrite_all(w->fd, data, aligned) == -1)
+				return (-1);
+			w->doff += aligned;
+			data += aligned;
+			size -= aligned;
+		}
+	}
+
+	/*
+	 * Anything else goes through the bounce buffer.
+	 */
+	while (size != 0) {
+		n = w->bufsize - w->blen;
+		if (n > size)
+			n = size;
+		memcpy(w->bounce + w->blen, data, n);
+		w->blen += n;
+		data += n;
+		size -= n;
+		if (w->blen != w->bufsize && size != 0)
+			continue;
+		aligned = w->blen & ~(size_t)(SF_BUFWRITE_ALIGN - 1);
+		if (aligned != 0) {
+			if (sf_bufwrite_all(w->fd, w->bounce, aligned) == -1)
+				return (-1);
+			w->doff += aligned;
+			w->blen -= aligned;
+			memmove(w->bounce, w->bounce + aligned, w->blen);
+		}
+	}
+	if (w->blen != 0)
+		return (sf_bufwrite_tail(w));
+	return (0);
+}
+#endif /* O_DIRECT */
+
+static ssize_t
+sf_bufwrite_write(void *cookie, const char *data, size_t size)
+{
+	struct sf_bufwrite *w = cookie;
+	int ret;
+
+#ifdef O_DIRECT
+	if (w->direct)
+		ret = sf_bufwrite_direct(w, (const u_char *)data, size);
+	else
+#endif
+		ret = sf_bufwrite_all(w->fd, (const u_char *)data, size);
+	if (ret == -1)
+		return (-1);
+	w->pos += (off_t)size;
+	return ((ssize_t)size);
+}
+
+static int
+sf_bufwrite_close(void *cookie)
+{
+	struct sf_bufwrite *w = cookie;
+	int ret = 0;
+
+	if (w->close_fd && close(w->fd) == -1)
+		ret = -1;
+	free(w->buf);
+	free(w->bounce);
+	free(w);
+	return (ret);
+}
+
+/*
+ * We can only say where we are, which is all ftell() needs.
+ */
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_bufwrite_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sf_bufwrite *w = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	*offset = w->pos;
+	return (0);
+}
+#else
+static int
+sf_bufwrite_funopen_write(void *cookie, const char *data, int size)
+{
+	return ((int)sf_bufwrite_write(cookie, data, (size_t)size));
+}
+
+static fpos_t
+sf_bufwrite_seek(void *cookie, fpos_t offset, int whence)
+{
+	struct sf_bufwrite *w = cookie;
+
+	if (whence != SEEK_CUR || offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	return (w->pos);
+}
+#endif
+
+FILE *
+sf_bufwrite_open(const char *fname, size_t bufsize, int flags, char *errbuf)
+{
+	struct sf_bufwrite *w;
+	FILE *f;
+	int oflags, err;
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+
+	if (bufsize < SF_BUFWRITE_MINBUF)
+		bufsize = SF_BUFWRITE_MINBUF;
+	bufsize = (bufsize + SF_BUFWRITE_ALIGN - 1) &
+	    ~(size_t)(SF_BUFWRITE_ALIGN - 1);
+	w->bufsize = bufsize;
+
+	if (fname == NULL) {
+		/*
+		 * Write to the standard output; anything already
+		 * written to stdout has to go first.  O_DIRECT makes
+		 * no sense here, so we ignore PCAP_DUMP_DIRECT.
+		 */
+		(void)fflush(stdout);
+		w->fd = fileno(stdout);
+		fname = "standard output";
+	} else {
+		oflags = O_WRONLY|O_CREAT|O_TRUNC;
+		if (flags & PCAP_DUMP_DIRECT) {
+#ifdef O_DIRECT
+			oflags |= O_DIRECT;
+			w->direct = 1;
+#else
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: direct I/O isn't supported on this platform",
+			    fname);
+			free(w);
+			return (NULL);
+#endif
+		}
+		w->fd = open(fname, oflags, 0666);
+		if (w->fd == -1) {
+			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "%s", fname);
+			free(w);
+			return (NULL);
+		}
+		w->close_fd = 1;
+	}
+	w->pos = lseek(w->fd, 0, SEEK_CUR);
+	if (w->pos == -1)
+		w->pos = 0;	/* a pipe */
+	w->doff = w->pos;
+
+	err = posix_memalign((void **)&w->buf, SF_BUFWRITE_ALIGN, bufsize);
+	if (err == 0 && w->direct) {
+		err = posix_memalign((void **)&w->bounce, SF_BUFWRITE_ALIGN,
+		    bufsize);
+	}
+	if (err != 0) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    err, "malloc");
+		goto fail;
+	}
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = NULL;
+	funcs.write = sf_bufwrite_write;
+	funcs.seek = sf_bufwrite_seek;
+	funcs.close = sf_bufwrite_close;
+	f = fopencookie(w, "wb", funcs);
+#else
+	f = funopen(w, NULL, sf_bufwrite_funopen_write, sf_bufwrite_seek,
+	    sf_bufwrite_close);
+#endif
+	if (f == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s: can't create output stream", fname);
+		goto fail;
+	}
+	if (setvbuf(f, (char *)w->buf, _IOFBF, bufsize) != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: can't set output buffer", fname);
+		(void)fclose(f);
+		return (NULL);
+	}
+	return (f);
+
+fail:
+	if (w->close_fd)
+		(void)close(w->fd);
+	free(w->buf);
+	free(w->bounce);
+	free(w);
+	return (NULL);
+}
+
+#else /* SF_BUFWRITE_SUPPORTED */
+
+/*
+ * All we can do is ask stdio for a big buffer.
+ */
+FILE *
+sf_bufwrite_open(const char *fname, size_t bufsize, int flags, char *errbuf)
+{
+	FILE *f;
+
+	if (flags & PCAP_DUMP_DIRECT) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: direct I/O isn't supported on this platform",
+		    fname == NULL ? "standard output" : fname);
+		return (NULL);
+	}
+	if (fname == NULL)
+		return (stdout);
+	f = fopen(fname, "wb");
+	if (f == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		return (NULL);
+	}
+	if (bufsize < SF_BUFWRITE_MINBUF)
+		bufsize = SF_BUFWRITE_MINBUF;
+	(void)setvbuf(f, NULL, _IOFBF, bufsize);
+	return (f);
+}
+
+#endif /* SF_BUFWRITE_SUPPORTED */
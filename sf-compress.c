@@ -0,0 +1,1042 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Compressed savefiles.
+ *
+ * A compressed savefile is a pcap or pcapng file compressed, as a
+ * whole, with zstd or LZ4 (in the LZ4 frame format, as the lz4
+ * command writes it), so it can also be made, or unpacked, with the
+ * zstd and lz4 commands.  Neither format's magic number can be
+ * mistaken for a savefile's, so sf_fopen_offline() checks for them
+ * before trying the savefile formats and, if it finds one, reads the
+ * file through a stdio stream, made with fopencookie() or funopen(),
+ * that decompresses it; sf-pcap.c and sf-pcapng.c read that stream as
+ * they would the file itself, and don't need to know.
+ *
+ * Writing goes the other way: the dumper is a stream whose output is
+ * compressed before it's written.  Compressing is much slower than
+ * gathering packets, so, if we have pthreads, the stream's write
+ * routine just copies what it's handed into a ring of large buffers,
+ * and a helper thread compresses full buffers and writes the result;
+ * the thread writing packets only waits if the compressor falls a
+ * whole ring behind.
+ */
+
+/*
+ * fopencookie() is a GNU extension.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "sf-compress.h"
+
+/*
+ * The formats' magic numbers, as they appear in the file.
+ */
+static const u_char sf_zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+static const u_char sf_lz4_magic[4] = { 0x04, 0x22, 0x4D, 0x18 };
+
+int
+sf_compressed_magic(bpf_u_int32 magic)
+{
+	if (memcmp(&magic, sf_zstd_magic, sizeof(magic)) == 0)
+		return (PCAP_COMPRESS_ZSTD);
+	if (memcmp(&magic, sf_lz4_magic, sizeof(magic)) == 0)
+		return (PCAP_COMPRESS_LZ4);
+	return (0);
+}
+
+/*
+ * Return 1 if we can compress and decompress with method, otherwise
+ * put an error message in errbuf and return 0.
+ */
+static int
+sf_compress_check(int method, char *errbuf)
+{
+	const char *name;
+
+	switch (method) {
+
+	case PCAP_COMPRESS_ZSTD:
+#if defined(SF_COMPRESS_SUPPORTED) && defined(HAVE_LIBZSTD)
+		return (1);
+#else
+		name = "zstd";
+		break;
+#endif
+
+	case PCAP_COMPRESS_LZ4:
+#if defined(SF_COMPRESS_SUPPORTED) && defined(HAVE_LIBLZ4)
+		return (1);
+#else
+		name = "LZ4";
+		break;
+#endif
+
+	default:
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "unknown compression method %d", method);
+		return (0);
+	}
+	pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "%s-compressed savefiles aren't supported by this version of libpcap",
+	    name);
+	return (0);
+}
+
+#ifdef SF_COMPRESS_SUPPORTED
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+
+/*
+ * Amount of compressed data we read at a time, and the size of the
+ * buffer of the stream from which the decompressed data is read.
+ */
+#define SF_DECOMPRESS_INBUF	(128*1024)
+#define SF_DECOMPRESS_OUTBUF	(64*1024)
+
+struct sf_decompress {
+	FILE	*fp;		/* the compressed file */
+	int	close_fp;	/* close fp when we're closed */
+	FILE	*stream;	/* the stream we hand to the parser */
+	int	method;
+	u_char	*inbuf;
+	size_t	inlen;		/* amount of data in inbuf */
+	size_t	inoff;		/* offset of the next byte to decompress */
+	int	eof;		/* we've read all of fp */
+	int	pending;	/* the decompressor may have output left */
+	off_t	pos;		/* amount of data handed to the parser */
+#ifdef HAVE_LIBZSTD
+	ZSTD_DStream *zds;
+#endif
+#ifdef HAVE_LIBLZ4
+	LZ4F_dctx *lz4d;
+#endif
+};
+
+/*
+ * Decompress what we can of what's in inbuf into buf, which has *got
+ * bytes in it already and room for size bytes.
+ */
+static int
+sf_decompress_step(struct sf_decompress *dc, char *buf, size_t size,
+    size_t *got)
+{
+#ifdef HAVE_LIBZSTD
+	if (dc->method == PCAP_COMPRESS_ZSTD) {
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+
+		in.src = dc->inbuf;
+		in.size = dc->inlen;
+		in.pos = dc->inoff;
+		out.dst = buf;
+		out.size = size;
+		out.pos = *got;
+		if (ZSTD_isError(ZSTD_decompressStream(dc->zds, &out, &in)))
+			return (-1);
+		dc->inoff = in.pos;
+		*got = out.pos;
+	}
+#endif
+#ifdef HAVE_LIBLZ4
+	if (dc->method == PCAP_COMPRESS_LZ4) {
+		size_t dstsize, srcsize;
+
+		dstsize = size - *got;
+		srcsize = dc->inlen - dc->inoff;
+		if (LZ4F_isError(LZ4F_decompress(dc->lz4d, buf + *got,
+		    &dstsize, dc->inbuf + dc->inoff, &srcsize, NULL)))
+			return (-1);
+		dc->inoff += srcsize;
+		*got += dstsize;
+	}
+#endif
+
+	/*
+	 * If we filled the buffer, there may be more where that came
+	 * from, even if we've used up our input.
+	 */
+	dc->pending = (*got == size);
+	return (0);
+}
+
+static ssize_t
+sf_decompress_read(void *cookie, char *buf, size_t size)
+{
+	struct sf_decompress *dc = cookie;
+	size_t got = 0, n;
+
+	while (got < size) {
+		if (dc->inoff == dc->inlen && !dc->pending) {
+			/*
+			 * Don't wait for more input if we have
+			 * something to hand back.
+			 */
+			if (dc->eof || got != 0)
+				break;
+			n = fread(dc->inbuf, 1, SF_DECOMPRESS_INBUF, dc->fp);
+			if (n == 0) {
+				if (ferror(dc->fp))
+					return (-1);
+				/*
+				 * If that was the middle of a frame,
+				 * the file is truncated; the parser
+				 * will find that out for itself.
+				 */
+				dc->eof = 1;
+				break;
+			}
+			dc->inlen = n;
+			dc->inoff = 0;
+		}
+		if (sf_decompress_step(dc, buf, size, &got) == -1) {
+			errno = EIO;
+			return (-1);
+		}
+	}
+	dc->pos += (off_t)got;
+	return ((ssize_t)got);
+}
+
+/*
+ * We can't seek in the decompressed data; we can only say where we
+ * are, for ftell().
+ */
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_decompress_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sf_decompress *dc = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	*offset = dc->pos;
+	return (0);
+}
+#else
+static fpos_t
+sf_decompress_seek(void *cookie, fpos_t offset, int whence)
+{
+	struct sf_decompress *dc = cookie;
+
+	if (whence != SEEK_CUR || offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	return (dc->pos);
+}
+#endif
+
+static void
+sf_decompress_free(struct sf_decompress *dc)
+{
+#ifdef HAVE_LIBZSTD
+	if (dc->zds != NULL)
+		(void)ZSTD_freeDStream(dc->zds);
+#endif
+#ifdef HAVE_LIBLZ4
+	if (dc->lz4d != NULL)
+		(void)LZ4F_freeDecompressionContext(dc->lz4d);
+#endif
+	free(dc->inbuf);
+	free(dc);
+}
+
+static int
+sf_decompress_close_cookie(void *cookie)
+{
+	struct sf_decompress *dc = cookie;
+
+	if (dc->close_fp)
+		(void)fclose(dc->fp);
+	sf_decompress_free(dc);
+	return (0);
+}
+
+#if defined(HAVE_FUNOPEN) && !defined(HAVE_FOPENCOOKIE)
+static int
+sf_decompress_funopen_read(void *cookie, char *buf, int size)
+{
+	return ((int)sf_decompress_read(cookie, buf, (size_t)size));
+}
+#endif
+
+struct sf_decompress *
+sf_decompress_open(FILE *fp, int method, bpf_u_int32 magic, char *errbuf)
+{
+	struct sf_decompress *dc;
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	if (!sf_compress_check(method, errbuf))
+		return (NULL);
+	dc = calloc(1, sizeof(*dc));
+	if (dc == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	dc->fp = fp;
+	dc->close_fp = (fp != stdin);
+	dc->method = method;
+
+	/*
+	 * The magic number is the start of the compressed data.
+	 */
+	dc->inbuf = malloc(SF_DECOMPRESS_INBUF);
+	if (dc->inbuf == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		goto fail;
+	}
+	memcpy(dc->inbuf, &magic, sizeof(magic));
+	dc->inlen = sizeof(magic);
+
+#ifdef HAVE_LIBZSTD
+	if (method == PCAP_COMPRESS_ZSTD) {
+		dc->zds = ZSTD_createDStream();
+		if (dc->zds == NULL ||
+		    ZSTD_isError(ZSTD_initDStream(dc->zds))) {
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "can't create zstd decompressor");
+			goto fail;
+		}
+	}
+#endif
+#ifdef HAVE_LIBLZ4
+	if (method == PCAP_COMPRESS_LZ4 &&
+	    LZ4F_isError(LZ4F_createDecompressionContext(&dc->lz4d,
+	    LZ4F_VERSION))) {
+		dc->lz4d = NULL;
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't create LZ4 decompressor");
+		goto fail;
+	}
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = sf_decompress_read;
+	funcs.write = NULL;
+	funcs.seek = sf_decompress_seek;
+	funcs.close = sf_decompress_close_cookie;
+	dc->stream = fopencookie(dc, "rb", funcs);
+#else
+	dc->stream = funopen(dc, sf_decompress_funopen_read, NULL,
+	    sf_decompress_seek, sf_decompress_close_cookie);
+#endif
+	if (dc->stream == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't create decompressing stream");
+		goto fail;
+	}
+
+	/*
+	 * Have stdio ask us for data in large pieces, so we don't
+	 * call the decompressor for every packet header.
+	 */
+	setvbuf(dc->stream, NULL, _IOFBF, SF_DECOMPRESS_OUTBUF);
+	return (dc);
+
+fail:
+	sf_decompress_free(dc);
+	return (NULL);
+}
+
+FILE *
+sf_decompress_stream(struct sf_decompress *dc)
+{
+	return (dc->stream);
+}
+
+void
+sf_decompress_close(struct sf_decompress *dc, int close_fp)
+{
+	dc->close_fp = close_fp;
+	(void)fclose(dc->stream);
+}
+
+/*
+ * Size of each buffer in the ring of data waiting to be compressed,
+ * and the number of buffers; the stream's own buffer is smaller, as
+ * what's in it is copied to the ring.
+ */
+#define SF_COMPRESS_BUFSIZE	(1024*1024)
+#define SF_COMPRESS_NBUFS	4
+#define SF_COMPRESS_STDIO_BUFSIZE	(64*1024)
+
+struct sf_cbuf {
+	u_char	*data;
+	size_t	len;		/* amount of data in the buffer */
+};
+
+struct sf_compress {
+	FILE	*stream;
+	int	fd;
+	int	close_fd;	/* close fd when we're closed */
+	int	method;
+	off_t	pos;		/* amount of data written to the stream */
+	int	failed;		/* errno from a failed write, or 0 */
+	u_char	*out;		/* compressed data */
+	size_t	outsize;
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx *zcs;
+#endif
+#ifdef HAVE_LIBLZ4
+	LZ4F_cctx *lz4c;
+#endif
+
+#ifdef HAVE_PTHREADS
+	struct sf_cbuf bufs[SF_COMPRESS_NBUFS];
+	u_int	fill;		/* buffer the stream's filling */
+	pthread_t thread;
+	int	thread_started;
+	pthread_mutex_t mtx;	/* protects what follows */
+	pthread_cond_t filled;	/* signalled when a buffer is filled */
+	pthread_cond_t drained;	/* signalled when a buffer is compressed */
+	u_int	head;		/* next buffer to compress */
+	u_int	count;		/* number of full buffers */
+	int	err;		/* errno from the thread's failed write, or 0 */
+	int	stop;		/* the thread should exit */
+#endif
+	struct sf_compress *next;	/* next on the list of compressing streams */
+};
+
+/*
+ * Open compressing streams, so sf_compress_flush() can find them.
+ */
+static struct sf_compress *sf_compress_list;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t sf_compress_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * What sf_compress_data() does once it's compressed the data.
+ */
+#define SF_COMPRESS_CONTINUE	0	/* nothing more */
+#define SF_COMPRESS_FLUSH	1	/* write out all of it */
+#define SF_COMPRESS_END		2	/* write out all of it, and finish */
+
+static int
+sf_compress_write_all(int fd, const u_char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len != 0) {
+		n = write(fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+/*
+ * Compress len bytes of data and write out what the compressor hands
+ * back, and then do what mode says.  Returns -1, with errno set, on an
+ * error.
+ */
+static int
+sf_compress_data(struct sf_compress *c, const u_char *data, size_t len,
+    int mode)
+{
+#ifdef HAVE_LIBZSTD
+	if (c->method == PCAP_COMPRESS_ZSTD) {
+		ZSTD_inBuffer in;
+		ZSTD_outBuffer out;
+		size_t left;
+
+		in.src = data;
+		in.size = len;
+		in.pos = 0;
+		do {
+			out.dst = c->out;
+			out.size = c->outsize;
+			out.pos = 0;
+			left = ZSTD_compressStream2(c->zcs, &out, &in,
+			    mode == SF_COMPRESS_END ? ZSTD_e_end :
+			    mode == SF_COMPRESS_FLUSH ? ZSTD_e_flush :
+			    ZSTD_e_continue);
+			if (ZSTD_isError(left)) {
+				errno = EIO;
+				return (-1);
+			}
+			if (out.pos != 0 &&
+			    sf_compress_write_all(c->fd, c->out, out.pos) == -1)
+				return (-1);
+		} while (mode != SF_COMPRESS_CONTINUE ? left != 0 :
+		    in.pos < in.size);
+	}
+#endif
+#ifdef HAVE_LIBLZ4
+	if (c->method == PCAP_COMPRESS_LZ4) {
+		size_t n, clen;
+
+		while (len != 0) {
+			n = len;
+			if (n > SF_COMPRESS_BUFSIZE)
+				n = SF_COMPRESS_BUFSIZE;
+			clen = LZ4F_compressUpdate(c->lz4c, c->out,
+			    c->outsize, data, n, NULL);
+			if (LZ4F_isError(clen)) {
+				errno = EIO;
+				return (-1);
+			}
+			if (clen != 0 &&
+			    sf_compress_write_all(c->fd, c->out, clen) == -1)
+				return (-1);
+			data += n;
+			len -= n;
+		}
+		if (mode != SF_COMPRESS_CONTINUE) {
+			if (mode == SF_COMPRESS_END)
+				clen = LZ4F_compressEnd(c->lz4c, c->out,
+				    c->outsize, NULL);
+			else
+				clen = LZ4F_flush(c->lz4c, c->out,
+				    c->outsize, NULL);
+			if (LZ4F_isError(clen)) {
+				errno = EIO;
+				return (-1);
+			}
+			if (sf_compress_write_all(c->fd, c->out, clen) == -1)
+				return (-1);
+		}
+	}
+#endif
+	return (0);
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+sf_compress_thread(void *arg)
+{
+	struct sf_compress *c = arg;
+	struct sf_cbuf *b;
+	int err;
+
+	for (;;) {
+		pthread_mutex_lock(&c->mtx);
+		while (!c->stop && c->count == 0)
+			pthread_cond_wait(&c->filled, &c->mtx);
+		if (c->count == 0) {
+			pthread_mutex_unlock(&c->mtx);
+			break;
+		}
+		b = &c->bufs[c->head];
+		err = c->err;
+		pthread_mutex_unlock(&c->mtx);
+
+		/*
+		 * After an error, just hand buffers back.
+		 */
+		if (err == 0 && sf_compress_data(c, b->data, b->len,
+		    SF_COMPRESS_CONTINUE) == -1)
+			err = errno;
+
+		pthread_mutex_lock(&c->mtx);
+		c->err = err;
+		c->head = (c->head + 1) % SF_COMPRESS_NBUFS;
+		c->count--;
+		pthread_cond_signal(&c->drained);
+		pthread_mutex_unlock(&c->mtx);
+	}
+	return (NULL);
+}
+
+/*
+ * Hand the buffer we've filled to the thread, and, unless wait is
+ * zero, wait until there's another one to fill.
+ */
+static int
+sf_compress_queue(struct sf_compress *c, int wait)
+{
+	int err;
+
+	pthread_mutex_lock(&c->mtx);
+	c->count++;
+	pthread_cond_signal(&c->filled);
+	while (wait && c->err == 0 && c->count == SF_COMPRESS_NBUFS)
+		pthread_cond_wait(&c->drained, &c->mtx);
+	err = c->err;
+	pthread_mutex_unlock(&c->mtx);
+	if (err != 0) {
+		c->failed = err;
+		errno = err;
+		return (-1);
+	}
+	if (wait) {
+		c->fill = (c->fill + 1) % SF_COMPRESS_NBUFS;
+		c->bufs[c->fill].len = 0;
+	}
+	return (0);
+}
+#endif
+
+static ssize_t
+sf_compress_write(void *cookie, const char *data, size_t size)
+{
+	struct sf_compress *c = cookie;
+#ifdef HAVE_PTHREADS
+	struct sf_cbuf *b;
+	size_t done, n;
+#endif
+
+	if (c->failed != 0) {
+		errno = c->failed;
+		return (-1);
+	}
+#ifdef HAVE_PTHREADS
+	for (done = 0; done < size; done += n) {
+		b = &c->bufs[c->fill];
+		n = SF_COMPRESS_BUFSIZE - b->len;
+		if (n > size - done)
+			n = size - done;
+		memcpy(b->data + b->len, data + done, n);
+		b->len += n;
+		if (b->len == SF_COMPRESS_BUFSIZE &&
+		    sf_compress_queue(c, 1) == -1)
+			return (-1);
+	}
+#else
+	if (sf_compress_data(c, (const u_char *)data, size,
+	    SF_COMPRESS_CONTINUE) == -1) {
+		c->failed = errno;
+		return (-1);
+	}
+#endif
+	c->pos += (off_t)size;
+	return ((ssize_t)size);
+}
+
+static void
+sf_compress_free(struct sf_compress *c)
+{
+	struct sf_compress **cp;
+#ifdef HAVE_PTHREADS
+	u_int i;
+#endif
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_compress_list_mtx);
+#endif
+	for (cp = &sf_compress_list; *cp != NULL; cp = &(*cp)->next) {
+		if (*cp == c) {
+			*cp = c->next;
+			break;
+		}
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_compress_list_mtx);
+
+	for (i = 0; i < SF_COMPRESS_NBUFS; i++)
+		free(c->bufs[i].data);
+#endif
+#ifdef HAVE_LIBZSTD
+	if (c->zcs != NULL)
+		(void)ZSTD_freeCCtx(c->zcs);
+#endif
+#ifdef HAVE_LIBLZ4
+	if (c->lz4c != NULL)
+		(void)LZ4F_freeCompressionContext(c->lz4c);
+#endif
+	if (c->close_fd)
+		(void)close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+#ifdef HAVE_PTHREADS
+static void
+sf_compress_stop(struct sf_compress *c)
+{
+	pthread_mutex_lock(&c->mtx);
+	c->stop = 1;
+	pthread_cond_signal(&c->filled);
+	pthread_mutex_unlock(&c->mtx);
+	pthread_join(c->thread, NULL);
+	pthread_cond_destroy(&c->filled);
+	pthread_cond_destroy(&c->drained);
+	pthread_mutex_destroy(&c->mtx);
+}
+#endif
+
+/*
+ * Called when the stream is closed; compress what's left, finish the
+ * compressed data, and close the file.
+ */
+static int
+sf_compress_close(void *cookie)
+{
+	struct sf_compress *c = cookie;
+	int err;
+
+#ifdef HAVE_PTHREADS
+	if (c->failed == 0 && c->bufs[c->fill].len != 0)
+		(void)sf_compress_queue(c, 0);
+	sf_compress_stop(c);
+	if (c->failed == 0)
+		c->failed = c->err;
+#endif
+	err = c->failed;
+	if (err == 0 && sf_compress_data(c, NULL, 0, SF_COMPRESS_END) == -1)
+		err = errno;
+	if (c->close_fd) {
+		c->close_fd = 0;
+		if (close(c->fd) == -1 && err == 0)
+			err = errno;
+	}
+	sf_compress_free(c);
+	if (err != 0) {
+		errno = err;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Called after the stream has been flushed: compress what's waiting
+ * in the ring, and have the compressor write out everything it's
+ * been given, so that what's in the file so far can be decompressed.
+ * Streams we didn't open are left alone.
+ */
+int
+sf_compress_flush(FILE *f)
+{
+	struct sf_compress *c;
+#ifdef HAVE_PTHREADS
+	int err;
+#endif
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_compress_list_mtx);
+#endif
+	for (c = sf_compress_list; c != NULL; c = c->next) {
+		if (c->stream == f)
+			break;
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_compress_list_mtx);
+#endif
+	if (c == NULL)
+		return (0);
+
+	if (c->failed != 0) {
+		errno = c->failed;
+		return (-1);
+	}
+#ifdef HAVE_PTHREADS
+	if (c->bufs[c->fill].len != 0 && sf_compress_queue(c, 1) == -1)
+		return (-1);
+	pthread_mutex_lock(&c->mtx);
+	while (c->err == 0 && c->count != 0)
+		pthread_cond_wait(&c->drained, &c->mtx);
+	err = c->err;
+	pthread_mutex_unlock(&c->mtx);
+	if (err != 0) {
+		c->failed = err;
+		errno = err;
+		return (-1);
+	}
+#endif
+	if (sf_compress_data(c, NULL, 0, SF_COMPRESS_FLUSH) == -1) {
+		c->failed = errno;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * We can only say where we are, which is all ftell() needs; that's
+ * the amount of uncompressed data written.
+ */
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_compress_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sf_compress *c = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	*offset = c->pos;
+	return (0);
+}
+#else
+static int
+sf_compress_funopen_write(void *cookie, const char *data, int size)
+{
+	return ((int)sf_compress_write(cookie, data, (size_t)size));
+}
+
+static fpos_t
+sf_compress_seek(void *cookie, fpos_t offset, int whence)
+{
+	struct sf_compress *c = cookie;
+
+	if (whence != SEEK_CUR || offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	return (c->pos);
+}
+#endif
+
+FILE *
+sf_compress_open(const char *fname, int method, int level, char *errbuf)
+{
+	struct sf_compress *c;
+	FILE *f;
+#ifdef HAVE_PTHREADS
+	u_int i;
+	int err;
+#endif
+#ifdef HAVE_LIBLZ4
+	LZ4F_preferences_t prefs;
+	size_t clen;
+#endif
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	if (!sf_compress_check(method, errbuf))
+		return (NULL);
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	c->method = method;
+
+	/*
+	 * Have the compressors put a checksum of the data at the end,
+	 * so that damage to a stored file is noticed.
+	 */
+#ifdef HAVE_LIBZSTD
+	if (method == PCAP_COMPRESS_ZSTD) {
+		c->zcs = ZSTD_createCCtx();
+		if (c->zcs == NULL ||
+		    ZSTD_isError(ZSTD_CCtx_setParameter(c->zcs,
+		    ZSTD_c_compressionLevel, level)) ||
+		    ZSTD_isError(ZSTD_CCtx_setParameter(c->zcs,
+		    ZSTD_c_checksumFlag, 1))) {
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "can't create zstd compressor with level %d",
+			    level);
+			goto fail;
+		}
+		c->outsize = ZSTD_CStreamOutSize();
+	}
+#endif
+#ifdef HAVE_LIBLZ4
+	if (method == PCAP_COMPRESS_LZ4) {
+		if (LZ4F_isError(LZ4F_createCompressionContext(&c->lz4c,
+		    LZ4F_VERSION))) {
+			c->lz4c = NULL;
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "can't create LZ4 compressor");
+			goto fail;
+		}
+		memset(&prefs, 0, sizeof(prefs));
+		prefs.frameInfo.contentChecksumFlag =
+		    LZ4F_contentChecksumEnabled;
+		prefs.compressionLevel = level;
+		c->outsize = LZ4F_compressBound(SF_COMPRESS_BUFSIZE, &prefs);
+		if (c->outsize < LZ4F_HEADER_SIZE_MAX)
+			c->outsize = LZ4F_HEADER_SIZE_MAX;
+	}
+#endif
+	c->out = malloc(c->outsize);
+	if (c->out == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		goto fail;
+	}
+
+	if (fname == NULL) {
+		/*
+		 * Anything already written to the standard output has
+		 * to go first.
+		 */
+		(void)fflush(stdout);
+		c->fd = fileno(stdout);
+		fname = "standard output";
+	} else {
+		c->fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+		if (c->fd == -1) {
+			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "%s", fname);
+			goto fail;
+		}
+		c->close_fd = 1;
+	}
+
+#ifdef HAVE_LIBLZ4
+	if (method == PCAP_COMPRESS_LZ4) {
+		clen = LZ4F_compressBegin(c->lz4c, c->out, c->outsize, &prefs);
+		if (LZ4F_isError(clen)) {
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: can't start LZ4 compression with level %d",
+			    fname, level);
+			goto fail;
+		}
+		if (sf_compress_write_all(c->fd, c->out, clen) == -1) {
+			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "Can't write to %s", fname);
+			goto fail;
+		}
+	}
+#endif
+
+#ifdef HAVE_PTHREADS
+	for (i = 0; i < SF_COMPRESS_NBUFS; i++) {
+		c->bufs[i].data = malloc(SF_COMPRESS_BUFSIZE);
+		if (c->bufs[i].data == NULL) {
+			pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "malloc");
+			goto fail;
+		}
+	}
+	pthread_mutex_init(&c->mtx, NULL);
+	pthread_cond_init(&c->filled, NULL);
+	pthread_cond_init(&c->drained, NULL);
+	err = pthread_create(&c->thread, NULL, sf_compress_thread, c);
+	if (err != 0) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    err, "pthread_create");
+		pthread_cond_destroy(&c->filled);
+		pthread_cond_destroy(&c->drained);
+		pthread_mutex_destroy(&c->mtx);
+		goto fail;
+	}
+	c->thread_started = 1;
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = NULL;
+	funcs.write = sf_compress_write;
+	funcs.seek = sf_compress_seek;
+	funcs.close = sf_compress_close;
+	f = fopencookie(c, "wb", funcs);
+#else
+	f = funopen(c, NULL, sf_compress_funopen_write, sf_compress_seek,
+	    sf_compress_close);
+#endif
+	if (f == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s: can't create output stream", fname);
+		goto fail;
+	}
+	setvbuf(f, NULL, _IOFBF, SF_COMPRESS_STDIO_BUFSIZE);
+	c->stream = f;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_compress_list_mtx);
+#endif
+	c->next = sf_compress_list;
+	sf_compress_list = c;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_compress_list_mtx);
+#endif
+	return (f);
+
+fail:
+#ifdef HAVE_PTHREADS
+	if (c->thread_started)
+		sf_compress_stop(c);
+#endif
+	sf_compress_free(c);
+	return (NULL);
+}
+
+#else /* SF_COMPRESS_SUPPORTED */
+
+struct sf_decompress *
+sf_decompress_open(FILE *fp _U_, int method, bpf_u_int32 magic _U_,
+    char *errbuf)
+{
+	(void)sf_compress_check(method, errbuf);
+	return (NULL);
+}
+
+FILE *
+sf_decompress_stream(struct sf_decompress *dc _U_)
+{
+	return (NULL);
+}
+
+void
+sf_decompress_close(struct sf_decompress *dc _U_, int close_fp _U_)
+{
+}
+
+FILE *
+sf_compress_open(const char *fname _U_, int method, int level _U_,
+    char *errbuf)
+{
+	(void)sf_compress_check(method, errbuf);
+	return (NULL);
+}
+
+int
+sf_compress_flush(FILE *f _U_)
+{
+	return (0);
+}
+
+#endif /* SF_COMPRESS_SUPPORTED */
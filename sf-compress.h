@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * sf-compress.h - compressed savefiles
+ */
+
+#ifndef sf_compress_h
+#define	sf_compress_h
+
+/*
+ * Compression needs a way to make a stdio stream that goes through
+ * our own I/O routines, and at least one compression library.
+ */
+#if (defined(HAVE_LIBZSTD) || defined(HAVE_LIBLZ4)) && \
+    (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN))
+#define SF_COMPRESS_SUPPORTED
+#endif
+
+/*
+ * If magic, the first 4 bytes of a file as read from it, is the magic
+ * number of a compressed format, return its PCAP_COMPRESS_ value,
+ * otherwise return 0.
+ */
+extern int sf_compressed_magic(bpf_u_int32 magic);
+
+struct sf_decompress;
+
+/*
+ * Start decompressing fp, which is compressed with method, and of
+ * which the first 4 bytes, magic, have already been read.
+ * sf_decompress_stream() returns the stream from which to read the
+ * decompressed data; closing it with fclose() also closes fp, unless
+ * fp is stdin.  sf_decompress_close() closes that stream, and closes
+ * fp only if close_fp is non-zero.
+ */
+extern struct sf_decompress *sf_decompress_open(FILE *fp, int method,
+    bpf_u_int32 magic, char *errbuf);
+extern FILE *sf_decompress_stream(struct sf_decompress *dc);
+extern void sf_decompress_close(struct sf_decompress *dc, int close_fp);
+
+/*
+ * Open fname for writing, or, if fname is NULL, write to the standard
+ * output, through a stream that compresses what's written to it with
+ * method at level.  On failure, returns NULL and puts an error message
+ * in errbuf.
+ */
+extern FILE *sf_compress_open(const char *fname, int method, int level,
+    char *errbuf);
+extern int sf_compress_flush(FILE *f);
+
+#endif
@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Time stamp index files for savefiles.
+ *
+ * An index file sits next to the savefile it indexes, with ".idx"
+ * appended to the savefile's name, and lets a reader find roughly where
+ * in the savefile the packets from a given time start without reading
+ * everything before them.  It's a header followed by an array of
+ * entries, each giving the offset of a packet record, or, for pcapng,
+ * a packet block, and the latest time stamp of all the packets before
+ * that offset; as that time stamp never goes down, the entries can
+ * be binary-searched even if the packets aren't quite in time order.
+ * The header also gives the time stamp of the first packet, so that a
+ * reader can tell whether the savefile is still the one that was
+ * indexed.
+ *
+ * Everything is written in the byte order of the host writing it; a
+ * reader can tell from the magic number whether it has to swap.
+ */
+
+/*
+ * fopencookie() is a GNU extension.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "pcap-common.h"
+#include "sf-index.h"
+
+#define SF_INDEX_MAGIC		0x50494458	/* "PIDX" */
+#define SF_INDEX_VERSION_MAJOR	2
+#define SF_INDEX_VERSION_MINOR	0
+
+/*
+ * Index entry interval used if the caller doesn't ask for one.
+ */
+#define SF_INDEX_DEFAULT_BYTES	(1024*1024)
+
+struct sf_index_header {
+	bpf_u_int32 magic;
+	u_short	version_major;
+	u_short	version_minor;
+	bpf_u_int32 entry_size;		/* size of an entry */
+	bpf_u_int32 reserved;
+	uint64_t first_ts;		/* time stamp of the first packet, ns */
+};
+
+struct sf_index_entry {
+	uint64_t ts;			/* latest time stamp before offset, ns */
+	uint64_t offset;		/* offset of a record in the savefile */
+	bpf_u_int32 nifs;		/* interfaces described before offset */
+	bpf_u_int32 reserved;
+};
+
+struct sf_index_writer {
+	FILE	*f;
+	u_int	every_packets;
+	uint64_t every_bytes;
+	u_int	nentries;
+	u_int	packets;		/* packets since the last entry */
+	uint64_t last_offset;		/* offset in the last entry */
+	uint64_t max_ts;		/* latest time stamp so far */
+};
+
+static char *
+sf_index_name(const char *savefile, char *errbuf)
+{
+	size_t len = strlen(savefile) + sizeof(".idx");
+	char *name;
+
+	name = malloc(len);
+	if (name == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	pcap_snprintf(name, len, "%s.idx", savefile);
+	return (name);
+}
+
+/*
+ * The header is written along with the first entry, once we know the
+ * first packet's time stamp; until then, the index is empty, and
+ * readers ignore it.
+ */
+struct sf_index_writer *
+sf_index_writer_open(const char *savefile, u_int every_packets,
+    uint64_t every_bytes, char *errbuf)
+{
+	struct sf_index_writer *w;
+	char *name;
+
+	name = sf_index_name(savefile, errbuf);
+	if (name == NULL)
+		return (NULL);
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(name);
+		return (NULL);
+	}
+	w->f = fopen(name, "wb");
+	if (w->f == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", name);
+		free(name);
+		free(w);
+		return (NULL);
+	}
+	free(name);
+	if (every_packets == 0 && every_bytes == 0)
+		every_bytes = SF_INDEX_DEFAULT_BYTES;
+	w->every_packets = every_packets;
+	w->every_bytes = every_bytes;
+	return (w);
+}
+
+int
+sf_index_writer_packet(struct sf_index_writer *w, uint64_t ts,
+    uint64_t offset, u_int nifs)
+{
+	struct sf_index_header hdr;
+	struct sf_index_entry e;
+
+	if (w->nentries == 0) {
+		hdr.magic = SF_INDEX_MAGIC;
+		hdr.version_major = SF_INDEX_VERSION_MAJOR;
+		hdr.version_minor = SF_INDEX_VERSION_MINOR;
+		hdr.entry_size = sizeof(struct sf_index_entry);
+		hdr.reserved = 0;
+		hdr.first_ts = ts;
+		if (fwrite(&hdr, sizeof(hdr), 1, w->f) != 1)
+			return (-1);
+	}
+	if (w->nentries == 0 ||
+	    (w->every_packets != 0 && w->packets >= w->every_packets) ||
+	    (w->every_bytes != 0 && offset - w->last_offset >= w->every_bytes)) {
+		e.ts = w->max_ts;
+		e.offset = offset;
+		e.nifs = nifs;
+		e.reserved = 0;
+		if (fwrite(&e, sizeof(e), 1, w->f) != 1)
+			return (-1);
+		w->nentries++;
+		w->packets = 0;
+		w->last_offset = offset;
+	}
+	w->packets++;
+	if (ts > w->max_ts)
+		w->max_ts = ts;
+	return (0);
+}
+
+int
+sf_index_writer_flush(struct sf_index_writer *w)
+{
+	return (fflush(w->f) == EOF ? -1 : 0);
+}
+
+int
+sf_index_writer_close(struct sf_index_writer *w)
+{
+	int ret;
+
+	ret = (fclose(w->f) == EOF ? -1 : 0);
+	free(w);
+	return (ret);
+}
+
+static int
+sf_index_read_entry(FILE *f, uint64_t i, int swapped,
+    struct sf_index_entry *e)
+{
+	if (sf_fseek64(f, (int64_t)(sizeof(struct sf_index_header) +
+	    i * sizeof(*e))) == -1)
+		return (-1);
+	if (fread(e, sizeof(*e), 1, f) != 1)
+		return (-1);
+	if (swapped) {
+		e->ts = SWAPLL(e->ts);
+		e->offset = SWAPLL(e->offset);
+		e->nifs = SWAPLONG(e->nifs);
+	}
+	return (0);
+}
+
+int
+sf_index_find(const char *savefile, int64_t savefile_size, uint64_t ts,
+    struct sf_index_hit *hit, char *errbuf)
+{
+	struct sf_index_header hdr;
+	struct sf_index_entry e;
+	char *name;
+	FILE *f;
+	int64_t size;
+	uint64_t lo, hi, mid;
+	int swapped;
+
+	name = sf_index_name(savefile, errbuf);
+	if (name == NULL)
+		return (-1);
+	f = fopen(name, "rb");
+	free(name);
+	if (f == NULL)
+		return (1);	/* no index */
+
+	/*
+	 * If the header doesn't look right, or the index is empty,
+	 * ignore it; we can always find our way without it.
+	 */
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		goto noindex;
+	if (hdr.magic == SF_INDEX_MAGIC)
+		swapped = 0;
+	else if (hdr.magic == SWAPLONG(SF_INDEX_MAGIC)) {
+		swapped = 1;
+		hdr.version_major = SWAPSHORT(hdr.version_major);
+		hdr.entry_size = SWAPLONG(hdr.entry_size);
+		hdr.first_ts = SWAPLL(hdr.first_ts);
+	} else
+		goto noindex;
+	if (hdr.version_major != SF_INDEX_VERSION_MAJOR ||
+	    hdr.entry_size != sizeof(e))
+		goto noindex;
+	if (fseek(f, 0, SEEK_END) == -1 || (size = sf_ftell64(f)) == -1)
+		goto noindex;
+	hi = (uint64_t)(size - (int64_t)sizeof(hdr)) / sizeof(e);
+	if (hi == 0)
+		goto noindex;
+
+	/*
+	 * An index for a longer file than this one is for some other
+	 * file; so is one whose first entry isn't the first packet,
+	 * which the caller checks for us.
+	 */
+	if (sf_index_read_entry(f, hi - 1, swapped, &e) == -1)
+		goto readerr;
+	if (e.offset >= (uint64_t)savefile_size)
+		goto noindex;
+	if (sf_index_read_entry(f, 0, swapped, &e) == -1)
+		goto readerr;
+	hit->first_offset = e.offset;
+	hit->first_nifs = e.nifs;
+	hit->first_ts = hdr.first_ts;
+
+	/*
+	 * Find the last entry whose time stamp is before ts; the first
+	 * entry's time stamp is 0, as nothing comes before it, so, for
+	 * any ts after the epoch, there is one.
+	 */
+	lo = 0;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (sf_index_read_entry(f, mid, swapped, &e) == -1)
+			goto readerr;
+		if (e.ts < ts)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (sf_index_read_entry(f, lo, swapped, &e) == -1)
+		goto readerr;
+	(void)fclose(f);
+	hit->offset = e.offset;
+	hit->nifs = e.nifs;
+	return (0);
+
+readerr:
+	pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+	    errno, "error reading index file");
+	(void)fclose(f);
+	return (-1);
+
+noindex:
+	(void)fclose(f);
+	return (1);
+}
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Size of the stream's buffer.
+ */
+#define SF_INDEX_BUFSIZE	(1024*1024)
+
+/*
+ * A stream that writes a pcap file and follows the packet records
+ * going past, so it can index them.
+ */
+struct sf_index_dump {
+	FILE	*stream;
+	int	fd;
+	u_char	*buf;			/* the stream's buffer */
+	struct sf_index_writer *w;
+	uint64_t frac_ns;		/* nanoseconds per time stamp unit */
+	uint64_t offset;		/* bytes written so far */
+	size_t	filehdr_left;		/* file header bytes still to come */
+	u_char	rechdr[sizeof(struct pcap_sf_pkthdr)];
+	size_t	rechdr_len;		/* amount of a record header we have */
+	uint64_t rec_offset;		/* offset of that record */
+	bpf_u_int32 data_left;		/* packet data still to come */
+};
+
+static ssize_t
+sf_index_dump_write(void *cookie, const char *buf, size_t size)
+{
+	struct sf_index_dump *d = cookie;
+	const u_char *p = (const u_char *)buf;
+	const u_char *end = p + size;
+	struct pcap_sf_pkthdr sfh;
+	ssize_t n;
+	size_t left;
+	uint64_t ts;
+
+	for (left = size; left != 0; left -= (size_t)n) {
+		n = write(d->fd, buf + (size - left), left);
+		if (n == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return (-1);
+		}
+	}
+
+	while (p < end) {
+		left = end - p;
+		if (d->filehdr_left != 0) {
+			if (left > d->filehdr_left)
+				left = d->filehdr_left;
+			d->filehdr_left -= left;
+		} else if (d->data_left != 0) {
+			if (left > d->data_left)
+				left = d->data_left;
+			d->data_left -= (bpf_u_int32)left;
+		} else {
+			if (d->rechdr_len == 0)
+				d->rec_offset = d->offset;
+			if (left > sizeof(d->rechdr) - d->rechdr_len)
+				left = sizeof(d->rechdr) - d->rechdr_len;
+			memcpy(d->rechdr + d->rechdr_len, p, left);
+			d->rechdr_len += left;
+			if (d->rechdr_len == sizeof(d->rechdr)) {
+				memcpy(&sfh, d->rechdr, sizeof(sfh));
+				ts = (uint64_t)(bpf_u_int32)sfh.ts.tv_sec *
+				    1000000000 +
+				    (uint64_t)(bpf_u_int32)sfh.ts.tv_usec *
+				    d->frac_ns;
+				if (sf_index_writer_packet(d->w, ts,
+				    d->rec_offset, 0) == -1)
+					return (-1);
+				d->data_left = sfh.caplen;
+				d->rechdr_len = 0;
+			}
+		}
+		p += left;
+		d->offset += left;
+	}
+
+	/*
+	 * Keep the index up to date with what's in the file.
+	 */
+	if (sf_index_writer_flush(d->w) == -1)
+		return (-1);
+	return ((ssize_t)size);
+}
+
+static int
+sf_index_dump_close(void *cookie)
+{
+	struct sf_index_dump *d = cookie;
+	int ret = 0;
+
+	if (close(d->fd) == -1)
+		ret = -1;
+	if (sf_index_writer_close(d->w) == -1)
+		ret = -1;
+	free(d->buf);
+	free(d);
+	return (ret);
+}
+
+/*
+ * We can only say where we are, which is all ftell() needs.
+ */
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_index_dump_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sf_index_dump *d = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	*offset = (off64_t)d->offset;
+	return (0);
+}
+#else
+static int
+sf_index_dump_funopen_write(void *cookie, const char *buf, int size)
+{
+	return ((int)sf_index_dump_write(cookie, buf, (size_t)size));
+}
+
+static fpos_t
+sf_index_dump_seek(void *cookie, fpos_t offset, int whence)
+{
+	struct sf_index_dump *d = cookie;
+
+	if (whence != SEEK_CUR || offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	return ((fpos_t)d->offset);
+}
+#endif
+
+FILE *
+sf_index_dump_open(const char *fname, u_int precision, u_int every_packets,
+    uint64_t every_bytes, char *errbuf)
+{
+	struct sf_index_dump *d;
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	d->buf = malloc(SF_INDEX_BUFSIZE);
+	if (d->buf == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		free(d);
+		return (NULL);
+	}
+	d->frac_ns = (precision == PCAP_TSTAMP_PRECISION_NANO) ? 1 : 1000;
+	d->filehdr_left = sizeof(struct pcap_file_header);
+
+	d->fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (d->fd == -1) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", fname);
+		goto fail;
+	}
+	d->w = sf_index_writer_open(fname, every_packets, every_bytes,
+	    errbuf);
+	if (d->w == NULL) {
+		(void)close(d->fd);
+		goto fail;
+	}
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = NULL;
+	funcs.write = sf_index_dump_write;
+	funcs.seek = sf_index_dump_seek;
+	funcs.close = sf_index_dump_close;
+	d->stream = fopencookie(d, "wb", funcs);
+#else
+	d->stream = funopen(d, NULL, sf_index_dump_funopen_write,
+	    sf_index_dump_seek, sf_index_dump_close);
+#endif
+	if (d->stream == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't create output stream");
+		(void)close(d->fd);
+		(void)sf_index_writer_close(d->w);
+		goto fail;
+	}
+	if (setvbuf(d->stream, (char *)d->buf, _IOFBF, SF_INDEX_BUFSIZE) != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't set output buffer");
+		(void)fclose(d->stream);
+		return (NULL);
+	}
+	return (d->stream);
+
+fail:
+	free(d->buf);
+	free(d);
+	return (NULL);
+}
+
+#else /* defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN) */
+
+FILE *
+sf_index_dump_open(const char *fname _U_, u_int precision _U_,
+    u_int every_packets _U_, uint64_t every_bytes _U_, char *errbuf)
+{
+	pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "indexed savefiles aren't supported on this platform");
+	return (NULL);
+}
+
+#endif /* defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN) */
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * sf-index.h - time stamp index files for savefiles
+ */
+
+#ifndef sf_index_h
+#define	sf_index_h
+
+struct sf_index_writer;
+
+/*
+ * Create the index file for the savefile named savefile, to which an
+ * entry will be added every every_packets packets or every_bytes
+ * bytes, whichever comes first; 0 means no limit, and, if both are 0,
+ * a default interval is used.  On failure, returns NULL and puts an
+ * error message in errbuf.
+ */
+extern struct sf_index_writer *sf_index_writer_open(const char *savefile,
+    u_int every_packets, uint64_t every_bytes, char *errbuf);
+
+/*
+ * Note that a packet with time stamp ts, in nanoseconds, is about to
+ * be written at the given offset, with nifs interfaces having been
+ * described before it (pcapng), adding an index entry if one is due.
+ * Returns -1 on a write error, with errno set, and 0 otherwise.
+ */
+extern int sf_index_writer_packet(struct sf_index_writer *w, uint64_t ts,
+    uint64_t offset, u_int nifs);
+extern int sf_index_writer_flush(struct sf_index_writer *w);
+extern int sf_index_writer_close(struct sf_index_writer *w);
+
+/*
+ * What sf_index_find() found: the entry, and the offset, interface
+ * count and time stamp of the first packet in the indexed savefile,
+ * which the caller should check against the savefile, in case it's
+ * been replaced since it was indexed.
+ */
+struct sf_index_hit {
+	uint64_t offset;
+	u_int	nifs;
+	uint64_t first_offset;
+	u_int	first_nifs;
+	uint64_t first_ts;
+};
+
+/*
+ * Look up, in the index file for the savefile named savefile, which is
+ * savefile_size bytes long, the last entry before which all packets
+ * have time stamps earlier than ts, in nanoseconds.  Returns 0 and
+ * fills in hit if there is such an entry, 1 if there's no usable
+ * index, and -1, with an error message in errbuf, on an error.
+ */
+extern int sf_index_find(const char *savefile, int64_t savefile_size,
+    uint64_t ts, struct sf_index_hit *hit, char *errbuf);
+
+/*
+ * Return a stream to which a pcap file, file header first, can be
+ * written, which writes it to the file named fname, and writes an
+ * index for it as sf_index_writer_open() does.  precision is the
+ * time stamp precision of the pcap file.  On failure, returns NULL
+ * and puts an error message in errbuf.
+ */
+extern FILE *sf_index_dump_open(const char *fname, u_int precision,
+    u_int every_packets, uint64_t every_bytes, char *errbuf);
+
+#endif
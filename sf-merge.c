@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Merging savefiles in time stamp order.
+ *
+ * A merge handle has a handle for each of its files, and a binary
+ * heap of the files that have packets left, ordered by the time stamp
+ * of each file's next packet, with ties going to the file that comes
+ * first in the list, so that the output doesn't depend on how the
+ * heap happens to be arranged.  The packet at the top of the heap is
+ * the next one to return; once it's been used - i.e., on the next
+ * call - we read the next packet from its file and move that file
+ * down the heap, which takes O(log n) comparisons for n files.
+ *
+ * The heap holds copies of the time stamps, rather than pointers to
+ * the files' handles, so that sifting doesn't touch a handle per
+ * comparison; with hundreds of files, the handles don't stay in the
+ * cache, but the heap does.
+ *
+ * The files are read through their own handles, which, where they
+ * can, map the files into memory and ask the system to read them
+ * ahead of us, so each file gets its own read-ahead without our
+ * needing a buffer, or a thread, per file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+
+#include "sf-merge.h"
+
+struct merge_source {
+	pcap_t *p;
+	struct pcap_pkthdr hdr;		/* header of its next packet */
+	u_char *data;			/* data of its next packet */
+};
+
+struct merge_heap_entry {
+	struct timeval ts;		/* time stamp of its next packet */
+	u_int source;			/* index in sources */
+};
+
+struct pcap_merge {
+	struct merge_source *sources;
+	u_int nsources;
+	struct merge_heap_entry *heap;
+	u_int nheap;
+	int cur;			/* source of the last packet, or -1 */
+};
+
+static int
+merge_before(const struct merge_heap_entry *a,
+    const struct merge_heap_entry *b)
+{
+	if (a->ts.tv_sec != b->ts.tv_sec)
+		return (a->ts.tv_sec < b->ts.tv_sec);
+	if (a->ts.tv_usec != b->ts.tv_usec)
+		return (a->ts.tv_usec < b->ts.tv_usec);
+	return (a->source < b->source);
+}
+
+/*
+ * Move the entry at position i down the heap until neither of its
+ * children comes before it.
+ */
+static void
+merge_sift_down(struct merge_heap_entry *heap, u_int n, u_int i)
+{
+	struct merge_heap_entry e = heap[i];
+	u_int child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && merge_before(&heap[child + 1],
+		    &heap[child]))
+			child++;
+		if (!merge_before(&heap[child], &e))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = e;
+}
+
+/*
+ * Read the next packet from a source; returns 0 if we got one, 1 at
+ * the end of its file, and -1, with an error message in p->errbuf,
+ * on an error.
+ */
+static int
+merge_read(pcap_t *p, struct merge_source *s)
+{
+	int status;
+
+	status = s->p->next_packet_op(s->p, &s->hdr, &s->data);
+	if (status == -1) {
+		/*
+		 * Put the file name in front of the source's message,
+		 * cutting it short if it doesn't all fit.
+		 */
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "%s: ",
+		    s->p->opt.device != NULL ? s->p->opt.device :
+		    "standard input");
+		strlcat(p->errbuf, s->p->errbuf, PCAP_ERRBUF_SIZE);
+	}
+	return (status);
+}
+
+static int
+sf_merge_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct pcap_merge *pm = p->priv;
+	struct merge_source *s;
+	int status;
+
+	if (pm->cur != -1) {
+		/*
+		 * The packet we returned last time came from the
+		 * file at the top of the heap, and our caller is
+		 * done with it; replace it with that file's next
+		 * packet, or, if there isn't one, drop the file.
+		 */
+		s = &pm->sources[pm->cur];
+		status = merge_read(p, s);
+		if (status == -1)
+			return (-1);
+		if (status == 1)
+			pm->heap[0] = pm->heap[--pm->nheap];
+		else
+			pm->heap[0].ts = s->hdr.ts;
+		pm->cur = -1;
+		merge_sift_down(pm->heap, pm->nheap, 0);
+	}
+	if (pm->nheap == 0)
+		return (1);
+	pm->cur = (int)pm->heap[0].source;
+	s = &pm->sources[pm->cur];
+	*hdr = s->hdr;
+	*data = s->data;
+	return (0);
+}
+
+static void
+sf_merge_cleanup(pcap_t *p)
+{
+	struct pcap_merge *pm = p->priv;
+	u_int i;
+
+	/*
+	 * p->rfile belongs to the first file's handle.
+	 */
+	for (i = 0; i < pm->nsources; i++)
+		pcap_close(pm->sources[i].p);
+	free(pm->sources);
+	free(pm->heap);
+	uninstall_bpf_program(p);
+}
+
+pcap_t *
+sf_merge_open(pcap_t **sources, u_int nsources, u_int precision,
+    char *errbuf)
+{
+	pcap_t *p;
+	struct pcap_merge *pm;
+	struct merge_source *s;
+	u_int i;
+	int status;
+
+	if (nsources > INT_MAX) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "Too many files to merge");
+		return (NULL);
+	}
+	for (i = 1; i < nsources; i++) {
+		if (sources[i]->linktype != sources[0]->linktype) {
+			pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+			    "%s: link-layer type %d differs from %s's %d",
+			    sources[i]->opt.device != NULL ?
+			    sources[i]->opt.device : "standard input",
+			    sources[i]->linktype,
+			    sources[0]->opt.device != NULL ?
+			    sources[0]->opt.device : "standard input",
+			    sources[0]->linktype);
+			return (NULL);
+		}
+	}
+
+	p = pcap_open_offline_common(errbuf, sizeof (struct pcap_merge));
+	if (p == NULL)
+		return (NULL);
+	pm = p->priv;
+	pm->sources = calloc(nsources, sizeof(*pm->sources));
+	pm->heap = calloc(nsources, sizeof(*pm->heap));
+	if (pm->sources == NULL || pm->heap == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		goto fail;
+	}
+
+	/*
+	 * Read each file's first packet, and put the files that have
+	 * one into the heap.
+	 */
+	pm->cur = -1;
+	for (i = 0; i < nsources; i++) {
+		s = &pm->sources[i];
+		s->p = sources[i];
+		status = merge_read(p, s);
+		if (status == -1) {
+			strlcpy(errbuf, p->errbuf, PCAP_ERRBUF_SIZE);
+			goto fail;
+		}
+		if (status == 0) {
+			pm->heap[pm->nheap].ts = s->hdr.ts;
+			pm->heap[pm->nheap].source = i;
+			pm->nheap++;
+		}
+		if (s->p->snapshot > p->snapshot)
+			p->snapshot = s->p->snapshot;
+	}
+	for (i = pm->nheap / 2; i > 0; i--)
+		merge_sift_down(pm->heap, pm->nheap, i - 1);
+	pm->nsources = nsources;
+
+	p->linktype = sources[0]->linktype;
+	p->opt.tstamp_precision = precision;
+	p->version_major = sources[0]->version_major;
+	p->version_minor = sources[0]->version_minor;
+
+	/*
+	 * pcap_next_ex() and pcap_loop() treat handles with an rfile
+	 * as savefile handles.
+	 */
+	p->rfile = sources[0]->rfile;
+	p->fddipad = 0;
+	p->next_packet_op = sf_merge_next_packet;
+	p->cleanup_op = sf_merge_cleanup;
+	sf_setup_ops(p);
+	return (p);
+
+fail:
+	free(pm->sources);
+	free(pm->heap);
+	free(p);
+	return (NULL);
+}
+
+/*
+ * Return the index, in the list of files given to
+ * pcap_open_offline_merge(), of the file from which the last packet
+ * read from a merge handle came.
+ */
+int
+pcap_offline_merge_source(pcap_t *p)
+{
+	if (p->next_packet_op != sf_merge_next_packet)
+		return (-1);
+	return (((struct pcap_merge *)p->priv)->cur);
+}
+
+/*
+ * Open a pcapng file to which to write the packets read from a merge
+ * handle, with an interface for each of the merged files, in the
+ * order in which they were given, named after the file; pass
+ * pcap_offline_merge_source() as the interface ID to pcap_ng_dump().
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_open_merged(pcap_t *p, const char *fname)
+{
+	struct pcap_merge *pm;
+	pcap_ng_dumper_t *d;
+	pcap_t *sp;
+	u_int i;
+
+	if (p->next_packet_op != sf_merge_next_packet) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not a handle returned by pcap_open_offline_merge()");
+		return (NULL);
+	}
+	pm = p->priv;
+	d = pcap_ng_dump_open(fname, p->errbuf);
+	if (d == NULL)
+		return (NULL);
+	for (i = 0; i < pm->nsources; i++) {
+		sp = pm->sources[i].p;
+		if (pcap_ng_dump_add_interface(d, sp,
+		    sp->opt.device != NULL ? sp->opt.device :
+		    "standard input") == -1) {
+			strlcpy(p->errbuf, sp->errbuf, PCAP_ERRBUF_SIZE);
+			(void)pcap_ng_dump_close(d);
+			return (NULL);
+		}
+	}
+	return (d);
+}
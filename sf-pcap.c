@@ -46,6 +46,15 @@
 
 #include "pcap-int.h"
 
+/*
+ * We can map savefiles into memory on UN*Xes.
+ */
+#if !defined(_WIN32) && !defined(MSDOS)
+#define SF_MMAP_SUPPORTED
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "pcap-common.h"
 
 #ifdef HAVE_OS_PROTO_H
@@ -53,6 +62,10 @@
 #endif
 
 #include "sf-pcap.h"
+#include "sf-bufwrite.h"
+#include "sf-compress.h"
+#include "sf-rotate.h"
+#include "sf-index.h"
 
 /*
  * Setting O_BINARY on DOS/Windows is a bit tricky
@@ -108,6 +121,23 @@
 #define LT_LINKTYPE_EXT(x)	((x) & 0xFC000000)
 
 static int pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **datap);
+static int64_t pcap_tell(pcap_t *p);
+static int pcap_seek(pcap_t *p, int64_t off, u_int nifs);
+static int pcap_resync(pcap_t *p, int64_t off, int64_t *recoff,
+    struct pcap_pkthdr *hdr, u_int *nifs);
+#ifdef SF_MMAP_SUPPORTED
+static int pcap_next_packet_mmap(pcap_t *p, struct pcap_pkthdr *hdr,
+    u_char **datap);
+#endif
+
+#ifdef SF_MMAP_SUPPORTED
+/*
+ * When the file is mapped into memory, we ask the OS to start reading
+ * the data at least this far ahead of the packet we're handing out,
+ * in chunks of this size.
+ */
+#define SF_MMAP_READAHEAD	(4*1024*1024)
+#endif
 
 /*
  * Private data for reading pcap savefiles.
@@ -128,6 +158,12 @@ struct pcap_sf {
 	size_t hdrsize;
 	swapped_type_t lengths_swapped;
 	tstamp_scale_type_t scale_type;
+#ifdef SF_MMAP_SUPPORTED
+	u_char *map;		/* the file, if it's mapped into memory */
+	size_t maplen;		/* size of the mapping */
+	size_t mapoff;		/* offset of the next packet record */
+	size_t advised;		/* offset up to which we've done MADV_WILLNEED */
+#endif
 };
 
 /*
@@ -248,6 +284,10 @@ pcap_check_header(bpf_u_int32 magic, FILE *fp, u_int precision, char *errbuf,
 	p->linktype_ext = LT_LINKTYPE_EXT(hdr.linktype);
 
 	p->next_packet_op = pcap_next_packet;
+	p->sf_tell_op = pcap_tell;
+	p->sf_seek_op = pcap_seek;
+	p->sf_resync_op = pcap_resync;
+	p->sf_packets_only = 1;
 
 	ps = p->priv;
 
@@ -421,56 +461,29 @@ grow_buffer(pcap_t *p, u_int bufsize)
 }
 
 /*
- * Read and return the next packet from the savefile.  Return the header
- * in hdr and a pointer to the contents in data.  Return 0 on success, 1
- * if there were no more packets, and -1 on an error.
+ * Convert a packet record header from the savefile into a pcap_pkthdr,
+ * byte-swapping it, scaling the time stamp, and un-swapping the
+ * lengths as necessary.  Return -1 if the captured length is bigger
+ * than we consider sane, and 0 otherwise.
  */
 static int
-pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+pcap_convert_header(pcap_t *p, const struct pcap_sf_patched_pkthdr *sf_hdr,
+    struct pcap_pkthdr *hdr)
 {
 	struct pcap_sf *ps = p->priv;
-	struct pcap_sf_patched_pkthdr sf_hdr;
-	FILE *fp = p->rfile;
-	size_t amt_read;
 	bpf_u_int32 t;
 
-	/*
-	 * Read the packet header; the structure we use as a buffer
-	 * is the longer structure for files generated by the patched
-	 * libpcap, but if the file has the magic number for an
-	 * unpatched libpcap we only read as many bytes as the regular
-	 * header has.
-	 */
-	amt_read = fread(&sf_hdr, 1, ps->hdrsize, fp);
-	if (amt_read != ps->hdrsize) {
-		if (ferror(fp)) {
-			pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
-			    errno, "error reading dump file");
-			return (-1);
-		} else {
-			if (amt_read != 0) {
-				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "truncated dump file; tried to read %lu header bytes, only got %lu",
-				    (unsigned long)ps->hdrsize,
-				    (unsigned long)amt_read);
-				return (-1);
-			}
-			/* EOF */
-			return (1);
-		}
-	}
-
 	if (p->swapped) {
 		/* these were written in opposite byte order */
-		hdr->caplen = SWAPLONG(sf_hdr.caplen);
-		hdr->len = SWAPLONG(sf_hdr.len);
-		hdr->ts.tv_sec = SWAPLONG(sf_hdr.ts.tv_sec);
-		hdr->ts.tv_usec = SWAPLONG(sf_hdr.ts.tv_usec);
+		hdr->caplen = SWAPLONG(sf_hdr->caplen);
+		hdr->len = SWAPLONG(sf_hdr->len);
+		hdr->ts.tv_sec = SWAPLONG(sf_hdr->ts.tv_sec);
+		hdr->ts.tv_usec = SWAPLONG(sf_hdr->ts.tv_usec);
 	} else {
-		hdr->caplen = sf_hdr.caplen;
-		hdr->len = sf_hdr.len;
-		hdr->ts.tv_sec = sf_hdr.ts.tv_sec;
-		hdr->ts.tv_usec = sf_hdr.ts.tv_usec;
+		hdr->caplen = sf_hdr->caplen;
+		hdr->len = sf_hdr->len;
+		hdr->ts.tv_sec = sf_hdr->ts.tv_sec;
+		hdr->ts.tv_usec = sf_hdr->ts.tv_usec;
 	}
 
 	switch (ps->scale_type) {
@@ -545,6 +558,50 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 		}
 		return (-1);
 	}
+	return (0);
+}
+
+/*
+ * Read and return the next packet from the savefile.  Return the header
+ * in hdr and a pointer to the contents in data.  Return 0 on success, 1
+ * if there were no more packets, and -1 on an error.
+ */
+static int
+pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_sf_patched_pkthdr sf_hdr;
+	FILE *fp = p->rfile;
+	size_t amt_read;
+
+	/*
+	 * Read the packet header; the structure we use as a buffer
+	 * is the longer structure for files generated by the patched
+	 * libpcap, but if the file has the magic number for an
+	 * unpatched libpcap we only read as many bytes as the regular
+	 * header has.
+	 */
+	amt_read = fread(&sf_hdr, 1, ps->hdrsize, fp);
+	if (amt_read != ps->hdrsize) {
+		if (ferror(fp)) {
+			pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "error reading dump file");
+			return (-1);
+		} else {
+			if (amt_read != 0) {
+				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+				    "truncated dump file; tried to read %lu header bytes, only got %lu",
+				    (unsigned long)ps->hdrsize,
+				    (unsigned long)amt_read);
+				return (-1);
+			}
+			/* EOF */
+			return (1);
+		}
+	}
+
+	if (pcap_convert_header(p, &sf_hdr, hdr) == -1)
+		return (-1);
 
 	if (hdr->caplen > (bpf_u_int32)p->snapshot) {
 		/*
@@ -698,6 +755,378 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 	return (0);
 }
 
+/*
+ * Return the offset of the next packet record.
+ */
+static int64_t
+pcap_tell(pcap_t *p)
+{
+#ifdef SF_MMAP_SUPPORTED
+	struct pcap_sf *ps = p->priv;
+
+	if (ps->map != NULL)
+		return ((int64_t)ps->mapoff);
+#endif
+	return (sf_ftell64(p->rfile));
+}
+
+/*
+ * Make the packet record at the given offset the next one we read.
+ */
+static int
+pcap_seek(pcap_t *p, int64_t off, u_int nifs _U_)
+{
+#ifdef SF_MMAP_SUPPORTED
+	struct pcap_sf *ps = p->priv;
+#endif
+
+	if (off < (int64_t)sizeof(struct pcap_file_header)) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "offset %" PRId64 " is in the file header", off);
+		return (-1);
+	}
+#ifdef SF_MMAP_SUPPORTED
+	if (ps->map != NULL) {
+		if ((uint64_t)off > ps->maplen) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "offset %" PRId64 " is past the end of the file",
+			    off);
+			return (-1);
+		}
+		ps->mapoff = (size_t)off;
+		ps->advised = ps->mapoff & ~(size_t)(SF_MMAP_READAHEAD - 1);
+		return (0);
+	}
+#endif
+	if (sf_fseek64(p->rfile, off) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't seek in dump file");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Number of consecutive plausible packet record headers we have to see
+ * before we believe we've found the start of a record.
+ */
+#define SF_RESYNC_CHAIN		4
+
+/*
+ * Maximum difference, in seconds, between the time stamps of
+ * consecutive records in such a chain.
+ */
+#define SF_RESYNC_MAXGAP	86400
+
+/*
+ * When the time stamps' fractions are all 0, the chain starting at each
+ * record's fraction field, this many bytes into the record, looks as
+ * good as the real one, with all of its time stamps 0.
+ */
+#define SF_RESYNC_FRACOFF	4
+
+/*
+ * Could this be a packet record header?  If so, convert it into *hdr.
+ */
+static int
+pcap_plausible_header(pcap_t *p, const u_char *buf, struct pcap_pkthdr *hdr)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_sf_patched_pkthdr sf_hdr;
+	bpf_u_int32 caplen, len, frac, t;
+	int nsec;
+
+	memcpy(&sf_hdr, buf, ps->hdrsize);
+	if (p->swapped) {
+		caplen = SWAPLONG(sf_hdr.caplen);
+		len = SWAPLONG(sf_hdr.len);
+		frac = SWAPLONG(sf_hdr.ts.tv_usec);
+	} else {
+		caplen = sf_hdr.caplen;
+		len = sf_hdr.len;
+		frac = sf_hdr.ts.tv_usec;
+	}
+	if (ps->lengths_swapped == SWAPPED ||
+	    (ps->lengths_swapped == MAYBE_SWAPPED && caplen > len)) {
+		t = caplen;
+		caplen = len;
+		len = t;
+	}
+
+	/*
+	 * The time stamp's fraction has to be less than a second; is
+	 * it in microseconds or nanoseconds in the file?
+	 */
+	nsec = (ps->scale_type == SCALE_DOWN ||
+	    (ps->scale_type == PASS_THROUGH &&
+	     p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO));
+	if (frac >= (nsec ? 1000000000U : 1000000U))
+		return (0);
+
+	/*
+	 * No packet is 0 bytes long; without this, a run of zeroes,
+	 * such as padding in the packet data, would look like a
+	 * chain of empty records.
+	 */
+	if (len == 0 || caplen > len ||
+	    caplen > max_snaplen_for_dlt(p->linktype))
+		return (0);
+	return (pcap_convert_header(p, &sf_hdr, hdr) == 0);
+}
+
+/*
+ * Is there a chain of plausible record headers starting at offset i in
+ * win, which holds len bytes of the file, and which is winsize bytes
+ * long, so that it holds the rest of the file if len < winsize?  If
+ * so, the first header is converted into *hdr.  If checkgap is 0, the
+ * gaps between the records' time stamps aren't checked.
+ */
+static int
+pcap_resync_chain(pcap_t *p, const u_char *win, size_t len, size_t winsize,
+    size_t i, int checkgap, struct pcap_pkthdr *hdr)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_pkthdr h;
+	time_t prev_sec = 0;
+	size_t j;
+	int n;
+
+	for (j = i, n = 0; n < SF_RESYNC_CHAIN; n++) {
+		if (j == len && len < winsize)
+			break;		/* ends at the end of the file */
+		if (j + ps->hdrsize > len ||
+		    !pcap_plausible_header(p, win + j, &h))
+			break;
+		if (n == 0)
+			*hdr = h;
+		else if (checkgap &&
+		    (h.ts.tv_sec - prev_sec > SF_RESYNC_MAXGAP ||
+		     prev_sec - h.ts.tv_sec > SF_RESYNC_MAXGAP))
+			break;
+		prev_sec = h.ts.tv_sec;
+		j += ps->hdrsize + h.caplen;
+	}
+	return (n == SF_RESYNC_CHAIN || (n != 0 && j == len && len < winsize));
+}
+
+/*
+ * Find the first packet record that starts at or after off, by
+ * looking for a chain of plausible record headers, each following
+ * on from the previous one, or ending exactly at the end of the file.
+ *
+ * A chain that starts SF_RESYNC_FRACOFF bytes after the start of
+ * another chain is ignored, as no record is that short, so it has to
+ * be the chain of the other chain's time stamp fractions; the window
+ * we read starts that many bytes before off to catch that.  The other
+ * chain's time stamps aren't checked for that, as a step in the clock
+ * can break it up where the chain of fractions, all 0, carries on.
+ */
+static int
+pcap_resync(pcap_t *p, int64_t off, int64_t *recoff, struct pcap_pkthdr *hdr,
+    u_int *nifs)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_pkthdr h;
+	int64_t base;
+	size_t maxrec, winsize, len, i;
+	u_char *win;
+
+	if (off < (int64_t)sizeof(struct pcap_file_header))
+		off = sizeof(struct pcap_file_header);
+	base = off - SF_RESYNC_FRACOFF;
+	if (base < (int64_t)sizeof(struct pcap_file_header))
+		base = sizeof(struct pcap_file_header);
+
+	/*
+	 * A record has to start within one maximum-sized record of
+	 * off, and the rest of the chain has to follow it.  Records
+	 * can be bigger than the snapshot length; pcap_next_packet()
+	 * cuts them down to it.
+	 */
+	maxrec = ps->hdrsize + max_snaplen_for_dlt(p->linktype);
+	winsize = (off - base) + (SF_RESYNC_CHAIN + 1) * maxrec;
+	win = malloc(winsize);
+	if (win == NULL) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	if (sf_fseek64(p->rfile, base) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't seek in dump file");
+		free(win);
+		return (-1);
+	}
+	len = fread(win, 1, winsize, p->rfile);
+	if (len != winsize && ferror(p->rfile)) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "error reading dump file");
+		free(win);
+		return (-1);
+	}
+
+	for (i = (size_t)(off - base);
+	    i < (size_t)(off - base) + maxrec && i + ps->hdrsize <= len; i++) {
+		if (!pcap_resync_chain(p, win, len, winsize, i, 1, hdr))
+			continue;
+		if (i >= SF_RESYNC_FRACOFF &&
+		    pcap_resync_chain(p, win, len, winsize,
+		    i - SF_RESYNC_FRACOFF, 0, &h))
+			continue;
+		*recoff = base + (int64_t)i;
+		*nifs = 0;
+		free(win);
+		return (0);
+	}
+	free(win);
+	return (1);
+}
+
+#ifdef SF_MMAP_SUPPORTED
+static void
+sf_mmap_cleanup(pcap_t *p)
+{
+	struct pcap_sf *ps = p->priv;
+
+	if (ps->map != NULL) {
+		(void)munmap(ps->map, ps->maplen);
+		ps->map = NULL;
+	}
+	sf_cleanup(p);
+}
+
+/*
+ * Map a savefile opened by pcap_check_header() into memory, so that
+ * packets are handed out straight from the mapping rather than being
+ * read into p->buffer.  Returns 1 if the file was mapped and 0 if it
+ * wasn't, in which case it's read with stdio as usual; that's the case
+ * for pcapng files, pipes, and files too large to map.
+ */
+int
+sf_pcap_mmap(pcap_t *p)
+{
+	struct pcap_sf *ps = p->priv;
+	struct stat st;
+	off_t off;
+	void *map;
+
+	if (p->next_packet_op != pcap_next_packet)
+		return (0);
+	if (fstat(fileno(p->rfile), &st) == -1 || !S_ISREG(st.st_mode))
+		return (0);
+	if ((off_t)(size_t)st.st_size != st.st_size)
+		return (0);	/* too big to map */
+
+	/*
+	 * Find where the first packet record starts; stdio has
+	 * probably read past it.
+	 */
+#ifdef HAVE_FSEEKO
+	off = ftello(p->rfile);
+#else
+	off = ftell(p->rfile);
+#endif
+	if (off <= 0 || off > st.st_size)
+		return (0);
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+	    fileno(p->rfile), 0);
+	if (map == MAP_FAILED)
+		return (0);
+#ifdef MADV_SEQUENTIAL
+	(void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+	ps->map = map;
+	ps->maplen = (size_t)st.st_size;
+	ps->mapoff = (size_t)off;
+	ps->advised = (size_t)off & ~(size_t)(SF_MMAP_READAHEAD - 1);
+	p->next_packet_op = pcap_next_packet_mmap;
+	p->cleanup_op = sf_mmap_cleanup;
+	return (1);
+}
+
+/*
+ * Like pcap_next_packet(), but for a savefile mapped into memory.
+ */
+static int
+pcap_next_packet_mmap(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct pcap_sf *ps = p->priv;
+	struct pcap_sf_patched_pkthdr sf_hdr;
+	size_t left = ps->maplen - ps->mapoff;
+	u_char *pkt;
+
+	if (left < ps->hdrsize) {
+		if (left != 0) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "truncated dump file; tried to read %lu header bytes, only got %lu",
+			    (unsigned long)ps->hdrsize, (unsigned long)left);
+			return (-1);
+		}
+		/* EOF */
+		return (1);
+	}
+
+	/*
+	 * The record header might not be aligned, so copy it out.
+	 */
+	memcpy(&sf_hdr, ps->map + ps->mapoff, ps->hdrsize);
+	if (pcap_convert_header(p, &sf_hdr, hdr) == -1)
+		return (-1);
+	left -= ps->hdrsize;
+	if (hdr->caplen > left) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated dump file; tried to read %u captured bytes, only got %lu",
+		    hdr->caplen, (unsigned long)left);
+		return (-1);
+	}
+	pkt = ps->map + ps->mapoff + ps->hdrsize;
+	ps->mapoff += ps->hdrsize + hdr->caplen;
+
+	/*
+	 * As in pcap_next_packet(), don't hand out more than the
+	 * snapshot length.
+	 */
+	if (hdr->caplen > (bpf_u_int32)p->snapshot)
+		hdr->caplen = p->snapshot;
+
+	if (p->swapped) {
+		/*
+		 * The pseudo-headers have to be swapped in place, and
+		 * the mapping is read-only, so copy the packet.
+		 */
+		if (hdr->caplen > p->bufsize && !grow_buffer(p, hdr->caplen))
+			return (-1);
+		memcpy(p->buffer, pkt, hdr->caplen);
+		*data = p->buffer;
+		swap_pseudo_headers(p->linktype, hdr, *data);
+	} else
+		*data = pkt;
+
+#ifdef MADV_WILLNEED
+	/*
+	 * Keep the OS reading ahead of us.
+	 */
+	while (ps->advised < ps->maplen &&
+	    ps->advised < ps->mapoff + SF_MMAP_READAHEAD) {
+		size_t len = ps->maplen - ps->advised;
+
+		if (len > SF_MMAP_READAHEAD)
+			len = SF_MMAP_READAHEAD;
+		(void)madvise(ps->map + ps->advised, len, MADV_WILLNEED);
+		ps->advised += len;
+	}
+#endif
+	return (0);
+}
+#else /* SF_MMAP_SUPPORTED */
+int
+sf_pcap_mmap(pcap_t *p _U_)
+{
+	return (0);
+}
+#endif /* SF_MMAP_SUPPORTED */
+
 static int
 sf_write_header(pcap_t *p, FILE *fp, int linktype, int thiszone, int snaplen)
 {
@@ -737,8 +1166,48 @@ pcap_dump(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 	(void)fwrite(sp, h->caplen, 1, f);
 }
 
+/*
+ * Output a batch of packets to the initialized dump file.
+ * Returns the number of packets written, or -1, with errno set,
+ * if a write failed.
+ */
+int
+pcap_dump_batch(pcap_dumper_t *p, const struct pcap_pkthdr *hdrs,
+    const u_char * const *pkts, int npkts)
+{
+	FILE *f = (FILE *)p;
+	struct pcap_sf_pkthdr sf_hdr;
+	int i;
+
+#if !defined(_WIN32) && !defined(MSDOS)
+	/*
+	 * Take the stream's lock once, rather than having each
+	 * fwrite() take it and drop it.
+	 */
+	flockfile(f);
+#endif
+	for (i = 0; i < npkts; i++) {
+		sf_hdr.ts.tv_sec  = hdrs[i].ts.tv_sec;
+		sf_hdr.ts.tv_usec = hdrs[i].ts.tv_usec;
+		sf_hdr.caplen     = hdrs[i].caplen;
+		sf_hdr.len        = hdrs[i].len;
+		if (fwrite(&sf_hdr, sizeof(sf_hdr), 1, f) != 1)
+			break;
+		if (hdrs[i].caplen != 0 &&
+		    fwrite(pkts[i], hdrs[i].caplen, 1, f) != 1)
+			break;
+	}
+#if !defined(_WIN32) && !defined(MSDOS)
+	funlockfile(f);
+#endif
+	if (i < npkts)
+		return (-1);
+	return (i);
+}
+
 static pcap_dumper_t *
-pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
+pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname,
+    size_t bufsize)
 {
 
 #if defined(_WIN32) || defined(MSDOS)
@@ -746,13 +1215,16 @@ pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
 	 * If we're writing to the standard output, put it in binary
 	 * mode, as savefiles are binary files.
 	 *
-	 * Otherwise, we turn off buffering.
+	 * Otherwise, we turn off buffering, unless we were asked
+	 * for a large buffer.
 	 * XXX - why?  And why not on the standard output?
 	 */
 	if (f == stdout)
 		SET_BINMODE(f);
-	else
+	else if (bufsize == 0)
 		setvbuf(f, NULL, _IONBF, 0);
+#else
+	(void)bufsize;
 #endif
 	if (sf_write_header(p, f, linktype, p->tzoff, p->snapshot) == -1) {
 		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
@@ -769,6 +1241,17 @@ pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
  */
 pcap_dumper_t *
 pcap_dump_open(pcap_t *p, const char *fname)
+{
+	return (pcap_dump_open_buffered(p, fname, 0, 0));
+}
+
+/*
+ * Likewise, but, if bufsize isn't 0, gather output in an aligned buffer
+ * of at least bufsize bytes and write it a buffer at a time.
+ */
+pcap_dumper_t *
+pcap_dump_open_buffered(pcap_t *p, const char *fname, size_t bufsize,
+    int flags)
 {
 	FILE *f;
 	int linktype;
@@ -797,7 +1280,19 @@ pcap_dump_open(pcap_t *p, const char *fname)
 		    "A null pointer was supplied as the file name");
 		return NULL;
 	}
-	if (fname[0] == '-' && fname[1] == '\0') {
+	if (bufsize != 0) {
+		if (fname[0] == '-' && fname[1] == '\0') {
+			fname = "standard output";
+			f = sf_bufwrite_open(NULL, bufsize, flags, p->errbuf);
+		} else
+			f = sf_bufwrite_open(fname, bufsize, flags, p->errbuf);
+		if (f == NULL)
+			return (NULL);
+	} else if (flags & PCAP_DUMP_DIRECT) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: direct I/O requires a buffer size", fname);
+		return (NULL);
+	} else if (fname[0] == '-' && fname[1] == '\0') {
 		f = stdout;
 		fname = "standard output";
 	} else {
@@ -814,7 +1309,7 @@ pcap_dump_open(pcap_t *p, const char *fname)
 			return (NULL);
 		}
 	}
-	return (pcap_setup_dump(p, linktype, f, fname));
+	return (pcap_setup_dump(p, linktype, f, fname, bufsize));
 }
 
 /*
@@ -834,7 +1329,146 @@ pcap_dump_fopen(pcap_t *p, FILE *f)
 	}
 	linktype |= p->linktype_ext;
 
-	return (pcap_setup_dump(p, linktype, f, "stream"));
+	return (pcap_setup_dump(p, linktype, f, "stream", 0));
+}
+
+/*
+ * Initialize so that sf_write() will output to a series of files,
+ * named pattern followed by a sequence number, starting a new file
+ * when the current one would grow past max_bytes bytes or span more
+ * than max_seconds seconds, and, if max_files isn't 0, deleting the
+ * oldest file when there are more than max_files of them.
+ */
+pcap_dumper_t *
+pcap_dump_open_rotating(pcap_t *p, const char *pattern, uint64_t max_bytes,
+    u_int max_seconds, u_int max_files)
+{
+	FILE *f;
+	int linktype;
+
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_dump_open_rotating",
+		    pattern);
+		return (NULL);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: link-layer type %d isn't supported in savefiles",
+		    pattern, p->linktype);
+		return (NULL);
+	}
+	linktype |= p->linktype_ext;
+
+	if (pattern == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return NULL;
+	}
+	if (max_bytes != 0 && max_bytes < sizeof(struct pcap_file_header) +
+	    sizeof(struct pcap_sf_pkthdr)) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: maximum file size is too small", pattern);
+		return (NULL);
+	}
+	f = sf_rotate_open(pattern, max_bytes, max_seconds, max_files,
+	    p->errbuf);
+	if (f == NULL)
+		return (NULL);
+	return (pcap_setup_dump(p, linktype, f, pattern, 1));
+}
+
+/*
+ * Initialize so that sf_write() will output to the file named 'fname',
+ * and write a time stamp index for it, for pcap_offline_seek_time(),
+ * with an entry every every_packets packets or every_bytes bytes.
+ */
+pcap_dumper_t *
+pcap_dump_open_indexed(pcap_t *p, const char *fname, u_int every_packets,
+    uint64_t every_bytes)
+{
+	FILE *f;
+	int linktype;
+
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_dump_open_indexed",
+		    fname);
+		return (NULL);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: link-layer type %d isn't supported in savefiles",
+		    fname, p->linktype);
+		return (NULL);
+	}
+	linktype |= p->linktype_ext;
+
+	if (fname == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return NULL;
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "The standard output can't be indexed");
+		return (NULL);
+	}
+	f = sf_index_dump_open(fname, p->opt.tstamp_precision, every_packets,
+	    every_bytes, p->errbuf);
+	if (f == NULL)
+		return (NULL);
+	return (pcap_setup_dump(p, linktype, f, fname, 1));
+}
+
+/*
+ * Initialize so that sf_write() will output to the file named 'fname',
+ * compressed with method at level, with the compression done in a
+ * helper thread if possible.
+ */
+pcap_dumper_t *
+pcap_dump_open_compressed(pcap_t *p, const char *fname, int method,
+    int level)
+{
+	FILE *f;
+	int linktype;
+
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: not-yet-activated pcap_t passed to pcap_dump_open_compressed",
+		    fname);
+		return (NULL);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "%s: link-layer type %d isn't supported in savefiles",
+		    fname, p->linktype);
+		return (NULL);
+	}
+	linktype |= p->linktype_ext;
+
+	if (fname == NULL) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return NULL;
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		fname = "standard output";
+		f = sf_compress_open(NULL, method, level, p->errbuf);
+	} else
+		f = sf_compress_open(fname, method, level, p->errbuf);
+	if (f == NULL)
+		return (NULL);
+	return (pcap_setup_dump(p, linktype, f, fname, 1));
+}
+
+int
+pcap_dump_rotate_stats(pcap_dumper_t *p, struct pcap_dump_rotate_stat *ps)
+{
+	return (sf_rotate_stats((FILE *)p, ps));
 }
 
 pcap_dumper_t *
@@ -859,7 +1493,7 @@ pcap_dump_open_append(pcap_t *p, const char *fname)
 		return NULL;
 	}
 	if (fname[0] == '-' && fname[1] == '\0')
-		return (pcap_setup_dump(p, linktype, stdout, "standard output"));
+		return (pcap_setup_dump(p, linktype, stdout, "standard output", 0));
 
 	/*
 	 * "b" is supported as of C90, so *all* UN*Xes should support it,
@@ -1063,8 +1697,9 @@ pcap_dump_flush(pcap_dumper_t *p)
 
 	if (fflush((FILE *)p) == EOF)
 		return (-1);
-	else
-		return (0);
+	if (sf_compress_flush((FILE *)p) == -1)
+		return (-1);
+	return (0);
 }
 
 void
@@ -33,5 +33,6 @@
 
 extern pcap_t *pcap_check_header(bpf_u_int32 magic, FILE *fp,
     u_int precision, char *errbuf, int *err);
+extern int sf_pcap_mmap(pcap_t *p);
 
 #endif
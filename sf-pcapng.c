@@ -35,6 +35,15 @@
 
 #include "pcap-int.h"
 
+/*
+ * We can map savefiles into memory on UN*Xes.
+ */
+#if !defined(_WIN32) && !defined(MSDOS)
+#define SF_MMAP_SUPPORTED
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "pcap-common.h"
 
 #ifdef HAVE_OS_PROTO_H
@@ -42,6 +51,9 @@
 #endif
 
 #include "sf-pcapng.h"
+#include "sf-bufwrite.h"
+#include "sf-index.h"
+#include "sf-compress.h"
 
 /*
  * Block types.
@@ -174,6 +186,18 @@ struct packet_block {
 	/* followed by packet data, options, and trailer */
 };
 
+/*
+ * Other blocks we know of.  We skip all of them when reading, except
+ * that we write ISBs; the rest only have to be recognized when looking
+ * for the start of a block in the middle of a file.
+ */
+#define BT_NRB			0x00000004	/* Name Resolution Block */
+#define BT_ISB			0x00000005	/* Interface Statistics Block */
+#define BT_SJE			0x00000009	/* systemd Journal Export Block */
+#define BT_DSB			0x0000000A	/* Decryption Secrets Block */
+#define BT_CB_COPY		0x00000BAD	/* Custom Block */
+#define BT_CB_NO_COPY		0x40000BAD	/* Custom Block, not to be copied */
+
 /*
  * Block cursor - used when processing the contents of a block.
  * Contains a pointer into the data being processed and a count
@@ -201,6 +225,18 @@ struct pcap_ng_if {
 	tstamp_scale_type_t scale_type;	/* how to scale */
 	uint64_t scale_factor;		/* time stamp scale factor for power-of-10 tsresol */
 	uint64_t tsoffset;		/* time stamp offset */
+	int64_t offset;			/* offset of its IDB in the file */
+
+	/*
+	 * Precomputed so that converting a time stamp needs no
+	 * division by a variable: tsresol is 10^tsresol_exp or
+	 * 2^tsresol_exp, scale_factor is 10^scale_exp, and, when
+	 * scaling a power-of-2 resolution down, scale_mult is the
+	 * user-requested resolution times 2^(64-tsresol_exp).
+	 */
+	u_int tsresol_exp;
+	u_int scale_exp;
+	uint64_t scale_mult;
 };
 
 /*
@@ -228,8 +264,39 @@ struct pcap_ng_sf {
 	bpf_u_int32 ifcount;		/* number of interfaces seen in this capture */
 	bpf_u_int32 ifaces_size;	/* size of array below */
 	struct pcap_ng_if *ifaces;	/* array of interface information */
+
+	/*
+	 * Where we are in the file, so that we can be repositioned.
+	 * ifaces has ifknown valid entries, for the IDBs of the current
+	 * section; ifcount of them precede the next block we'll read.
+	 * We've seen every IDB before frontier.
+	 */
+	int64_t off;			/* offset of the next block */
+	int64_t blockoff;		/* offset of the last block read */
+	int64_t section_off;		/* offset of the current section's SHB */
+	int64_t frontier;		/* furthest offset we've read to */
+	bpf_u_int32 ifknown;		/* number of valid entries in ifaces */
+
+#ifdef SF_MMAP_SUPPORTED
+	/*
+	 * If the file is mapped into memory, blocks are parsed in place
+	 * in the mapping, at off, rather than being read into p->buffer.
+	 */
+	u_char *map;		/* the file, if it's mapped into memory */
+	size_t maplen;		/* size of the mapping */
+	size_t advised;		/* offset up to which we've done MADV_WILLNEED */
+#endif
 };
 
+#ifdef SF_MMAP_SUPPORTED
+/*
+ * When the file is mapped into memory, we ask the OS to start reading
+ * the data at least this far ahead of the block we're parsing, in
+ * chunks of this size.
+ */
+#define SF_MMAP_READAHEAD	(4*1024*1024)
+#endif
+
 /*
  * Maximum block size for a given maximum snapshot length; we calculate
  * this based
@@ -245,6 +312,10 @@ struct pcap_ng_sf {
 static void pcap_ng_cleanup(pcap_t *p);
 static int pcap_ng_next_packet(pcap_t *p, struct pcap_pkthdr *hdr,
     u_char **data);
+static int64_t pcap_ng_tell(pcap_t *p);
+static int pcap_ng_seek(pcap_t *p, int64_t off, u_int nifs);
+static int pcap_ng_resync(pcap_t *p, int64_t off, int64_t *recoff,
+    struct pcap_pkthdr *hdr, u_int *nifs);
 
 static int
 read_bytes(FILE *fp, void *buf, size_t bytes_to_read, int fail_on_eof,
@@ -270,6 +341,84 @@ read_bytes(FILE *fp, void *buf, size_t bytes_to_read, int fail_on_eof,
 	return (1);
 }
 
+#ifdef SF_MMAP_SUPPORTED
+/*
+ * Like read_block(), but for a file mapped into memory; the cursor
+ * points into the mapping, so nothing is copied, and blocks we don't
+ * look at are never touched beyond their headers.  We don't map files
+ * with the opposite byte order, as we'd have to swap fields in place.
+ */
+static int
+read_block_mapped(pcap_t *p, struct block_cursor *cursor, char *errbuf)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	struct block_header *bhdrp;
+	size_t left;
+
+	if ((uint64_t)ps->off >= ps->maplen)
+		return (0);	/* EOF */
+	left = ps->maplen - (size_t)ps->off;
+	if (left < sizeof(*bhdrp)) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated dump file; tried to read %lu bytes, only got %lu",
+		    (unsigned long)sizeof(*bhdrp), (unsigned long)left);
+		return (-1);
+	}
+
+	/*
+	 * Blocks are a multiple of 4 bytes long, and the mapping is
+	 * page-aligned, so this, and the fixed-length parts of the
+	 * blocks, are aligned.
+	 */
+	bhdrp = (struct block_header *)(ps->map + ps->off);
+	if (bhdrp->total_length < sizeof(struct block_header) +
+	    sizeof(struct block_trailer) ||
+	    (bhdrp->total_length & 3) != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "block in pcapng dump file has a bad length of %u",
+		    bhdrp->total_length);
+		return (-1);
+	}
+	if (bhdrp->total_length > ps->max_blocksize) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "block is larger than maximum block size %u",
+		    ps->max_blocksize);
+		return (-1);
+	}
+	if (bhdrp->total_length > left) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "truncated dump file; tried to read %lu bytes, only got %lu",
+		    (unsigned long)(bhdrp->total_length - sizeof(*bhdrp)),
+		    (unsigned long)(left - sizeof(*bhdrp)));
+		return (-1);
+	}
+
+	ps->blockoff = ps->off;
+	ps->off += bhdrp->total_length;
+
+	cursor->data = (u_char *)(bhdrp + 1);
+	cursor->data_remaining = bhdrp->total_length - sizeof(*bhdrp) -
+	    sizeof(struct block_trailer);
+	cursor->block_type = bhdrp->block_type;
+
+#ifdef MADV_WILLNEED
+	/*
+	 * Keep the OS reading ahead of us.
+	 */
+	while (ps->advised < ps->maplen &&
+	    ps->advised < (size_t)ps->off + SF_MMAP_READAHEAD) {
+		size_t len = ps->maplen - ps->advised;
+
+		if (len > SF_MMAP_READAHEAD)
+			len = SF_MMAP_READAHEAD;
+		(void)madvise(ps->map + ps->advised, len, MADV_WILLNEED);
+		ps->advised += len;
+	}
+#endif
+	return (1);
+}
+#endif
+
 static int
 read_block(FILE *fp, pcap_t *p, struct block_cursor *cursor, char *errbuf)
 {
@@ -281,6 +430,11 @@ read_block(FILE *fp, pcap_t *p, struct block_cursor *cursor, char *errbuf)
 
 	ps = p->priv;
 
+#ifdef SF_MMAP_SUPPORTED
+	if (ps->map != NULL)
+		return (read_block_mapped(p, cursor, errbuf));
+#endif
+
 	status = read_bytes(fp, &bhdr, sizeof(bhdr), 0, errbuf);
 	if (status <= 0)
 		return (status);	/* error or EOF */
@@ -349,6 +503,9 @@ read_block(FILE *fp, pcap_t *p, struct block_cursor *cursor, char *errbuf)
 	if (read_bytes(fp, bdata, data_remaining, 1, errbuf) == -1)
 		return (-1);
 
+	ps->blockoff = ps->off;
+	ps->off += bhdr.total_length;
+
 	/*
 	 * Initialize the cursor.
 	 */
@@ -568,6 +725,8 @@ add_interface(pcap_t *p, struct block_cursor *cursor, char *errbuf)
 	uint64_t tsresol;
 	uint64_t tsoffset;
 	int is_binary;
+	uint64_t r;
+	u_int exp, scale_exp = 0;
 
 	ps = p->priv;
 
@@ -688,11 +847,16 @@ add_interface(pcap_t *p, struct block_cursor *cursor, char *errbuf)
 
 	ps->ifaces[ps->ifcount - 1].tsresol = tsresol;
 	ps->ifaces[ps->ifcount - 1].tsoffset = tsoffset;
+	ps->ifaces[ps->ifcount - 1].offset = ps->blockoff;
+	ps->ifknown = ps->ifcount;
 
 	/*
 	 * Determine whether we're scaling up or down or not
 	 * at all for this interface.
 	 */
+	for (exp = 0, r = tsresol; r > 1; r /= is_binary ? 2 : 10)
+		exp++;
+	ps->ifaces[ps->ifcount - 1].tsresol_exp = exp;
 	if (tsresol == ps->user_tsresol) {
 		/*
 		 * The resolution is the resolution the user wants,
@@ -704,13 +868,23 @@ add_interface(pcap_t *p, struct block_cursor *cursor, char *errbuf)
 		 * The resolution is greater than what the user wants,
 		 * so we have to scale the timestamps down.
 		 */
-		if (is_binary)
+		if (is_binary) {
+			/*
+			 * The user-requested resolution is less than
+			 * 2^exp, so this fits.
+			 */
+			ps->ifaces[ps->ifcount - 1].scale_mult =
+			    ps->user_tsresol << (64 - exp);
 			ps->ifaces[ps->ifcount - 1].scale_type = SCALE_DOWN_BIN;
-		else {
+		} else {
 			/*
 			 * Calculate the scale factor.
 			 */
 			ps->ifaces[ps->ifcount - 1].scale_factor = tsresol/ps->user_tsresol;
+			for (r = ps->ifaces[ps->ifcount - 1].scale_factor;
+			    r > 1; r /= 10)
+				scale_exp++;
+			ps->ifaces[ps->ifcount - 1].scale_exp = scale_exp;
 			ps->ifaces[ps->ifcount - 1].scale_type = SCALE_DOWN_DEC;
 		}
 	} else {
@@ -938,6 +1112,7 @@ pcap_ng_check_header(bpf_u_int32 magic, FILE *fp, u_int precision, char *errbuf,
 	}
 	p->version_major = shbp->major_version;
 	p->version_minor = shbp->minor_version;
+	ps->off = total_length;
 
 	/*
 	 * Save the time stamp resolution the user requested.
@@ -1034,7 +1209,11 @@ done:
 		ps->max_blocksize = MAX_BLOCKSIZE(max_snaplen_for_dlt(p->linktype));
 
 	p->next_packet_op = pcap_ng_next_packet;
+	p->sf_tell_op = pcap_ng_tell;
+	p->sf_seek_op = pcap_ng_seek;
+	p->sf_resync_op = pcap_ng_resync;
 	p->cleanup_op = pcap_ng_cleanup;
+	ps->frontier = ps->off;
 
 	return (p);
 
@@ -1051,259 +1230,716 @@ pcap_ng_cleanup(pcap_t *p)
 {
 	struct pcap_ng_sf *ps = p->priv;
 
+#ifdef SF_MMAP_SUPPORTED
+	if (ps->map != NULL) {
+		(void)munmap(ps->map, ps->maplen);
+		ps->map = NULL;
+	}
+#endif
 	free(ps->ifaces);
 	sf_cleanup(p);
 }
 
 /*
- * Read and return the next packet from the savefile.  Return the header
- * in hdr and a pointer to the contents in data.  Return 0 on success, 1
- * if there were no more packets, and -1 on an error.
+ * Map a pcapng file opened by pcap_ng_check_header() into memory, so
+ * that blocks are parsed where they lie rather than being read into
+ * p->buffer.  Returns 1 if the file was mapped and 0 if it wasn't, in
+ * which case it's read with stdio as usual; that's the case for pcap
+ * files, files with the opposite byte order, pipes, and files too
+ * large to map.
+ */
+#ifdef SF_MMAP_SUPPORTED
+int
+sf_pcap_ng_mmap(pcap_t *p)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	struct stat st;
+	void *map;
+
+	if (p->next_packet_op != pcap_ng_next_packet || p->swapped)
+		return (0);
+	if (fstat(fileno(p->rfile), &st) == -1 || !S_ISREG(st.st_mode))
+		return (0);
+	if ((off_t)(size_t)st.st_size != st.st_size)
+		return (0);	/* too big to map */
+	if (ps->off <= 0 || ps->off > st.st_size)
+		return (0);
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+	    fileno(p->rfile), 0);
+	if (map == MAP_FAILED)
+		return (0);
+#ifdef MADV_SEQUENTIAL
+	(void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+	ps->map = map;
+	ps->maplen = (size_t)st.st_size;
+	ps->advised = (size_t)ps->off & ~(size_t)(SF_MMAP_READAHEAD - 1);
+	return (1);
+}
+#else /* SF_MMAP_SUPPORTED */
+int
+sf_pcap_ng_mmap(pcap_t *p _U_)
+{
+	return (0);
+}
+#endif /* SF_MMAP_SUPPORTED */
+
+/*
+ * Process an Interface Description Block.
  */
 static int
-pcap_ng_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+process_idb_block(pcap_t *p, struct block_cursor *cursor)
 {
 	struct pcap_ng_sf *ps = p->priv;
-	struct block_cursor cursor;
-	int status;
-	struct enhanced_packet_block *epbp;
-	struct simple_packet_block *spbp;
-	struct packet_block *pbp;
-	bpf_u_int32 interface_id = 0xFFFFFFFF;
 	struct interface_description_block *idbp;
-	struct section_header_block *shbp;
-	FILE *fp = p->rfile;
-	uint64_t t, sec, frac;
 
 	/*
-	 * Look for an Enhanced Packet Block, a Simple Packet Block,
-	 * or a Packet Block.
+	 * Interface Description Block.  Get a pointer
+	 * to its fixed-length portion.
 	 */
-	for (;;) {
-		/*
-		 * Read the block type and length; those are common
-		 * to all blocks.
-		 */
-		status = read_block(fp, p, &cursor, p->errbuf);
-		if (status == 0)
-			return (1);	/* EOF */
-		if (status == -1)
-			return (-1);	/* error */
-		switch (cursor.block_type) {
+	idbp = get_from_block_data(cursor, sizeof(*idbp),
+	    p->errbuf);
+	if (idbp == NULL)
+		return (-1);	/* error */
 
-		case BT_EPB:
-			/*
-			 * Get a pointer to the fixed-length portion of the
-			 * EPB.
-			 */
-			epbp = get_from_block_data(&cursor, sizeof(*epbp),
-			    p->errbuf);
-			if (epbp == NULL)
-				return (-1);	/* error */
+	/*
+	 * Byte-swap it if necessary.
+	 */
+	if (p->swapped) {
+		idbp->linktype = SWAPSHORT(idbp->linktype);
+		idbp->snaplen = SWAPLONG(idbp->snaplen);
+	}
 
-			/*
-			 * Byte-swap it if necessary.
-			 */
-			if (p->swapped) {
-				/* these were written in opposite byte order */
-				interface_id = SWAPLONG(epbp->interface_id);
-				hdr->caplen = SWAPLONG(epbp->caplen);
-				hdr->len = SWAPLONG(epbp->len);
-				t = ((uint64_t)SWAPLONG(epbp->timestamp_high)) << 32 |
-				    SWAPLONG(epbp->timestamp_low);
-			} else {
-				interface_id = epbp->interface_id;
-				hdr->caplen = epbp->caplen;
-				hdr->len = epbp->len;
-				t = ((uint64_t)epbp->timestamp_high) << 32 |
-				    epbp->timestamp_low;
-			}
-			goto found;
+	/*
+	 * If the link-layer type or snapshot length
+	 * differ from the ones for the first IDB we
+	 * saw, quit.
+	 *
+	 * XXX - just discard packets from those
+	 * interfaces?
+	 */
+	if (p->linktype != idbp->linktype) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "an interface has a type %u different from the type of the first interface",
+		    idbp->linktype);
+		return (-1);
+	}
+	if ((bpf_u_int32)p->snapshot != idbp->snaplen) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "an interface has a snapshot length %u different from the type of the first interface",
+		    idbp->snaplen);
+		return (-1);
+	}
 
-		case BT_SPB:
-			/*
-			 * Get a pointer to the fixed-length portion of the
-			 * SPB.
-			 */
-			spbp = get_from_block_data(&cursor, sizeof(*spbp),
-			    p->errbuf);
-			if (spbp == NULL)
-				return (-1);	/* error */
+	/*
+	 * If we've been repositioned to before this IDB, we already
+	 * have it.
+	 */
+	if (ps->ifcount < ps->ifknown &&
+	    ps->ifaces[ps->ifcount].offset == ps->blockoff) {
+		ps->ifcount++;
+		return (0);
+	}
 
-			/*
-			 * SPB packets are assumed to have arrived on
-			 * the first interface.
-			 */
-			interface_id = 0;
+	/*
+	 * Try to add this interface.
+	 */
+	if (!add_interface(p, cursor, p->errbuf))
+		return (-1);
+	return (0);
+}
 
-			/*
-			 * Byte-swap it if necessary.
-			 */
-			if (p->swapped) {
-				/* these were written in opposite byte order */
-				hdr->len = SWAPLONG(spbp->len);
-			} else
-				hdr->len = spbp->len;
+/*
+ * Process a Section Header Block after the first.
+ */
+static int
+process_shb_block(pcap_t *p, struct block_cursor *cursor)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	struct section_header_block *shbp;
 
-			/*
-			 * The SPB doesn't give the captured length;
-			 * it's the minimum of the snapshot length
-			 * and the packet length.
-			 */
-			hdr->caplen = hdr->len;
-			if (hdr->caplen > (bpf_u_int32)p->snapshot)
-				hdr->caplen = p->snapshot;
-			t = 0;	/* no time stamps */
-			goto found;
+	/*
+	 * Section Header Block.  Get a pointer
+	 * to its fixed-length portion.
+	 */
+	shbp = get_from_block_data(cursor, sizeof(*shbp),
+	    p->errbuf);
+	if (shbp == NULL)
+		return (-1);	/* error */
 
-		case BT_PB:
-			/*
-			 * Get a pointer to the fixed-length portion of the
-			 * PB.
-			 */
-			pbp = get_from_block_data(&cursor, sizeof(*pbp),
-			    p->errbuf);
-			if (pbp == NULL)
-				return (-1);	/* error */
+	/*
+	 * Assume the byte order of this section is
+	 * the same as that of the previous section.
+	 * We'll check for that later.
+	 */
+	if (p->swapped) {
+		shbp->byte_order_magic =
+		    SWAPLONG(shbp->byte_order_magic);
+		shbp->major_version =
+		    SWAPSHORT(shbp->major_version);
+	}
 
-			/*
-			 * Byte-swap it if necessary.
-			 */
-			if (p->swapped) {
-				/* these were written in opposite byte order */
-				interface_id = SWAPSHORT(pbp->interface_id);
-				hdr->caplen = SWAPLONG(pbp->caplen);
-				hdr->len = SWAPLONG(pbp->len);
-				t = ((uint64_t)SWAPLONG(pbp->timestamp_high)) << 32 |
-				    SWAPLONG(pbp->timestamp_low);
-			} else {
-				interface_id = pbp->interface_id;
-				hdr->caplen = pbp->caplen;
-				hdr->len = pbp->len;
-				t = ((uint64_t)pbp->timestamp_high) << 32 |
-				    pbp->timestamp_low;
-			}
-			goto found;
+	/*
+	 * Make sure the byte order doesn't change;
+	 * pcap_is_swapped() shouldn't change its
+	 * return value in the middle of reading a capture.
+	 */
+	switch (shbp->byte_order_magic) {
 
-		case BT_IDB:
-			/*
-			 * Interface Description Block.  Get a pointer
-			 * to its fixed-length portion.
-			 */
-			idbp = get_from_block_data(&cursor, sizeof(*idbp),
-			    p->errbuf);
-			if (idbp == NULL)
-				return (-1);	/* error */
+	case BYTE_ORDER_MAGIC:
+		/*
+		 * OK.
+		 */
+		break;
 
-			/*
-			 * Byte-swap it if necessary.
-			 */
-			if (p->swapped) {
-				idbp->linktype = SWAPSHORT(idbp->linktype);
-				idbp->snaplen = SWAPLONG(idbp->snaplen);
-			}
+	case SWAPLONG(BYTE_ORDER_MAGIC):
+		/*
+		 * Byte order changes.
+		 */
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "the file has sections with different byte orders");
+		return (-1);
 
-			/*
-			 * If the link-layer type or snapshot length
-			 * differ from the ones for the first IDB we
-			 * saw, quit.
-			 *
-			 * XXX - just discard packets from those
-			 * interfaces?
-			 */
-			if (p->linktype != idbp->linktype) {
-				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "an interface has a type %u different from the type of the first interface",
-				    idbp->linktype);
-				return (-1);
-			}
-			if ((bpf_u_int32)p->snapshot != idbp->snaplen) {
+	default:
+		/*
+		 * Not a valid SHB.
+		 */
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "the file has a section with a bad byte order magic field");
+		return (-1);
+	}
+
+	/*
+	 * Make sure the major version is the version
+	 * we handle.
+	 */
+	if (shbp->major_version != PCAP_NG_VERSION_MAJOR) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "unknown pcapng savefile major version number %u",
+		    shbp->major_version);
+		return (-1);
+	}
+
+	/*
+	 * Reset the interface count; this section should
+	 * have its own set of IDBs.  If any of them
+	 * don't have the same interface type, snapshot
+	 * length, or resolution as the first interface
+	 * we saw, we'll fail.  (And if we don't see
+	 * any IDBs, we'll fail when we see a packet
+	 * block.)
+	 *
+	 * If we've been repositioned to the beginning of the
+	 * section we're in, we already know its IDBs.
+	 */
+	ps->ifcount = 0;
+	if (ps->blockoff != ps->section_off) {
+		ps->ifknown = 0;
+		ps->section_off = ps->blockoff;
+	}
+	return (0);
+}
+
+/*
+ * Return the offset of the next block.
+ */
+static int64_t
+pcap_ng_tell(pcap_t *p)
+{
+	struct pcap_ng_sf *ps = p->priv;
+
+	return (ps->off);
+}
+
+/*
+ * Forget the section we're in and go back to the beginning of the
+ * file.
+ */
+static void
+pcap_ng_restart(pcap_t *p)
+{
+	struct pcap_ng_sf *ps = p->priv;
+
+	ps->section_off = 0;
+	ps->frontier = 0;
+	ps->ifcount = 0;
+	ps->ifknown = 0;
+}
+
+/*
+ * Follow the chain of block lengths from frontier to the first block
+ * that starts at or after off, processing the IDBs and SHBs we pass
+ * and skipping the rest, and return its offset in *posp.  If nifs
+ * isn't 0, it's the number of IDBs before off, all in the first
+ * section, so we can jump to off once we've seen that many.
+ *
+ * Returns 0 on success, 1 if we got to the end of the file first,
+ * and -1 on an error.
+ */
+static int
+pcap_ng_walk(pcap_t *p, int64_t off, u_int nifs, int64_t *posp)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	FILE *fp = p->rfile;
+	struct block_header bhdr;
+	struct block_cursor cursor;
+	int64_t pos;
+	int status;
+
+	ps->ifcount = ps->ifknown;
+	pos = ps->frontier;
+	if (sf_fseek64(fp, pos) == -1)
+		goto seekerr;
+	while (pos < off) {
+		if (nifs != 0 && ps->section_off == 0 &&
+		    ps->ifknown >= nifs) {
+			pos = off;
+			break;
+		}
+		status = read_bytes(fp, &bhdr, sizeof(bhdr), 0, p->errbuf);
+		if (status == -1)
+			return (-1);
+		if (status == 0)
+			return (1);
+		if (p->swapped) {
+			bhdr.block_type = SWAPLONG(bhdr.block_type);
+			bhdr.total_length = SWAPLONG(bhdr.total_length);
+		}
+		if (bhdr.total_length < sizeof(struct block_header) +
+		    sizeof(struct block_trailer) ||
+		    (bhdr.total_length & 3) != 0) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "block in pcapng dump file has a bad length of %u",
+			    bhdr.total_length);
+			return (-1);
+		}
+		if (bhdr.block_type == BT_IDB || bhdr.block_type == BT_SHB) {
+			if (sf_fseek64(fp, pos) == -1)
+				goto seekerr;
+			ps->off = pos;
+			status = read_block(fp, p, &cursor, p->errbuf);
+			if (status == 0) {
 				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "an interface has a snapshot length %u different from the type of the first interface",
-				    idbp->snaplen);
+				    "truncated dump file");
 				return (-1);
 			}
-
-			/*
-			 * Try to add this interface.
-			 */
-			if (!add_interface(p, &cursor, p->errbuf))
+			if (status == -1)
 				return (-1);
-			break;
+			if (bhdr.block_type == BT_IDB)
+				status = process_idb_block(p, &cursor);
+			else
+				status = process_shb_block(p, &cursor);
+			if (status == -1)
+				return (-1);
+		}
 
-		case BT_SHB:
+		/*
+		 * If the file's mapped, reading the block didn't move
+		 * us past it.
+		 */
+		pos += bhdr.total_length;
+		if (sf_fseek64(fp, pos) == -1)
+			goto seekerr;
+		ps->frontier = pos;
+	}
+	ps->frontier = pos;
+	*posp = pos;
+	return (0);
+
+seekerr:
+	pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+	    errno, "can't seek in dump file");
+	return (-1);
+}
+
+/*
+ * Make the block at the given offset the next one we read.
+ *
+ * The interfaces described before that offset have to be the ones
+ * the packets after it refer to, so, if we haven't read that far, we
+ * look at the blocks in between for IDBs and SHBs.
+ */
+static int
+pcap_ng_seek(pcap_t *p, int64_t off, u_int nifs)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	int64_t pos;
+	bpf_u_int32 i;
+	int status;
+
+	if (off < ps->section_off) {
+		/*
+		 * That's in an earlier section, whose IDBs we've
+		 * forgotten; start again from the beginning.
+		 */
+		pcap_ng_restart(p);
+	}
+	if (off <= ps->frontier) {
+		for (i = 0; i < ps->ifknown && ps->ifaces[i].offset < off; i++)
+			;
+		ps->ifcount = i;
+		pos = off;
+	} else {
+		status = pcap_ng_walk(p, off, nifs, &pos);
+		if (status == -1)
+			return (-1);
+		if (status == 1) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "offset %" PRId64 " is past the end of the file",
+			    off);
+			return (-1);
+		}
+		if (pos != off) {
+			pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+			    "offset %" PRId64 " isn't at the start of a block",
+			    off);
+			return (-1);
+		}
+	}
+	if (sf_fseek64(p->rfile, pos) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't seek in dump file");
+		return (-1);
+	}
+	ps->off = pos;
+#ifdef SF_MMAP_SUPPORTED
+	ps->advised = (size_t)pos & ~(size_t)(SF_MMAP_READAHEAD - 1);
+#endif
+	return (0);
+}
+
+/*
+ * Number of consecutive plausible blocks we have to see before we
+ * believe we've found the start of a block.
+ */
+#define NG_RESYNC_CHAIN		4
+
+static int
+pcap_ng_plausible_block_type(bpf_u_int32 block_type)
+{
+	switch (block_type) {
+
+	case BT_SHB:
+	case BT_IDB:
+	case BT_PB:
+	case BT_SPB:
+	case BT_NRB:
+	case BT_ISB:
+	case BT_EPB:
+	case BT_SJE:
+	case BT_DSB:
+	case BT_CB_COPY:
+	case BT_CB_NO_COPY:
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Find the first block that starts at or after off, somewhere we've
+ * already read past, by looking for a chain of blocks of known types
+ * whose trailing lengths match their leading ones, each following on
+ * from the previous one, or ending exactly at the end of the file.
+ * Blocks start on 4-byte boundaries, so we only look at those.
+ */
+static int
+pcap_ng_find_block(pcap_t *p, int64_t off, int64_t *posp)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	bpf_u_int32 type, len, trailer;
+	size_t winsize, got, i, j;
+	u_char *win;
+	int n;
+
+	off = (off + 3) & ~(int64_t)3;
+	winsize = (NG_RESYNC_CHAIN + 1) * (size_t)ps->max_blocksize;
+	win = malloc(winsize);
+	if (win == NULL) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	if (sf_fseek64(p->rfile, off) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't seek in dump file");
+		free(win);
+		return (-1);
+	}
+	got = fread(win, 1, winsize, p->rfile);
+	if (got != winsize && ferror(p->rfile)) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "error reading dump file");
+		free(win);
+		return (-1);
+	}
+
+	for (i = 0; i < ps->max_blocksize && i + 8 <= got; i += 4) {
+		for (j = i, n = 0; n < NG_RESYNC_CHAIN; n++) {
+			if (j == got && got < winsize)
+				break;		/* ends at the end of the file */
+			if (j + 8 > got)
+				break;
+			memcpy(&type, win + j, 4);
+			memcpy(&len, win + j + 4, 4);
+			if (p->swapped) {
+				type = SWAPLONG(type);
+				len = SWAPLONG(len);
+			}
+			if (!pcap_ng_plausible_block_type(type) ||
+			    len < sizeof(struct block_header) +
+			    sizeof(struct block_trailer) ||
+			    (len & 3) != 0 || len > ps->max_blocksize ||
+			    len > got - j)
+				break;
+			memcpy(&trailer, win + j + len - 4, 4);
+			if (p->swapped)
+				trailer = SWAPLONG(trailer);
+			if (trailer != len)
+				break;
+			j += len;
+		}
+		if (n == NG_RESYNC_CHAIN || (n != 0 && j == got && got < winsize)) {
+			*posp = off + (int64_t)i;
+			free(win);
+			return (0);
+		}
+	}
+	free(win);
+	return (1);
+}
+
+/*
+ * Find the first packet block that starts at or after off.  Past the
+ * furthest we've read, we can follow the chain of block lengths, which
+ * we have to do anyway to see the IDBs; before it, we look for the
+ * start of a block, and the IDBs we've seen tell us which interfaces
+ * are described before it.
+ */
+static int
+pcap_ng_resync(pcap_t *p, int64_t off, int64_t *recoff,
+    struct pcap_pkthdr *hdr, u_int *nifs)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	int64_t pos;
+	u_char *data;
+	int status;
+
+	if (off < ps->section_off)
+		pcap_ng_restart(p);
+	if (off > ps->frontier)
+		status = pcap_ng_walk(p, off, 0, &pos);
+	else
+		status = pcap_ng_find_block(p, off, &pos);
+	if (status != 0)
+		return (status);
+	if (pcap_ng_seek(p, pos, 0) == -1)
+		return (-1);
+	status = pcap_ng_next_packet(p, hdr, &data);
+	if (status != 0)
+		return (status);
+	*recoff = ps->blockoff;
+	*nifs = ps->section_off == 0 ? ps->ifcount : 0;
+	return (0);
+}
+
+/*
+ * Divide by 10^e, for 0 <= e <= 19.  Each case divides by a constant,
+ * which compilers turn into a multiplication and shifts.
+ */
+static inline uint64_t
+div_pow10(uint64_t x, u_int e)
+{
+	switch (e) {
+
+	case 0:		return (x);
+	case 1:		return (x / 10U);
+	case 2:		return (x / 100U);
+	case 3:		return (x / 1000U);
+	case 4:		return (x / 10000U);
+	case 5:		return (x / 100000U);
+	case 6:		return (x / 1000000U);
+	case 7:		return (x / 10000000U);
+	case 8:		return (x / 100000000U);
+	case 9:		return (x / 1000000000U);
+	case 10:	return (x / 10000000000ULL);
+	case 11:	return (x / 100000000000ULL);
+	case 12:	return (x / 1000000000000ULL);
+	case 13:	return (x / 10000000000000ULL);
+	case 14:	return (x / 100000000000000ULL);
+	case 15:	return (x / 1000000000000000ULL);
+	case 16:	return (x / 10000000000000000ULL);
+	case 17:	return (x / 100000000000000000ULL);
+	case 18:	return (x / 1000000000000000000ULL);
+	default:	return (x / 10000000000000000000ULL);
+	}
+}
+
+/*
+ * Return the upper 64 bits of the 128-bit product of a and b.
+ */
+static inline uint64_t
+mulhi64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	return ((uint64_t)(((unsigned __int128)a * b) >> 64));
+#else
+	uint64_t a_lo = a & 0xFFFFFFFFU, a_hi = a >> 32;
+	uint64_t b_lo = b & 0xFFFFFFFFU, b_hi = b >> 32;
+	uint64_t lo_lo = a_lo * b_lo, lo_hi = a_lo * b_hi;
+	uint64_t hi_lo = a_hi * b_lo, hi_hi = a_hi * b_hi;
+	uint64_t mid;
+
+	mid = (lo_lo >> 32) + (lo_hi & 0xFFFFFFFFU) + (hi_lo & 0xFFFFFFFFU);
+	return (hi_hi + (lo_hi >> 32) + (hi_lo >> 32) + (mid >> 32));
+#endif
+}
+
+/*
+ * Read and return the next packet from the savefile.  Return the header
+ * in hdr and a pointer to the contents in data.  Return 0 on success, 1
+ * if there were no more packets, and -1 on an error.
+ */
+static int
+pcap_ng_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
+{
+	struct pcap_ng_sf *ps = p->priv;
+	struct block_cursor cursor;
+	int status;
+	struct enhanced_packet_block *epbp;
+	struct simple_packet_block *spbp;
+	struct packet_block *pbp;
+	bpf_u_int32 interface_id = 0xFFFFFFFF;
+	FILE *fp = p->rfile;
+	struct pcap_ng_if *ifp;
+	uint64_t t, sec, frac;
+
+	/*
+	 * Look for an Enhanced Packet Block, a Simple Packet Block,
+	 * or a Packet Block.
+	 */
+	for (;;) {
+		/*
+		 * Read the block type and length; those are common
+		 * to all blocks.
+		 */
+		status = read_block(fp, p, &cursor, p->errbuf);
+		if (status == 0)
+			return (1);	/* EOF */
+		if (status == -1)
+			return (-1);	/* error */
+		if (ps->off > ps->frontier)
+			ps->frontier = ps->off;
+		switch (cursor.block_type) {
+
+		case BT_EPB:
 			/*
-			 * Section Header Block.  Get a pointer
-			 * to its fixed-length portion.
+			 * Get a pointer to the fixed-length portion of the
+			 * EPB.
 			 */
-			shbp = get_from_block_data(&cursor, sizeof(*shbp),
+			epbp = get_from_block_data(&cursor, sizeof(*epbp),
 			    p->errbuf);
-			if (shbp == NULL)
+			if (epbp == NULL)
 				return (-1);	/* error */
 
 			/*
-			 * Assume the byte order of this section is
-			 * the same as that of the previous section.
-			 * We'll check for that later.
+			 * Byte-swap it if necessary.
 			 */
 			if (p->swapped) {
-				shbp->byte_order_magic =
-				    SWAPLONG(shbp->byte_order_magic);
-				shbp->major_version =
-				    SWAPSHORT(shbp->major_version);
+				/* these were written in opposite byte order */
+				interface_id = SWAPLONG(epbp->interface_id);
+				hdr->caplen = SWAPLONG(epbp->caplen);
+				hdr->len = SWAPLONG(epbp->len);
+				t = ((uint64_t)SWAPLONG(epbp->timestamp_high)) << 32 |
+				    SWAPLONG(epbp->timestamp_low);
+			} else {
+				interface_id = epbp->interface_id;
+				hdr->caplen = epbp->caplen;
+				hdr->len = epbp->len;
+				t = ((uint64_t)epbp->timestamp_high) << 32 |
+				    epbp->timestamp_low;
 			}
+			goto found;
 
+		case BT_SPB:
 			/*
-			 * Make sure the byte order doesn't change;
-			 * pcap_is_swapped() shouldn't change its
-			 * return value in the middle of reading a capture.
+			 * Get a pointer to the fixed-length portion of the
+			 * SPB.
 			 */
-			switch (shbp->byte_order_magic) {
+			spbp = get_from_block_data(&cursor, sizeof(*spbp),
+			    p->errbuf);
+			if (spbp == NULL)
+				return (-1);	/* error */
 
-			case BYTE_ORDER_MAGIC:
-				/*
-				 * OK.
-				 */
-				break;
+			/*
+			 * SPB packets are assumed to have arrived on
+			 * the first interface.
+			 */
+			interface_id = 0;
 
-			case SWAPLONG(BYTE_ORDER_MAGIC):
-				/*
-				 * Byte order changes.
-				 */
-				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "the file has sections with different byte orders");
-				return (-1);
+			/*
+			 * Byte-swap it if necessary.
+			 */
+			if (p->swapped) {
+				/* these were written in opposite byte order */
+				hdr->len = SWAPLONG(spbp->len);
+			} else
+				hdr->len = spbp->len;
 
-			default:
-				/*
-				 * Not a valid SHB.
-				 */
-				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "the file has a section with a bad byte order magic field");
-				return (-1);
+			/*
+			 * The SPB doesn't give the captured length;
+			 * it's the minimum of the snapshot length
+			 * and the packet length.
+			 */
+			hdr->caplen = hdr->len;
+			if (hdr->caplen > (bpf_u_int32)p->snapshot)
+				hdr->caplen = p->snapshot;
+			t = 0;	/* no time stamps */
+			goto found;
+
+		case BT_PB:
+			/*
+			 * Get a pointer to the fixed-length portion of the
+			 * PB.
+			 */
+			pbp = get_from_block_data(&cursor, sizeof(*pbp),
+			    p->errbuf);
+			if (pbp == NULL)
+				return (-1);	/* error */
+
+			/*
+			 * Byte-swap it if necessary.
+			 */
+			if (p->swapped) {
+				/* these were written in opposite byte order */
+				interface_id = SWAPSHORT(pbp->interface_id);
+				hdr->caplen = SWAPLONG(pbp->caplen);
+				hdr->len = SWAPLONG(pbp->len);
+				t = ((uint64_t)SWAPLONG(pbp->timestamp_high)) << 32 |
+				    SWAPLONG(pbp->timestamp_low);
+			} else {
+				interface_id = pbp->interface_id;
+				hdr->caplen = pbp->caplen;
+				hdr->len = pbp->len;
+				t = ((uint64_t)pbp->timestamp_high) << 32 |
+				    pbp->timestamp_low;
 			}
+			goto found;
 
+		case BT_IDB:
 			/*
-			 * Make sure the major version is the version
-			 * we handle.
+			 * Interface Description Block.
 			 */
-			if (shbp->major_version != PCAP_NG_VERSION_MAJOR) {
-				pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
-				    "unknown pcapng savefile major version number %u",
-				    shbp->major_version);
+			if (process_idb_block(p, &cursor) == -1)
 				return (-1);
-			}
+			break;
 
+		case BT_SHB:
 			/*
-			 * Reset the interface count; this section should
-			 * have its own set of IDBs.  If any of them
-			 * don't have the same interface type, snapshot
-			 * length, or resolution as the first interface
-			 * we saw, we'll fail.  (And if we don't see
-			 * any IDBs, we'll fail when we see a packet
-			 * block.)
+			 * Section Header Block.
 			 */
-			ps->ifcount = 0;
+			if (process_shb_block(p, &cursor) == -1)
+				return (-1);
 			break;
 
 		default:
@@ -1337,22 +1973,19 @@ found:
 
 	/*
 	 * Convert the time stamp to seconds and fractions of a second,
-	 * with the fractions being in units of the file-supplied resolution.
-	 */
-	sec = t / ps->ifaces[interface_id].tsresol + ps->ifaces[interface_id].tsoffset;
-	frac = t % ps->ifaces[interface_id].tsresol;
-
-	/*
-	 * Convert the fractions from units of the file-supplied resolution
-	 * to units of the user-requested resolution.
+	 * and convert the fractions from units of the file-supplied
+	 * resolution to units of the user-requested resolution.
 	 */
-	switch (ps->ifaces[interface_id].scale_type) {
+	ifp = &ps->ifaces[interface_id];
+	switch (ifp->scale_type) {
 
 	case PASS_THROUGH:
 		/*
 		 * The interface resolution is what the user wants,
-		 * so we're done.
+		 * so we're done once we've split the time stamp.
 		 */
+		sec = div_pow10(t, ifp->tsresol_exp);
+		frac = t - sec * ifp->tsresol;
 		break;
 
 	case SCALE_UP_DEC:
@@ -1369,80 +2002,50 @@ found:
 		 * We've calculated that quotient already, so we just
 		 * multiply by it.
 		 */
-		frac *= ps->ifaces[interface_id].scale_factor;
+		sec = div_pow10(t, ifp->tsresol_exp);
+		frac = (t - sec * ifp->tsresol) * ifp->scale_factor;
 		break;
 
-	case SCALE_UP_BIN:
+	case SCALE_DOWN_DEC:
 		/*
-		 * The interface resolution is less than what the user
-		 * wants; scale the fractional part up to the units of
-		 * the resolution the user requested by multiplying by
-		 * the quotient of the user-requested resolution and the
-		 * file-supplied resolution.
-		 *
-		 * The file-supplied resolution is a power of 2, so the
-		 * quotient is not an integer, so, in order to do this
-		 * entirely with integer arithmetic, we multiply by the
-		 * user-requested resolution and divide by the file-
-		 * supplied resolution.
-		 *
-		 * XXX - Is there something clever we could do here,
-		 * given that we know that the file-supplied resolution
-		 * is a power of 2?  Doing a multiplication followed by
-		 * a division runs the risk of overflowing, and involves
-		 * two non-simple arithmetic operations.
+		 * The interface resolution is greater than what the user
+		 * wants; scale the fractional part down to the units of
+		 * the resolution the user requested by dividing by the
+		 * quotient of the file-supplied resolution and the
+		 * user-requested resolution, which is a power of 10.
 		 */
-		frac *= ps->user_tsresol;
-		frac /= ps->ifaces[interface_id].tsresol;
+		sec = div_pow10(t, ifp->tsresol_exp);
+		frac = div_pow10(t - sec * ifp->tsresol, ifp->scale_exp);
 		break;
 
-	case SCALE_DOWN_DEC:
+	case SCALE_UP_BIN:
 		/*
-		 * The interface resolution is greater than what the user
-		 * wants; scale the fractional part up to the units of
-		 * the resolution the user requested by multiplying by
-		 * the quotient of the user-requested resolution and the
-		 * file-supplied resolution.
-		 *
-		 * Those resolutions are both powers of 10, and the user-
-		 * requested resolution is less than the file-supplied
-		 * resolution, so the quotient in question isn't an
-		 * integer, but its reciprocal is, and we can just divide
-		 * by the reciprocal of the quotient.  We've calculated
-		 * the reciprocal of that quotient already, so we must
-		 * divide by it.
+		 * The interface resolution is a power of 2 less than
+		 * what the user wants; multiply the fractional part by
+		 * the user-requested resolution and divide it by the
+		 * file-supplied resolution.  The fractional part is
+		 * less than the latter, which is less than the former,
+		 * so the product fits in 64 bits.
 		 */
-		frac /= ps->ifaces[interface_id].scale_factor;
+		sec = t >> ifp->tsresol_exp;
+		frac = ((t & (ifp->tsresol - 1)) * ps->user_tsresol) >>
+		    ifp->tsresol_exp;
 		break;
 
-
 	case SCALE_DOWN_BIN:
+	default:
 		/*
-		 * The interface resolution is greater than what the user
-		 * wants; convert the fractional part to units of the
-		 * resolution the user requested by multiplying by the
-		 * quotient of the user-requested resolution and the
-		 * file-supplied resolution.  We do that by multiplying
-		 * by the user-requested resolution and dividing by the
-		 * file-supplied resolution, as the quotient might not
-		 * fit in an integer.
-		 *
-		 * The file-supplied resolution is a power of 2, so the
-		 * quotient is not an integer, and neither is its
-		 * reciprocal, so, in order to do this entirely with
-		 * integer arithmetic, we multiply by the user-requested
-		 * resolution and divide by the file-supplied resolution.
-		 *
-		 * XXX - Is there something clever we could do here,
-		 * given that we know that the file-supplied resolution
-		 * is a power of 2?  Doing a multiplication followed by
-		 * a division runs the risk of overflowing, and involves
-		 * two non-simple arithmetic operations.
+		 * The interface resolution is a power of 2 greater than
+		 * what the user wants; multiplying the fractional part
+		 * by the user-requested resolution could overflow, so
+		 * take the upper 64 bits of its product with that
+		 * resolution shifted up to make up for the division.
 		 */
-		frac *= ps->user_tsresol;
-		frac /= ps->ifaces[interface_id].tsresol;
+		sec = t >> ifp->tsresol_exp;
+		frac = mulhi64(t & (ifp->tsresol - 1), ifp->scale_mult);
 		break;
 	}
+	sec += ifp->tsoffset;
 #ifdef _WIN32
 	/*
 	 * tv_sec and tv_used in the Windows struct timeval are both
@@ -1473,3 +2076,431 @@ found:
 
 	return (0);
 }
+
+/*
+ * Writing pcapng files.
+ *
+ * We write a single section, in host byte order, with an IDB for each
+ * interface added to the dumper, an EPB for each packet, and an ISB
+ * for each set of statistics.
+ */
+
+/*
+ * Interface Statistics Block.
+ */
+struct interface_statistics_block {
+	bpf_u_int32	interface_id;
+	bpf_u_int32	timestamp_high;
+	bpf_u_int32	timestamp_low;
+	/* followed by options and trailer */
+};
+
+/*
+ * Options in the ISB.
+ */
+#define ISB_IFRECV	4	/* packets received by the interface */
+#define ISB_IFDROP	5	/* packets dropped by the interface */
+#define ISB_OSDROP	7	/* packets dropped by the OS */
+
+/*
+ * Size of the buffer for a dumper we open ourselves.
+ */
+#define PCAP_NG_DUMP_BUFSIZE	(1024*1024)
+
+#define ROUNDUP4(x)	(((x) + 3) & ~(size_t)3)
+
+/*
+ * Per-interface information for a dumper.
+ */
+struct pcap_ng_dump_if {
+	uint64_t	units;		/* time stamp units per second */
+	uint64_t	last_ts;	/* time stamp of the last packet */
+};
+
+struct pcap_ng_dumper {
+	FILE	*f;
+	bpf_u_int32 ifcount;		/* number of interfaces added */
+	bpf_u_int32 ifaces_size;	/* size of array below */
+	struct pcap_ng_dump_if *ifaces;
+	uint64_t offset;		/* bytes written so far */
+	struct sf_index_writer *index;	/* index, if we're writing one */
+};
+
+/*
+ * Append an option to an option list being assembled in opts,
+ * which the caller has made big enough.
+ */
+static size_t
+ng_add_option(u_char *opts, size_t optlen, u_short code, const void *value,
+    u_short value_length)
+{
+	struct option_header opthdr;
+
+	opthdr.option_code = code;
+	opthdr.option_length = value_length;
+	memcpy(opts + optlen, &opthdr, sizeof(opthdr));
+	optlen += sizeof(opthdr);
+	if (value_length != 0) {
+		memcpy(opts + optlen, value, value_length);
+		memset(opts + optlen + value_length, 0,
+		    ROUNDUP4(value_length) - value_length);
+		optlen += ROUNDUP4(value_length);
+	}
+	return (optlen);
+}
+
+/*
+ * Write a block made up of the fixed part of the block, the variable-
+ * length data, if any, padded to a multiple of 4 bytes, and the options,
+ * if any.
+ */
+static int
+ng_write_block(pcap_ng_dumper_t *d, bpf_u_int32 block_type,
+    const void *fixed, size_t fixed_len, const void *data, size_t data_len,
+    const u_char *opts, size_t opt_len)
+{
+	static const u_char pad[3];
+	struct block_header bhdr;
+	struct block_trailer btrlr;
+	size_t total_length;
+
+	total_length = sizeof(bhdr) + fixed_len + ROUNDUP4(data_len) +
+	    opt_len + sizeof(btrlr);
+	if (total_length > 0xFFFFFFFFU) {
+		errno = EINVAL;
+		return (-1);
+	}
+	bhdr.block_type = block_type;
+	bhdr.total_length = (bpf_u_int32)total_length;
+	btrlr.total_length = (bpf_u_int32)total_length;
+
+	if (fwrite(&bhdr, sizeof(bhdr), 1, d->f) != 1 ||
+	    fwrite(fixed, fixed_len, 1, d->f) != 1)
+		return (-1);
+	if (data_len != 0) {
+		if (fwrite(data, data_len, 1, d->f) != 1)
+			return (-1);
+		if (ROUNDUP4(data_len) != data_len &&
+		    fwrite(pad, ROUNDUP4(data_len) - data_len, 1, d->f) != 1)
+			return (-1);
+	}
+	if (opt_len != 0 && fwrite(opts, opt_len, 1, d->f) != 1)
+		return (-1);
+	if (fwrite(&btrlr, sizeof(btrlr), 1, d->f) != 1)
+		return (-1);
+	d->offset += total_length;
+	return (0);
+}
+
+static pcap_ng_dumper_t *
+pcap_ng_setup_dump(FILE *f, const char *fname, char *errbuf)
+{
+	pcap_ng_dumper_t *d;
+	struct section_header_block shb;
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		if (f != stdout)
+			(void)fclose(f);
+		return (NULL);
+	}
+	d->f = f;
+
+	shb.byte_order_magic = BYTE_ORDER_MAGIC;
+	shb.major_version = PCAP_NG_VERSION_MAJOR;
+	shb.minor_version = PCAP_NG_VERSION_MINOR;
+	shb.section_length = 0xFFFFFFFFFFFFFFFFULL;	/* not specified */
+	if (ng_write_block(d, BT_SHB, &shb, sizeof(shb), NULL, 0,
+	    NULL, 0) == -1) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "Can't write to %s", fname);
+		if (f != stdout)
+			(void)fclose(f);
+		free(d);
+		return (NULL);
+	}
+	return (d);
+}
+
+/*
+ * Open a pcapng file, named fname, to write to.
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_open(const char *fname, char *errbuf)
+{
+	FILE *f;
+
+	if (fname == NULL) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return (NULL);
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		fname = "standard output";
+		f = sf_bufwrite_open(NULL, PCAP_NG_DUMP_BUFSIZE, 0, errbuf);
+	} else
+		f = sf_bufwrite_open(fname, PCAP_NG_DUMP_BUFSIZE, 0, errbuf);
+	if (f == NULL)
+		return (NULL);
+	return (pcap_ng_setup_dump(f, fname, errbuf));
+}
+
+/*
+ * Likewise, but compress the file with method at level.
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_open_compressed(const char *fname, int method, int level,
+    char *errbuf)
+{
+	FILE *f;
+
+	if (fname == NULL) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "A null pointer was supplied as the file name");
+		return (NULL);
+	}
+	if (fname[0] == '-' && fname[1] == '\0') {
+		fname = "standard output";
+		f = sf_compress_open(NULL, method, level, errbuf);
+	} else
+		f = sf_compress_open(fname, method, level, errbuf);
+	if (f == NULL)
+		return (NULL);
+	return (pcap_ng_setup_dump(f, fname, errbuf));
+}
+
+/*
+ * Likewise, but also write a time stamp index for the file, for
+ * pcap_offline_seek_time().
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_open_indexed(const char *fname, u_int every_packets,
+    uint64_t every_bytes, char *errbuf)
+{
+	pcap_ng_dumper_t *d;
+
+	if (fname != NULL && fname[0] == '-' && fname[1] == '\0') {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "The standard output can't be indexed");
+		return (NULL);
+	}
+	d = pcap_ng_dump_open(fname, errbuf);
+	if (d == NULL)
+		return (NULL);
+	d->index = sf_index_writer_open(fname, every_packets, every_bytes,
+	    errbuf);
+	if (d->index == NULL) {
+		(void)pcap_ng_dump_close(d);
+		return (NULL);
+	}
+	return (d);
+}
+
+/*
+ * Write a pcapng file to the given stream.
+ */
+pcap_ng_dumper_t *
+pcap_ng_dump_fopen(FILE *f, char *errbuf)
+{
+	return (pcap_ng_setup_dump(f, "stream", errbuf));
+}
+
+/*
+ * Add an interface, with the link-layer header type, snapshot length,
+ * and time stamp precision of p, and return its interface ID, or
+ * return -1 and put an error message in p's error buffer.
+ */
+int
+pcap_ng_dump_add_interface(pcap_ng_dumper_t *d, pcap_t *p, const char *name)
+{
+	struct interface_description_block idb;
+	struct pcap_ng_dump_if *ifaces;
+	bpf_u_int32 new_ifaces_size;
+	int linktype;
+	size_t namelen, optlen;
+	u_char *opts;
+	u_char tsresol, fcslen;
+
+	if (!p->activated) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "not-yet-activated pcap_t passed to pcap_ng_dump_add_interface");
+		return (-1);
+	}
+	linktype = dlt_to_linktype(p->linktype);
+	if (linktype == -1) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "link-layer type %d isn't supported in savefiles",
+		    p->linktype);
+		return (-1);
+	}
+	if (d->ifcount >= 0x7FFFFFFFU) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "too many interfaces in pcapng file");
+		return (-1);
+	}
+	namelen = (name != NULL) ? strlen(name) : 0;
+	if (namelen > 0xFFFF) {
+		pcap_snprintf(p->errbuf, PCAP_ERRBUF_SIZE,
+		    "interface name is too long");
+		return (-1);
+	}
+
+	if (d->ifcount >= d->ifaces_size) {
+		new_ifaces_size = (d->ifaces_size == 0) ? 1 :
+		    d->ifaces_size * 2;
+		ifaces = realloc(d->ifaces,
+		    new_ifaces_size * sizeof(struct pcap_ng_dump_if));
+		if (ifaces == NULL) {
+			pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+			    errno, "malloc");
+			return (-1);
+		}
+		d->ifaces = ifaces;
+		d->ifaces_size = new_ifaces_size;
+	}
+
+	/*
+	 * if_name, if_tsresol, if_fcslen, and opt_endofopt.
+	 */
+	opts = malloc(sizeof(struct option_header) + ROUNDUP4(namelen) +
+	    3 * (sizeof(struct option_header) + 4));
+	if (opts == NULL) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (-1);
+	}
+	optlen = 0;
+	if (namelen != 0)
+		optlen = ng_add_option(opts, optlen, IF_NAME, name,
+		    (u_short)namelen);
+	if (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) {
+		tsresol = 9;
+		optlen = ng_add_option(opts, optlen, IF_TSRESOL, &tsresol, 1);
+	}
+	if (LT_FCS_LENGTH_PRESENT(p->linktype_ext)) {
+		fcslen = (u_char)LT_FCS_LENGTH(p->linktype_ext);
+		optlen = ng_add_option(opts, optlen, IF_FCSLEN, &fcslen, 1);
+	}
+	if (optlen != 0)
+		optlen = ng_add_option(opts, optlen, OPT_ENDOFOPT, NULL, 0);
+
+	idb.linktype = (u_short)linktype;
+	idb.reserved = 0;
+	idb.snaplen = (bpf_u_int32)p->snapshot;
+	if (ng_write_block(d, BT_IDB, &idb, sizeof(idb), NULL, 0,
+	    opts, optlen) == -1) {
+		pcap_fmt_errmsg_for_errno(p->errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "Can't write interface description");
+		free(opts);
+		return (-1);
+	}
+	free(opts);
+
+	d->ifaces[d->ifcount].units =
+	    (p->opt.tstamp_precision == PCAP_TSTAMP_PRECISION_NANO) ?
+	    1000000000 : 1000000;
+	d->ifaces[d->ifcount].last_ts = 0;
+	return ((int)d->ifcount++);
+}
+
+/*
+ * Write a packet captured on interface ifid.  The time stamp is in
+ * the precision of the pcap_t with which the interface was added.
+ */
+int
+pcap_ng_dump(pcap_ng_dumper_t *d, int ifid, const struct pcap_pkthdr *h,
+    const u_char *sp)
+{
+	struct enhanced_packet_block epb;
+	struct pcap_ng_dump_if *ifp;
+	uint64_t t;
+
+	if (ifid < 0 || (bpf_u_int32)ifid >= d->ifcount) {
+		errno = EINVAL;
+		return (-1);
+	}
+	ifp = &d->ifaces[ifid];
+	t = (uint64_t)h->ts.tv_sec * ifp->units + (uint64_t)h->ts.tv_usec;
+	ifp->last_ts = t;
+	if (d->index != NULL &&
+	    sf_index_writer_packet(d->index, (uint64_t)h->ts.tv_sec *
+	    1000000000 + (uint64_t)h->ts.tv_usec * (1000000000 / ifp->units),
+	    d->offset, d->ifcount) == -1)
+		return (-1);
+
+	epb.interface_id = (bpf_u_int32)ifid;
+	epb.timestamp_high = (bpf_u_int32)(t >> 32);
+	epb.timestamp_low = (bpf_u_int32)t;
+	epb.caplen = h->caplen;
+	epb.len = h->len;
+	return (ng_write_block(d, BT_EPB, &epb, sizeof(epb), sp, h->caplen,
+	    NULL, 0));
+}
+
+/*
+ * Write the statistics for interface ifid, as of the last packet
+ * written for it.
+ */
+int
+pcap_ng_dump_stats(pcap_ng_dumper_t *d, int ifid, const struct pcap_stat *ps)
+{
+	struct interface_statistics_block isb;
+	u_char opts[3 * (sizeof(struct option_header) + 8) +
+	    sizeof(struct option_header)];
+	size_t optlen;
+	uint64_t count;
+
+	if (ifid < 0 || (bpf_u_int32)ifid >= d->ifcount) {
+		errno = EINVAL;
+		return (-1);
+	}
+	isb.interface_id = (bpf_u_int32)ifid;
+	isb.timestamp_high = (bpf_u_int32)(d->ifaces[ifid].last_ts >> 32);
+	isb.timestamp_low = (bpf_u_int32)d->ifaces[ifid].last_ts;
+
+	count = ps->ps_recv;
+	optlen = ng_add_option(opts, 0, ISB_IFRECV, &count, 8);
+	count = ps->ps_ifdrop;
+	optlen = ng_add_option(opts, optlen, ISB_IFDROP, &count, 8);
+	count = ps->ps_drop;
+	optlen = ng_add_option(opts, optlen, ISB_OSDROP, &count, 8);
+	optlen = ng_add_option(opts, optlen, OPT_ENDOFOPT, NULL, 0);
+	return (ng_write_block(d, BT_ISB, &isb, sizeof(isb), NULL, 0,
+	    opts, optlen));
+}
+
+FILE *
+pcap_ng_dump_file(pcap_ng_dumper_t *d)
+{
+	return (d->f);
+}
+
+int
+pcap_ng_dump_flush(pcap_ng_dumper_t *d)
+{
+	if (fflush(d->f) == EOF)
+		return (-1);
+	if (sf_compress_flush(d->f) == -1)
+		return (-1);
+	if (d->index != NULL && sf_index_writer_flush(d->index) == -1)
+		return (-1);
+	return (0);
+}
+
+int
+pcap_ng_dump_close(pcap_ng_dumper_t *d)
+{
+	int ret = 0;
+
+	if (ferror(d->f))
+		ret = -1;
+	if (fclose(d->f) == EOF)
+		ret = -1;
+	if (d->index != NULL && sf_index_writer_close(d->index) == -1)
+		ret = -1;
+	free(d->ifaces);
+	free(d);
+	return (ret);
+}
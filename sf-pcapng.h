@@ -20,7 +20,7 @@
  *
  * sf-pcapng.h - pcapng-file-format-specific routines
  *
- * Used to read pcapng savefiles.
+ * Used to read and write pcapng savefiles.
  */
 
 #ifndef sf_pcapng_h
@@ -28,5 +28,6 @@
 
 extern pcap_t *pcap_ng_check_header(bpf_u_int32 magic, FILE *fp,
     u_int precision, char *errbuf, int *err);
+extern int sf_pcap_ng_mmap(pcap_t *p);
 
 #endif
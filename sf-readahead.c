@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Read-ahead for savefiles.
+ *
+ * A helper thread reads the file into a ring of buffers, staying up to
+ * the read-ahead depth ahead of the code parsing packets, so that the
+ * parser rarely has to wait for the disk.  The ring is presented to
+ * the savefile readers as a stdio stream made with fopencookie() or
+ * funopen(), so sf-pcap.c and sf-pcapng.c read it with fread() as they
+ * would read the file itself, and don't need to know it's there.
+ *
+ * Positioning the stream, if the file can be positioned, moves within
+ * the buffer being read if the new position is in it, and otherwise
+ * stops the thread, throws away what it's read, and starts it again
+ * at the new position.
+ */
+
+/*
+ * fopencookie() is a GNU extension.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "sf-readahead.h"
+
+#ifdef SF_READAHEAD_SUPPORTED
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Largest buffer in the ring; the ring has at least two buffers.
+ */
+#define SF_READAHEAD_MAXBUF	(1024*1024)
+#define SF_READAHEAD_MINBUF	(64*1024)
+
+/*
+ * Size of the buffer of the stream we hand to the parser.
+ */
+#define SF_READAHEAD_STDIOBUF	(64*1024)
+
+struct sf_rabuf {
+	u_char	*data;
+	size_t	len;		/* amount of data in the buffer */
+};
+
+struct sf_readahead {
+	FILE	*fp;		/* the stream we're reading ahead of */
+	int	close_fp;	/* close fp when we're closed */
+	FILE	*stream;	/* the stream we hand to the parser */
+	int	seekable;	/* fp's file can be positioned */
+	pthread_t thread;
+	int	running;	/* thread has been started and not joined */
+
+	pthread_mutex_t mtx;
+	pthread_cond_t filled;	/* signalled when a buffer is filled */
+	pthread_cond_t drained;	/* signalled when a buffer is drained */
+	struct sf_rabuf *bufs;
+	u_int	nbufs;
+	size_t	bufsize;
+	u_int	head;		/* buffer the parser is reading */
+	u_int	count;		/* number of filled buffers */
+	int	eof;		/* the thread has reached the end of the file */
+	int	error;		/* errno from a failed read, or 0 */
+	int	stop;		/* the thread should exit */
+
+	/*
+	 * Used only by the parser; the buffer at head is the parser's
+	 * while count is non-zero, so it can read it without locking.
+	 */
+	struct sf_rabuf *cur;	/* bufs[head], if we've waited for it */
+	size_t	off;		/* offset of the next byte in cur */
+	int64_t	pos;		/* offset of that byte in the file */
+};
+
+static void *
+sf_readahead_thread(void *arg)
+{
+	struct sf_readahead *ra = arg;
+	struct sf_rabuf *b;
+	ssize_t n;
+	int oldstate;
+
+	/*
+	 * We only let ourselves be cancelled while we're waiting for
+	 * read() to return, which, on a pipe, might be forever.
+	 */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+
+	for (;;) {
+		pthread_mutex_lock(&ra->mtx);
+		while (!ra->stop && ra->count == ra->nbufs)
+			pthread_cond_wait(&ra->drained, &ra->mtx);
+		if (ra->stop) {
+			pthread_mutex_unlock(&ra->mtx);
+			break;
+		}
+		b = &ra->bufs[(ra->head + ra->count) % ra->nbufs];
+		pthread_mutex_unlock(&ra->mtx);
+
+		do {
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,
+			    &oldstate);
+			n = read(fileno(ra->fp), b->data, ra->bufsize);
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,
+			    &oldstate);
+		} while (n == -1 && errno == EINTR);
+
+		pthread_mutex_lock(&ra->mtx);
+		if (n > 0) {
+			b->len = (size_t)n;
+			ra->count++;
+		} else if (n == 0)
+			ra->eof = 1;
+		else
+			ra->error = errno;
+		pthread_cond_signal(&ra->filled);
+		pthread_mutex_unlock(&ra->mtx);
+		if (n <= 0)
+			break;
+	}
+	return (NULL);
+}
+
+/*
+ * Hand the parser up to size bytes from the ring.
+ */
+static ssize_t
+sf_readahead_read(void *cookie, char *buf, size_t size)
+{
+	struct sf_readahead *ra = cookie;
+	size_t copied = 0, n;
+
+	while (copied < size) {
+		if (ra->cur == NULL || ra->off == ra->cur->len) {
+			pthread_mutex_lock(&ra->mtx);
+			if (ra->cur != NULL) {
+				/*
+				 * We've used up this buffer; give it
+				 * back to the thread.
+				 */
+				ra->cur = NULL;
+				ra->off = 0;
+				ra->head = (ra->head + 1) % ra->nbufs;
+				ra->count--;
+				pthread_cond_signal(&ra->drained);
+			}
+			while (ra->count == 0 && !ra->eof && ra->error == 0)
+				pthread_cond_wait(&ra->filled, &ra->mtx);
+			if (ra->count == 0) {
+				pthread_mutex_unlock(&ra->mtx);
+				if (ra->error != 0 && copied == 0) {
+					errno = ra->error;
+					return (-1);
+				}
+				break;
+			}
+			ra->cur = &ra->bufs[ra->head];
+			pthread_mutex_unlock(&ra->mtx);
+		}
+		n = ra->cur->len - ra->off;
+		if (n > size - copied)
+			n = size - copied;
+		memcpy(buf + copied, ra->cur->data + ra->off, n);
+		ra->off += n;
+		copied += n;
+	}
+	ra->pos += (int64_t)copied;
+	return ((ssize_t)copied);
+}
+
+static void
+sf_readahead_free(struct sf_readahead *ra)
+{
+	u_int i;
+
+	if (ra->bufs != NULL) {
+		for (i = 0; i < ra->nbufs; i++)
+			free(ra->bufs[i].data);
+		free(ra->bufs);
+	}
+	free(ra);
+}
+
+static void
+sf_readahead_stop(struct sf_readahead *ra)
+{
+	if (!ra->running)
+		return;
+	pthread_mutex_lock(&ra->mtx);
+	ra->stop = 1;
+	pthread_cond_signal(&ra->drained);
+	pthread_mutex_unlock(&ra->mtx);
+	pthread_cancel(ra->thread);
+	pthread_join(ra->thread, NULL);
+	ra->running = 0;
+}
+
+static void
+sf_readahead_destroy(struct sf_readahead *ra)
+{
+	sf_readahead_stop(ra);
+	pthread_cond_destroy(&ra->filled);
+	pthread_cond_destroy(&ra->drained);
+	pthread_mutex_destroy(&ra->mtx);
+}
+
+/*
+ * Make the next byte handed to the parser the one at the given
+ * offset, as lseek() would, returning the new offset, or -1, with
+ * errno set, on an error.
+ */
+static int64_t
+sf_readahead_seek(struct sf_readahead *ra, int64_t offset, int whence)
+{
+	struct stat st;
+	int64_t target, start;
+	int err;
+
+	switch (whence) {
+
+	case SEEK_SET:
+		target = offset;
+		break;
+
+	case SEEK_CUR:
+		target = ra->pos + offset;
+		break;
+
+	case SEEK_END:
+		if (fstat(fileno(ra->fp), &st) == -1)
+			return (-1);
+		target = (int64_t)st.st_size + offset;
+		break;
+
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	if (target == ra->pos)
+		return (target);	/* nothing to do; this is ftell() */
+	if (!ra->seekable) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	if (target < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	/*
+	 * If it's in the buffer we're reading, just move there.
+	 */
+	if (ra->cur != NULL) {
+		start = ra->pos - (int64_t)ra->off;
+		if (target >= start && target <= start + (int64_t)ra->cur->len) {
+			ra->off = (size_t)(target - start);
+			ra->pos = target;
+			return (target);
+		}
+	}
+
+	/*
+	 * Otherwise, stop the thread, throw away what it's read, and
+	 * have it start again from there.  If we can't, reads fail.
+	 */
+	sf_readahead_stop(ra);
+	ra->head = 0;
+	ra->count = 0;
+	ra->stop = 0;
+	ra->cur = NULL;
+	ra->off = 0;
+	if (lseek(fileno(ra->fp), (off_t)target, SEEK_SET) == -1) {
+		ra->error = errno;
+		return (-1);
+	}
+	ra->eof = 0;
+	ra->error = 0;
+	ra->pos = target;
+	err = pthread_create(&ra->thread, NULL, sf_readahead_thread, ra);
+	if (err != 0) {
+		ra->error = err;
+		errno = err;
+		return (-1);
+	}
+	ra->running = 1;
+	return (target);
+}
+
+/*
+ * Called when the stream is closed; stop the thread and free
+ * everything.
+ */
+static int
+sf_readahead_close_cookie(void *cookie)
+{
+	struct sf_readahead *ra = cookie;
+
+	sf_readahead_destroy(ra);
+	if (ra->close_fp)
+		(void)fclose(ra->fp);
+	sf_readahead_free(ra);
+	return (0);
+}
+
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_readahead_seek_cookie(void *cookie, off64_t *offset, int whence)
+{
+	int64_t pos;
+
+	pos = sf_readahead_seek(cookie, (int64_t)*offset, whence);
+	if (pos == -1)
+		return (-1);
+	*offset = (off64_t)pos;
+	return (0);
+}
+#else
+static int
+sf_readahead_funopen_read(void *cookie, char *buf, int size)
+{
+	return ((int)sf_readahead_read(cookie, buf, (size_t)size));
+}
+
+static fpos_t
+sf_readahead_funopen_seek(void *cookie, fpos_t offset, int whence)
+{
+	return ((fpos_t)sf_readahead_seek(cookie, (int64_t)offset, whence));
+}
+#endif
+
+struct sf_readahead *
+sf_readahead_open(FILE *fp, size_t depth, char *errbuf)
+{
+	struct sf_readahead *ra;
+	u_int i;
+	int err;
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	ra->fp = fp;
+	ra->close_fp = (fp != stdin);
+
+	/*
+	 * We haven't read anything from fp, so the file's position
+	 * is the stream's.
+	 */
+	ra->pos = (int64_t)lseek(fileno(fp), 0, SEEK_CUR);
+	if (ra->pos == -1)
+		ra->pos = 0;
+	else
+		ra->seekable = 1;
+
+	/*
+	 * Split the depth into at least two buffers, none bigger
+	 * than SF_READAHEAD_MAXBUF.
+	 */
+	ra->bufsize = depth / 2;
+	if (ra->bufsize > SF_READAHEAD_MAXBUF)
+		ra->bufsize = SF_READAHEAD_MAXBUF;
+	if (ra->bufsize < SF_READAHEAD_MINBUF)
+		ra->bufsize = SF_READAHEAD_MINBUF;
+	ra->nbufs = (u_int)(depth / ra->bufsize);
+	if (ra->nbufs < 2)
+		ra->nbufs = 2;
+	ra->bufs = calloc(ra->nbufs, sizeof(*ra->bufs));
+	if (ra->bufs == NULL)
+		goto nomem;
+	for (i = 0; i < ra->nbufs; i++) {
+		ra->bufs[i].data = malloc(ra->bufsize);
+		if (ra->bufs[i].data == NULL)
+			goto nomem;
+	}
+
+	pthread_mutex_init(&ra->mtx, NULL);
+	pthread_cond_init(&ra->filled, NULL);
+	pthread_cond_init(&ra->drained, NULL);
+	err = pthread_create(&ra->thread, NULL, sf_readahead_thread, ra);
+	if (err != 0) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    err, "pthread_create");
+		sf_readahead_destroy(ra);
+		sf_readahead_free(ra);
+		return (NULL);
+	}
+	ra->running = 1;
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = sf_readahead_read;
+	funcs.write = NULL;
+	funcs.seek = sf_readahead_seek_cookie;
+	funcs.close = sf_readahead_close_cookie;
+	ra->stream = fopencookie(ra, "rb", funcs);
+#else
+	ra->stream = funopen(ra, sf_readahead_funopen_read, NULL,
+	    sf_readahead_funopen_seek, sf_readahead_close_cookie);
+#endif
+	if (ra->stream == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't create read-ahead stream");
+		sf_readahead_destroy(ra);
+		sf_readahead_free(ra);
+		return (NULL);
+	}
+
+	/*
+	 * The parser reads a record header at a time; give the stream
+	 * a buffer, as, without one, some stdio implementations call
+	 * sf_readahead_read() for one byte at a time.
+	 */
+	setvbuf(ra->stream, NULL, _IOFBF, SF_READAHEAD_STDIOBUF);
+	return (ra);
+
+nomem:
+	pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE, errno, "malloc");
+	sf_readahead_free(ra);
+	return (NULL);
+}
+
+FILE *
+sf_readahead_stream(struct sf_readahead *ra)
+{
+	return (ra->stream);
+}
+
+void
+sf_readahead_close(struct sf_readahead *ra, int close_fp)
+{
+	ra->close_fp = close_fp;
+	(void)fclose(ra->stream);
+}
+
+#endif /* SF_READAHEAD_SUPPORTED */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sf-readahead.h - read-ahead for savefiles
+ */
+
+#ifndef sf_readahead_h
+#define	sf_readahead_h
+
+/*
+ * Read-ahead needs a helper thread and a way to make a stdio stream
+ * that reads from our buffers.
+ */
+#if defined(PCAP_SUPPORT_READAHEAD) && \
+    (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN))
+#define SF_READAHEAD_SUPPORTED
+
+struct sf_readahead;
+
+/*
+ * Start reading ahead of fp, keeping up to depth bytes buffered.
+ * sf_readahead_stream() returns the stream to read instead of fp;
+ * closing it with fclose() also closes fp, unless fp is stdin.
+ * sf_readahead_close() closes that stream, and closes fp only if
+ * close_fp is non-zero.
+ */
+extern struct sf_readahead *sf_readahead_open(FILE *fp, size_t depth,
+    char *errbuf);
+extern FILE *sf_readahead_stream(struct sf_readahead *ra);
+extern void sf_readahead_close(struct sf_readahead *ra, int close_fp);
+#endif
+
+#endif
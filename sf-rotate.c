@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2026 The libpcap contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Rotating pcap savefiles.
+ *
+ * A rotating dumper is a stdio stream, so that pcap_dump() and the rest
+ * of the pcap_dumper_t routines work on it unchanged.  What's written
+ * to it is a pcap file; our write routine follows the file header and
+ * the packet records going past, and, at the start of a record that
+ * would take the current file past its size or time limit, finishes
+ * that file and starts the next one with a copy of the file header.
+ *
+ * If we have pthreads, a helper thread creates, and preallocates space
+ * for, the next file before it's needed, closes finished files, and
+ * deletes files that have fallen out of the ring, so that starting a
+ * new file costs the thread writing packets little more than writing
+ * the file header.
+ */
+
+/*
+ * fopencookie() and fallocate() are GNU extensions.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap-int.h"
+#include "sf-rotate.h"
+
+#if defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN)
+#define SF_ROTATE_SUPPORTED
+#endif
+
+#ifdef SF_ROTATE_SUPPORTED
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/*
+ * Size of the stream's buffer; we write to the current file when
+ * it fills up.
+ */
+#define SF_ROTATE_BUFSIZE	(1024*1024)
+
+struct sf_rotate {
+	FILE	*stream;
+	u_char	*buf;		/* the stream's buffer */
+	char	*pattern;
+	size_t	namesize;	/* size of the name buffers */
+	char	*name;		/* name buffer for the writing thread */
+	uint64_t max_bytes;
+	u_int	max_seconds;
+	u_int	max_files;
+
+	int	fd;		/* current file */
+	u_int	seq;		/* its sequence number */
+	uint64_t file_bytes;	/* bytes we've put in it */
+	u_int	file_packets;	/* packets we've put in it */
+	bpf_int32 file_start;	/* time stamp of its first packet */
+
+	/*
+	 * What we know about what's been written to the stream.
+	 */
+	u_char	filehdr[sizeof(struct pcap_file_header)];
+	size_t	filehdr_len;	/* amount of the file header we have */
+	u_char	rechdr[sizeof(struct pcap_sf_pkthdr)];
+	size_t	rechdr_len;	/* amount of a split record header we have */
+	bpf_u_int32 data_left;	/* packet data in the current record still to come */
+
+	u_int	unlink_before;	/* delete files with sequence numbers below this */
+	u_int	unlinked;	/* files below this have been deleted */
+
+	struct pcap_dump_rotate_stat stats;
+	struct sf_rotate *next;	/* next on the list of rotating streams */
+
+#ifdef HAVE_PTHREADS
+	pthread_t thread;
+	int	thread_started;
+	char	*tname;		/* name buffer for the helper thread */
+	pthread_mutex_t mtx;	/* protects what follows, and stats */
+	pthread_cond_t cv;	/* signalled when there's work or it's done */
+	int	next_fd;	/* next file, once it's been created, or -1 */
+	int	next_err;	/* errno from failing to create it, or 0 */
+	int	retire_fd;	/* finished file for the thread to close, or -1 */
+	uint64_t retire_bytes;	/* its length */
+	int	stop;		/* the thread should exit */
+#endif
+};
+
+/*
+ * Open rotating streams, so sf_rotate_stats() can find them.
+ */
+static struct sf_rotate *sf_rotate_list;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t sf_rotate_list_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static uint64_t
+sf_rotate_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+	{
+		struct timeval tv;
+
+		(void)gettimeofday(&tv, NULL);
+		return ((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+}
+
+static int
+sf_rotate_put(int fd, const u_char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len != 0) {
+		n = write(fd, data, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+static const char *
+sf_rotate_name(struct sf_rotate *r, u_int seq, char *name)
+{
+	pcap_snprintf(name, r->namesize, "%s%u", r->pattern, seq);
+	return (name);
+}
+
+/*
+ * Create the file with the given sequence number and, if we can,
+ * allocate space for all of it.
+ */
+static int
+sf_rotate_create(struct sf_rotate *r, u_int seq, char *name)
+{
+	int fd;
+
+	fd = open(sf_rotate_name(r, seq, name), O_WRONLY|O_CREAT|O_TRUNC,
+	    0666);
+	if (fd == -1)
+		return (-1);
+#ifdef FALLOC_FL_KEEP_SIZE
+	/*
+	 * Allocate the blocks, but leave the file empty; writing
+	 * the file then won't have to allocate anything.
+	 */
+	if (r->max_bytes != 0)
+		(void)fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)r->max_bytes);
+#endif
+	return (fd);
+}
+
+/*
+ * Close a finished file, len bytes long, first giving back the space
+ * allocated past the end of it.
+ */
+static int
+sf_rotate_finish(struct sf_rotate *r, int fd, uint64_t len)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (r->max_bytes != 0)
+		(void)ftruncate(fd, (off_t)len);
+#endif
+	return (close(fd));
+}
+
+#ifdef HAVE_PTHREADS
+static void *
+sf_rotate_thread(void *arg)
+{
+	struct sf_rotate *r = arg;
+	uint64_t len;
+	int fd, err;
+	u_int seq;
+
+	pthread_mutex_lock(&r->mtx);
+	for (;;) {
+		while (!r->stop && r->retire_fd == -1 &&
+		    (r->next_fd != -1 || r->next_err != 0) &&
+		    r->unlinked >= r->unlink_before)
+			pthread_cond_wait(&r->cv, &r->mtx);
+		if (r->stop)
+			break;
+
+		if (r->retire_fd != -1) {
+			fd = r->retire_fd;
+			len = r->retire_bytes;
+			r->retire_fd = -1;
+			pthread_mutex_unlock(&r->mtx);
+			(void)sf_rotate_finish(r, fd, len);
+			pthread_mutex_lock(&r->mtx);
+		} else if (r->next_fd == -1 && r->next_err == 0) {
+			seq = r->seq + 1;
+			pthread_mutex_unlock(&r->mtx);
+			fd = sf_rotate_create(r, seq, r->tname);
+			err = errno;
+			pthread_mutex_lock(&r->mtx);
+			if (fd == -1)
+				r->next_err = err;
+			else
+				r->next_fd = fd;
+			pthread_cond_broadcast(&r->cv);
+		} else {
+			seq = r->unlinked++;
+			pthread_mutex_unlock(&r->mtx);
+			(void)unlink(sf_rotate_name(r, seq, r->tname));
+			pthread_mutex_lock(&r->mtx);
+			r->stats.rs_deleted++;
+		}
+	}
+	pthread_mutex_unlock(&r->mtx);
+	return (NULL);
+}
+#endif
+
+/*
+ * Finish the current file and start the next one.
+ */
+static int
+sf_rotate_switch(struct sf_rotate *r)
+{
+	uint64_t start, usec;
+	int fd, oldfd = -1, stalled = 0;
+
+	start = sf_rotate_usec();
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&r->mtx);
+	while (r->next_fd == -1 && r->next_err == 0) {
+		/*
+		 * The thread hasn't created the next file yet.
+		 */
+		stalled = 1;
+		pthread_cond_wait(&r->cv, &r->mtx);
+	}
+	if (r->next_fd == -1) {
+		errno = r->next_err;
+		r->next_err = 0;	/* let the thread try again */
+		pthread_cond_broadcast(&r->cv);
+		pthread_mutex_unlock(&r->mtx);
+		return (-1);
+	}
+	fd = r->next_fd;
+	r->next_fd = -1;
+	if (r->retire_fd == -1) {
+		r->retire_fd = r->fd;
+		r->retire_bytes = r->file_bytes;
+	} else
+		oldfd = r->fd;	/* the thread's busy; close it ourselves */
+	r->fd = fd;
+	r->seq++;
+	if (r->max_files != 0 && r->seq >= r->max_files)
+		r->unlink_before = r->seq - r->max_files + 1;
+	pthread_cond_broadcast(&r->cv);
+	pthread_mutex_unlock(&r->mtx);
+#else
+	fd = sf_rotate_create(r, r->seq + 1, r->name);
+	if (fd == -1)
+		return (-1);
+	oldfd = r->fd;
+	r->fd = fd;
+	r->seq++;
+	if (r->max_files != 0 && r->seq >= r->max_files)
+		r->unlink_before = r->seq - r->max_files + 1;
+	while (r->unlinked < r->unlink_before) {
+		(void)unlink(sf_rotate_name(r, r->unlinked++, r->name));
+		r->stats.rs_deleted++;
+	}
+#endif
+	if (oldfd != -1)
+		(void)sf_rotate_finish(r, oldfd, r->file_bytes);
+
+	r->file_bytes = 0;
+	r->file_packets = 0;
+	if (sf_rotate_put(r->fd, r->filehdr, sizeof(r->filehdr)) == -1)
+		return (-1);
+	r->file_bytes = sizeof(r->filehdr);
+
+	usec = sf_rotate_usec() - start;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&r->mtx);
+#endif
+	r->stats.rs_files++;
+	r->stats.rs_stalls += stalled;
+	r->stats.rs_last_usec = usec;
+	if (usec > r->stats.rs_max_usec)
+		r->stats.rs_max_usec = usec;
+	r->stats.rs_total_usec += usec;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&r->mtx);
+#endif
+	return (0);
+}
+
+/*
+ * Should the record with this header go in a new file?
+ */
+static int
+sf_rotate_due(struct sf_rotate *r, const struct pcap_sf_pkthdr *sfh)
+{
+	if (r->file_packets == 0)
+		return (0);	/* every file gets at least one packet */
+	if (r->max_bytes != 0 &&
+	    r->file_bytes + sizeof(*sfh) + sfh->caplen > r->max_bytes)
+		return (1);
+	if (r->max_seconds != 0 &&
+	    (int64_t)sfh->ts.tv_sec - r->file_start >= (int64_t)r->max_seconds)
+		return (1);
+	return (0);
+}
+
+static ssize_t
+sf_rotate_write(void *cookie, const char *buf, size_t size)
+{
+	struct sf_rotate *r = cookie;
+	const u_char *p = (const u_char *)buf;
+	const u_char *end = p + size;
+	const u_char *start = p;	/* data not yet written */
+	const u_char *hdr;
+	struct pcap_sf_pkthdr sfh;
+	size_t n;
+
+	while (p < end) {
+		if (r->filehdr_len < sizeof(r->filehdr)) {
+			/*
+			 * The file header; keep it for the files to come.
+			 */
+			n = sizeof(r->filehdr) - r->filehdr_len;
+			if (n > (size_t)(end - p))
+				n = end - p;
+			memcpy(r->filehdr + r->filehdr_len, p, n);
+			r->filehdr_len += n;
+			p += n;
+			start = p;
+			if (r->filehdr_len == sizeof(r->filehdr)) {
+				if (sf_rotate_put(r->fd, r->filehdr,
+				    sizeof(r->filehdr)) == -1)
+					return (-1);
+				r->file_bytes = sizeof(r->filehdr);
+			}
+			continue;
+		}
+		if (r->data_left != 0) {
+			n = r->data_left;
+			if (n > (size_t)(end - p))
+				n = end - p;
+			p += n;
+			r->data_left -= (bpf_u_int32)n;
+			r->file_bytes += n;
+			continue;
+		}
+
+		/*
+		 * A record header.  Usually it's all here; if it isn't,
+		 * put what we've seen of it aside until we have the
+		 * rest, as we can't tell which file it goes in until
+		 * then.
+		 */
+		if (r->rechdr_len == 0 &&
+		    (size_t)(end - p) >= sizeof(r->rechdr))
+			hdr = p;
+		else {
+			if (r->rechdr_len == 0) {
+				if (sf_rotate_put(r->fd, start, p - start) == -1)
+					return (-1);
+			}
+			n = sizeof(r->rechdr) - r->rechdr_len;
+			if (n > (size_t)(end - p))
+				n = end - p;
+			memcpy(r->rechdr + r->rechdr_len, p, n);
+			r->rechdr_len += n;
+			p += n;
+			start = p;
+			if (r->rechdr_len < sizeof(r->rechdr))
+				break;
+			hdr = r->rechdr;
+		}
+		memcpy(&sfh, hdr, sizeof(sfh));
+
+		if (sf_rotate_due(r, &sfh)) {
+			if (hdr == p) {
+				if (sf_rotate_put(r->fd, start, p - start) == -1)
+					return (-1);
+				start = p;
+			}
+			if (sf_rotate_switch(r) == -1)
+				return (-1);
+		}
+		if (hdr == r->rechdr) {
+			if (sf_rotate_put(r->fd, r->rechdr,
+			    sizeof(r->rechdr)) == -1)
+				return (-1);
+			r->rechdr_len = 0;
+		} else
+			p += sizeof(sfh);
+		if (r->file_packets == 0)
+			r->file_start = sfh.ts.tv_sec;
+		r->file_packets++;
+		r->file_bytes += sizeof(sfh);
+		r->data_left = sfh.caplen;
+	}
+	if (sf_rotate_put(r->fd, start, end - start) == -1)
+		return (-1);
+	return ((ssize_t)size);
+}
+
+static void
+sf_rotate_free(struct sf_rotate *r)
+{
+	struct sf_rotate **rp;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_rotate_list_mtx);
+#endif
+	for (rp = &sf_rotate_list; *rp != NULL; rp = &(*rp)->next) {
+		if (*rp == r) {
+			*rp = r->next;
+			break;
+		}
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_rotate_list_mtx);
+
+	if (r->thread_started) {
+		pthread_mutex_lock(&r->mtx);
+		r->stop = 1;
+		pthread_cond_broadcast(&r->cv);
+		pthread_mutex_unlock(&r->mtx);
+		pthread_join(r->thread, NULL);
+		pthread_cond_destroy(&r->cv);
+		pthread_mutex_destroy(&r->mtx);
+		if (r->retire_fd != -1)
+			(void)sf_rotate_finish(r, r->retire_fd,
+			    r->retire_bytes);
+		if (r->next_fd != -1) {
+			/*
+			 * Nothing was ever written to the next file.
+			 */
+			(void)close(r->next_fd);
+			(void)unlink(sf_rotate_name(r, r->seq + 1, r->name));
+		}
+	}
+	free(r->tname);
+#endif
+	if (r->name != NULL) {
+		while (r->unlinked < r->unlink_before)
+			(void)unlink(sf_rotate_name(r, r->unlinked++, r->name));
+	}
+	free(r->name);
+	free(r->pattern);
+	free(r->buf);
+	free(r);
+}
+
+static int
+sf_rotate_close(void *cookie)
+{
+	struct sf_rotate *r = cookie;
+	int ret = 0;
+
+	if (sf_rotate_finish(r, r->fd, r->file_bytes) == -1)
+		ret = -1;
+	sf_rotate_free(r);
+	return (ret);
+}
+
+/*
+ * We can only say where we are in the current file, which is all
+ * ftell() needs.
+ */
+#ifdef HAVE_FOPENCOOKIE
+static int
+sf_rotate_seek(void *cookie, off64_t *offset, int whence)
+{
+	struct sf_rotate *r = cookie;
+
+	if (whence != SEEK_CUR || *offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	*offset = (off64_t)(r->file_bytes + r->rechdr_len);
+	return (0);
+}
+#else
+static int
+sf_rotate_funopen_write(void *cookie, const char *buf, int size)
+{
+	return ((int)sf_rotate_write(cookie, buf, (size_t)size));
+}
+
+static fpos_t
+sf_rotate_seek(void *cookie, fpos_t offset, int whence)
+{
+	struct sf_rotate *r = cookie;
+
+	if (whence != SEEK_CUR || offset != 0) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	return ((fpos_t)(r->file_bytes + r->rechdr_len));
+}
+#endif
+
+FILE *
+sf_rotate_open(const char *pattern, uint64_t max_bytes, u_int max_seconds,
+    u_int max_files, char *errbuf)
+{
+	struct sf_rotate *r;
+	int err;
+#ifdef HAVE_FOPENCOOKIE
+	cookie_io_functions_t funcs;
+#endif
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "malloc");
+		return (NULL);
+	}
+	r->fd = -1;
+	r->max_bytes = max_bytes;
+	r->max_seconds = max_seconds;
+	r->max_files = max_files;
+	r->namesize = strlen(pattern) + 11;	/* room for a 32-bit number */
+	r->pattern = strdup(pattern);
+	r->name = malloc(r->namesize);
+	r->buf = malloc(SF_ROTATE_BUFSIZE);
+#ifdef HAVE_PTHREADS
+	r->next_fd = -1;
+	r->retire_fd = -1;
+	r->tname = malloc(r->namesize);
+	if (r->tname == NULL)
+		goto nomem;
+#endif
+	if (r->pattern == NULL || r->name == NULL || r->buf == NULL)
+		goto nomem;
+
+	r->fd = sf_rotate_create(r, 0, r->name);
+	if (r->fd == -1) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "%s", r->name);
+		sf_rotate_free(r);
+		return (NULL);
+	}
+	r->stats.rs_files = 1;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_init(&r->mtx, NULL);
+	pthread_cond_init(&r->cv, NULL);
+	err = pthread_create(&r->thread, NULL, sf_rotate_thread, r);
+	if (err != 0) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    err, "pthread_create");
+		pthread_cond_destroy(&r->cv);
+		pthread_mutex_destroy(&r->mtx);
+		goto fail;
+	}
+	r->thread_started = 1;
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+	funcs.read = NULL;
+	funcs.write = sf_rotate_write;
+	funcs.seek = sf_rotate_seek;
+	funcs.close = sf_rotate_close;
+	r->stream = fopencookie(r, "wb", funcs);
+#else
+	r->stream = funopen(r, NULL, sf_rotate_funopen_write, sf_rotate_seek,
+	    sf_rotate_close);
+#endif
+	if (r->stream == NULL) {
+		pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE,
+		    errno, "can't create output stream");
+		goto fail;
+	}
+	if (setvbuf(r->stream, (char *)r->buf, _IOFBF, SF_ROTATE_BUFSIZE) != 0) {
+		pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+		    "can't set output buffer");
+		(void)fclose(r->stream);
+		return (NULL);
+	}
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_rotate_list_mtx);
+#endif
+	r->next = sf_rotate_list;
+	sf_rotate_list = r;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_rotate_list_mtx);
+#endif
+	return (r->stream);
+
+nomem:
+	err = errno;
+	pcap_fmt_errmsg_for_errno(errbuf, PCAP_ERRBUF_SIZE, err, "malloc");
+fail:
+	if (r->fd != -1) {
+		(void)close(r->fd);
+		(void)unlink(r->name);
+	}
+	sf_rotate_free(r);
+	return (NULL);
+}
+
+int
+sf_rotate_stats(FILE *f, struct pcap_dump_rotate_stat *ps)
+{
+	struct sf_rotate *r;
+	int ret = -1;
+
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&sf_rotate_list_mtx);
+#endif
+	for (r = sf_rotate_list; r != NULL; r = r->next) {
+		if (r->stream == f) {
+#ifdef HAVE_PTHREADS
+			pthread_mutex_lock(&r->mtx);
+#endif
+			*ps = r->stats;
+#ifdef HAVE_PTHREADS
+			pthread_mutex_unlock(&r->mtx);
+#endif
+			ret = 0;
+			break;
+		}
+	}
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&sf_rotate_list_mtx);
+#endif
+	return (ret);
+}
+
+#else /* SF_ROTATE_SUPPORTED */
+
+FILE *
+sf_rotate_open(const char *pattern _U_, uint64_t max_bytes _U_,
+    u_int max_seconds _U_, u_int max_files _U_, char *errbuf)
+{
+	pcap_snprintf(errbuf, PCAP_ERRBUF_SIZE,
+	    "rotating savefiles aren't supported on this platform");
+	return (NULL);
+}
+
+int
+sf_rotate_stats(FILE *f _U_, struct pcap_dump_rotate_stat *ps _U_)
+{
+	return (-1);
+}
+
+#endif /* SF_ROTATE_SUPPORTED */
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Measure how long it takes to compile filter expressions, with
+ * pcap_compile() or with a compiler handle from pcap_compiler_create(),
+ * in one or more threads; each thread compiles every expression in
+ * turn, with its own pcap_t and, if a compiler handle is used, its own
+ * handle.
+ *
+ * With -g, it compiles generated "host A or host B or ..." and
+ * "port A or port B or ..." expressions with the given number of terms,
+ * to measure how compile time grows with the size of the filter.
+ *
+ * With -c, the compiled filter cache is enabled with the given number of
+ * entries; with -C, the cache is loaded from the given file, if it
+ * exists, before compiling, and saved to it afterwards.
+ */
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pcap/funcattrs.h"
+
+#define MAX_EXPRS	1024
+
+static char *program_name;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+static char *copy_argv(char **);
+static void read_exprs(const char *);
+static void gen_exprs(long);
+
+/*
+ * Expressions compiled if none are given on the command line.
+ */
+static const char *default_exprs[] = {
+	"tcp port 80",
+	"host 192.168.1.1 and udp",
+	"ip src net 10.0.0.0/8 and not tcp port 22",
+	"tcp[13] & 2 != 0 and dst portrange 1024-65535",
+	"vlan 100 and (ip6 or arp)",
+	"udp port 53 or udp port 123 or udp port 161 or tcp port 443",
+	"ether host 00:11:22:33:44:55 and ip and greater 200",
+	"icmp or (tcp and src host 172.16.0.1 and dst port 25)",
+};
+
+static const char **exprs;
+static int nexprs;
+
+static int linktype = DLT_EN10MB;
+static int snaplen = 65535;
+static int Oflag = 1;
+static int reuse;
+static long iterations = 10000;
+static u_int cache_entries;
+static const char *cache_file;
+
+struct bench_thread {
+	pthread_t thread;
+	long compiles;
+	double secs;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *
+bench(void *arg)
+{
+	struct bench_thread *bt = arg;
+	struct bpf_program fcode;
+	pcap_compiler_t *pc = NULL;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	double start;
+	long i;
+	int j, status;
+
+	pd = pcap_open_dead(linktype, snaplen);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	if (reuse) {
+		pc = pcap_compiler_create(ebuf);
+		if (pc == NULL)
+			error("%s", ebuf);
+	}
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < nexprs; j++) {
+			if (reuse)
+				status = pcap_compiler_compile(pc, pd, &fcode,
+				    exprs[j], Oflag,
+				    PCAP_NETMASK_UNKNOWN);
+			else
+				status = pcap_compile(pd, &fcode, exprs[j],
+				    Oflag, PCAP_NETMASK_UNKNOWN);
+			if (status < 0)
+				error("\"%s\": %s", exprs[j], pcap_geterr(pd));
+			pcap_freecode(&fcode);
+		}
+	}
+	bt->secs = now() - start;
+	bt->compiles = iterations * nexprs;
+	if (pc != NULL)
+		pcap_compiler_close(pc);
+	pcap_close(pd);
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *cp, *expr;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	int op, i, nthreads = 1;
+	long terms;
+	struct bench_thread *threads;
+	long compiles = 0;
+	double start, wall, secs = 0;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	exprs = default_exprs;
+	nexprs = sizeof(default_exprs) / sizeof(default_exprs[0]);
+	while ((op = getopt(argc, argv, "c:C:d:F:g:n:Ors:t:")) != -1) {
+		switch (op) {
+
+		case 'c':
+			cache_entries = (u_int)atoi(optarg);
+			break;
+
+		case 'C':
+			cache_file = optarg;
+			break;
+
+		case 'd':
+			linktype = pcap_datalink_name_to_val(optarg);
+			if (linktype < 0)
+				error("invalid data link type %s", optarg);
+			break;
+
+		case 'F':
+			read_exprs(optarg);
+			break;
+
+		case 'g':
+			terms = atol(optarg);
+			if (terms <= 0)
+				error("invalid term count %s", optarg);
+			gen_exprs(terms);
+			break;
+
+		case 'n':
+			iterations = atol(optarg);
+			if (iterations <= 0)
+				error("invalid iteration count %s", optarg);
+			break;
+
+		case 'O':
+			Oflag = 0;
+			break;
+
+		case 'r':
+			reuse = 1;
+			break;
+
+		case 's':
+			snaplen = atoi(optarg);
+			if (snaplen <= 0)
+				error("invalid snaplen %s", optarg);
+			break;
+
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads <= 0)
+				error("invalid thread count %s", optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+
+	if (optind < argc) {
+		expr = copy_argv(&argv[optind]);
+		exprs = malloc(sizeof(*exprs));
+		if (exprs == NULL)
+			error("malloc: %s", pcap_strerror(errno));
+		exprs[0] = expr;
+		nexprs = 1;
+	}
+
+	if (cache_entries != 0 &&
+	    pcap_compile_cache_set_size(cache_entries) != 0)
+		error("Can't enable the compiled filter cache");
+	if (cache_file != NULL && access(cache_file, F_OK) == 0 &&
+	    pcap_compile_cache_load(cache_file, ebuf) != 0)
+		error("%s", ebuf);
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL)
+		error("calloc: %s", pcap_strerror(errno));
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i].thread, NULL, bench,
+		    &threads[i]) != 0)
+			error("Can't create thread");
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		compiles += threads[i].compiles;
+		secs += threads[i].secs;
+	}
+	wall = now() - start;
+	if (cache_file != NULL && pcap_compile_cache_save(cache_file, ebuf) != 0)
+		error("%s", ebuf);
+
+	printf("%s: %ld compiles of %d expression%s in %d thread%s%s\n",
+	    reuse ? "pcap_compiler_compile" : "pcap_compile",
+	    compiles, nexprs, nexprs == 1 ? "" : "s",
+	    nthreads, nthreads == 1 ? "" : "s",
+	    cache_entries != 0 ? ", with the cache" : "");
+	printf("%.3f usec per compile, %.0f compiles/sec\n",
+	    secs * 1e6 / compiles, compiles / wall);
+	free(threads);
+	exit(0);
+}
+
+/*
+ * Read expressions from a file, one per line; blank lines and lines
+ * starting with "#" are ignored.
+ */
+static void
+read_exprs(const char *fname)
+{
+	FILE *fp;
+	char line[8192];
+	size_t len;
+
+	fp = fopen(fname, "r");
+	if (fp == NULL)
+		error("can't open %s: %s", fname, pcap_strerror(errno));
+	exprs = malloc(MAX_EXPRS * sizeof(*exprs));
+	if (exprs == NULL)
+		error("malloc: %s", pcap_strerror(errno));
+	nexprs = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (nexprs == MAX_EXPRS)
+			error("more than %d expressions in %s", MAX_EXPRS,
+			    fname);
+		exprs[nexprs] = strdup(line);
+		if (exprs[nexprs] == NULL)
+			error("strdup: %s", pcap_strerror(errno));
+		nexprs++;
+	}
+	fclose(fp);
+	if (nexprs == 0)
+		error("no expressions in %s", fname);
+}
+
+/*
+ * Generate a "host" expression and a "port" expression with 'terms'
+ * terms each.
+ */
+static void
+gen_exprs(long terms)
+{
+	char term[32];
+	char *buf;
+	size_t len, size;
+	long i;
+	int j;
+
+	exprs = malloc(2 * sizeof(*exprs));
+	if (exprs == NULL)
+		error("malloc: %s", pcap_strerror(errno));
+	size = terms * (sizeof(term) + 4);
+	for (j = 0; j < 2; j++) {
+		buf = malloc(size);
+		if (buf == NULL)
+			error("malloc: %s", pcap_strerror(errno));
+		len = 0;
+		for (i = 0; i < terms; i++) {
+			if (j == 0)
+				snprintf(term, sizeof(term), "host 10.%ld.%ld.%ld",
+				    ((i + 1) >> 16) & 0xff, ((i + 1) >> 8) & 0xff,
+				    (i + 1) & 0xff);
+			else
+				snprintf(term, sizeof(term), "port %ld",
+				    i % 65535 + 1);
+			len += snprintf(buf + len, size - len, "%s%s",
+			    i == 0 ? "" : " or ", term);
+		}
+		exprs[j] = buf;
+	}
+	nexprs = 2;
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr,
+	    "Usage: %s [ -Or ] [ -c entries ] [ -C file ] [ -d dlt ] [ -n iterations ]\n",
+	    program_name);
+	(void)fprintf(stderr,
+	    "\t\t[ -s snaplen ] [ -t threads ]\n");
+	(void)fprintf(stderr,
+	    "\t\t[ -F file | -g terms | expression ]\n");
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/*
+ * Copy arg vector into a new buffer, concatenating arguments with spaces.
+ */
+static char *
+copy_argv(register char **argv)
+{
+	register char **p;
+	register u_int len = 0;
+	char *buf;
+	char *src, *dst;
+
+	p = argv;
+	if (*p == 0)
+		return 0;
+
+	while (*p)
+		len += strlen(*p++) + 1;
+
+	buf = (char *)malloc(len);
+	if (buf == NULL)
+		error("copy_argv: malloc");
+
+	p = argv;
+	dst = buf;
+	while ((src = *p++) != NULL) {
+		while ((*dst++ = *src++) != '\0')
+			;
+		dst[-1] = ' ';
+	}
+	dst[-1] = '\0';
+
+	return buf;
+}
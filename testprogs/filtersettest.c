@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Compile a list of filters into a filter set with pcap_compile_set(),
+ * and each of them on its own with pcap_compile(), and check that, for
+ * a generated set of packets, pcap_offline_filter_set() says a packet
+ * matches a filter exactly when bpf_filter() running that filter on its
+ * own does.
+ *
+ * The filters share leading tests, trailing code, or all of their code,
+ * in various ways; two of them keep a value in scratch memory past the
+ * point where they part ways, and one of those then overwrites it.  The
+ * "ip6 protochain" filters aren't merged with the others.  The packets
+ * are Ethernet frames with IPv4, IPv6, ARP and VLAN-tagged traffic, some
+ * of it fragmented, cut short or with IPv6 extension headers, and some
+ * random bytes.
+ */
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+#endif
+
+#include "pcap/funcattrs.h"
+
+#ifdef _WIN32
+  #include "portability.h"
+#endif
+
+#define SNAPLEN		1500
+
+static const char *exprs[] = {
+	"tcp port 80",
+	"tcp port 443",
+	"udp port 53",
+	"tcp port 80",
+	"port 53",
+	"tcp port 80 or tcp port 443",
+	"host 10.0.0.1",
+	"src host 10.0.0.1 and tcp",
+	"dst host 10.1.2.3",
+	"net 10.0.0.0/8",
+	"ip",
+	"ip6",
+	"arp",
+	"vlan",
+	"vlan and tcp port 80",
+	"icmp",
+	"tcp[13] & 2 != 0",
+	"udp portrange 1000-2000",
+	"ip[6] & 0x3f != 0",
+	"len > 100",
+	"greater 200",
+	"ether broadcast",
+	"ip6 protochain 6",
+	"ip6 protochain 17",
+	"not tcp",
+	"tcp or udp",
+	"ip6 and tcp dst port 443",
+	"ip6 and udp src port 53",
+	"ip[2] + ip[3] > ip[14] + ip[15]",
+	"ip[2] + ip[3] != ip[4] + ip[5] and ip[6] + ip[7] != ip[10] + ip[11] and ip[12] + ip[13] != ip[14] + ip[15]",
+	"",
+};
+#define NEXPRS	(sizeof exprs / sizeof exprs[0])
+
+static char *program_name;
+static u_int seed = 1;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+static u_int
+rnd(u_int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) % n);
+}
+
+static void
+put16(u_char *p, u_int v)
+{
+	p[0] = (u_char)(v >> 8);
+	p[1] = (u_char)v;
+}
+
+static u_int
+pick_port(void)
+{
+	static const u_int ports[] = { 22, 53, 80, 443 };
+
+	if (rnd(4) == 0)
+		return (900 + rnd(1200));
+	return (ports[rnd(4)]);
+}
+
+/*
+ * Put a TCP, UDP or ICMP header at p, returning its length.
+ */
+static u_int
+gen_transport(u_char *p, u_int proto)
+{
+	switch (proto) {
+
+	case 6:
+		memset(p, 0, 20);
+		put16(p, pick_port());
+		put16(p + 2, pick_port());
+		p[12] = 5 << 4;
+		p[13] = (u_char)rnd(64);
+		return (20);
+
+	case 17:
+		memset(p, 0, 8);
+		put16(p, pick_port());
+		put16(p + 2, pick_port());
+		return (8);
+
+	default:
+		memset(p, 0, 8);
+		p[0] = (u_char)rnd(16);
+		return (8);
+	}
+}
+
+static void
+gen_ipv4_addr(u_char *p)
+{
+	static const u_char addrs[][4] = {
+		{ 10, 0, 0, 1 }, { 10, 1, 2, 3 }, { 192, 168, 0, 1 }
+	};
+
+	memcpy(p, addrs[rnd(3)], 4);
+}
+
+static u_int
+gen_ipv4(u_char *p)
+{
+	static const u_int protos[] = { 6, 17, 1 };
+	u_int hlen, proto, len;
+
+	hlen = rnd(4) == 0 ? 24 : 20;
+	proto = protos[rnd(3)];
+	memset(p, 0, hlen);
+	p[0] = 0x40 | (u_char)(hlen / 4);
+	put16(p + 4, rnd(0x10000));
+	if (rnd(8) == 0)
+		put16(p + 6, rnd(2) ? 0x2000 : 1 + rnd(0x1fff));
+	p[8] = 64;
+	p[9] = (u_char)proto;
+	put16(p + 10, rnd(0x10000));
+	gen_ipv4_addr(p + 12);
+	gen_ipv4_addr(p + 16);
+	len = hlen + gen_transport(p + hlen, proto);
+	put16(p + 2, len);
+	return (len);
+}
+
+static u_int
+gen_ipv6(u_char *p)
+{
+	static const u_int protos[] = { 6, 17, 58 };
+	u_int len = 40, proto;
+
+	proto = protos[rnd(3)];
+	memset(p, 0, 40);
+	p[0] = 0x60;
+	p[7] = 64;
+	p[8] = 0x20;
+	p[9] = 0x01;
+	p[10] = 0x0d;
+	p[11] = 0xb8;
+	p[23] = (u_char)(1 + rnd(2));
+	memcpy(p + 24, p + 8, 15);
+	p[39] = (u_char)(1 + rnd(2));
+	if (rnd(4) == 0) {
+		/*
+		 * A hop-by-hop options header first.
+		 */
+		p[6] = 0;
+		memset(p + 40, 0, 8);
+		p[40] = (u_char)proto;
+		len += 8;
+	} else
+		p[6] = (u_char)proto;
+	return (len + gen_transport(p + len, proto));
+}
+
+/*
+ * Make a packet, returning its length on the wire and setting *caplen
+ * to the amount of it captured.
+ */
+static u_int
+gen_packet(u_char *pkt, u_int *caplen)
+{
+	u_int len, kind;
+
+	if (rnd(8) == 0)
+		memset(pkt, 0xff, 6);
+	else {
+		memset(pkt, 0, 6);
+		pkt[0] = 0x02;
+		pkt[5] = (u_char)rnd(4);
+	}
+	memset(pkt + 6, 0, 6);
+	pkt[6] = 0x02;
+	pkt[11] = 0x01;
+	kind = rnd(16);
+	if (kind < 7) {
+		put16(pkt + 12, 0x0800);
+		len = 14 + gen_ipv4(pkt + 14);
+	} else if (kind < 12) {
+		put16(pkt + 12, 0x86dd);
+		len = 14 + gen_ipv6(pkt + 14);
+	} else if (kind < 13) {
+		put16(pkt + 12, 0x0806);
+		memset(pkt + 14, 0, 28);
+		len = 14 + 28;
+	} else if (kind < 15) {
+		put16(pkt + 12, 0x8100);
+		put16(pkt + 14, rnd(4096));
+		put16(pkt + 16, 0x0800);
+		len = 18 + gen_ipv4(pkt + 18);
+	} else {
+		len = 14 + rnd(100);
+		for (kind = 12; kind < len; kind++)
+			pkt[kind] = (u_char)rnd(256);
+	}
+	if (rnd(2) == 0) {
+		kind = rnd(SNAPLEN - len + 1);
+		for (; kind != 0; kind--, len++)
+			pkt[len] = (u_char)rnd(256);
+	}
+	*caplen = len;
+	if (rnd(8) == 0)
+		*caplen = rnd(len + 1);
+	return (len);
+}
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	pcap_t *pd;
+	struct bpf_filter_set *fs;
+	struct bpf_program progs[NEXPRS];
+	bpf_u_int32 matches[(NEXPRS + 31) / 32];
+	struct pcap_pkthdr h;
+	u_char pkt[SNAPLEN];
+	u_long npackets = 100000, n, failures = 0;
+	u_int i, expected, nexpected;
+	int optimize = 1, got;
+	char *end;
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "n:Os:")) != -1) {
+		switch (op) {
+
+		case 'n':
+			npackets = strtoul(optarg, &end, 0);
+			if (optarg == end || *end != '\0')
+				error("invalid packet count %s", optarg);
+			break;
+
+		case 'O':
+			optimize = 0;
+			break;
+
+		case 's':
+			seed = (u_int)strtoul(optarg, &end, 0);
+			if (optarg == end || *end != '\0')
+				error("invalid seed %s", optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	pd = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	if (pcap_compile_set(pd, &fs, exprs, (int)NEXPRS, optimize,
+	    PCAP_NETMASK_UNKNOWN) == -1)
+		error("pcap_compile_set: %s", pcap_geterr(pd));
+	for (i = 0; i < NEXPRS; i++) {
+		if (pcap_compile(pd, &progs[i], exprs[i], optimize,
+		    PCAP_NETMASK_UNKNOWN) == -1)
+			error("\"%s\": %s", exprs[i], pcap_geterr(pd));
+	}
+
+	memset(&h, 0, sizeof(h));
+	for (n = 0; n < npackets; n++) {
+		h.len = gen_packet(pkt, &h.caplen);
+		got = pcap_offline_filter_set(fs, &h, pkt, matches);
+		nexpected = 0;
+		for (i = 0; i < NEXPRS; i++) {
+			expected = bpf_filter(progs[i].bf_insns, pkt, h.len,
+			    h.caplen) != 0;
+			nexpected += expected;
+			if (((matches[i / 32] >> (i % 32)) & 1) != expected) {
+				fprintf(stderr, "%s: FAILED: packet %lu: \"%s\" %s, but it %s on its own\n",
+				    program_name, n, exprs[i],
+				    expected ? "didn't match in the set" :
+				    "matched in the set",
+				    expected ? "matches" : "doesn't match");
+				failures++;
+			}
+		}
+		if (got != (int)nexpected) {
+			fprintf(stderr, "%s: FAILED: packet %lu: pcap_offline_filter_set returned %d, expected %u\n",
+			    program_name, n, got, nexpected);
+			failures++;
+		}
+	}
+
+	pcap_freecode_set(fs);
+	for (i = 0; i < NEXPRS; i++)
+		pcap_freecode(&progs[i]);
+	pcap_close(pd);
+	if (failures != 0) {
+		fprintf(stderr, "%s: %lu failures\n", program_name, failures);
+		exit(1);
+	}
+	printf("%s: %lu packets, %u filters, all results matched\n",
+	    program_name, npackets, (u_int)NEXPRS);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "Usage: %s [ -O ] [ -n packets ] [ -s seed ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
@@ -36,6 +36,7 @@ The Regents of the University of California.  All rights reserved.\n";
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h>
 #ifdef _WIN32
   #include "getopt.h"
   #include "unix.h"
@@ -53,6 +54,7 @@ The Regents of the University of California.  All rights reserved.\n";
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #include "pcap/funcattrs.h"
 
@@ -68,6 +70,21 @@ PCAP_API void pcap_set_optimizer_debug(int);
 PCAP_API void pcap_set_print_dot_graph(int);
 #endif
 
+#ifndef _WIN32
+/*
+ * These are internal to libpcap, but, on UN*X, we're linked with the
+ * static library, so we can call them, to compare the interpreter for
+ * pre-decoded programs with the regular interpreter.
+ */
+#define HAVE_BPF_THREADED
+struct bpf_threaded_code;
+extern struct bpf_threaded_code *bpf_threaded_compile(const struct bpf_insn *,
+    u_int);
+extern u_int bpf_threaded_filter(const struct bpf_threaded_code *,
+    const u_char *, u_int, u_int, const struct bpf_aux_data *);
+extern void bpf_threaded_free(struct bpf_threaded_code *);
+#endif
+
 static char *program_name;
 
 /* Forwards */
@@ -156,6 +173,387 @@ warn(const char *fmt, ...)
 	}
 }
 
+/*
+ * Benchmarking of the filter against a savefile.
+ *
+ * We read the savefile with no filter, to see how long just reading
+ * it takes; with the filter installed with pcap_setfilter(), so that
+ * it's run by libpcap, using native code if libpcap could compile the
+ * filter into native code; and with the filter run by calling
+ * pcap_offline_filter() from the callback, which always uses the
+ * interpreter.
+ */
+#define BENCH_NO_FILTER		0
+#define BENCH_INSTALLED		1
+#define BENCH_INTERPRETED	2
+
+struct bench_state {
+	struct bpf_program *fcode;
+	u_long npkts;
+	u_long nmatched;
+};
+
+static void
+bench_count(u_char *user, const struct pcap_pkthdr *h _U_,
+    const u_char *sp _U_)
+{
+	struct bench_state *bs = (struct bench_state *)user;
+
+	bs->npkts++;
+	bs->nmatched++;
+}
+
+static void
+bench_filter(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	struct bench_state *bs = (struct bench_state *)user;
+
+	bs->npkts++;
+	if (pcap_offline_filter(bs->fcode, h, sp))
+		bs->nmatched++;
+}
+
+/*
+ * Read the savefile "passes" times, in the specified fashion, and
+ * return the CPU time taken, in seconds.
+ */
+static double
+bench_run(const char *rfile, int dlt, int passes, struct bpf_program *fcode,
+    int mode, struct bench_state *bs)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *rd;
+	clock_t start;
+	int i;
+
+	bs->fcode = fcode;
+	bs->npkts = 0;
+	bs->nmatched = 0;
+	start = clock();
+	for (i = 0; i < passes; i++) {
+		rd = pcap_open_offline(rfile, ebuf);
+		if (rd == NULL)
+			error("%s", ebuf);
+		if (pcap_datalink(rd) != dlt)
+			error("%s has link-layer type %s, not %s", rfile,
+			    pcap_datalink_val_to_name(pcap_datalink(rd)),
+			    pcap_datalink_val_to_name(dlt));
+		if (mode == BENCH_INSTALLED && pcap_setfilter(rd, fcode) < 0)
+			error("%s", pcap_geterr(rd));
+		if (pcap_loop(rd, -1,
+		    mode == BENCH_INTERPRETED ? bench_filter : bench_count,
+		    (u_char *)bs) == -1)
+			error("%s", pcap_geterr(rd));
+		pcap_close(rd);
+	}
+	return ((double)(clock() - start) / CLOCKS_PER_SEC);
+}
+
+static void
+benchmark(const char *rfile, int dlt, int passes, struct bpf_program *fcode)
+{
+	struct bench_state bs;
+	double base, installed, interpreted;
+	u_long npkts, nmatched;
+
+	/*
+	 * The installed filter only delivers the packets that it
+	 * accepts, so get the total packet count from the other runs.
+	 */
+	base = bench_run(rfile, dlt, passes, fcode, BENCH_NO_FILTER, &bs);
+	npkts = bs.npkts;
+	if (npkts == 0)
+		error("%s contains no packets", rfile);
+	interpreted = bench_run(rfile, dlt, passes, fcode, BENCH_INTERPRETED,
+	    &bs);
+	nmatched = bs.nmatched;
+	installed = bench_run(rfile, dlt, passes, fcode, BENCH_INSTALLED, &bs);
+	if (bs.nmatched != nmatched)
+		warn("installed filter matched %lu packets, interpreted filter matched %lu",
+		    bs.nmatched, nmatched);
+
+	base = base * 1e9 / npkts;
+	interpreted = interpreted * 1e9 / npkts;
+	installed = installed * 1e9 / npkts;
+	printf("%lu packets, %lu matched, %d pass%s\n", npkts / passes,
+	    bs.nmatched / passes, passes, passes == 1 ? "" : "es");
+	printf("no filter:   %8.1f ns/packet\n", base);
+	printf("interpreted: %8.1f ns/packet (filter %.1f ns)\n", interpreted,
+	    interpreted - base);
+	printf("installed:   %8.1f ns/packet (filter %.1f ns)\n", installed,
+	    installed - base);
+}
+
+#ifdef HAVE_BPF_THREADED
+/*
+ * Maximum number of packets to read into memory for the interpreter
+ * microbenchmark.
+ */
+#define MICROBENCH_MAX_PKTS	1000000
+
+/*
+ * Time the filter on packets already in memory, with the regular
+ * interpreter, with the interpreter for pre-decoded programs, and
+ * with bpf_filter_batch().
+ */
+static void
+microbenchmark(const char *rfile, int passes, struct bpf_program *fcode)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *rd;
+	struct pcap_pkthdr *hdr, *hdrs;
+	const u_char *data;
+	u_char **pkts;
+	u_int *wirelens, *buflens, *verdicts;
+	struct bpf_threaded_code *code;
+	u_long npkts, i, nmatched, tmatched, bmatched;
+	clock_t start;
+	double interpreted, threaded, batched;
+	int pass;
+
+	hdrs = malloc(MICROBENCH_MAX_PKTS * sizeof(*hdrs));
+	pkts = malloc(MICROBENCH_MAX_PKTS * sizeof(*pkts));
+	wirelens = malloc(MICROBENCH_MAX_PKTS * sizeof(*wirelens));
+	buflens = malloc(MICROBENCH_MAX_PKTS * sizeof(*buflens));
+	verdicts = malloc(MICROBENCH_MAX_PKTS * sizeof(*verdicts));
+	if (hdrs == NULL || pkts == NULL || wirelens == NULL ||
+	    buflens == NULL || verdicts == NULL)
+		error("Can't allocate packet arrays");
+	rd = pcap_open_offline(rfile, ebuf);
+	if (rd == NULL)
+		error("%s", ebuf);
+	for (npkts = 0; npkts < MICROBENCH_MAX_PKTS &&
+	    pcap_next_ex(rd, &hdr, &data) == 1; npkts++) {
+		hdrs[npkts] = *hdr;
+		wirelens[npkts] = hdr->len;
+		buflens[npkts] = hdr->caplen;
+		pkts[npkts] = malloc(hdr->caplen);
+		if (pkts[npkts] == NULL)
+			error("Can't allocate packet data");
+		memcpy(pkts[npkts], data, hdr->caplen);
+	}
+	pcap_close(rd);
+
+	code = bpf_threaded_compile(fcode->bf_insns, fcode->bf_len);
+	if (code == NULL)
+		error("Can't decode the filter");
+
+	nmatched = 0;
+	start = clock();
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < npkts; i++) {
+			if (bpf_filter(fcode->bf_insns, pkts[i], hdrs[i].len,
+			    hdrs[i].caplen) != 0)
+				nmatched++;
+		}
+	}
+	interpreted = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	tmatched = 0;
+	start = clock();
+	for (pass = 0; pass < passes; pass++) {
+		for (i = 0; i < npkts; i++) {
+			if (bpf_threaded_filter(code, pkts[i], hdrs[i].len,
+			    hdrs[i].caplen, NULL) != 0)
+				tmatched++;
+		}
+	}
+	threaded = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (tmatched != nmatched)
+		warn("pre-decoded filter matched %lu packets, interpreted filter matched %lu",
+		    tmatched, nmatched);
+
+	bmatched = 0;
+	start = clock();
+	for (pass = 0; pass < passes; pass++) {
+		bmatched += bpf_filter_batch(fcode->bf_insns,
+		    (const u_char * const *)pkts, wirelens, buflens,
+		    (u_int)npkts, verdicts);
+	}
+	batched = (double)(clock() - start) / CLOCKS_PER_SEC;
+	if (bmatched != nmatched)
+		warn("batched filter matched %lu packets, interpreted filter matched %lu",
+		    bmatched, nmatched);
+
+	if (npkts != 0) {
+		interpreted = interpreted * 1e9 / ((double)npkts * passes);
+		threaded = threaded * 1e9 / ((double)npkts * passes);
+		batched = batched * 1e9 / ((double)npkts * passes);
+		printf("in memory, %lu packets:\n", npkts);
+		printf("interpreter: %8.1f ns/packet\n", interpreted);
+		printf("pre-decoded: %8.1f ns/packet\n", threaded);
+		printf("batched:     %8.1f ns/packet\n", batched);
+	}
+
+	bpf_threaded_free(code);
+	for (i = 0; i < npkts; i++)
+		free(pkts[i]);
+	free(pkts);
+	free(hdrs);
+	free(wirelens);
+	free(buflens);
+	free(verdicts);
+}
+#endif
+
+/*
+ * Checking of the optimizer.
+ *
+ * The optimized program is run, along with the program compiled
+ * without optimization, on generated packets, and any packets for which
+ * they return different values are reported.  The packets are random
+ * bytes, with the constants the unoptimized program compares against,
+ * and values next to them, stored at the offsets it loads from, so that
+ * most of the paths through the program get taken.
+ *
+ * A load past the end of the packet makes a program reject the packet,
+ * and the optimizer can remove loads whose values aren't needed, so the
+ * packet buffers are big enough for the loads not to fail; the packet
+ * length that "len", "less" and "greater" test is generated separately.
+ */
+#define CHECK_PKTLEN		4096
+#define CHECK_MAX_FIELDS	256
+#define CHECK_MAX_CONSTS	1024
+#define CHECK_MAX_REPORTS	10
+
+struct check_field {
+	u_int	off;
+	u_int	size;		/* 1, 2 or 4 */
+};
+
+static u_int check_seed = 1;
+
+static u_int
+check_random(void)
+{
+	/* xorshift, so that the packets are the same everywhere */
+	check_seed ^= check_seed << 13;
+	check_seed ^= check_seed >> 17;
+	check_seed ^= check_seed << 5;
+	return (check_seed);
+}
+
+static void
+check_store(u_char *pkt, const struct check_field *f, bpf_u_int32 v)
+{
+	u_int i;
+
+	if (f->off + f->size > CHECK_PKTLEN)
+		return;
+	for (i = 0; i < f->size; i++)
+		pkt[f->off + i] = (u_char)(v >> (8 * (f->size - 1 - i)));
+}
+
+static bpf_u_int32
+check_value(const bpf_u_int32 *consts, u_int nconsts)
+{
+	bpf_u_int32 v;
+
+	v = consts[check_random() % nconsts];
+	switch (check_random() % 6) {
+
+	case 0:
+		v--;
+		break;
+
+	case 1:
+		v++;
+		break;
+
+	case 2:
+		v ^= 1U << (check_random() % 32);
+		break;
+	}
+	return (v);
+}
+
+static int
+check_optimizer(pcap_t *pd, const char *cmdbuf, bpf_u_int32 netmask,
+    struct bpf_program *fcode, u_long npkts)
+{
+	struct bpf_program ucode;
+	struct check_field fields[CHECK_MAX_FIELDS];
+	bpf_u_int32 consts[CHECK_MAX_CONSTS];
+	const struct bpf_insn *insn;
+	u_char *pkt;
+	u_int nfields, nconsts, i, j;
+	u_int len, r1, r2;
+	u_long n, nmatched, ndiffs;
+
+	if (pcap_compile(pd, &ucode, cmdbuf, 0, netmask) < 0)
+		error("%s", pcap_geterr(pd));
+
+	/*
+	 * Find the fields the unoptimized program loads, and the
+	 * constants it compares them with.  Packet-relative loads are
+	 * assumed to be relative to an IPv4 header with no options,
+	 * and the byte that header's length is loaded from is given
+	 * that length.
+	 */
+	nfields = 0;
+	nconsts = 0;
+	consts[nconsts++] = 0x45;
+	for (i = 0; i < ucode.bf_len; i++) {
+		insn = &ucode.bf_insns[i];
+		if (nfields < CHECK_MAX_FIELDS &&
+		    (BPF_CLASS(insn->code) == BPF_LD ||
+		     BPF_CLASS(insn->code) == BPF_LDX) &&
+		    (BPF_MODE(insn->code) == BPF_ABS ||
+		     BPF_MODE(insn->code) == BPF_IND ||
+		     BPF_MODE(insn->code) == BPF_MSH)) {
+			fields[nfields].off = insn->k;
+			if (BPF_MODE(insn->code) == BPF_IND)
+				fields[nfields].off += 20;
+			fields[nfields].size =
+			    BPF_SIZE(insn->code) == BPF_W ? 4 :
+			    BPF_SIZE(insn->code) == BPF_H ? 2 : 1;
+			nfields++;
+		}
+		if (nconsts < CHECK_MAX_CONSTS &&
+		    BPF_CLASS(insn->code) == BPF_JMP &&
+		    BPF_SRC(insn->code) == BPF_K &&
+		    BPF_OP(insn->code) != BPF_JA)
+			consts[nconsts++] = insn->k;
+	}
+
+	pkt = malloc(CHECK_PKTLEN);
+	if (pkt == NULL)
+		error("Can't allocate packet buffer");
+	nmatched = 0;
+	ndiffs = 0;
+	for (n = 0; n < npkts; n++) {
+		for (i = 0; i < CHECK_PKTLEN; i++)
+			pkt[i] = (u_char)check_random();
+		for (i = 0; i < nfields; i++) {
+			if (check_random() % 4 != 0)
+				check_store(pkt, &fields[i],
+				    check_value(consts, nconsts));
+		}
+		if (check_random() % 2 == 0)
+			len = check_value(consts, nconsts);
+		else
+			len = check_random() % 1600;
+		r1 = bpf_filter(fcode->bf_insns, pkt, len, CHECK_PKTLEN);
+		r2 = bpf_filter(ucode.bf_insns, pkt, len, CHECK_PKTLEN);
+		if (r2 != 0)
+			nmatched++;
+		if (r1 == r2)
+			continue;
+		if (ndiffs++ < CHECK_MAX_REPORTS) {
+			printf("optimized program returned %u, unoptimized program returned %u, for length %u and:\n",
+			    r1, r2, len);
+			for (j = 0; j < 128; j++)
+				printf("%02x%s", pkt[j],
+				    j % 16 == 15 ? "\n" : " ");
+		}
+	}
+	printf("%lu packets, %lu matched, %lu difference%s\n", npkts,
+	    nmatched, ndiffs, ndiffs == 1 ? "" : "s");
+	free(pkt);
+	pcap_freecode(&ucode);
+	return (ndiffs == 0);
+}
+
 /*
  * Copy arg vector into a new buffer, concatenating arguments with spaces.
  */
@@ -198,6 +596,10 @@ main(int argc, char **argv)
 	int dflag;
 	int gflag;
 	char *infile;
+	char *rfile;
+	char *hostsfile;
+	int passes;
+	u_long checkpkts;
 	int Oflag;
 	long snaplen;
 	char *p;
@@ -206,6 +608,8 @@ main(int argc, char **argv)
 	bpf_u_int32 netmask = PCAP_NETMASK_UNKNOWN;
 	char *cmdbuf;
 	pcap_t *pd;
+	pcap_compiler_t *pc;
+	char ebuf[PCAP_ERRBUF_SIZE];
 	struct bpf_program fcode;
 
 #ifdef _WIN32
@@ -217,6 +621,10 @@ main(int argc, char **argv)
 	gflag = 0;
 
 	infile = NULL;
+	rfile = NULL;
+	hostsfile = NULL;
+	passes = 1;
+	checkpkts = 0;
 	Oflag = 1;
 	snaplen = 68;
 
@@ -226,9 +634,18 @@ main(int argc, char **argv)
 		program_name = argv[0];
 
 	opterr = 0;
-	while ((op = getopt(argc, argv, "dF:gm:Os:")) != -1) {
+	while ((op = getopt(argc, argv, "c:dF:gH:m:n:Or:s:")) != -1) {
 		switch (op) {
 
+		case 'c': {
+			char *end;
+
+			checkpkts = strtoul(optarg, &end, 0);
+			if (optarg == end || *end != '\0' || checkpkts == 0)
+				error("invalid packet count %s", optarg);
+			break;
+		}
+
 		case 'd':
 			++dflag;
 			break;
@@ -245,10 +662,30 @@ main(int argc, char **argv)
 			infile = optarg;
 			break;
 
+		case 'H':
+			hostsfile = optarg;
+			break;
+
+		case 'n': {
+			char *end;
+			long n;
+
+			n = strtol(optarg, &end, 0);
+			if (optarg == end || *end != '\0' || n <= 0 ||
+			    n > INT_MAX)
+				error("invalid pass count %s", optarg);
+			passes = (int)n;
+			break;
+		}
+
 		case 'O':
 			Oflag = 0;
 			break;
 
+		case 'r':
+			rfile = optarg;
+			break;
+
 		case 'm': {
 			bpf_u_int32 addr;
 
@@ -300,6 +737,9 @@ main(int argc, char **argv)
 			error("invalid data link type %s", argv[optind]);
 	}
 
+	if (checkpkts != 0 && hostsfile != NULL)
+		error("-c can't be used with -H");
+
 	if (infile)
 		cmdbuf = read_infile(infile);
 	else
@@ -314,7 +754,21 @@ main(int argc, char **argv)
 	if (pd == NULL)
 		error("Can't open fake pcap_t");
 
-	if (pcap_compile(pd, &fcode, cmdbuf, Oflag, netmask) < 0)
+	if (hostsfile != NULL) {
+		/*
+		 * Look up host names only in the hosts file.
+		 */
+		pc = pcap_compiler_create(ebuf);
+		if (pc == NULL)
+			error("%s", ebuf);
+		if (pcap_compiler_load_hosts(pc, hostsfile, ebuf) < 0)
+			error("%s", ebuf);
+		pcap_compiler_set_resolve(pc, PCAP_RESOLVE_TABLE_ONLY, 0);
+		if (pcap_compiler_compile(pc, pd, &fcode, cmdbuf, Oflag,
+		    netmask) < 0)
+			error("%s", pcap_geterr(pd));
+		pcap_compiler_close(pc);
+	} else if (pcap_compile(pd, &fcode, cmdbuf, Oflag, netmask) < 0)
 		error("%s", pcap_geterr(pd));
 
 	have_fcode = 1;
@@ -335,7 +789,18 @@ main(int argc, char **argv)
 		printf("machine codes for empty filter:\n");
 #endif
 
-	bpf_dump(&fcode, dflag);
+	if (checkpkts != 0) {
+		if (!check_optimizer(pd, cmdbuf, netmask, &fcode, checkpkts)) {
+			pcap_freecode(&fcode);
+			exit(1);
+		}
+	} else if (rfile != NULL) {
+		benchmark(rfile, dlt, passes, &fcode);
+#ifdef HAVE_BPF_THREADED
+		microbenchmark(rfile, passes, &fcode);
+#endif
+	} else
+		bpf_dump(&fcode, dflag);
 	free(cmdbuf);
 	if (have_fcode)
 		pcap_freecode (&fcode);
@@ -350,9 +815,9 @@ usage(void)
 	    pcap_lib_version());
 	(void)fprintf(stderr,
 #ifdef BDEBUG
-	    "Usage: %s [-dgO] [ -F file ] [ -m netmask] [ -s snaplen ] dlt [ expression ]\n",
+	    "Usage: %s [-dgO] [ -c count ] [ -F file ] [ -H hostsfile ] [ -m netmask] [ -s snaplen ] [ -r file [ -n passes ] ] dlt [ expression ]\n",
 #else
-	    "Usage: %s [-dO] [ -F file ] [ -m netmask] [ -s snaplen ] dlt [ expression ]\n",
+	    "Usage: %s [-dO] [ -c count ] [ -F file ] [ -H hostsfile ] [ -m netmask] [ -s snaplen ] [ -r file [ -n passes ] ] dlt [ expression ]\n",
 #endif
 	    program_name);
 	exit(1);
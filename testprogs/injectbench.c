@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Measure how fast packets can be sent on an interface, one at a time
+ * with pcap_inject() and in batches with pcap_inject_batch_linux(),
+ * and report the throughput of each.
+ *
+ * The packets are Ethernet broadcasts with the local experimental
+ * Ethertype, so they can be sent on a pair of veth interfaces without
+ * disturbing anything:
+ *
+ *	ip link add injectbench0 type veth peer name injectbench1
+ *	ip link set injectbench0 up
+ *	ip link set injectbench1 up
+ *	injectbench -i injectbench0
+ *
+ * Sending requires the privileges needed to capture on the interface.
+ */
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pcap/funcattrs.h"
+
+#define MIN_SIZE	60
+#define MAX_SIZE	1514
+
+static char *program_name;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Fill in packet i: broadcast, from a locally administered address,
+ * with Ethertype 0x88B5, and the packet number in the payload.
+ */
+static void
+make_packet(u_char *buf, size_t size, u_long i)
+{
+	size_t j;
+
+	memset(buf, 0xff, 6);
+	buf[6] = 0x02;
+	memset(buf + 7, 0, 5);
+	buf[12] = 0x88;
+	buf[13] = 0xb5;
+	buf[14] = (u_char)(i >> 24);
+	buf[15] = (u_char)(i >> 16);
+	buf[16] = (u_char)(i >> 8);
+	buf[17] = (u_char)i;
+	for (j = 18; j < size; j++)
+		buf[j] = (u_char)j;
+}
+
+static void
+report(const char *what, u_long npackets, size_t size, double secs)
+{
+	printf("%s: %lu packets of %zu bytes in %.3f seconds, %.0f packets/s, %.1f Mbit/s\n",
+	    what, npackets, size, secs, npackets / secs,
+	    npackets * size * 8 / secs / 1e6);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *cp, *device = NULL;
+	char ebuf[PCAP_ERRBUF_SIZE];
+	int op, status, batch = 64, qdisc_bypass = 0;
+	u_long npackets = 1000000, sent;
+	size_t size = MIN_SIZE, *sizes;
+	u_char **bufs;
+	pcap_t *pd;
+	double start, inject_secs;
+	int i, n;
+#ifdef __linux__
+	double batch_secs;
+#endif
+
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	while ((op = getopt(argc, argv, "b:i:n:qs:")) != -1) {
+		switch (op) {
+
+		case 'b':
+			batch = atoi(optarg);
+			if (batch <= 0)
+				error("invalid batch size %s", optarg);
+			break;
+
+		case 'i':
+			device = optarg;
+			break;
+
+		case 'n':
+			npackets = strtoul(optarg, &cp, 0);
+			if (optarg == cp || *cp != '\0' || npackets == 0)
+				error("invalid packet count %s", optarg);
+			break;
+
+		case 'q':
+			qdisc_bypass = 1;
+			break;
+
+		case 's':
+			size = (size_t)atoi(optarg);
+			if (size < MIN_SIZE || size > MAX_SIZE)
+				error("invalid packet size %s; it must be between %d and %d",
+				    optarg, MIN_SIZE, MAX_SIZE);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (device == NULL || optind != argc)
+		usage();
+
+	pd = pcap_create(device, ebuf);
+	if (pd == NULL)
+		error("%s: pcap_create failed: %s", device, ebuf);
+	status = pcap_set_snaplen(pd, 128);
+	if (status != 0)
+		error("%s: pcap_set_snaplen failed: %s", device,
+		    pcap_statustostr(status));
+	if (qdisc_bypass) {
+#ifdef __linux__
+		status = pcap_set_qdisc_bypass_linux(pd, 1);
+		if (status != 0)
+			error("%s: pcap_set_qdisc_bypass_linux failed: %s",
+			    device, pcap_statustostr(status));
+#else
+		error("-q is only supported on Linux");
+#endif
+	}
+	status = pcap_activate(pd);
+	if (status < 0)
+		error("%s: %s\n(%s)", device, pcap_statustostr(status),
+		    pcap_geterr(pd));
+
+	bufs = calloc(batch, sizeof(*bufs));
+	sizes = calloc(batch, sizeof(*sizes));
+	if (bufs == NULL || sizes == NULL)
+		error("calloc: %s", pcap_strerror(errno));
+	for (i = 0; i < batch; i++) {
+		bufs[i] = malloc(size);
+		if (bufs[i] == NULL)
+			error("malloc: %s", pcap_strerror(errno));
+		sizes[i] = size;
+	}
+
+	/*
+	 * One system call per packet.
+	 */
+	start = now();
+	for (sent = 0; sent < npackets; sent++) {
+		make_packet(bufs[sent % batch], size, sent);
+		if (pcap_inject(pd, bufs[sent % batch], size) == -1)
+			error("%s: pcap_inject failed after %lu packets: %s",
+			    device, sent, pcap_geterr(pd));
+	}
+	inject_secs = now() - start;
+	report("pcap_inject", npackets, size, inject_secs);
+
+#ifdef __linux__
+	/*
+	 * A batch of packets at a time, through the transmit ring.
+	 */
+	start = now();
+	for (sent = 0; sent < npackets; sent += n) {
+		n = batch;
+		if ((u_long)n > npackets - sent)
+			n = (int)(npackets - sent);
+		for (i = 0; i < n; i++)
+			make_packet(bufs[i], size, sent + i);
+		n = pcap_inject_batch_linux(pd, (const void * const *)bufs,
+		    sizes, n);
+		if (n == PCAP_ERROR)
+			error("%s: pcap_inject_batch_linux failed after %lu packets: %s",
+			    device, sent, pcap_geterr(pd));
+	}
+	batch_secs = now() - start;
+	report("pcap_inject_batch_linux", npackets, size, batch_secs);
+	printf("batches of %d packets: %.2f times the throughput of pcap_inject\n",
+	    batch, inject_secs / batch_secs);
+#else
+	(void)n;
+	printf("pcap_inject_batch_linux is only available on Linux\n");
+#endif
+
+	pcap_close(pd);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr,
+	    "Usage: %s [ -q ] [ -b batch ] [ -n packets ] [ -s size ] -i interface\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
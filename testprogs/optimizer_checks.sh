@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Check the optimizer: run each of the filters below through
+# "filtertest -c", which runs the optimized and the unoptimized program
+# for the filter on generated packets and reports any packets for which
+# they don't return the same value.
+#
+# Usage: optimizer_checks.sh [ filtertest ]
+#
+
+FILTERTEST=${1:-./filtertest}
+PACKETS=200000
+failed=0
+
+#
+# Make an expression ORing "$1 N" for each of the other arguments.
+#
+or_list()
+{
+	field=$1
+	shift
+	expr=""
+	for v
+	do
+		expr="$expr${expr:+ or }$field $v"
+	done
+	echo "$expr"
+}
+
+check()
+{
+	dlt=$1
+	shift
+	if ! "$FILTERTEST" -c $PACKETS "$dlt" "$@" >/dev/null
+	then
+		echo "FAILED: $dlt $*"
+		failed=1
+	fi
+}
+
+#
+# Long chains of comparisons, which are turned into binary searches.
+#
+check EN10MB "$(or_list host 10.0.0.1 10.0.0.2 10.0.0.9 10.0.1.1 192.168.1.1 \
+    192.168.1.2 172.16.0.1 172.16.0.7 10.0.0.3 10.0.0.4)"
+check EN10MB "$(or_list port 22 25 53 80 110 143 443 993 995 8080 8443)"
+check EN10MB "$(or_list 'ip[9] =' 1 2 6 17 41 47 50 51 89 132)"
+check EN10MB "net 10.0.0.0/8 or net 172.16.0.0/12 or net 192.168.0.0/16 or \
+    net 10.1.0.0/16 or net 10.2.3.0/24 or host 10.3.4.5 or host 11.0.0.1 or \
+    net 100.64.0.0/10 or host 1.1.1.1 or host 8.8.8.8"
+
+#
+# A long chain of comparisons of alternating source and destination
+# ports, which has to be regrouped before it can be searched.
+#
+check EN10MB "$(or_list port $(seq 1 7 1400))"
+
+#
+# Chains that mix masks.  Only masks that clear the low bits of the
+# value give a single range of values for each comparison; the others
+# mustn't be turned into range checks.
+#
+check EN10MB "ip[6:2] & 0x1fff = 5 or $(or_list 'ip[6:2] =' 100 200 300 400 \
+    500 600 700 800)"
+check EN10MB "tcp[0:2] & 0xff00 = 0x100 or $(or_list 'tcp[0:2] =' 1000 2000 \
+    3000 4000 5000 6000 7000 8000)"
+check EN10MB "ip[2:2] & 0xfff0 = 0x40 or ip[2:2] & 0xff00 = 0x200 or \
+    $(or_list 'ip[2:2] =' 20 28 40 52 60 64 576 1500)"
+check EN10MB "ip[8] & 0xf0 = 0x40 or ip[8] & 0x0f = 0x01 or \
+    $(or_list 'ip[8] =' 1 2 32 64 128 255 250 200)"
+
+exit $failed
@@ -0,0 +1,1122 @@
+/*
+ * Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000
+ *	The Regents of the University of California.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that: (1) source code distributions
+ * retain the above copyright notice and this paragraph in its entirety, (2)
+ * distributions including binary code include the above copyright notice and
+ * this paragraph in its entirety in the documentation or other materials
+ * provided with the distribution, and (3) all advertising materials mentioning
+ * features or use of this software display the following acknowledgement:
+ * ``This product includes software developed by the University of California,
+ * Lawrence Berkeley Laboratory and its contributors.'' Neither the name of
+ * the University nor the names of its contributors may be used to endorse
+ * or promote products derived from this software without specific prior
+ * written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "varattrs.h"
+
+#ifndef lint
+static const char copyright[] _U_ =
+    "@(#) Copyright (c) 1988, 1989, 1990, 1991, 1992, 1993, 1994, 1995, 1996, 1997, 2000\n\
+The Regents of the University of California.  All rights reserved.\n";
+#endif
+
+/*
+ * Write a generated set of packets to savefiles in each of the ways
+ * libpcap can write them, read them back in each of the ways it can
+ * read them, and check that the same packets come back:
+ *
+ *	written with pcap_dump(), buffered, with direct I/O, with
+ *	pcap_dump_batch(), with an index, compressed, as pcapng, and
+ *	split over rotating files, and read with pcap_open_offline(),
+ *	from a mapping and with read-ahead;
+ *
+ *	positioned with pcap_offline_seek_time(), with and without an
+ *	index;
+ *
+ *	split with pcap_offline_partition(), with the parts read in
+ *	order;
+ *
+ *	split between two files that are merged again with
+ *	pcap_open_offline_merge().
+ *
+ * Ways of writing or reading that aren't supported on this platform,
+ * or by the libraries libpcap was built with, are reported as skipped.
+ * The files are written in the directory given with -d, or the current
+ * directory, and removed afterwards unless -k is given.
+ */
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef _WIN32
+  #include "getopt.h"
+#else
+  #include <unistd.h>
+  #include <sys/stat.h>
+#endif
+#include <errno.h>
+
+#include "pcap/funcattrs.h"
+
+#ifdef _WIN32
+  #include "portability.h"
+#endif
+
+#define SNAPLEN		1000
+#define BATCH		32
+#define MAXFILES	64
+#define NSEEKS		300
+
+static char *program_name;
+
+/* Forwards */
+static void PCAP_NORETURN usage(void);
+static void PCAP_NORETURN error(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+static void failure(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+static void skipped(const char *, ...) PCAP_PRINTFLIKE(1, 2);
+
+static u_int npackets = 20000;
+static struct pcap_pkthdr *hdrs;
+static const char *dir = ".";
+static int failures;
+
+/*
+ * Files written, removed at the end.
+ */
+static char *files[MAXFILES];
+static int nfiles;
+
+/*
+ * Ways of writing a file.
+ */
+enum writer {
+	W_DUMP,
+	W_BUFFERED,
+	W_DIRECT,
+	W_BATCH,
+	W_INDEXED,
+	W_ZSTD,
+	W_LZ4,
+	W_NG,
+	W_NG_INDEXED,
+	W_NG_ZSTD,
+	W_NG_LZ4
+};
+
+static const struct {
+	enum writer w;
+	const char *name;
+} writers[] = {
+	{ W_DUMP,	"dump.pcap" },
+	{ W_BUFFERED,	"buffered.pcap" },
+	{ W_DIRECT,	"direct.pcap" },
+	{ W_BATCH,	"batch.pcap" },
+	{ W_INDEXED,	"indexed.pcap" },
+	{ W_ZSTD,	"zstd.pcap.zst" },
+	{ W_LZ4,	"lz4.pcap.lz4" },
+	{ W_NG,		"dump.pcapng" },
+	{ W_NG_INDEXED,	"indexed.pcapng" },
+	{ W_NG_ZSTD,	"zstd.pcapng.zst" },
+	{ W_NG_LZ4,	"lz4.pcapng.lz4" },
+};
+#define NWRITERS	(sizeof writers / sizeof writers[0])
+
+/*
+ * Ways of reading a file.
+ */
+enum reader {
+	R_STDIO,
+	R_MMAP,
+	R_READAHEAD
+};
+
+static const char *reader_names[] = {
+	"pcap_open_offline",
+	"pcap_open_offline_mmap",
+	"pcap_open_offline_readahead"
+};
+#define NREADERS	(sizeof reader_names / sizeof reader_names[0])
+
+/*
+ * Time stamps go up by between 1 microsecond and 5 milliseconds, and
+ * some packets have the same time stamp as the one before them, but
+ * never the first packet of a run of 100, so that splitting the
+ * packets into runs of 100 doesn't make the order of packets with the
+ * same time stamp ambiguous.
+ */
+static void
+gen_headers(void)
+{
+	u_int i;
+	long usec;
+
+	hdrs = (struct pcap_pkthdr *)calloc(npackets, sizeof(*hdrs));
+	if (hdrs == NULL)
+		error("Out of memory");
+	usec = 0;
+	for (i = 0; i < npackets; i++) {
+		if (i == 0)
+			usec = 123456;
+		else if (i % 7 != 3 || i % 100 == 0)
+			usec += 1 + (long)((i * 7919U) % 5000);
+		hdrs[i].ts.tv_sec = 1700000000 + usec / 1000000;
+		hdrs[i].ts.tv_usec = usec % 1000000;
+		hdrs[i].len = 42 + (i * 37) % 1458;
+		if (i % 5 == 0)
+			hdrs[i].caplen = hdrs[i].len / 2;
+		else
+			hdrs[i].caplen = hdrs[i].len > SNAPLEN ? SNAPLEN : hdrs[i].len;
+	}
+}
+
+/*
+ * Whole-second time stamps, an hour apart, so that a long enough file
+ * covers more than a year, with the clock stepped back by three days
+ * half way through, and no packets cut short, so that the chain of
+ * the records' fraction fields looks like a chain of records too.
+ */
+static void
+gen_stepped_headers(void)
+{
+	u_int i;
+
+	for (i = 0; i < npackets; i++) {
+		hdrs[i].ts.tv_sec = 1500000000 + (time_t)i * 3600;
+		if (i >= npackets / 2)
+			hdrs[i].ts.tv_sec -= 3 * 86400;
+		hdrs[i].ts.tv_usec = 0;
+		hdrs[i].len = 42 + (i * 37) % (SNAPLEN - 42);
+		hdrs[i].caplen = hdrs[i].len;
+	}
+}
+
+static void
+gen_data(u_int i, u_char *data)
+{
+	u_int j;
+
+	for (j = 0; j < hdrs[i].caplen; j++)
+		data[j] = (u_char)(i * 31 + j * 7 + (i >> 8));
+}
+
+static const char *
+file_name(const char *name)
+{
+	char *path;
+	size_t len;
+	int i;
+
+	len = strlen(dir) + strlen("/savefiletest-") + strlen(name) + 1;
+	path = malloc(len);
+	if (path == NULL)
+		error("Out of memory");
+	snprintf(path, len, "%s/savefiletest-%s", dir, name);
+	for (i = 0; i < nfiles; i++) {
+		if (strcmp(files[i], path) == 0) {
+			free(path);
+			return (files[i]);
+		}
+	}
+	if (nfiles == MAXFILES)
+		error("Too many files");
+	files[nfiles++] = path;
+	return (path);
+}
+
+static void
+remove_files(void)
+{
+	char *idx;
+	size_t len;
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		(void)remove(files[i]);
+		len = strlen(files[i]) + sizeof ".idx";
+		idx = malloc(len);
+		if (idx != NULL) {
+			snprintf(idx, len, "%s.idx", files[i]);
+			(void)remove(idx);
+			free(idx);
+		}
+	}
+}
+
+/*
+ * Returns 1 if the message is about something that isn't supported,
+ * rather than something that went wrong.
+ */
+static int
+unsupported(const char *msg)
+{
+	return (strstr(msg, "isn't supported") != NULL ||
+	    strstr(msg, "aren't supported") != NULL);
+}
+
+/*
+ * Write packets first through last - 1 to a pcap file, with pcap_dump()
+ * or, if batch is set, pcap_dump_batch().
+ */
+static int
+write_pcap(pcap_dumper_t *pdd, u_int first, u_int last, int batch)
+{
+	static u_char data[BATCH][SNAPLEN];
+	const u_char *pkts[BATCH];
+	u_int i, n;
+
+	for (i = first; i < last; i += n) {
+		if (!batch) {
+			gen_data(i, data[0]);
+			pcap_dump((u_char *)pdd, &hdrs[i], data[0]);
+			n = 1;
+			continue;
+		}
+		for (n = 0; n < BATCH && i + n < last; n++) {
+			gen_data(i + n, data[n]);
+			pkts[n] = data[n];
+		}
+		if (pcap_dump_batch(pdd, &hdrs[i], pkts, (int)n) != (int)n)
+			return (-1);
+	}
+	return (pcap_dump_flush(pdd));
+}
+
+static int
+write_pcapng(pcap_ng_dumper_t *nd, pcap_t *pd, u_int first, u_int last)
+{
+	static u_char data[SNAPLEN];
+	u_int i;
+	int ifid;
+
+	ifid = pcap_ng_dump_add_interface(nd, pd, "savefiletest0");
+	if (ifid == -1)
+		return (-1);
+	for (i = first; i < last; i++) {
+		gen_data(i, data);
+		if (pcap_ng_dump(nd, ifid, &hdrs[i], data) == -1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Write packets first through last - 1 to path in the given way;
+ * returns 1 on success, 0 if that isn't supported, and -1 on failure,
+ * having reported it.
+ */
+static int
+write_file(enum writer w, const char *path, u_int first, u_int last)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd;
+	pcap_dumper_t *pdd = NULL;
+	pcap_ng_dumper_t *nd = NULL;
+	int status;
+
+	pd = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	switch (w) {
+
+	case W_DUMP:
+		pdd = pcap_dump_open(pd, path);
+		break;
+
+	case W_BUFFERED:
+	case W_BATCH:
+		pdd = pcap_dump_open_buffered(pd, path, 256 * 1024, 0);
+		break;
+
+	case W_DIRECT:
+		pdd = pcap_dump_open_buffered(pd, path, 256 * 1024,
+		    PCAP_DUMP_DIRECT);
+		break;
+
+	case W_INDEXED:
+		pdd = pcap_dump_open_indexed(pd, path, 500, 0);
+		break;
+
+	case W_ZSTD:
+		pdd = pcap_dump_open_compressed(pd, path, PCAP_COMPRESS_ZSTD, 0);
+		break;
+
+	case W_LZ4:
+		pdd = pcap_dump_open_compressed(pd, path, PCAP_COMPRESS_LZ4, 0);
+		break;
+
+	case W_NG:
+		nd = pcap_ng_dump_open(path, ebuf);
+		break;
+
+	case W_NG_INDEXED:
+		nd = pcap_ng_dump_open_indexed(path, 500, 0, ebuf);
+		break;
+
+	case W_NG_ZSTD:
+		nd = pcap_ng_dump_open_compressed(path, PCAP_COMPRESS_ZSTD, 0,
+		    ebuf);
+		break;
+
+	case W_NG_LZ4:
+		nd = pcap_ng_dump_open_compressed(path, PCAP_COMPRESS_LZ4, 0,
+		    ebuf);
+		break;
+	}
+	if (w < W_NG) {
+		if (pdd == NULL) {
+			/*
+			 * Direct I/O also depends on the file system.
+			 */
+			if (unsupported(pcap_geterr(pd)) || w == W_DIRECT) {
+				skipped("%s: %s", path, pcap_geterr(pd));
+				pcap_close(pd);
+				return (0);
+			}
+			failure("%s: %s", path, pcap_geterr(pd));
+			pcap_close(pd);
+			return (-1);
+		}
+		status = write_pcap(pdd, first, last, w == W_BATCH);
+		if (status == -1)
+			failure("%s: writing: %s", path, strerror(errno));
+		pcap_dump_close(pdd);
+	} else {
+		if (nd == NULL) {
+			if (unsupported(ebuf)) {
+				skipped("%s: %s", path, ebuf);
+				pcap_close(pd);
+				return (0);
+			}
+			failure("%s: %s", path, ebuf);
+			pcap_close(pd);
+			return (-1);
+		}
+		status = write_pcapng(nd, pd, first, last);
+		if (status == -1)
+			failure("%s: writing: %s", path, pcap_geterr(pd));
+		if (pcap_ng_dump_close(nd) == -1 && status != -1) {
+			failure("%s: closing: %s", path, strerror(errno));
+			status = -1;
+		}
+	}
+	pcap_close(pd);
+	return (status == -1 ? -1 : 1);
+}
+
+/*
+ * Returns NULL, having reported why, if it fails; *skip is set if the
+ * way of reading isn't supported.
+ */
+static pcap_t *
+open_file(enum reader r, const char *path, int *skip)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *p = NULL;
+
+	*skip = 0;
+	switch (r) {
+
+	case R_STDIO:
+		p = pcap_open_offline(path, ebuf);
+		break;
+
+	case R_MMAP:
+		p = pcap_open_offline_mmap(path, PCAP_TSTAMP_PRECISION_MICRO,
+		    ebuf);
+		break;
+
+	case R_READAHEAD:
+		p = pcap_open_offline_readahead(path,
+		    PCAP_TSTAMP_PRECISION_MICRO, 4, ebuf);
+		break;
+	}
+	if (p == NULL) {
+		if (unsupported(ebuf)) {
+			skipped("%s: %s: %s", path, reader_names[r], ebuf);
+			*skip = 1;
+		} else
+			failure("%s: %s: %s", path, reader_names[r], ebuf);
+	}
+	return (p);
+}
+
+/*
+ * Check that the packet just read is packet i.
+ */
+static int
+check_packet(const char *what, u_int i, const struct pcap_pkthdr *h,
+    const u_char *data)
+{
+	static u_char expected[SNAPLEN];
+
+	if (i >= npackets) {
+		failure("%s: got a packet after the last one", what);
+		return (-1);
+	}
+	if (h->ts.tv_sec != hdrs[i].ts.tv_sec ||
+	    h->ts.tv_usec != hdrs[i].ts.tv_usec ||
+	    h->caplen != hdrs[i].caplen || h->len != hdrs[i].len) {
+		failure("%s: packet %u: got %ld.%06ld %u/%u, expected %ld.%06ld %u/%u",
+		    what, i, (long)h->ts.tv_sec, (long)h->ts.tv_usec,
+		    h->caplen, h->len, (long)hdrs[i].ts.tv_sec,
+		    (long)hdrs[i].ts.tv_usec, hdrs[i].caplen, hdrs[i].len);
+		return (-1);
+	}
+	gen_data(i, expected);
+	if (memcmp(data, expected, h->caplen) != 0) {
+		failure("%s: packet %u: the data doesn't match", what, i);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Read packets from p until the end of the file, checking that they
+ * are packets *next, *next + 1, ...
+ */
+static int
+read_packets(pcap_t *p, const char *what, u_int *next)
+{
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	int status;
+
+	while ((status = pcap_next_ex(p, &h, &data)) == 1) {
+		if (check_packet(what, *next, h, data) == -1)
+			return (-1);
+		(*next)++;
+	}
+	if (status != PCAP_ERROR_BREAK) {
+		failure("%s: after packet %u: %s", what, *next,
+		    pcap_geterr(p));
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+test_read(const char *path)
+{
+	char what[256];
+	pcap_t *p;
+	u_int r, next;
+	int skip;
+
+	for (r = 0; r < NREADERS; r++) {
+		p = open_file((enum reader)r, path, &skip);
+		if (p == NULL)
+			continue;
+		snprintf(what, sizeof what, "%s: %s", path, reader_names[r]);
+		next = 0;
+		if (read_packets(p, what, &next) == 0 && next != npackets)
+			failure("%s: read %u packets, expected %u", what, next,
+			    npackets);
+		pcap_close(p);
+	}
+}
+
+/*
+ * Return the index of the first packet with a time stamp at or after
+ * ts, or npackets if there is none.
+ */
+static u_int
+first_at_or_after(const struct timeval *ts)
+{
+	u_int lo, hi, mid;
+
+	lo = 0;
+	hi = npackets;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (hdrs[mid].ts.tv_sec < ts->tv_sec ||
+		    (hdrs[mid].ts.tv_sec == ts->tv_sec &&
+		     hdrs[mid].ts.tv_usec < ts->tv_usec))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Seek to the time stamps of randomly chosen packets, to times just
+ * before them, and to times before the first packet and after the
+ * last, checking that the next packet read is the right one.
+ */
+static void
+test_seek(enum reader r, const char *path)
+{
+	char what[256];
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	struct timeval ts;
+	pcap_t *p;
+	u_int seed, i, expected;
+	int n, skip, status;
+
+	p = open_file(r, path, &skip);
+	if (p == NULL)
+		return;
+	snprintf(what, sizeof what, "%s: %s: seek", path, reader_names[r]);
+	seed = 1;
+	for (n = 0; n < NSEEKS; n++) {
+		seed = seed * 1103515245 + 12345;
+		i = (seed >> 8) % npackets;
+		ts = hdrs[i].ts;
+		if (n == 0)
+			ts.tv_sec -= 10;
+		else if (n == 1)
+			ts.tv_sec = hdrs[npackets - 1].ts.tv_sec + 10;
+		else if (n % 2 == 0) {
+			if (ts.tv_usec == 0) {
+				ts.tv_sec--;
+				ts.tv_usec = 999999;
+			} else
+				ts.tv_usec--;
+		}
+		expected = first_at_or_after(&ts);
+		if (pcap_offline_seek_time(p, &ts) == PCAP_ERROR) {
+			failure("%s to %ld.%06ld: %s", what, (long)ts.tv_sec,
+			    (long)ts.tv_usec, pcap_geterr(p));
+			break;
+		}
+		status = pcap_next_ex(p, &h, &data);
+		if (expected == npackets) {
+			if (status != PCAP_ERROR_BREAK) {
+				failure("%s to %ld.%06ld: expected the end of the file",
+				    what, (long)ts.tv_sec, (long)ts.tv_usec);
+				break;
+			}
+			continue;
+		}
+		if (status != 1) {
+			failure("%s to %ld.%06ld: expected packet %u, got %s",
+			    what, (long)ts.tv_sec, (long)ts.tv_usec, expected,
+			    status == PCAP_ERROR_BREAK ? "the end of the file" :
+			    pcap_geterr(p));
+			break;
+		}
+		if (check_packet(what, expected, h, data) == -1)
+			break;
+	}
+	pcap_close(p);
+}
+
+static void
+test_partition(const char *path, u_int nchunks)
+{
+	char ebuf[PCAP_ERRBUF_SIZE], what[256];
+	pcap_t *chunks[16];
+	u_int next;
+	int n, i, status;
+
+	n = pcap_offline_partition(path, PCAP_TSTAMP_PRECISION_MICRO, chunks,
+	    nchunks, ebuf);
+	if (n == PCAP_ERROR) {
+		failure("%s: pcap_offline_partition: %s", path, ebuf);
+		return;
+	}
+	if (npackets >= 100 * nchunks && n != (int)nchunks)
+		failure("%s: pcap_offline_partition: %d parts, expected %u",
+		    path, n, nchunks);
+	next = 0;
+	status = 0;
+	for (i = 0; i < n; i++) {
+		snprintf(what, sizeof what,
+		    "%s: pcap_offline_partition: part %d of %d", path, i + 1, n);
+		if (status == 0)
+			status = read_packets(chunks[i], what, &next);
+		pcap_close(chunks[i]);
+	}
+	if (status == 0 && next != npackets)
+		failure("%s: pcap_offline_partition: %d parts had %u packets, expected %u",
+		    path, n, next, npackets);
+}
+
+/*
+ * Write the first half of the packets to a compressed file and flush
+ * it; they should all be there to read, with the file still open.
+ */
+static void
+test_flush(enum writer w, const char *name)
+{
+	char ebuf[PCAP_ERRBUF_SIZE], what[256];
+	pcap_t *pd, *p;
+	pcap_dumper_t *pdd;
+	const char *path;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	u_int next;
+
+	path = file_name(name);
+	pd = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	pdd = pcap_dump_open_compressed(pd, path,
+	    w == W_ZSTD ? PCAP_COMPRESS_ZSTD : PCAP_COMPRESS_LZ4, 0);
+	if (pdd == NULL) {
+		failure("%s: %s", path, pcap_geterr(pd));
+		pcap_close(pd);
+		return;
+	}
+	if (write_pcap(pdd, 0, npackets / 2, 0) == -1)
+		failure("%s: writing: %s", path, strerror(errno));
+	else {
+		p = pcap_open_offline(path, ebuf);
+		if (p == NULL)
+			failure("%s: after pcap_dump_flush: %s", path, ebuf);
+		else {
+			snprintf(what, sizeof what, "%s: after pcap_dump_flush",
+			    path);
+			next = 0;
+			while (next < npackets / 2 &&
+			    pcap_next_ex(p, &h, &data) == 1) {
+				if (check_packet(what, next, h, data) == -1)
+					break;
+				next++;
+			}
+			if (next != npackets / 2)
+				failure("%s: %u packets could be read, expected %u",
+				    what, next, npackets / 2);
+			pcap_close(p);
+		}
+	}
+	pcap_dump_close(pdd);
+	pcap_close(pd);
+}
+
+/*
+ * Large packets whose data is itself a stream of pcap packet records,
+ * as if a pcap file were being sent over the network, with a few
+ * bytes of padding at the end; splitting the file has to find the real
+ * records, not those.
+ */
+#define EMBED_PACKETS	40
+#define EMBED_SIZE	60007
+#define EMBED_RECORD	100
+
+static void
+gen_embedded(u_int i, struct pcap_pkthdr *h, u_char *data)
+{
+	bpf_u_int32 rec[4];
+	u_int j;
+
+	h->ts.tv_sec = 1600000000 + i;
+	h->ts.tv_usec = 0;
+	h->caplen = h->len = EMBED_SIZE;
+	memset(data, 0, EMBED_SIZE);
+	for (j = 0; j + EMBED_RECORD <= EMBED_SIZE; j += EMBED_RECORD) {
+		rec[0] = (bpf_u_int32)h->ts.tv_sec;
+		rec[1] = j;
+		rec[2] = rec[3] = EMBED_RECORD - sizeof(rec);
+		memcpy(data + j, rec, sizeof(rec));
+		memset(data + j + sizeof(rec), (int)(i + j),
+		    EMBED_RECORD - sizeof(rec));
+	}
+}
+
+static void
+test_embedded(void)
+{
+	static u_char data[EMBED_SIZE];
+	char ebuf[PCAP_ERRBUF_SIZE];
+	pcap_t *pd, *chunks[16];
+	pcap_dumper_t *pdd;
+	const char *path;
+	struct pcap_pkthdr h, *hp;
+	const u_char *pkt;
+	u_int next;
+	int n, i, ret, status;
+
+	path = file_name("embedded.pcap");
+	pd = pcap_open_dead(DLT_EN10MB, 65535);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	pdd = pcap_dump_open(pd, path);
+	if (pdd == NULL) {
+		failure("%s: %s", path, pcap_geterr(pd));
+		pcap_close(pd);
+		return;
+	}
+	for (next = 0; next < EMBED_PACKETS; next++) {
+		gen_embedded(next, &h, data);
+		pcap_dump((u_char *)pdd, &h, data);
+	}
+	pcap_dump_close(pdd);
+	pcap_close(pd);
+
+	n = pcap_offline_partition(path, PCAP_TSTAMP_PRECISION_MICRO, chunks,
+	    16, ebuf);
+	if (n == PCAP_ERROR) {
+		failure("%s: pcap_offline_partition: %s", path, ebuf);
+		return;
+	}
+	next = 0;
+	status = 0;
+	for (i = 0; i < n; i++) {
+		while (status == 0 &&
+		    (ret = pcap_next_ex(chunks[i], &hp, &pkt)) == 1) {
+			gen_embedded(next, &h, data);
+			if (next >= EMBED_PACKETS ||
+			    hp->ts.tv_sec != h.ts.tv_sec ||
+			    hp->caplen != h.caplen ||
+			    memcmp(pkt, data, h.caplen) != 0) {
+				failure("%s: pcap_offline_partition: part %d of %d: packet %u is wrong",
+				    path, i + 1, n, next);
+				status = -1;
+				break;
+			}
+			next++;
+		}
+		if (status == 0 && ret != PCAP_ERROR_BREAK) {
+			failure("%s: pcap_offline_partition: part %d of %d: after packet %u: %s",
+			    path, i + 1, n, next, pcap_geterr(chunks[i]));
+			status = -1;
+		}
+		pcap_close(chunks[i]);
+	}
+	if (status == 0 && next != EMBED_PACKETS)
+		failure("%s: pcap_offline_partition: %d parts had %u packets, expected %u",
+		    path, n, next, EMBED_PACKETS);
+}
+
+/*
+ * Write the runs of 100 packets alternately to a pcap file and a
+ * pcapng file, and merge them.
+ */
+static void
+test_merge(void)
+{
+	char ebuf[PCAP_ERRBUF_SIZE];
+	const char *paths[2];
+	pcap_dumper_t *pdd;
+	pcap_ng_dumper_t *nd;
+	pcap_t *pd, *p;
+	struct pcap_pkthdr *h;
+	const u_char *data;
+	u_int i, next;
+	int ifid, src, status;
+	u_char buf[SNAPLEN];
+
+	paths[0] = file_name("merge0.pcap");
+	paths[1] = file_name("merge1.pcapng");
+	pd = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	pdd = pcap_dump_open(pd, paths[0]);
+	if (pdd == NULL)
+		error("%s: %s", paths[0], pcap_geterr(pd));
+	nd = pcap_ng_dump_open(paths[1], ebuf);
+	if (nd == NULL)
+		error("%s: %s", paths[1], ebuf);
+	ifid = pcap_ng_dump_add_interface(nd, pd, "savefiletest1");
+	if (ifid == -1)
+		error("%s: %s", paths[1], pcap_geterr(pd));
+	for (i = 0; i < npackets; i++) {
+		gen_data(i, buf);
+		if ((i / 100) % 2 == 0)
+			pcap_dump((u_char *)pdd, &hdrs[i], buf);
+		else if (pcap_ng_dump(nd, ifid, &hdrs[i], buf) == -1)
+			error("%s: %s", paths[1], pcap_geterr(pd));
+	}
+	pcap_dump_close(pdd);
+	if (pcap_ng_dump_close(nd) == -1)
+		error("%s: %s", paths[1], strerror(errno));
+	pcap_close(pd);
+
+	p = pcap_open_offline_merge(paths, 2, PCAP_TSTAMP_PRECISION_MICRO,
+	    ebuf);
+	if (p == NULL) {
+		failure("pcap_open_offline_merge: %s", ebuf);
+		return;
+	}
+	next = 0;
+	while ((status = pcap_next_ex(p, &h, &data)) == 1) {
+		if (check_packet("pcap_open_offline_merge", next, h, data) == -1)
+			break;
+		src = pcap_offline_merge_source(p);
+		if (src != (int)((next / 100) % 2)) {
+			failure("pcap_open_offline_merge: packet %u came from file %d, expected %u",
+			    next, src, (next / 100) % 2);
+			break;
+		}
+		next++;
+	}
+	if (status == PCAP_ERROR)
+		failure("pcap_open_offline_merge: %s", pcap_geterr(p));
+	else if (status == PCAP_ERROR_BREAK && next != npackets)
+		failure("pcap_open_offline_merge: read %u packets, expected %u",
+		    next, npackets);
+	pcap_close(p);
+}
+
+/*
+ * Write the packets to rotating files, each with about an eighth of
+ * them, and read them back from each file in turn.
+ */
+static void
+test_rotate(void)
+{
+	char name[32], what[256];
+	struct pcap_dump_rotate_stat rs;
+	pcap_dumper_t *pdd;
+	pcap_t *pd, *p;
+	const char *pattern, *path;
+	uint64_t max_bytes;
+	u_int i, next;
+	int skip;
+#ifndef _WIN32
+	struct stat st;
+#endif
+
+	max_bytes = 0;
+	for (i = 0; i < npackets; i++)
+		max_bytes += 16 + hdrs[i].caplen;
+	max_bytes /= 8;
+	pattern = file_name("rotate-");
+	pd = pcap_open_dead(DLT_EN10MB, SNAPLEN);
+	if (pd == NULL)
+		error("Can't open fake pcap_t");
+	pdd = pcap_dump_open_rotating(pd, pattern, max_bytes, 0, 0);
+	if (pdd == NULL) {
+		failure("%s: %s", pattern, pcap_geterr(pd));
+		pcap_close(pd);
+		return;
+	}
+	if (write_pcap(pdd, 0, npackets, 0) == -1) {
+		failure("%s: writing: %s", pattern, strerror(errno));
+		pcap_dump_close(pdd);
+		pcap_close(pd);
+		return;
+	}
+	if (pcap_dump_rotate_stats(pdd, &rs) == -1)
+		error("%s: pcap_dump_rotate_stats failed", pattern);
+	pcap_dump_close(pdd);
+	pcap_close(pd);
+	if (rs.rs_files < 2)
+		failure("%s: %u file written, expected more", pattern,
+		    rs.rs_files);
+
+	next = 0;
+	for (i = 0; i < rs.rs_files; i++) {
+		snprintf(name, sizeof name, "rotate-%u", i);
+		path = file_name(name);
+#ifndef _WIN32
+		/*
+		 * Space allocated for the file in advance, but not
+		 * used, should have been freed.
+		 */
+		if (stat(path, &st) == 0 &&
+		    (uint64_t)st.st_blocks * 512 > (uint64_t)st.st_size + 65536)
+			failure("%s: %lld bytes allocated for %lld bytes of data",
+			    path, (long long)st.st_blocks * 512,
+			    (long long)st.st_size);
+#endif
+		p = open_file(R_STDIO, path, &skip);
+		if (p == NULL)
+			return;
+		snprintf(what, sizeof what, "%s: pcap_dump_open_rotating", path);
+		if (read_packets(p, what, &next) == -1) {
+			pcap_close(p);
+			return;
+		}
+		pcap_close(p);
+	}
+	if (next != npackets)
+		failure("%s: %u files had %u packets, expected %u", pattern,
+		    rs.rs_files, next, npackets);
+}
+
+int
+main(int argc, char **argv)
+{
+	register int op;
+	register char *cp;
+	const char *path;
+	static const u_int nchunks[] = { 1, 2, 7, 16 };
+	int keep, written[NWRITERS];
+	u_int i, j;
+	char *end;
+
+	keep = 0;
+	if ((cp = strrchr(argv[0], '/')) != NULL)
+		program_name = cp + 1;
+	else
+		program_name = argv[0];
+
+	opterr = 0;
+	while ((op = getopt(argc, argv, "d:kn:")) != -1) {
+		switch (op) {
+
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'k':
+			keep = 1;
+			break;
+
+		case 'n':
+			npackets = strtoul(optarg, &end, 0);
+			if (optarg == end || *end != '\0' || npackets < 100)
+				error("invalid packet count %s", optarg);
+			break;
+
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	gen_headers();
+
+	for (i = 0; i < NWRITERS; i++) {
+		path = file_name(writers[i].name);
+		written[i] = write_file(writers[i].w, path, 0, npackets);
+		if (written[i] == 1)
+			test_read(path);
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		if (written[i] != 1)
+			continue;
+		path = file_name(writers[i].name);
+		switch (writers[i].w) {
+
+		case W_DUMP:
+		case W_INDEXED:
+		case W_NG:
+		case W_NG_INDEXED:
+			test_seek(R_STDIO, path);
+			test_seek(R_MMAP, path);
+			test_seek(R_READAHEAD, path);
+			break;
+
+		default:
+			break;
+		}
+		switch (writers[i].w) {
+
+		case W_DUMP:
+		case W_NG:
+			for (j = 0; j < sizeof nchunks / sizeof nchunks[0]; j++)
+				test_partition(path, nchunks[j]);
+			break;
+
+		default:
+			break;
+		}
+		switch (writers[i].w) {
+
+		case W_ZSTD:
+			test_flush(W_ZSTD, "flush.pcap.zst");
+			break;
+
+		case W_LZ4:
+			test_flush(W_LZ4, "flush.pcap.lz4");
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	test_merge();
+	test_rotate();
+
+	test_embedded();
+
+	/*
+	 * Partitioning has to find record boundaries however far apart
+	 * the time stamps in the file are.
+	 */
+	gen_stepped_headers();
+	path = file_name("stepped.pcap");
+	if (write_file(W_DUMP, path, 0, npackets) == 1) {
+		test_read(path);
+		for (j = 0; j < sizeof nchunks / sizeof nchunks[0]; j++)
+			test_partition(path, nchunks[j]);
+	}
+
+	if (!keep)
+		remove_files();
+	if (failures != 0) {
+		fprintf(stderr, "%s: %d failures\n", program_name, failures);
+		exit(1);
+	}
+	printf("%s: all tests passed\n", program_name);
+	exit(0);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "Usage: %s [ -k ] [ -d directory ] [ -n packets ]\n",
+	    program_name);
+	exit(1);
+}
+
+/* VARARGS */
+static void
+error(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	exit(1);
+	/* NOTREACHED */
+}
+
+/* VARARGS */
+static void
+failure(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: FAILED: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+	failures++;
+}
+
+/* VARARGS */
+static void
+skipped(const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)fprintf(stderr, "%s: skipped: ", program_name);
+	va_start(ap, fmt);
+	(void)vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	if (*fmt) {
+		fmt += strlen(fmt);
+		if (fmt[-1] != '\n')
+			(void)fputc('\n', stderr);
+	}
+}